@@ -58,6 +58,13 @@ struct Health : BaseComponent {
     int max_hp = 100;
 };
 
+template <>
+struct afterhours::is_plain_component<Position> : std::true_type {};
+template <>
+struct afterhours::is_plain_component<Velocity> : std::true_type {};
+template <>
+struct afterhours::is_plain_component<Health> : std::true_type {};
+
 struct Marker : BaseComponent {};
 
 // ============================================================================
@@ -125,6 +132,27 @@ TEST_CASE("entity_churn", "[benchmark][churn]") {
             return 0;
         });
     };
+
+    // Steady state: the same 1000 entities die and are replaced every round,
+    // so allocation should come from the collection's block pool.
+    BENCHMARK_ADVANCED("replace 1000 entities with components, 10 rounds")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            for (int round = 0; round < 10; ++round) {
+                for (int i = 0; i < 1000; ++i) {
+                    auto &e = EntityHelper::createEntity();
+                    e.addComponent<Position>();
+                    e.addComponent<Velocity>();
+                }
+                EntityHelper::merge_entity_arrays();
+                for (const auto &sp : EntityHelper::get_entities())
+                    sp->cleanup = true;
+                EntityHelper::cleanup();
+            }
+            cleanup_all();
+            return 0;
+        });
+    };
 }
 
 // ============================================================================
@@ -190,6 +218,28 @@ TEST_CASE("component_add_remove_cycle", "[benchmark][component]") {
         });
         cleanup_all();
     };
+
+    BENCHMARK_ADVANCED("add+remove pooled Position on 1000 entities")
+    (Catch::Benchmark::Chronometer meter) {
+        EntityCollection ec;
+        ec.reserve_components<Position>(1000);
+        std::vector<Entity *> ents;
+        ents.reserve(1000);
+        for (int i = 0; i < 1000; ++i) {
+            ents.push_back(&ec.createEntity());
+        }
+        ec.merge_entity_arrays();
+
+        meter.measure([&ents] {
+            for (auto *e : ents) {
+                e->addComponent<Position>();
+            }
+            for (auto *e : ents) {
+                e->removeComponent<Position>();
+            }
+            return ents.size();
+        });
+    };
 }
 
 // ============================================================================
@@ -240,6 +290,18 @@ TEST_CASE("query_benchmarks", "[benchmark][query]") {
         });
     };
 
+    BENCHMARK_ADVANCED("gen_frame on 10000 (50% match)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            const std::size_t n = EntityQuery<>({.ignore_temp_warning = true})
+                                      .whereHasComponent<Velocity>()
+                                      .gen_frame()
+                                      .size();
+            frame_arena().reset();
+            return n;
+        });
+    };
+
     BENCHMARK_ADVANCED("2 component filters on 10000 (50% match)")
     (Catch::Benchmark::Chronometer meter) {
         meter.measure([] {
@@ -301,6 +363,47 @@ TEST_CASE("query_benchmarks", "[benchmark][query]") {
         });
     };
 
+    BENCHMARK_ADVANCED("gen_as<Position> sum on 10000 (50% match)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            float sum = 0.f;
+            for (Position &p : EntityQuery<>({.ignore_temp_warning = true})
+                                   .whereHasComponent<Velocity>()
+                                   .gen_as<Position>())
+                sum += p.x;
+            return sum;
+        });
+    };
+
+    BENCHMARK_ADVANCED("typed query<Position, Velocity> sum on 10000")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            float sum = 0.f;
+            for (auto [e, p, v] : query<Position, Read<Velocity>>()) sum += p.x;
+            return sum;
+        });
+    };
+
+    BENCHMARK_ADVANCED("typed query component+tag+not on 10000")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            return query<Position, tags::Any<DemoTag::Runner>,
+                         tags::None<DemoTag::Store>>()
+                .count();
+        });
+    };
+
+    BENCHMARK_ADVANCED("hand-written loop sum on 10000 (50% match)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            float sum = 0.f;
+            for (const auto &sp : EntityHelper::get_entities())
+                if (sp->has<Position>() && sp->has<Velocity>())
+                    sum += sp->get<Position>().x;
+            return sum;
+        });
+    };
+
     cleanup_all();
 }
 
@@ -370,6 +473,18 @@ TEST_CASE("handle_benchmarks", "[benchmark][handle]") {
         });
     };
 
+    BENCHMARK_ADVANCED("getEntityAsSharedPtr on 10000 entities")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&ents] {
+            int found = 0;
+            for (Entity &e : ents) {
+                if (EntityHelper::getEntityAsSharedPtr(e))
+                    found++;
+            }
+            return found;
+        });
+    };
+
     cleanup_all();
 
     // Now handles are stale — measure stale resolution cost.
@@ -553,6 +668,56 @@ TEST_CASE("snapshot_benchmarks", "[benchmark][snapshot]") {
     cleanup_all();
 }
 
+TEST_CASE("binary_snapshot_benchmarks", "[benchmark][snapshot]") {
+    snapshot::register_component<Position>();
+    snapshot::register_component<Velocity>();
+    snapshot::register_component<Health>();
+
+    EntityCollection ec;
+    for (int i = 0; i < 10000; ++i) {
+        auto &e = ec.createEntity();
+        e.addComponent<Position>().x = static_cast<float>(i);
+        e.addComponent<Velocity>().vx = 1.f;
+        if (i % 2 == 0) e.addComponent<Health>();
+        e.enableTag(DemoTag::Runner);
+    }
+    ec.merge_entity_arrays();
+
+    std::vector<std::byte> frame;
+    snapshot::save(ec, frame);
+
+    BENCHMARK_ADVANCED("binary save of 10000 (3 components)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&] {
+            snapshot::save(ec, frame);
+            return frame.size();
+        });
+    };
+
+    BENCHMARK_ADVANCED("binary restore of 10000 (rollback in place)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&] { return snapshot::restore(ec, frame); });
+    };
+
+    // 1% of the entities moved since `frame`.
+    for (std::size_t i = 0; i < 10000; i += 100)
+        ec.get_entities()[i]->get<Position>().y += 1.f;
+    std::vector<std::byte> delta;
+    snapshot::diff(frame, ec, delta);
+    EntityCollection mirror;
+    snapshot::restore(mirror, frame);
+
+    BENCHMARK_ADVANCED("binary diff of 10000 (1% changed)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&] { return snapshot::diff(frame, ec, delta); });
+    };
+
+    BENCHMARK_ADVANCED("apply delta to 10000 (1% changed)")
+    (Catch::Benchmark::Chronometer meter) {
+        meter.measure([&] { return snapshot::apply_delta(mirror, delta); });
+    };
+}
+
 // ============================================================================
 // MIXED WORKLOAD BENCHMARKS
 // ============================================================================
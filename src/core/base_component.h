@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <type_traits>
 #include <vector>
@@ -18,16 +20,19 @@ using ComponentID = size_t;
 
 namespace components {
 namespace internal {
+// Atomic: the first use of a component type may happen on any thread, e.g. in
+// two worlds starting up at once.
 inline ComponentID get_unique_id() noexcept {
-  static ComponentID lastID{0};
-  if (lastID >= max_num_components) {
+  static std::atomic<ComponentID> lastID{0};
+  const ComponentID id = lastID.fetch_add(1, std::memory_order_relaxed);
+  if (id >= max_num_components) {
     log_error("You are trying to add a new component but you have used up all "
               "the space allocated (max: %zu), increase "
               "AFTER_HOURS_MAX_COMPONENTS",
               max_num_components);
     return max_num_components - 1;
   }
-  return lastID++;
+  return id;
 }
 
 } // namespace internal
@@ -44,5 +49,18 @@ struct BaseComponent {
   BaseComponent() {}
   BaseComponent(BaseComponent &&) = default;
   virtual ~BaseComponent() {}
+
+  // Change ticks of the owning collection (see Entity::mark_changed and the
+  // Added<T>/Changed<T> system filters). 0 = never.
+  std::uint32_t ah_added_tick = 0;
+  std::uint32_t ah_changed_tick = 0;
 };
+
+// Specialize to std::true_type for a component whose fields (past the
+// BaseComponent header) are all trivially copyable: numbers, enums, vec2s,
+// EntityHandles, fixed arrays of those. No std::string, containers or
+// pointers. Such components may be copied byte for byte, e.g. by
+// snapshot::register_component<T>() and SystemManager::keep_previous<T>().
+// The language can't check this for a polymorphic T, hence the opt-in.
+template <typename T> struct is_plain_component : std::false_type {};
 } // namespace afterhours
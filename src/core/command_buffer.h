@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../logging.h"
+#include "entity.h"
+#include "entity_collection.h"
+#include "entity_handle.h"
+
+namespace afterhours {
+
+// Structural changes recorded now and applied later, at a sync point.
+//
+// Systems write creates, destroys, add/remove component and tag changes here
+// instead of applying them mid-iteration; flush() applies them in recording
+// order and then merges new entities once. SystemManager owns one (see
+// SystemBase::commands()) and flushes it at the end of every phase.
+//
+// Recording is thread-safe, so systems running on worker threads may use it.
+// bind() and flush() are not: call them from the thread that owns the
+// collection.
+//
+// Merged entities are targeted by handle, so a command whose entity died
+// before the flush is dropped. Entities still in temp are targeted by address
+// and id, checked against the collection at flush time.
+class EntityCommandBuffer {
+public:
+  using Init = std::function<void(Entity &)>;
+
+  EntityCommandBuffer() = default;
+  explicit EntityCommandBuffer(EntityCollection &collection)
+      : collection_(&collection) {}
+
+  // Choose the collection commands target and flush into. Pending commands
+  // were recorded against the old one, so they are flushed there first.
+  void bind(EntityCollection &collection) {
+    if (collection_ == &collection)
+      return;
+    if (collection_ && !empty())
+      flush();
+    collection_ = &collection;
+  }
+
+  [[nodiscard]] EntityCollection *bound_collection() const {
+    return collection_;
+  }
+
+  void create(Init init = {}) { push(Command::Kind::Create, std::move(init)); }
+
+  void create_permanent(Init init = {}) {
+    push(Command::Kind::CreatePermanent, std::move(init));
+  }
+
+  void destroy(Entity &entity) {
+    record(entity, [](Entity &e) { e.cleanup = true; });
+  }
+
+  template <typename T, typename... TArgs>
+  void add_component(Entity &entity, TArgs &&...args) {
+    record(entity, [... args = std::forward<TArgs>(args)](Entity &e) mutable {
+      if (e.has<T>())
+        e.removeComponent<T>();
+      e.addComponent<T>(std::move(args)...);
+    });
+  }
+
+  template <typename T> void remove_component(Entity &entity) {
+    record(entity, [](Entity &e) {
+      if (e.has<T>())
+        e.removeComponent<T>();
+    });
+  }
+
+  template <typename TTag> void enable_tag(Entity &entity, const TTag tag) {
+    record(entity, [tag](Entity &e) { e.enableTag(tag); });
+  }
+
+  template <typename TTag> void disable_tag(Entity &entity, const TTag tag) {
+    record(entity, [tag](Entity &e) { e.disableTag(tag); });
+  }
+
+  // Anything else, applied to `entity` at flush time.
+  void apply(Entity &entity, Init fn) { record(entity, std::move(fn)); }
+
+  [[nodiscard]] std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return commands_.size();
+  }
+  [[nodiscard]] bool empty() const { return size() == 0; }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.clear();
+  }
+
+  // Apply everything recorded so far, in order, then merge new entities once.
+  // Commands recorded while flushing (e.g. by a create's initializer) are
+  // applied too.
+  void flush() {
+    if (!collection_) {
+      if (!empty())
+        log_error("EntityCommandBuffer: flush() with no collection bound; "
+                  "dropping {} commands",
+                  size());
+      clear();
+      return;
+    }
+    EntityCollection &collection = *collection_;
+    for (int pass = 0; pass < max_flush_passes; ++pass) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (commands_.empty())
+          break;
+        applying_.swap(commands_);
+      }
+      live_temp_.clear();
+      live_temp_built_ = false;
+      for (Command &cmd : applying_)
+        run(collection, cmd);
+      applying_.clear();
+    }
+    if (!empty())
+      log_warn("EntityCommandBuffer: commands still pending after {} flush "
+               "passes",
+               max_flush_passes);
+    collection.merge_entity_arrays();
+  }
+
+private:
+  static constexpr int max_flush_passes = 16;
+
+  struct Command {
+    enum struct Kind : std::uint8_t { Create, CreatePermanent, Apply };
+
+    Kind kind;
+    EntityHandle handle;
+    // Only for entities that had no handle when recorded.
+    Entity *temp;
+    EntityID temp_id;
+    Init fn;
+  };
+
+  EntityCollection *collection_ = nullptr;
+  mutable std::mutex mutex_;
+  std::vector<Command> commands_;
+  // Swapped with commands_ during flush; both keep their capacity, so a
+  // steady stream of commands doesn't reallocate every frame.
+  std::vector<Command> applying_;
+  std::unordered_set<const Entity *> live_temp_;
+  bool live_temp_built_ = false;
+
+  void push(const Command::Kind kind, Init fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.push_back(
+        Command{kind, EntityHandle::invalid(), nullptr, -1, std::move(fn)});
+  }
+
+  void record(Entity &entity, Init fn) {
+    const EntityHandle handle =
+        collection_ ? collection_->handle_for(entity) : EntityHandle::invalid();
+    Command cmd{Command::Kind::Apply, handle, nullptr, -1, std::move(fn)};
+    if (handle.is_invalid()) {
+      cmd.temp = &entity;
+      cmd.temp_id = entity.id;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.push_back(std::move(cmd));
+  }
+
+  // A temp entity may have been merged, or dropped by the merge, since it
+  // was recorded. Only touch it if the collection still owns that address;
+  // its id rules out a new entity allocated in the same place, since a
+  // dropped temp entity's id is never reused.
+  [[nodiscard]] bool temp_alive(EntityCollection &collection,
+                                const Command &cmd) {
+    if (!live_temp_built_) {
+      for (const auto &sp : collection.get_temp())
+        live_temp_.insert(sp.get());
+      for (const auto &sp : collection.get_entities())
+        live_temp_.insert(sp.get());
+      live_temp_built_ = true;
+    }
+    return live_temp_.contains(cmd.temp) && cmd.temp->id == cmd.temp_id;
+  }
+
+  void run(EntityCollection &collection, Command &cmd) {
+    switch (cmd.kind) {
+    case Command::Kind::Create:
+    case Command::Kind::CreatePermanent: {
+      Entity &e = cmd.kind == Command::Kind::CreatePermanent
+                      ? collection.createPermanentEntity()
+                      : collection.createEntity();
+      // New temp entities invalidate the address set.
+      live_temp_built_ = false;
+      live_temp_.clear();
+      if (cmd.fn)
+        cmd.fn(e);
+      return;
+    }
+    case Command::Kind::Apply:
+      break;
+    }
+
+    if (!cmd.fn)
+      return;
+    if (cmd.handle.valid()) {
+      OptEntity target = collection.resolve(cmd.handle);
+      if (target)
+        cmd.fn(target.asE());
+      return;
+    }
+    if (cmd.temp && temp_alive(collection, cmd))
+      cmd.fn(*cmd.temp);
+  }
+};
+
+} // namespace afterhours
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../config.h"
+#include "../logging.h"
+#include "../memory/arena.h"
+#include "../type_name.h"
+#include "base_component.h"
+#include "entity_handle.h"
+#include "entity_index.h"
+
+namespace afterhours {
+
+// How an EntityCollection allocates the components of its entities.
+// - Heap: every component is its own std::make_unique (the original layout).
+// - Columns: components of one type are packed into per-type chunked columns
+//   owned by the collection. Entity::get<T>() still returns a stable
+//   reference; the column only changes where that reference points.
+enum struct ComponentStorageMode : std::uint8_t {
+  Heap,
+  Columns,
+};
+
+// Allocation counters for one component type's column, from
+// EntityCollection::component_pool_stats<T>() or for_each_component_pool().
+struct ComponentPoolStats {
+  std::string_view name;
+  // Components in the column now, and the most there have been at once.
+  std::size_t live = 0;
+  std::size_t peak = 0;
+  // Cells allocated, and the bytes they take.
+  std::size_t capacity = 0;
+  std::size_t bytes = 0;
+  // addComponent calls served, and how many of those had to allocate a new
+  // chunk. Every other one reused a freed cell.
+  std::size_t allocations = 0;
+  std::size_t chunk_allocations = 0;
+};
+
+struct ComponentColumnBase {
+  virtual ~ComponentColumnBase() = default;
+
+  // Destroy a component that was allocated from this column and give its
+  // cell back to the free list.
+  virtual void destroy(BaseComponent *component) = 0;
+
+  // Compaction support: a fresh, empty column of the same type, and a way to
+  // move one component out of `from` into this column. Columns whose type is
+  // not move-constructible report !relocatable() and are left in place.
+  [[nodiscard]] virtual std::unique_ptr<ComponentColumnBase>
+  make_empty() const = 0;
+  [[nodiscard]] virtual bool relocatable() const = 0;
+  [[nodiscard]] virtual BaseComponent *
+  relocate_from(ComponentColumnBase &from, BaseComponent *component) = 0;
+
+  [[nodiscard]] virtual std::size_t size() const = 0;
+  [[nodiscard]] virtual std::size_t capacity() const = 0;
+  [[nodiscard]] virtual ComponentPoolStats stats() const = 0;
+};
+
+// Chunked, free-listed storage for one component type.
+//
+// Chunks are a power-of-two number of bytes and aligned to their own size, so
+// the owning chunk of any cell is found by masking the pointer. That keeps
+// destroy() O(1) without storing anything extra in the component itself.
+template <typename T> class ComponentColumn final : public ComponentColumnBase {
+  static_assert(std::is_base_of_v<BaseComponent, T>,
+                "T must inherit from BaseComponent");
+
+  struct ChunkHeader {
+    std::uint32_t index;
+  };
+
+  static constexpr std::size_t header_bytes =
+      (sizeof(ChunkHeader) + alignof(T) - 1) & ~(alignof(T) - 1);
+
+public:
+  static constexpr std::size_t chunk_bytes = std::bit_ceil(
+      std::max<std::size_t>(16 * 1024, header_bytes + sizeof(T) * 8));
+  static constexpr std::size_t cells_per_chunk =
+      (chunk_bytes - header_bytes) / sizeof(T);
+
+  ComponentColumn() = default;
+  ComponentColumn(const ComponentColumn &) = delete;
+  ComponentColumn &operator=(const ComponentColumn &) = delete;
+
+  ~ComponentColumn() override {
+    for (std::size_t i = 0; i < live_.size(); ++i) {
+      if (live_[i])
+        cell(i)->~T();
+    }
+    for (std::byte *chunk : chunks_)
+      detail::aligned_free_compat(chunk);
+  }
+
+  template <typename... TArgs> [[nodiscard]] T *emplace(TArgs &&...args) {
+    if (free_.empty())
+      grow();
+    const std::uint32_t index = free_.back();
+    T *obj = new (cell(index)) T(std::forward<TArgs>(args)...);
+    free_.pop_back();
+    live_[index] = 1;
+    ++live_count_;
+    peak_ = std::max(peak_, live_count_);
+    ++allocations_;
+    return obj;
+  }
+
+  // Grow to at least `count` cells now, so the next `count - size()`
+  // emplaces don't allocate.
+  void reserve(const std::size_t count) {
+    while (live_.size() < count)
+      grow();
+  }
+
+  void destroy(BaseComponent *component) override {
+    T *obj = static_cast<T *>(component);
+    const std::uint32_t index = index_of(obj);
+    obj->~T();
+    live_[index] = 0;
+    --live_count_;
+    free_.push_back(index);
+  }
+
+  [[nodiscard]] std::unique_ptr<ComponentColumnBase>
+  make_empty() const override {
+    return std::make_unique<ComponentColumn<T>>();
+  }
+
+  [[nodiscard]] bool relocatable() const override {
+    return std::is_move_constructible_v<T>;
+  }
+
+  [[nodiscard]] BaseComponent *
+  relocate_from(ComponentColumnBase &from, BaseComponent *component) override {
+    if constexpr (std::is_move_constructible_v<T>) {
+      T *moved = emplace(std::move(*static_cast<T *>(component)));
+      from.destroy(component);
+      return moved;
+    } else {
+      (void)from;
+      return component;
+    }
+  }
+
+  [[nodiscard]] std::size_t size() const override { return live_count_; }
+  [[nodiscard]] std::size_t capacity() const override { return live_.size(); }
+
+  [[nodiscard]] ComponentPoolStats stats() const override {
+    return {.name = type_name<T>(),
+            .live = live_count_,
+            .peak = peak_,
+            .capacity = live_.size(),
+            .bytes = chunks_.size() * chunk_bytes,
+            .allocations = allocations_,
+            .chunk_allocations = chunks_.size()};
+  }
+
+  // Visit every live component in cell order. After
+  // EntityCollection::compact_component_storage() cell order matches entity
+  // order, so this is a straight walk through contiguous memory.
+  template <typename Fn> void each(Fn &&fn) {
+    for (std::size_t i = 0; i < live_.size(); ++i) {
+      if (live_[i])
+        fn(*cell(i));
+    }
+  }
+
+private:
+  std::vector<std::byte *> chunks_;
+  std::vector<std::uint32_t> free_;
+  std::vector<std::uint8_t> live_;
+  std::size_t live_count_ = 0;
+  std::size_t peak_ = 0;
+  std::size_t allocations_ = 0;
+
+  [[nodiscard]] T *cell(std::size_t index) const {
+    std::byte *chunk = chunks_[index / cells_per_chunk];
+    return reinterpret_cast<T *>(chunk + header_bytes +
+                                 (index % cells_per_chunk) * sizeof(T));
+  }
+
+  [[nodiscard]] std::uint32_t index_of(const T *obj) const {
+    const auto addr = reinterpret_cast<std::uintptr_t>(obj);
+    const auto *chunk = reinterpret_cast<const std::byte *>(
+        addr & ~static_cast<std::uintptr_t>(chunk_bytes - 1));
+    const auto *header = reinterpret_cast<const ChunkHeader *>(chunk);
+    const auto offset = static_cast<std::size_t>(
+        reinterpret_cast<const std::byte *>(obj) - (chunk + header_bytes));
+    return static_cast<std::uint32_t>(header->index * cells_per_chunk +
+                                      offset / sizeof(T));
+  }
+
+  void grow() {
+    auto *chunk = static_cast<std::byte *>(
+        detail::aligned_alloc_compat(chunk_bytes, chunk_bytes));
+    if (!chunk) {
+      log_error("ComponentColumn: failed to allocate a {} byte chunk",
+                chunk_bytes);
+      throw std::bad_alloc();
+    }
+    const auto chunk_index = static_cast<std::uint32_t>(chunks_.size());
+    new (chunk) ChunkHeader{chunk_index};
+    chunks_.push_back(chunk);
+
+    const std::size_t first = live_.size();
+    live_.resize(first + cells_per_chunk, 0);
+    // Pushed in reverse so the lowest cell is handed out first and a freshly
+    // grown column fills front to back.
+    for (std::size_t i = cells_per_chunk; i > 0; --i)
+      free_.push_back(static_cast<std::uint32_t>(first + i - 1));
+  }
+};
+
+// Slots of merged entities whose components or tags changed, in order.
+// Readers (match caches) keep an absolute cursor into it and catch up by
+// re-testing just those entities. Anything that reorders or removes entities
+// calls reset(), which bumps the epoch and sends every reader back to a full
+// rebuild; so does reading from before `base` after a trim.
+struct SignatureJournal {
+  static constexpr std::size_t max_entries = 1 << 16;
+
+  std::vector<EntityHandle::Slot> slots;
+  std::size_t base = 0;
+  std::uint64_t epoch = 1;
+
+  void record(const EntityHandle::Slot slot) {
+    if (slots.size() >= max_entries) {
+      reset();
+      return;
+    }
+    slots.push_back(slot);
+  }
+
+  void reset() {
+    base += slots.size();
+    slots.clear();
+    ++epoch;
+  }
+
+  [[nodiscard]] std::size_t end() const { return base + slots.size(); }
+  [[nodiscard]] EntityHandle::Slot at(const std::size_t absolute) const {
+    return slots[absolute - base];
+  }
+
+  // Drop entries every tracked reader (SystemManager's match caches) has
+  // consumed, but keep the newest `retained` so readers nobody tracks
+  // (CachedQuery) can still catch up incrementally if they refresh about as
+  // often as the journal is trimmed.
+  static constexpr std::size_t retained = 4096;
+
+  void trim_to(std::size_t absolute) {
+    absolute = std::min(absolute, end() - std::min(end(), retained));
+    if (absolute <= base)
+      return;
+    const std::size_t n = std::min(absolute - base, slots.size());
+    slots.erase(slots.begin(), slots.begin() + static_cast<std::ptrdiff_t>(n));
+    base += n;
+  }
+};
+
+// A collection's change clock. `now` advances each time SystemManager finishes
+// a system; components stamp it when added or marked changed, and a system
+// sees whatever was stamped after its previous run (Added<T>, Changed<T>).
+// Removals can't be stamped on the component, so they are kept here per slot
+// (Removed<T>), in a table only allocated once that component is removed.
+struct ChangeTicks {
+  std::uint32_t now = 1;
+  std::array<std::vector<std::uint32_t>, max_num_components> removed;
+  std::bitset<max_num_components> any_removed;
+
+  void note_removed(const EntityHandle::Slot slot, const ComponentID id) {
+    std::vector<std::uint32_t> &ticks = removed[id];
+    if (slot >= ticks.size())
+      ticks.resize(static_cast<std::size_t>(slot) + 1, 0);
+    ticks[slot] = now;
+    any_removed.set(id);
+  }
+
+  [[nodiscard]] std::uint32_t removed_at(const EntityHandle::Slot slot,
+                                         const ComponentID id) const {
+    const std::vector<std::uint32_t> &ticks = removed[id];
+    return slot < ticks.size() ? ticks[slot] : 0;
+  }
+
+  // The slot is being reused; its next entity starts with a clean history.
+  void forget(const EntityHandle::Slot slot) {
+    if (any_removed.none())
+      return;
+    for (std::size_t id = 0; id < max_num_components; ++id) {
+      if (any_removed.test(id) && slot < removed[id].size())
+        removed[id][slot] = 0;
+    }
+  }
+
+  void forget_all() {
+    for (std::size_t id = 0; id < max_num_components; ++id) {
+      if (any_removed.test(id))
+        removed[id].clear();
+    }
+    any_removed.reset();
+  }
+};
+
+// Per-collection component bookkeeping. Every entity a collection creates
+// points at its collection's storage through Entity::ah_storage.
+struct ComponentStorage {
+  ComponentStorageMode mode = ComponentStorageMode::Heap;
+  // Types kept in columns whatever the mode (reserve_components<T>()).
+  std::bitset<max_num_components> pooled_types;
+  std::array<std::unique_ptr<ComponentColumnBase>, max_num_components> columns;
+  SignatureJournal journal;
+  EntityIndexes indexes;
+  ChangeTicks ticks;
+
+  [[nodiscard]] bool uses_columns() const {
+    return mode == ComponentStorageMode::Columns;
+  }
+
+  // Is a component of type `id` added now allocated from its column?
+  [[nodiscard]] bool pools(const ComponentID id) const {
+    return uses_columns() || pooled_types.test(id);
+  }
+
+  template <typename T>
+  [[nodiscard]] ComponentColumn<T> &column(const ComponentID id) {
+    auto &slot = columns[id];
+    if (!slot)
+      slot = std::make_unique<ComponentColumn<T>>();
+    return static_cast<ComponentColumn<T> &>(*slot);
+  }
+
+  template <typename T, typename... TArgs>
+  [[nodiscard]] T *emplace(const ComponentID id, TArgs &&...args) {
+    return column<T>(id).emplace(std::forward<TArgs>(args)...);
+  }
+
+  void destroy(const ComponentID id, BaseComponent *component) {
+    if (!component)
+      return;
+    if (!columns[id]) {
+      log_error("ComponentStorage: no column {} to release a component into",
+                id);
+      return;
+    }
+    columns[id]->destroy(component);
+  }
+
+  [[nodiscard]] std::size_t column_size(const ComponentID id) const {
+    return columns[id] ? columns[id]->size() : 0;
+  }
+};
+
+} // namespace afterhours
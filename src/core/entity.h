@@ -4,6 +4,7 @@
 #include <atomic>
 #include <bitset>
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <type_traits>
 
@@ -11,6 +12,7 @@
 #include "../config.h"
 #include "../type_name.h"
 #include "base_component.h"
+#include "component_storage.h"
 #include "entity_handle.h"
 #include "pointer_policy.h"
 
@@ -28,7 +30,9 @@ using EntityID = int;
 
 inline std::atomic_int ENTITY_ID_GEN = 0;
 
-struct Entity {
+// shared_from_this() lets getEntityAsSharedPtr recover the owning pointer
+// from a plain Entity& without searching for it.
+struct Entity : std::enable_shared_from_this<Entity> {
   EntityID id;
   int entity_type = 0;
 
@@ -37,6 +41,13 @@ struct Entity {
   //   (e.g., it's still in temp_entities pre-merge).
   EntityHandle::Slot ah_slot_index = EntityHandle::INVALID_SLOT;
 
+  // Storage of the collection that created this entity (nullptr for entities
+  // built outside a collection). Components whose bit is set in ah_pooled
+  // live in one of its columns and must be handed back to it, never deleted.
+  // Stays valid as long as the entity does, even past its collection.
+  ComponentStorage *ah_storage = nullptr;
+  ComponentBitSet ah_pooled;
+
   ComponentBitSet componentSet;
   ComponentArray componentArray;
 
@@ -48,12 +59,86 @@ struct Entity {
   Entity(const Entity &) = delete;
   Entity(Entity &&other) noexcept = default;
 
-  virtual ~Entity() {}
+  virtual ~Entity() {
+    if (ah_pooled.none())
+      return;
+    for (size_t i = 0; i < max_num_components; ++i) {
+      if (ah_pooled.test(i))
+        release_component(i);
+    }
+  }
+
+  // Destroy the component in slot `id`, through the column it came from if
+  // it was pooled.
+  void release_component(const ComponentID id) {
+    if (ah_pooled.test(id)) {
+      ah_pooled.reset(id);
+      if (ah_storage) {
+        ah_storage->destroy(id, componentArray[id].release());
+        return;
+      }
+      log_error("entity {} has a pooled component {} but no storage", this->id,
+                id);
+    }
+    componentArray[id].reset();
+  }
+
+  // Tell the owning collection's match caches and indexes this (merged)
+  // entity gained or lost a component. Temp entities are picked up when they
+  // merge.
+  void note_component_change(const ComponentID id, const bool present) {
+    if (!ah_storage || ah_slot_index == EntityHandle::INVALID_SLOT)
+      return;
+    ah_storage->journal.record(ah_slot_index);
+    ah_storage->indexes.on_component(ah_slot_index, id, present);
+    if (!present)
+      ah_storage->ticks.note_removed(ah_slot_index, id);
+  }
+
+  // The owning collection's change tick; 0 for an entity outside one.
+  [[nodiscard]] std::uint32_t change_tick() const {
+    return ah_storage ? ah_storage->ticks.now : 0;
+  }
+
+  // Stamp component T as changed now, so Changed<T> filters pick this
+  // entity up. Writes through get<T>() aren't tracked; use this (or
+  // get_mut<T>()) after changes other systems should react to.
+  template <typename T> void mark_changed() {
+    const ComponentID component_id = components::get_type_id<T>();
+    if (componentArray[component_id])
+      componentArray[component_id]->ah_changed_tick = change_tick();
+  }
+
+  template <typename T> [[nodiscard]] T &get_mut() {
+    mark_changed<T>();
+    return get<T>();
+  }
+
+  // Tick component `id` was added at / last marked changed at / last removed
+  // at, or 0.
+  [[nodiscard]] std::uint32_t added_tick(const ComponentID id) const {
+    return componentArray[id] ? componentArray[id]->ah_added_tick : 0;
+  }
+  [[nodiscard]] std::uint32_t changed_tick(const ComponentID id) const {
+    return componentArray[id] ? componentArray[id]->ah_changed_tick : 0;
+  }
+  [[nodiscard]] std::uint32_t removed_tick(const ComponentID id) const {
+    if (!ah_storage || ah_slot_index == EntityHandle::INVALID_SLOT)
+      return 0;
+    return ah_storage->ticks.removed_at(ah_slot_index, id);
+  }
+
+  void note_tag_change(const TagId tag_id, const bool present) {
+    if (!ah_storage || ah_slot_index == EntityHandle::INVALID_SLOT)
+      return;
+    ah_storage->journal.record(ah_slot_index);
+    ah_storage->indexes.on_tag(ah_slot_index, tag_id, present);
+  }
 
   void recycle(EntityID new_id) {
     for (size_t i = 0; i < max_num_components; ++i) {
       if (componentSet.test(i)) {
-        componentArray[i].reset();
+        release_component(i);
       }
     }
     componentSet.reset();
@@ -117,7 +202,8 @@ struct Entity {
       return;
     }
     componentSet[components::get_type_id<T>()] = false;
-    componentArray[components::get_type_id<T>()].reset();
+    release_component(components::get_type_id<T>());
+    note_component_change(components::get_type_id<T>(), false);
   }
 
   template <typename T, typename... TArgs> T &addComponent(TArgs &&...args) {
@@ -135,10 +221,23 @@ struct Entity {
     }
 #endif
 
-    auto component = std::make_unique<T>(std::forward<TArgs>(args)...);
     const ComponentID component_id = components::get_type_id<T>();
-    componentArray[component_id] = std::move(component);
+    if (componentArray[component_id])
+      release_component(component_id);
+    if (ah_storage && ah_storage->pools(component_id)) {
+      componentArray[component_id].reset(ah_storage->template emplace<T>(
+          component_id, std::forward<TArgs>(args)...));
+      ah_pooled.set(component_id);
+    } else {
+      componentArray[component_id] =
+          std::make_unique<T>(std::forward<TArgs>(args)...);
+    }
+    componentArray[component_id]->ah_added_tick = change_tick();
+    componentArray[component_id]->ah_changed_tick = change_tick();
+    const bool had_component = componentSet[component_id];
     componentSet[component_id] = true;
+    if (!had_component)
+      note_component_change(component_id, true);
 
 #if defined(AFTER_HOURS_DEBUG)
     log_trace("your set is now {}", componentSet);
@@ -241,6 +340,8 @@ struct Entity {
   void enableTag(const TagId tag_id) {
     if (tag_id >= AFTER_HOURS_MAX_ENTITY_TAGS)
       return;
+    if (!tags.test(tag_id))
+      note_tag_change(tag_id, true);
     tags.set(tag_id);
   }
 
@@ -252,6 +353,8 @@ struct Entity {
   void disableTag(const TagId tag_id) {
     if (tag_id >= AFTER_HOURS_MAX_ENTITY_TAGS)
       return;
+    if (tags.test(tag_id))
+      note_tag_change(tag_id, false);
     tags.reset(tag_id);
   }
 
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "../logging.h"
+#include "../memory/arena.h"
+
+namespace afterhours {
+
+// Fixed-size blocks carved out of larger chunks and recycled through an
+// intrusive free list. EntityCollection allocates every Entity (together with
+// its shared_ptr control block, via std::allocate_shared) from one of these,
+// so creating and destroying entities in steady state never reaches the heap
+// and live entities sit next to each other in memory.
+//
+// The block size is fixed by the first allocation; requests of any other size
+// fall through to operator new. Not thread-safe: allocate and release
+// entities of one collection from one thread at a time.
+class EntityBlockPool {
+public:
+  explicit EntityBlockPool(const std::size_t blocks_per_chunk = 64)
+      : blocks_per_chunk_(blocks_per_chunk ? blocks_per_chunk : 1) {}
+
+  EntityBlockPool(const EntityBlockPool &) = delete;
+  EntityBlockPool &operator=(const EntityBlockPool &) = delete;
+
+  ~EntityBlockPool() {
+    if (in_use_ != 0)
+      log_warn("EntityBlockPool destroyed with {} blocks in use", in_use_);
+    for (std::byte *chunk : chunks_)
+      detail::aligned_free_compat(chunk);
+  }
+
+  [[nodiscard]] void *allocate(const std::size_t bytes,
+                               const std::size_t align) {
+    if (block_size_ == 0) {
+      block_align_ = std::max(align, alignof(FreeBlock));
+      block_size_ = (std::max(bytes, sizeof(FreeBlock)) + block_align_ - 1) &
+                    ~(block_align_ - 1);
+    }
+    if (bytes > block_size_ || align > block_align_)
+      return ::operator new(bytes, std::align_val_t{align});
+
+    if (!free_)
+      grow();
+    FreeBlock *block = free_;
+    free_ = block->next;
+    ++in_use_;
+    return block;
+  }
+
+  void deallocate(void *p, const std::size_t bytes, const std::size_t align) {
+    if (bytes > block_size_ || align > block_align_) {
+      ::operator delete(p, std::align_val_t{align});
+      return;
+    }
+    free_ = new (p) FreeBlock{free_};
+    --in_use_;
+  }
+
+  [[nodiscard]] std::size_t blocks_in_use() const { return in_use_; }
+  [[nodiscard]] std::size_t capacity() const {
+    return chunks_.size() * blocks_per_chunk_;
+  }
+  [[nodiscard]] std::size_t block_size() const { return block_size_; }
+
+private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  std::size_t blocks_per_chunk_;
+  std::size_t block_size_ = 0;
+  std::size_t block_align_ = 0;
+  std::size_t in_use_ = 0;
+  FreeBlock *free_ = nullptr;
+  std::vector<std::byte *> chunks_;
+
+  void grow() {
+    const std::size_t bytes = block_size_ * blocks_per_chunk_;
+    auto *chunk = static_cast<std::byte *>(
+        detail::aligned_alloc_compat(block_align_, bytes));
+    if (!chunk) {
+      log_error("EntityBlockPool: failed to allocate a {} byte chunk", bytes);
+      throw std::bad_alloc();
+    }
+    chunks_.push_back(chunk);
+    // Thread back to front so blocks are handed out in address order.
+    for (std::size_t i = blocks_per_chunk_; i > 0; --i)
+      free_ = new (chunk + (i - 1) * block_size_) FreeBlock{free_};
+  }
+};
+
+// std::allocate_shared allocator over an EntityBlockPool. Each control block
+// keeps the pool alive, so an entity held past its collection is still freed
+// into valid memory.
+template <typename T> struct EntityBlockAllocator {
+  using value_type = T;
+
+  std::shared_ptr<EntityBlockPool> pool;
+
+  explicit EntityBlockAllocator(std::shared_ptr<EntityBlockPool> p)
+      : pool(std::move(p)) {}
+  template <typename U>
+  EntityBlockAllocator(const EntityBlockAllocator<U> &other) // NOLINT
+      : pool(other.pool) {}
+
+  [[nodiscard]] T *allocate(const std::size_t n) {
+    return static_cast<T *>(pool->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, const std::size_t n) {
+    pool->deallocate(p, n * sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  bool operator==(const EntityBlockAllocator<U> &other) const {
+    return pool == other.pool;
+  }
+};
+
+} // namespace afterhours
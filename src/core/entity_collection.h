@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <set>
 #include <unordered_map>
@@ -10,9 +11,11 @@
 
 #include "../debug_allocator.h"
 #include "../logging.h"
+#include "../memory/frame_arena.h"
 #include "../type_name.h"
 #include "base_component.h"
 #include "entity.h"
+#include "entity_block_pool.h"
 #include "entity_handle.h"
 
 namespace afterhours {
@@ -29,10 +32,29 @@ using EntityAllocator = std::allocator<EntityType>;
 
 using Entities = std::vector<EntityType, EntityAllocator>;
 using RefEntities = std::vector<RefEntity>;
+// Freed with the frame (see frame_arena()).
+using FrameRefEntities = FrameVector<RefEntity>;
 
 // EntityCollection: Storage container for entities, handles, and related data.
 // Supports multiple independent collections for multi-threaded scenarios.
 struct EntityCollection {
+  // What this collection's entities point back into: the blocks they are
+  // allocated from (see EntityBlockPool) and the storage their components
+  // live in. Shared, and held by each entity's control block through its
+  // allocator, so an entity kept past its collection still releases its
+  // components and frees itself into valid memory. Heap-allocated so
+  // entities can keep a stable pointer to it even if the collection itself
+  // is moved.
+  struct Backing {
+    EntityBlockPool blocks;
+    ComponentStorage storage;
+  };
+  std::shared_ptr<Backing> backing_ = std::make_shared<Backing>();
+  std::shared_ptr<ComponentStorage> component_storage_{backing_,
+                                                       &backing_->storage};
+  std::shared_ptr<EntityBlockPool> entity_blocks_{backing_,
+                                                  &backing_->blocks};
+
   Entities entities_DO_NOT_USE;
   Entities temp_entities;
   std::set<int> permanant_ids;
@@ -41,8 +63,11 @@ struct EntityCollection {
   // Handle store:
   // - stable slot table + generation counters
   // - id->slot mapping for O(1) EntityID resolution
+  // A slot only points at its entity; entities_DO_NOT_USE owns it. Every
+  // path that drops an entity from that list clears its slot first, so
+  // resolving a handle never touches a reference count.
   struct Slot {
-    EntityType ent;
+    Entity *ent = nullptr;
     EntityHandle::Slot gen = 1;
   };
 
@@ -50,10 +75,21 @@ struct EntityCollection {
   std::vector<EntityHandle::Slot> free_slots;
   std::vector<EntityHandle::Slot> id_to_slot;
 
+  // Where each merged entity sits in entities_DO_NOT_USE, indexed by slot.
+  // Valid for one signature-journal epoch: anything that removes or reorders
+  // entities resets the journal, and the table is rebuilt on next use.
+  static constexpr std::uint32_t npos =
+      (std::numeric_limits<std::uint32_t>::max)();
+  std::vector<std::uint32_t> slot_positions_;
+  std::uint64_t slot_positions_epoch_ = 0;
+
   // Entity pool: pre-allocated entities for reuse, avoiding heap churn.
   Entities entity_pool_;
   size_t max_pool_size_ = 0;
   std::vector<EntityID> free_ids_;
+  // See use_own_entity_ids().
+  bool own_entity_ids_ = false;
+  EntityID next_entity_id_ = 0;
 
   struct CreationOptions {
     bool is_permanent;
@@ -73,21 +109,239 @@ struct EntityCollection {
     max_pool_size_ = std::max(max_pool_size_, count * 2);
     entity_pool_.reserve(count);
     for (size_t i = 0; i < count; ++i) {
-      entity_pool_.push_back(std::make_shared<Entity>(EntityID{-1}));
+      entity_pool_.push_back(allocate_entity(EntityID{-1}));
+    }
+  }
+
+  // Pool component T in this collection whatever the storage mode, and make
+  // room for `count` of them up front: like reserve_entities(), for types
+  // added and removed often (projectiles, requests, one-frame events). Adds
+  // and removes then reuse cells from T's column instead of the heap.
+  template <typename T> void reserve_components(const std::size_t count) {
+    const ComponentID id = components::get_type_id<T>();
+    component_storage_->pooled_types.set(id);
+    component_storage_->column<T>(id).reserve(count);
+  }
+
+  // Allocation counters for T's column (empty if T was never pooled here).
+  template <typename T>
+  [[nodiscard]] ComponentPoolStats component_pool_stats() const {
+    const ComponentID id = components::get_type_id<T>();
+    const auto &column = component_storage_->columns[id];
+    if (!column)
+      return {.name = type_name<T>()};
+    return column->stats();
+  }
+
+  // fn(const ComponentPoolStats &) for every column this collection has.
+  template <typename Fn> void for_each_component_pool(Fn &&fn) const {
+    for (const auto &column : component_storage_->columns) {
+      if (column)
+        fn(column->stats());
+    }
+  }
+
+  // Choose how components added from now on are allocated (see
+  // ComponentStorageMode). Safe to switch at any time: each entity remembers
+  // which of its components are pooled, so existing ones are released to
+  // wherever they came from.
+  void set_component_storage_mode(const ComponentStorageMode mode) {
+    component_storage_->mode = mode;
+  }
+
+  [[nodiscard]] ComponentStorageMode component_storage_mode() const {
+    return component_storage_->mode;
+  }
+
+  [[nodiscard]] ComponentStorage &component_storage() {
+    return *component_storage_;
+  }
+
+  // Visit every pooled T in column order, without going through entities.
+  // Only components allocated while in Columns mode are visited.
+  template <typename T, typename Fn> void for_each_component(Fn &&fn) {
+    const ComponentID id = components::get_type_id<T>();
+    if (!component_storage_->columns[id])
+      return;
+    component_storage_->column<T>(id).each(std::forward<Fn>(fn));
+  }
+
+  // Regroup entities by component signature (archetype) and rewrite every
+  // relocatable column in the new entity order, so that iterating entities
+  // walks each column front to back.
+  //
+  // This is a sync point: it MOVES pooled components, so any T& or T* held
+  // across the call dangles (handles and ids stay valid). Entity order
+  // changes too; groups keep the order their first member had, and entities
+  // keep their relative order within a group. Call it where you would call
+  // cleanup(), e.g. after loading a level or every few hundred frames.
+  void compact_component_storage() {
+    merge_entity_arrays();
+
+    std::unordered_map<ComponentBitSet, std::size_t> group_of;
+    std::vector<Entities> groups;
+    for (auto &sp : entities_DO_NOT_USE) {
+      if (!sp)
+        continue;
+      auto [it, inserted] =
+          group_of.try_emplace(sp->componentSet, groups.size());
+      if (inserted)
+        groups.emplace_back();
+      groups[it->second].push_back(std::move(sp));
+    }
+    entities_DO_NOT_USE.clear();
+    for (auto &group : groups) {
+      for (auto &sp : group)
+        entities_DO_NOT_USE.push_back(std::move(sp));
+    }
+    note_entity_order_changed();
+
+    // Entities parked in entity_pool_ keep their components until they are
+    // recycled, so they move along with the live ones (after them).
+    ComponentStorage &storage = *component_storage_;
+    const auto for_each_owner = [&](const ComponentID id, auto &&fn) {
+      for (Entities *list : {&entities_DO_NOT_USE, &entity_pool_}) {
+        for (auto &sp : *list) {
+          if (sp && sp->ah_pooled.test(id) && sp->ah_storage == &storage)
+            fn(*sp);
+        }
+      }
+    };
+
+    for (ComponentID id = 0; id < max_num_components; ++id) {
+      auto &old_column = storage.columns[id];
+      if (!old_column || old_column->size() == 0 ||
+          !old_column->relocatable())
+        continue;
+
+      // Anything held outside the collection (e.g. a shared_ptr kept past
+      // cleanup) would be stranded in the old column, so leave such a column
+      // alone.
+      std::size_t reachable = 0;
+      for_each_owner(id, [&](Entity &) { ++reachable; });
+      if (reachable != old_column->size()) {
+        log_warn("compact_component_storage: column {} has {} components "
+                 "outside the collection, skipping",
+                 id, old_column->size() - reachable);
+        continue;
+      }
+
+      std::unique_ptr<ComponentColumnBase> fresh = old_column->make_empty();
+      for_each_owner(id, [&](Entity &e) {
+        BaseComponent *moved =
+            fresh->relocate_from(*old_column, e.componentArray[id].release());
+        e.componentArray[id].reset(moved);
+      });
+      old_column = std::move(fresh);
     }
   }
 
   size_t pool_size() const { return entity_pool_.size(); }
 
+  [[nodiscard]] const EntityBlockPool &entity_block_pool() const {
+    return *entity_blocks_;
+  }
+
+  // A fresh entity in this collection's block pool, bound to its storage.
+  EntityType allocate_entity(const EntityID id) {
+    EntityType e = std::allocate_shared<Entity>(
+        EntityBlockAllocator<Entity>{entity_blocks_}, id);
+    e->ah_storage = component_storage_.get();
+    return e;
+  }
+
   EntityID alloc_entity_id() {
     if (!free_ids_.empty()) {
       EntityID id = free_ids_.back();
       free_ids_.pop_back();
       return id;
     }
+    if (own_entity_ids_)
+      return next_entity_id_++;
     return ENTITY_ID_GEN++;
   }
 
+  // Number this collection's entities from 0 on its own instead of from the
+  // process-wide ENTITY_ID_GEN, so creating one touches nothing shared with
+  // other collections (see World). Ids then only identify an entity within
+  // this collection: lookups that search several collections by id can't
+  // tell them apart. Call before creating any entities.
+  void use_own_entity_ids() {
+    if (!entities_DO_NOT_USE.empty() || !temp_entities.empty())
+      log_warn("use_own_entity_ids() on a collection that already has "
+               "entities; their ids may be handed out again");
+    own_entity_ids_ = true;
+  }
+
+  [[nodiscard]] bool has_own_entity_ids() const { return own_entity_ids_; }
+
+  // Call after removing or reordering entities in entities_DO_NOT_USE.
+  // Match caches (SystemManager) rebuild from scratch on their next use.
+  // Appending (merge_entity_arrays) does not need this.
+  void note_entity_order_changed() { component_storage_->journal.reset(); }
+
+  [[nodiscard]] const SignatureJournal &signature_journal() const {
+    return component_storage_->journal;
+  }
+
+  // Position of the merged entity in `slot`, or npos.
+  [[nodiscard]] std::uint32_t position_of_slot(const EntityHandle::Slot slot) {
+    const SignatureJournal &journal = component_storage_->journal;
+    if (slot_positions_epoch_ != journal.epoch) {
+      slot_positions_.assign(slots.size(), npos);
+      for (std::size_t i = 0; i < entities_DO_NOT_USE.size(); ++i) {
+        const auto &sp = entities_DO_NOT_USE[i];
+        if (sp && sp->ah_slot_index < slot_positions_.size())
+          slot_positions_[sp->ah_slot_index] = static_cast<std::uint32_t>(i);
+      }
+      slot_positions_epoch_ = journal.epoch;
+    }
+    return slot < slot_positions_.size() ? slot_positions_[slot] : npos;
+  }
+
+  // Slots of the merged entities that have component `id` / tag `tag_id`.
+  // The first call builds the index; after that Entity and this collection
+  // keep it current as components, tags and entities come and go.
+  const SlotSet &component_index(const ComponentID id) {
+    EntityIndexes &indexes = component_storage_->indexes;
+    if (!indexes.indexed_components.test(id)) {
+      indexes.components[id] = std::make_unique<SlotSet>();
+      indexes.indexed_components.set(id);
+      for (const auto &sp : entities_DO_NOT_USE) {
+        if (sp && sp->ah_slot_index != EntityHandle::INVALID_SLOT &&
+            sp->componentSet.test(id))
+          indexes.components[id]->insert(sp->ah_slot_index);
+      }
+    }
+    return *indexes.components[id];
+  }
+
+  const SlotSet &tag_index(const TagId tag_id) {
+    EntityIndexes &indexes = component_storage_->indexes;
+    if (!indexes.indexed_tags.test(tag_id)) {
+      indexes.tags[tag_id] = std::make_unique<SlotSet>();
+      indexes.indexed_tags.set(tag_id);
+      for (const auto &sp : entities_DO_NOT_USE) {
+        if (sp && sp->ah_slot_index != EntityHandle::INVALID_SLOT &&
+            sp->tags.test(tag_id))
+          indexes.tags[tag_id]->insert(sp->ah_slot_index);
+      }
+    }
+    return *indexes.tags[tag_id];
+  }
+
+  // See ChangeTicks. SystemManager moves the clock after every system.
+  [[nodiscard]] std::uint32_t change_tick() const {
+    return component_storage_->ticks.now;
+  }
+
+  // For code outside systems: returns the current tick and moves the clock
+  // on, so everything stamped from here is newer. Pass the result to
+  // TypedQuery::since() later to ask what changed in between.
+  std::uint32_t advance_change_tick() {
+    return component_storage_->ticks.now++;
+  }
+
   Entities &get_temp() { return temp_entities; }
   const Entities &get_temp() const { return temp_entities; }
 
@@ -136,8 +390,9 @@ struct EntityCollection {
       log_error("alloc_slot_index returned out-of-range slot {}", slot);
       return;
     }
-    slots[slot].ent = sp;
+    slots[slot].ent = sp.get();
     sp->ah_slot_index = slot;
+    component_storage_->indexes.on_merge(slot, sp->componentSet, sp->tags);
 
     ensure_id_mapping_size(sp->id);
     if (sp->id >= 0)
@@ -170,11 +425,11 @@ struct EntityCollection {
     }
 
     Slot &s = slots[slot];
-    if (s.ent) {
-      s.ent.reset();
-    }
+    s.ent = nullptr;
     s.gen = bump_gen(s.gen);
     free_slots.push_back(slot);
+    component_storage_->indexes.on_remove(slot);
+    component_storage_->ticks.forget(slot);
   }
 
   // Return a stable handle for a currently-merged entity.
@@ -188,7 +443,7 @@ struct EntityCollection {
     if (slot >= slots.size())
       return EntityHandle::invalid();
     const Slot &s = slots[slot];
-    if (!s.ent || s.ent.get() != &e)
+    if (s.ent != &e)
       return EntityHandle::invalid();
     return {slot, s.gen};
   }
@@ -230,28 +485,41 @@ struct EntityCollection {
       entity_pool_.pop_back();
       e->recycle(alloc_entity_id());
     } else {
-      e = std::make_shared<Entity>(alloc_entity_id());
+      e = allocate_entity(alloc_entity_id());
     }
-    temp_entities.push_back(e);
+    Entity &entity = *e;
+    temp_entities.push_back(std::move(e));
 
     if (options.is_permanent) {
-      permanant_ids.insert(e->id);
+      permanant_ids.insert(entity.id);
     }
 
-    return *e;
+    return entity;
   }
 
   void merge_entity_arrays() {
     if (temp_entities.empty())
       return;
 
-    for (const auto &entity : temp_entities) {
+    const bool positions_current =
+        slot_positions_epoch_ == component_storage_->journal.epoch;
+    // Moved, not copied: a merge shouldn't cost two refcount updates per
+    // entity.
+    for (auto &entity : temp_entities) {
       if (!entity)
         continue;
       if (entity->cleanup)
         continue;
-      entities_DO_NOT_USE.push_back(entity);
-      assign_slot_to_entity(entity);
+      entities_DO_NOT_USE.push_back(std::move(entity));
+      const EntityType &merged = entities_DO_NOT_USE.back();
+      assign_slot_to_entity(merged);
+      if (positions_current) {
+        const EntityHandle::Slot slot = merged->ah_slot_index;
+        if (slot_positions_.size() <= slot)
+          slot_positions_.resize(slots.size(), npos);
+        slot_positions_[slot] =
+            static_cast<std::uint32_t>(entities_DO_NOT_USE.size() - 1);
+      }
     }
     temp_entities.clear();
   }
@@ -272,23 +540,24 @@ struct EntityCollection {
     const ComponentID id = components::get_type_id<Component>();
     if (!singletonMap.contains(id)) {
       // Warn once per component id, not every frame — a missing singleton is
-      // queried per-frame and would otherwise flood the log.
-      static std::unordered_set<ComponentID> warned;
+      // queried per-frame and would otherwise flood the log. Per thread, so
+      // worlds stepped on different threads don't share it.
+      thread_local std::unordered_set<ComponentID> warned;
       if (warned.insert(id).second) {
         log_warn("Singleton map is missing value for component {} ({}). Did "
                  "you register this component previously?",
                  id, type_name<Component>());
       }
-      // Return a reference to a static dummy entity to avoid crash
+      // Return a reference to a thread-local dummy entity to avoid crash
       // This should never happen in proper usage, but prevents segfault
-      static Entity dummy_entity;
+      thread_local Entity dummy_entity;
       return dummy_entity;
     }
     auto *entity_ptr = singletonMap.at(id);
     if (!entity_ptr) {
       log_error("Singleton map contains null pointer for component {} ({})", id,
                 type_name<Component>());
-      static Entity dummy_entity;
+      thread_local Entity dummy_entity;
       return dummy_entity;
     }
     return *entity_ptr;
@@ -348,15 +617,7 @@ struct EntityCollection {
     merge_entity_arrays();
     Entities &entities = get_entities_for_mod();
 
-    // Build a set of entity pointers that are registered as singletons.
-    // This lets us skip the singletonMap scan for the vast majority of
-    // entities that are not singletons.
-    std::unordered_set<Entity *> singleton_entities;
-    singleton_entities.reserve(singletonMap.size());
-    for (const auto &[_, ptr] : singletonMap) {
-      singleton_entities.insert(ptr);
-    }
-
+    bool removed_any = false;
     std::size_t i = 0;
     while (i < entities.size()) {
       const auto &sp = entities[i];
@@ -364,21 +625,18 @@ struct EntityCollection {
         ++i;
         continue;
       }
-      // Remove any singleton registrations pointing at this entity,
-      // but only if this entity is actually a singleton.
-      if (sp && singleton_entities.count(sp.get())) {
+      // Drop any singleton registrations pointing at this entity. Only
+      // removed entities get here and singletons are few, so a scan is
+      // cheaper than the lookup set this used to build every frame.
+      if (sp && !singletonMap.empty()) {
         Entity *removed = sp.get();
-        for (auto it = singletonMap.begin(); it != singletonMap.end();) {
-          if (it->second == removed) {
-            it = singletonMap.erase(it);
-          } else {
-            ++it;
-          }
-        }
-        singleton_entities.erase(removed);
+        std::erase_if(singletonMap, [removed](const auto &kv) {
+          return kv.second == removed;
+        });
       }
       // invalidate removed entity slot/id mapping
       invalidate_entity_slot_if_any(entities[i]);
+      removed_any = true;
 
       EntityType removed = std::move(entities[i]);
       if (i != entities.size() - 1) {
@@ -399,6 +657,8 @@ struct EntityCollection {
         }
       }
     }
+    if (removed_any)
+      note_entity_order_changed();
   }
 
   void delete_all_entities_NO_REALLY_I_MEAN_ALL() {
@@ -416,6 +676,7 @@ struct EntityCollection {
     temp_entities.clear();
     permanant_ids.clear();
     singletonMap.clear();
+    note_entity_order_changed();
   }
 
   void delete_all_entities(const bool include_permanent) {
@@ -465,6 +726,7 @@ struct EntityCollection {
         std::swap(entities[i], entities.back());
       entities.pop_back();
     }
+    note_entity_order_changed();
   }
 
   // Rebuild the handle store (slots/free list/id mapping) from the current
@@ -477,6 +739,8 @@ struct EntityCollection {
     slots.clear();
     free_slots.clear();
     id_to_slot.clear();
+    component_storage_->indexes.clear();
+    component_storage_->ticks.forget_all();
 
     // Ensure entities don't think they already have a slot.
     for (auto &sp : entities_DO_NOT_USE) {
@@ -492,6 +756,7 @@ struct EntityCollection {
         continue;
       assign_slot_to_entity(sp);
     }
+    note_entity_order_changed();
   }
 
   // Replace the entire entity list with a new one and rebuild handle/id
@@ -505,6 +770,12 @@ struct EntityCollection {
 
     // Replace and rebuild indices.
     entities_DO_NOT_USE = std::move(new_entities);
+    // Adopt entities built elsewhere. One that already has pooled components
+    // keeps the storage they live in.
+    for (auto &sp : entities_DO_NOT_USE) {
+      if (sp && sp->ah_pooled.none())
+        sp->ah_storage = component_storage_.get();
+    }
     rebuild_handle_store_from_entities();
   }
 
@@ -545,20 +816,13 @@ struct EntityCollection {
     return opt_ent.asE();
   }
 
-  // Fast path is the O(1) id_to_slot lookup; the scan is a fallback for
-  // entities whose slot mapping is stale or absent (e.g. not yet merged).
+  // O(1) through the entity's own weak reference (Entity derives from
+  // enable_shared_from_this). The scan is only for an Entity that no
+  // shared_ptr owns (say, one on the stack), matched by id as before.
   std::shared_ptr<Entity> getEntityAsSharedPtr(const Entity &entity) const {
-    const EntityID id = entity.id;
-    if (id >= 0) {
-      const std::size_t idx = static_cast<std::size_t>(id);
-      if (idx < id_to_slot.size()) {
-        const EntityHandle::Slot slot = id_to_slot[idx];
-        if (slot != EntityHandle::INVALID_SLOT && slot < slots.size()) {
-          if (const auto &sp = slots[slot].ent; sp && sp->id == id)
-            return sp;
-        }
-      }
-    }
+    if (auto sp = std::const_pointer_cast<Entity>(
+            entity.weak_from_this().lock()))
+      return sp;
     for (const std::shared_ptr<Entity> &current_entity : get_entities()) {
       if (entity.id == current_entity->id)
         return current_entity;
@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "../debug_allocator.h"
+#include "../memory/frame_arena.h"
 #include "../singleton.h"
 #include "entity.h"
 
@@ -22,6 +23,7 @@ using EntityAllocator = std::allocator<EntityType>;
 
 using Entities = std::vector<EntityType, EntityAllocator>;
 using RefEntities = std::vector<RefEntity>;
+using FrameRefEntities = FrameVector<RefEntity>;
 
 SINGLETON_FWD(EntityHelper)
 struct EntityHelper {
@@ -61,6 +63,23 @@ struct EntityHelper {
     return EntityHelper::get().default_collection;
   }
 
+  // Makes `collection` the current thread's default until destroyed, then
+  // puts back whatever was registered before.
+  class ScopedDefaultCollection {
+  public:
+    explicit ScopedDefaultCollection(EntityCollection &collection)
+        : previous_(get_thread_default_collection_ptr()) {
+      set_default_collection(&collection);
+    }
+    ~ScopedDefaultCollection() { set_default_collection(previous_); }
+    ScopedDefaultCollection(const ScopedDefaultCollection &) = delete;
+    ScopedDefaultCollection &
+    operator=(const ScopedDefaultCollection &) = delete;
+
+  private:
+    EntityCollection *previous_;
+  };
+
   // Static methods that delegate to default collection (backward
   // compatibility)
   static void reserve_temp_space() {
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "../config.h"
+#include "base_component.h"
+#include "entity_handle.h"
+
+namespace afterhours {
+
+// Sparse set of entity slots: O(1) insert/erase/contains, and the members
+// packed densely for iteration.
+class SlotSet {
+public:
+  static constexpr std::uint32_t npos =
+      (std::numeric_limits<std::uint32_t>::max)();
+
+  [[nodiscard]] bool contains(const EntityHandle::Slot slot) const {
+    return slot < sparse_.size() && sparse_[slot] != npos;
+  }
+
+  void insert(const EntityHandle::Slot slot) {
+    if (contains(slot))
+      return;
+    if (slot >= sparse_.size())
+      sparse_.resize(static_cast<std::size_t>(slot) + 1, npos);
+    sparse_[slot] = static_cast<std::uint32_t>(dense_.size());
+    dense_.push_back(slot);
+  }
+
+  void erase(const EntityHandle::Slot slot) {
+    if (!contains(slot))
+      return;
+    const std::uint32_t at = sparse_[slot];
+    const EntityHandle::Slot last = dense_.back();
+    dense_[at] = last;
+    sparse_[last] = at;
+    dense_.pop_back();
+    sparse_[slot] = npos;
+  }
+
+  void clear() {
+    for (const EntityHandle::Slot slot : dense_)
+      sparse_[slot] = npos;
+    dense_.clear();
+  }
+
+  [[nodiscard]] std::size_t size() const { return dense_.size(); }
+  [[nodiscard]] bool empty() const { return dense_.empty(); }
+  [[nodiscard]] const std::vector<EntityHandle::Slot> &slots() const {
+    return dense_;
+  }
+
+private:
+  std::vector<EntityHandle::Slot> dense_;
+  std::vector<std::uint32_t> sparse_;
+};
+
+// Per-component and per-tag membership of a collection's merged entities.
+//
+// An index exists only once something asked for it (EntityQuery's
+// whereHasComponent/whereHasTag, through EntityCollection::component_index /
+// tag_index); from then on Entity and EntityCollection keep it current, and
+// every other component or tag costs nothing.
+struct EntityIndexes {
+  using TagSet = std::bitset<AFTER_HOURS_MAX_ENTITY_TAGS>;
+
+  std::array<std::unique_ptr<SlotSet>, max_num_components> components;
+  std::array<std::unique_ptr<SlotSet>, AFTER_HOURS_MAX_ENTITY_TAGS> tags;
+  std::bitset<max_num_components> indexed_components;
+  TagSet indexed_tags;
+
+  void on_component(const EntityHandle::Slot slot, const ComponentID id,
+                    const bool present) {
+    if (!indexed_components.test(id))
+      return;
+    if (present)
+      components[id]->insert(slot);
+    else
+      components[id]->erase(slot);
+  }
+
+  void on_tag(const EntityHandle::Slot slot, const std::size_t tag,
+              const bool present) {
+    if (!indexed_tags.test(tag))
+      return;
+    if (present)
+      tags[tag]->insert(slot);
+    else
+      tags[tag]->erase(slot);
+  }
+
+  void on_merge(const EntityHandle::Slot slot,
+                const std::bitset<max_num_components> &component_set,
+                const TagSet &tag_set) {
+    for_each_bit(component_set & indexed_components,
+                 [&](const std::size_t id) { components[id]->insert(slot); });
+    for_each_bit(tag_set & indexed_tags,
+                 [&](const std::size_t tag) { tags[tag]->insert(slot); });
+  }
+
+  void on_remove(const EntityHandle::Slot slot) {
+    for_each_bit(indexed_components,
+                 [&](const std::size_t id) { components[id]->erase(slot); });
+    for_each_bit(indexed_tags,
+                 [&](const std::size_t tag) { tags[tag]->erase(slot); });
+  }
+
+  void clear() {
+    for_each_bit(indexed_components,
+                 [&](const std::size_t id) { components[id]->clear(); });
+    for_each_bit(indexed_tags,
+                 [&](const std::size_t tag) { tags[tag]->clear(); });
+  }
+
+private:
+  template <std::size_t N, typename Fn>
+  static void for_each_bit(const std::bitset<N> &bits, Fn &&fn) {
+    if (bits.none())
+      return;
+    for (std::size_t i = 0; i < N; ++i) {
+      if (bits.test(i))
+        fn(i);
+    }
+  }
+};
+
+} // namespace afterhours
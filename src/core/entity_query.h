@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <memory>
@@ -12,6 +14,8 @@
 #include "../logging.h"
 #include "entity.h"
 #include "entity_helper.h"
+#include "entity_index.h"
+#include "worker_pool.h"
 
 // Opt-in via config.h (AFTER_HOURS_ENABLE_RANDOM): seedable, unbiased
 // gen_random(). Off => plain rand().
@@ -132,6 +136,7 @@ struct EntityQuery {
     }
   };
   template <typename T> auto &whereHasComponent() {
+    index_components.set(components::get_type_id<T>());
     return add_mod(new WhereHasComponent<T>());
   }
   template <typename T> auto &whereMissingComponent() {
@@ -157,7 +162,10 @@ struct EntityQuery {
       return entity.hasTag(id);
     }
   };
-  TReturn &whereHasTag(const TagId id) { return add_mod(new WhereHasTag(id)); }
+  TReturn &whereHasTag(const TagId id) {
+    note_index_tag(id);
+    return add_mod(new WhereHasTag(id));
+  }
 
   struct WhereHasAllTags : Modification {
     TagBitset mask;
@@ -167,6 +175,7 @@ struct EntityQuery {
     }
   };
   TReturn &whereHasAllTags(const TagBitset &mask) {
+    index_tags |= mask;
     return add_mod(new WhereHasAllTags(mask));
   }
 
@@ -250,6 +259,7 @@ struct EntityQuery {
   }
 
   template <typename T> auto &whereHasComponent() {
+    index_components.set(components::get_type_id<T>());
     return add_filter([](const Entity &e) { return e.has<T>(); });
   }
   template <typename T> auto &whereMissingComponent() {
@@ -261,10 +271,12 @@ struct EntityQuery {
   }
 
   TReturn &whereHasTag(const TagId id) {
+    note_index_tag(id);
     return add_filter([id](const Entity &e) { return e.hasTag(id); });
   }
 
   TReturn &whereHasAllTags(const TagBitset &mask) {
+    index_tags |= mask;
     return add_filter([mask](const Entity &e) { return e.hasAllTags(mask); });
   }
 
@@ -378,6 +390,34 @@ struct EntityQuery {
     return ents;
   }
 
+  // Append the matches to `out`, e.g. a FrameRefEntities, so the result
+  // takes no heap memory. Doesn't fill the query's own cache.
+  template <typename Out> void gen_into(Out &out) const {
+    if (ran_query) {
+      out.insert(out.end(), ents.begin(), ents.end());
+      return;
+    }
+    const std::size_t first = out.size();
+    visit_matches([&](Entity &e) {
+      out.push_back(e);
+      return true;
+    });
+    if (orderby && out.size() - first > 1) {
+      std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end(),
+                [&](const Entity &a, const Entity &b) {
+                  return (*orderby)(a, b);
+                });
+    }
+  }
+
+  // gen() into the calling thread's frame arena; valid until the frame ends.
+  [[nodiscard]] FrameRefEntities gen_frame() const {
+    FrameRefEntities out;
+    out.reserve(mods.empty() ? entities.size() : entities.size() / 2);
+    gen_into(out);
+    return out;
+  }
+
   template <typename Fn> void for_each(Fn &&fn) const {
     for (Entity &entity : gen()) {
       std::invoke(std::forward<Fn>(fn), entity);
@@ -393,20 +433,10 @@ struct EntityQuery {
       }
       return;
     }
-    for (const auto &e_ptr : entities) {
-      if (!e_ptr)
-        continue;
-      Entity &e = *e_ptr;
-      bool ok = true;
-      for (const auto &mod : mods) {
-        if (!mod(e)) {
-          ok = false;
-          break;
-        }
-      }
-      if (ok)
-        std::invoke(fn, e);
-    }
+    visit_matches([&](Entity &e) {
+      std::invoke(fn, e);
+      return true;
+    });
   }
 
   template <typename Component>
@@ -531,7 +561,8 @@ struct EntityQuery {
 
   explicit EntityQuery(EntityCollection &collection,
                        const QueryOptions &options = {})
-      : entities(init_entities_ref(collection, options)) {
+      : entities(init_entities_ref(collection, options)),
+        collection_(&collection) {
     const size_t size = collection.get_temp().size();
     if (size == 0)
       return;
@@ -556,6 +587,97 @@ struct EntityQuery {
 
 private:
   const Entities &entities;
+  // Set when querying a collection (rather than a bare entity list); its
+  // component/tag indexes can then narrow the scan.
+  EntityCollection *collection_ = nullptr;
+  // Components and tags every match must have, from whereHasComponent /
+  // whereHasTag / whereHasAllTags.
+  ComponentBitSet index_components;
+  TagBitset index_tags;
+
+  void note_index_tag(const TagId id) {
+    if (id < AFTER_HOURS_MAX_ENTITY_TAGS)
+      index_tags.set(id);
+  }
+
+  // An index only pays off once it rules out most of the list: the
+  // candidates have to be sorted back into list order.
+  static constexpr std::size_t index_min_ratio = 4;
+
+  // The smallest index over the required components and tags, if it is small
+  // enough to beat a linear scan. Building an index or the slot->position
+  // table writes to the collection, so parallel system jobs always scan.
+  [[nodiscard]] const SlotSet *narrowest_index() const {
+    if (!collection_ || (index_components.none() && index_tags.none()))
+      return nullptr;
+    if (WorkerPool::in_job())
+      return nullptr;
+    const SlotSet *best = nullptr;
+    for (std::size_t id = 0; id < index_components.size(); ++id) {
+      if (!index_components.test(id))
+        continue;
+      const SlotSet &set =
+          collection_->component_index(static_cast<ComponentID>(id));
+      if (!best || set.size() < best->size())
+        best = &set;
+    }
+    for (std::size_t tag = 0; tag < index_tags.size(); ++tag) {
+      if (!index_tags.test(tag))
+        continue;
+      const SlotSet &set = collection_->tag_index(static_cast<TagId>(tag));
+      if (!best || set.size() < best->size())
+        best = &set;
+    }
+    if (best && best->size() * index_min_ratio > entities.size())
+      return nullptr;
+    return best;
+  }
+
+  // Call `fn(Entity&)` for each entity passing every filter, in list order,
+  // until it returns false.
+  template <typename Fn> void visit_matches(Fn &&fn) const {
+    const auto passes = [&](const Entity &e) {
+      for (const auto &mod : mods) {
+        if (!mod(e))
+          return false;
+      }
+      return true;
+    };
+
+    if (const SlotSet *index = narrowest_index()) {
+      // Inside a SystemManager frame the sorted positions are frame scratch.
+      if (detail::current_frame_arena()) {
+        FrameVector<std::uint32_t> positions;
+        visit_index(*index, positions, passes, fn);
+      } else {
+        std::vector<std::uint32_t> positions;
+        visit_index(*index, positions, passes, fn);
+      }
+      return;
+    }
+
+    for (const auto &e_ptr : entities) {
+      if (e_ptr && passes(*e_ptr) && !fn(*e_ptr))
+        return;
+    }
+  }
+
+  template <typename Positions, typename Passes, typename Fn>
+  void visit_index(const SlotSet &index, Positions &positions,
+                   const Passes &passes, Fn &fn) const {
+    positions.reserve(index.size());
+    for (const EntityHandle::Slot slot : index.slots()) {
+      const std::uint32_t pos = collection_->position_of_slot(slot);
+      if (pos < entities.size())
+        positions.push_back(pos);
+    }
+    std::sort(positions.begin(), positions.end());
+    for (const std::uint32_t pos : positions) {
+      const auto &e_ptr = entities[pos];
+      if (e_ptr && passes(*e_ptr) && !fn(*e_ptr))
+        return;
+    }
+  }
 
   // Helper to initialize the entities reference in the constructor.
   // If force_merge is requested, merge first, then return the (now-updated)
@@ -578,43 +700,21 @@ private:
     // to return the first match), we can short-circuit as long as we aren't
     // ordering results. No upfront allocation needed.
     if (options.stop_on_first && !orderby) {
-      for (const auto &e_ptr : entities) {
-        if (!e_ptr)
-          continue;
-        const Entity &e = *e_ptr;
-        bool ok = true;
-        for (const auto &mod : mods) {
-          if (!mod(e)) {
-            ok = false;
-            break;
-          }
-        }
-        if (ok) {
-          RefEntities result;
-          result.push_back(const_cast<Entity &>(e));
-          return result;
-        }
-      }
-      return {};
+      RefEntities result;
+      visit_matches([&](Entity &e) {
+        result.push_back(e);
+        return false;
+      });
+      return result;
     }
 
     RefEntities out;
     out.reserve(mods.empty() ? entities.size() : entities.size() / 2);
 
-    for (const auto &e_ptr : entities) {
-      if (!e_ptr)
-        continue;
-      Entity &e = *e_ptr;
-      bool ok = true;
-      for (const auto &mod : mods) {
-        if (!mod(e)) {
-          ok = false;
-          break;
-        }
-      }
-      if (ok)
-        out.push_back(e);
-    }
+    visit_matches([&](Entity &e) {
+      out.push_back(e);
+      return true;
+    });
 
     if (orderby && out.size() > 1) {
       std::sort(out.begin(), out.end(), [&](const Entity &a, const Entity &b) {
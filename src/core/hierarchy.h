@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base_component.h"
+#include "entity.h"
+#include "entity_collection.h"
+#include "entity_handle.h"
+#include "entity_helper.h"
+#include "system.h"
+#include "../logging.h"
+
+namespace afterhours {
+
+// Parent/child links between entities, and world transforms worked out from
+// local ones down the tree.
+//
+//   set_parent(wheel, car);                  // both merged
+//   wheel.get_mut<LocalTransform>().value.x = 12.f;
+//   ...
+//   sm.register_update_system(std::make_unique<PropagateTransforms>());
+//
+// PropagateTransforms recomputes an entity's WorldTransform only when its
+// LocalTransform changed (get_mut / mark_changed), its parent link changed,
+// or an ancestor's world transform changed; untouched subtrees cost one
+// check per entity.
+
+// Translation, rotation (radians) and scale in 2D.
+struct Transform2D {
+  float x = 0.f;
+  float y = 0.f;
+  float rotation = 0.f;
+  float scale_x = 1.f;
+  float scale_y = 1.f;
+
+  // `child` (given relative to this) in this transform's frame. Scale is
+  // applied per axis before rotation, so a non-uniformly scaled parent
+  // doesn't skew a rotated child.
+  [[nodiscard]] Transform2D then(const Transform2D &child) const {
+    const float cx = child.x * scale_x;
+    const float cy = child.y * scale_y;
+    const float c = std::cos(rotation);
+    const float s = std::sin(rotation);
+    return {.x = x + cx * c - cy * s,
+            .y = y + cx * s + cy * c,
+            .rotation = rotation + child.rotation,
+            .scale_x = scale_x * child.scale_x,
+            .scale_y = scale_y * child.scale_y};
+  }
+};
+
+// Relative to the parent, or to the world for an entity without one. Mark
+// it changed after editing so PropagateTransforms picks it up.
+struct LocalTransform : BaseComponent {
+  Transform2D value;
+
+  LocalTransform() = default;
+  explicit LocalTransform(const Transform2D &t) : value(t) {}
+};
+
+// Written by PropagateTransforms, and marked changed when it moves.
+struct WorldTransform : BaseComponent {
+  Transform2D value;
+};
+
+struct Parent : BaseComponent {
+  EntityHandle entity = EntityHandle::invalid();
+};
+
+// In the order they were attached.
+struct Children : BaseComponent {
+  std::vector<EntityHandle> entities;
+};
+
+// Make `child` a child of `parent`, moving it from any previous parent.
+// Both must be merged (they need handles). Refuses, with a warning, to
+// parent an entity to itself or to one of its descendants.
+inline bool set_parent(Entity &child, Entity &parent) {
+  EntityCollection &coll = EntityHelper::get_default_collection();
+  const EntityHandle child_h = coll.handle_for(child);
+  const EntityHandle parent_h = coll.handle_for(parent);
+  if (!child_h.valid() || !parent_h.valid()) {
+    log_warn("set_parent: entity {} or {} isn't merged yet", child.id,
+             parent.id);
+    return false;
+  }
+  for (const Entity *e = &parent; e;) {
+    if (e == &child) {
+      log_warn("set_parent: entity {} is {} or one of its ancestors",
+               child.id, parent.id);
+      return false;
+    }
+    if (!e->has<Parent>())
+      break;
+    const OptEntity up = coll.resolve(e->get<Parent>().entity);
+    e = up ? &up.asE() : nullptr;
+  }
+
+  if (child.has<Parent>()) {
+    if (OptEntity old = coll.resolve(child.get<Parent>().entity);
+        old && old.asE().has<Children>())
+      std::erase_if(old.asE().get<Children>().entities,
+                    [&](const EntityHandle h) {
+                      return h.slot == child_h.slot && h.gen == child_h.gen;
+                    });
+    child.get_mut<Parent>().entity = parent_h;
+  } else {
+    child.addComponent<Parent>().entity = parent_h;
+  }
+  if (!parent.has<Children>())
+    parent.addComponent<Children>();
+  parent.get<Children>().entities.push_back(child_h);
+  return true;
+}
+
+// Make `child` a root again.
+inline void detach(Entity &child) {
+  if (!child.has<Parent>())
+    return;
+  EntityCollection &coll = EntityHelper::get_default_collection();
+  const EntityHandle child_h = coll.handle_for(child);
+  if (OptEntity old = coll.resolve(child.get<Parent>().entity);
+      old && old.asE().has<Children>())
+    std::erase_if(old.asE().get<Children>().entities,
+                  [&](const EntityHandle h) {
+                    return h.slot == child_h.slot && h.gen == child_h.gen;
+                  });
+  child.removeComponent<Parent>();
+}
+
+// Writes WorldTransform for every entity with a LocalTransform. Entities
+// are kept in dense arrays sorted by depth, so parents come before their
+// children and a parent's world transform is read from the array rather
+// than through its entity. The arrays are rebuilt only when the set of
+// entities or a parent link changes.
+//
+// An entity whose parent is gone, or has no LocalTransform, is a root.
+struct PropagateTransforms : System<LocalTransform> {
+  bool should_iterate() const override { return false; }
+
+  void once(float) override {
+    EntityCollection &coll = EntityHelper::get_default_collection();
+    const std::vector<std::uint32_t> *positions = synced_matches(coll);
+    if (!positions)
+      return;
+    if (match_cache.generation != built_generation_)
+      rebuild(coll, *positions);
+    if (!propagate(true)) {
+      rebuild(coll, *positions);
+      propagate(false);
+    }
+  }
+
+  // Entities in the order of the last pass.
+  [[nodiscard]] std::size_t size() const { return nodes_.size(); }
+  // How many world transforms the last pass recomputed.
+  [[nodiscard]] std::size_t recomputed() const { return recomputed_; }
+
+private:
+  static constexpr std::uint32_t no_parent = 0xffffffffu;
+
+  std::vector<Entity *> nodes_;
+  std::vector<std::uint32_t> parents_;
+  std::vector<Transform2D> worlds_;
+  std::vector<std::uint8_t> forced_;
+  std::vector<std::uint8_t> dirty_;
+  std::uint64_t built_generation_ = 0;
+  std::size_t recomputed_ = 0;
+
+  // Scratch for rebuild(), kept so rebuilding doesn't allocate once the
+  // arrays have grown.
+  std::vector<Entity *> listed_;
+  std::vector<std::uint32_t> node_of_slot_;
+  std::vector<std::uint32_t> parent_of_;
+  std::vector<std::uint8_t> orphaned_;
+  std::vector<std::uint32_t> depth_;
+  std::vector<std::uint32_t> walk_;
+  std::vector<std::uint32_t> start_;
+  std::vector<std::uint32_t> index_of_;
+
+  [[nodiscard]] bool link_changed(const Entity &e) const {
+    const ComponentID id = components::get_type_id<Parent>();
+    return e.changed_tick(id) > last_run_tick ||
+           e.removed_tick(id) > last_run_tick;
+  }
+
+  // One top-down pass. With `stop_on_relink`, gives up (returning false)
+  // at the first parent link changed since the arrays were built.
+  bool propagate(const bool stop_on_relink) {
+    const ComponentID local_id = components::get_type_id<LocalTransform>();
+    recomputed_ = 0;
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+      Entity &e = *nodes_[i];
+      const bool relinked = link_changed(e);
+      if (relinked && stop_on_relink)
+        return false;
+      const std::uint32_t p = parents_[i];
+      const bool dirty = forced_[i] || relinked ||
+                         e.changed_tick(local_id) > last_run_tick ||
+                         (p != no_parent && dirty_[p]);
+      dirty_[i] = dirty;
+      if (!dirty)
+        continue;
+      const Transform2D &local = e.get<LocalTransform>().value;
+      worlds_[i] = p == no_parent ? local : worlds_[p].then(local);
+      if (!e.has<WorldTransform>())
+        e.addComponent<WorldTransform>();
+      e.get_mut<WorldTransform>().value = worlds_[i];
+      ++recomputed_;
+    }
+    std::fill(forced_.begin(), forced_.end(), 0);
+    return true;
+  }
+
+  void rebuild(EntityCollection &coll,
+               const std::vector<std::uint32_t> &positions) {
+    const Entities &entities = coll.get_entities();
+    const std::size_t n = positions.size();
+    built_generation_ = match_cache.generation;
+
+    // Entities and parents, in list order.
+    std::vector<Entity *> &listed = listed_;
+    listed.clear();
+    node_of_slot_.clear();
+    for (const std::uint32_t pos : positions) {
+      Entity &e = *entities[pos];
+      if (e.ah_slot_index != EntityHandle::INVALID_SLOT) {
+        if (e.ah_slot_index >= node_of_slot_.size())
+          node_of_slot_.resize(e.ah_slot_index + 1, no_parent);
+        node_of_slot_[e.ah_slot_index] =
+            static_cast<std::uint32_t>(listed.size());
+      }
+      listed.push_back(&e);
+    }
+    std::vector<std::uint32_t> &parent_of = parent_of_;
+    std::vector<std::uint8_t> &orphaned = orphaned_;
+    parent_of.assign(n, no_parent);
+    orphaned.assign(n, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+      const Entity &e = *listed[i];
+      if (!e.has<Parent>())
+        continue;
+      const OptEntity parent = coll.resolve(e.get<Parent>().entity);
+      const std::uint32_t slot = parent ? parent.asE().ah_slot_index
+                                        : EntityHandle::INVALID_SLOT;
+      if (slot < node_of_slot_.size() && node_of_slot_[slot] != no_parent)
+        parent_of[i] = node_of_slot_[slot];
+      else
+        orphaned[i] = 1;
+    }
+
+    // Depth of each, walking up; a cycle (only possible by editing Parent
+    // directly) is cut where it was found.
+    constexpr std::uint32_t unknown = 0xffffffffu;
+    constexpr std::uint32_t visiting = 0xfffffffeu;
+    depth_.assign(n, unknown);
+    std::uint32_t max_depth = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      std::size_t at = i;
+      walk_.clear();
+      while (depth_[at] == unknown) {
+        depth_[at] = visiting;
+        walk_.push_back(static_cast<std::uint32_t>(at));
+        if (parent_of[at] == no_parent)
+          break;
+        if (depth_[parent_of[at]] == visiting) {
+          log_warn("PropagateTransforms: entity {} is its own ancestor",
+                   listed[at]->id);
+          parent_of[at] = no_parent;
+          break;
+        }
+        at = parent_of[at];
+      }
+      // walk_ runs child to ancestor; fill in from the top.
+      for (std::size_t k = walk_.size(); k-- > 0;) {
+        const std::uint32_t node = walk_[k];
+        const std::uint32_t p = parent_of[node];
+        depth_[node] = p == no_parent ? 0 : depth_[p] + 1;
+        max_depth = std::max(max_depth, depth_[node]);
+      }
+    }
+
+    // Counting sort by depth; list order within a depth.
+    std::vector<std::uint32_t> &start = start_;
+    start.assign(max_depth + 2, 0);
+    for (std::size_t i = 0; i < n; ++i)
+      ++start[depth_[i] + 1];
+    for (std::size_t d = 1; d < start.size(); ++d)
+      start[d] += start[d - 1];
+    std::vector<std::uint32_t> &index_of = index_of_;
+    index_of.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+      index_of[i] = start[depth_[i]]++;
+
+    nodes_.assign(n, nullptr);
+    parents_.assign(n, no_parent);
+    worlds_.assign(n, Transform2D{});
+    forced_.assign(n, 0);
+    dirty_.assign(n, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::uint32_t at = index_of[i];
+      Entity &e = *listed[i];
+      nodes_[at] = &e;
+      parents_[at] =
+          parent_of[i] == no_parent ? no_parent : index_of[parent_of[i]];
+      const bool has_world = e.has<WorldTransform>();
+      if (has_world)
+        worlds_[at] = e.get<WorldTransform>().value;
+      forced_[at] = orphaned[i] || !has_world;
+    }
+  }
+};
+
+} // namespace afterhours
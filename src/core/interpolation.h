@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "base_component.h"
+#include "entity.h"
+#include "pointer_policy.h"
+
+namespace afterhours {
+
+// Fixed-step state for render interpolation. For each component type handed
+// to SystemManager::keep_previous<T>(), the manager copies every entity's T
+// into its Previous<T> just before each fixed step, so a render system can
+// draw between the last two steps:
+//
+//   template <> struct is_plain_component<Transform> : std::true_type {};
+//   systems.keep_previous<Transform>();   // once, at startup
+//
+//   void for_each_with(const Entity &e, const Transform &t,
+//                      float) const override {
+//     const float a = interpolation_alpha();
+//     const vec2 at = lerp(previous<Transform>(e).position, t.position, a);
+//     ...
+//   }
+
+// What T was before the latest fixed step.
+template <typename T> struct Previous : BaseComponent {
+  T value{};
+};
+
+namespace detail {
+inline float &current_interpolation_alpha() {
+  thread_local float alpha = 1.f;
+  return alpha;
+}
+
+// Copy the component's own fields: everything after the BaseComponent
+// header (vtable pointer and change ticks).
+template <typename T> void copy_payload(const T &from, T &to) {
+  static_assert(is_plain_component<T>::value,
+                "copy_payload<T> needs T to opt in via is_plain_component");
+  static_assert_pointer_free_types<T>();
+  constexpr std::size_t header = sizeof(BaseComponent);
+  std::memcpy(reinterpret_cast<std::byte *>(&to) + header,
+              reinterpret_cast<const std::byte *>(&from) + header,
+              sizeof(T) - header);
+}
+
+struct ScopedInterpolationAlpha {
+  float previous = current_interpolation_alpha();
+  explicit ScopedInterpolationAlpha(const float alpha) {
+    current_interpolation_alpha() = alpha;
+  }
+  ~ScopedInterpolationAlpha() { current_interpolation_alpha() = previous; }
+  ScopedInterpolationAlpha(const ScopedInterpolationAlpha &) = delete;
+  ScopedInterpolationAlpha &
+  operator=(const ScopedInterpolationAlpha &) = delete;
+};
+} // namespace detail
+
+// How far, in [0, 1), the frame being rendered sits between the last fixed
+// step and the next one (SystemManager::fixed_alpha). Set while render
+// systems run; 1 elsewhere, so outside a render the current state wins.
+[[nodiscard]] inline float interpolation_alpha() {
+  return detail::current_interpolation_alpha();
+}
+
+// The entity's T as of the previous fixed step, or its current T when it
+// has none yet (it appeared since the last step, or T isn't kept).
+template <typename T> [[nodiscard]] const T &previous(const Entity &entity) {
+  if (entity.has<Previous<T>>())
+    return entity.get<Previous<T>>().value;
+  return entity.get<T>();
+}
+
+} // namespace afterhours
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base_component.h"
+#include "entity.h"
+#include "entity_collection.h"
+
+namespace afterhours {
+
+// Positions (into a collection's merged entity list) of every entity whose
+// component signature contains `required` and none of `forbidden`, and whose
+// tags pass the (optional) tag masks.
+//
+// sync() keeps it current without rescanning: it re-tests only the entities
+// the collection's SignatureJournal says changed (components or tags), and
+// scans only what was appended since last time. Removals and reorders reset
+// the journal, which costs one full rebuild.
+struct EntityMatchCache {
+  ComponentBitSet required;
+  ComponentBitSet forbidden;
+  TagBitset all_tags;
+  TagBitset any_tags;
+  TagBitset no_tags;
+
+  // Sorted, so iterating it visits entities in list order.
+  std::vector<std::uint32_t> positions;
+
+  const EntityCollection *collection = nullptr;
+  std::uint64_t epoch = 0;
+  // Bumped whenever `positions` changes.
+  std::uint64_t generation = 0;
+  std::size_t journal_cursor = 0;
+  std::size_t synced_count = 0;
+
+  [[nodiscard]] bool matches(const Entity &entity) const {
+    return (entity.componentSet & required) == required &&
+           (entity.componentSet & forbidden).none() &&
+           (entity.tags & all_tags) == all_tags &&
+           (any_tags.none() || (entity.tags & any_tags).any()) &&
+           (entity.tags & no_tags).none();
+  }
+
+  void sync(EntityCollection &source) {
+    const Entities &entities = source.get_entities();
+    const SignatureJournal &journal = source.signature_journal();
+
+    // Shrinking without a journal reset means someone edited the list
+    // directly; don't trust anything we have.
+    if (collection != &source || epoch != journal.epoch ||
+        journal_cursor < journal.base || entities.size() < synced_count) {
+      rebuild(source);
+      return;
+    }
+
+    for (std::size_t i = journal_cursor; i < journal.end(); ++i) {
+      const std::uint32_t pos = source.position_of_slot(journal.at(i));
+      // Entities past synced_count are covered by the tail scan below.
+      if (pos >= synced_count || !entities[pos])
+        continue;
+      const bool match = matches(*entities[pos]);
+      const auto it = std::lower_bound(positions.begin(), positions.end(), pos);
+      const bool present = it != positions.end() && *it == pos;
+      if (match && !present) {
+        positions.insert(it, pos);
+        ++generation;
+      } else if (!match && present) {
+        positions.erase(it);
+        ++generation;
+      }
+    }
+    journal_cursor = journal.end();
+
+    append_tail(entities);
+  }
+
+  void rebuild(EntityCollection &source) {
+    const SignatureJournal &journal = source.signature_journal();
+    collection = &source;
+    epoch = journal.epoch;
+    journal_cursor = journal.end();
+    synced_count = 0;
+    positions.clear();
+    ++generation;
+    append_tail(source.get_entities());
+  }
+
+private:
+  void append_tail(const Entities &entities) {
+    for (std::size_t i = synced_count; i < entities.size(); ++i) {
+      if (entities[i] && matches(*entities[i])) {
+        positions.push_back(static_cast<std::uint32_t>(i));
+        ++generation;
+      }
+    }
+    synced_count = entities.size();
+  }
+};
+
+} // namespace afterhours
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "base_component.h"
+#include "entity.h"
+
+namespace afterhours {
+
+// Negation wrapper for component queries
+template<typename T>
+struct Not {};
+
+// Access declarations: System<Read<A>, Write<B>> is handed `const A &` and
+// `B &`. A system whose components are all declared this way promises its
+// for_each_with only touches those components of the entity it was given, so
+// SystemManager may split it across worker threads and run it alongside
+// systems it doesn't conflict with (see SystemManager::set_worker_count).
+template<typename T>
+struct Read {};
+template<typename T>
+struct Write {};
+
+// Change filters, checked against the tick a system last ran at (see
+// Entity::mark_changed). Added<T> and Changed<T> also require T; Removed<T>
+// matches entities that lost T since then. They only filter: list T as well
+// to have it passed to for_each_with.
+template<typename T>
+struct Added {};
+template<typename T>
+struct Changed {};
+template<typename T>
+struct Removed {};
+
+namespace tags {
+template<auto... TagEnums>
+struct All {};
+template<auto... TagEnums>
+struct Any {};
+template<auto... TagEnums>
+struct None {};
+}  // namespace tags
+
+template<typename... Ts>
+struct type_list {};
+
+template<typename List, typename T>
+struct list_prepend;
+template<typename... Ts, typename T>
+struct list_prepend<type_list<Ts...>, T> {
+    using type = type_list<T, Ts...>;
+};
+
+template<typename T, typename Enable = void>
+struct is_component : std::false_type {};
+template<typename T>
+struct is_component<T, std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
+    : std::true_type {};
+
+// Support for Not<T> negation
+template<typename T>
+struct is_component<Not<T>,
+                    std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
+    : std::true_type {};
+template<typename T>
+struct is_component<Read<T>,
+                    std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
+    : std::true_type {};
+template<typename T>
+struct is_component<Write<T>,
+                    std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
+    : std::true_type {};
+
+template<typename T>
+struct is_read_component : std::false_type {};
+template<typename T>
+struct is_read_component<Read<T>> : std::true_type {};
+
+template<typename T>
+struct is_write_component : std::false_type {};
+template<typename T>
+struct is_write_component<Write<T>> : std::true_type {};
+
+// Read<T> / Write<T> / T -> the component type T.
+template<typename T>
+struct unwrap_access {
+    using type = T;
+};
+template<typename T>
+struct unwrap_access<Read<T>> {
+    using type = T;
+};
+template<typename T>
+struct unwrap_access<Write<T>> {
+    using type = T;
+};
+
+// What for_each_with receives for each listed component: Read<T> becomes
+// const T, everything else its component type.
+template<typename T>
+struct for_each_arg {
+    using type = typename unwrap_access<T>::type;
+};
+template<typename T>
+struct for_each_arg<Read<T>> {
+    using type = const T;
+};
+
+// Helper to detect Not<T> types
+template<typename T>
+struct is_not_component : std::false_type {};
+
+template<typename T>
+struct is_not_component<Not<T>> : std::true_type {};
+
+template<typename T>
+struct is_tag_type : std::false_type {};
+template<auto... Es>
+struct is_tag_type<tags::All<Es...>> : std::true_type {};
+template<auto... Es>
+struct is_tag_type<tags::Any<Es...>> : std::true_type {};
+template<auto... Es>
+struct is_tag_type<tags::None<Es...>> : std::true_type {};
+
+template<typename T>
+struct is_added_filter : std::false_type {};
+template<typename T>
+struct is_added_filter<Added<T>> : std::true_type {};
+template<typename T>
+struct is_changed_filter : std::false_type {};
+template<typename T>
+struct is_changed_filter<Changed<T>> : std::true_type {};
+template<typename T>
+struct is_removed_filter : std::false_type {};
+template<typename T>
+struct is_removed_filter<Removed<T>> : std::true_type {};
+template<typename T>
+struct is_change_filter
+    : std::bool_constant<is_added_filter<T>::value ||
+                         is_changed_filter<T>::value ||
+                         is_removed_filter<T>::value> {};
+
+// Added<T> / Changed<T> / Removed<T> -> T.
+template<typename T>
+struct unwrap_change {
+    using type = T;
+};
+template<typename T>
+struct unwrap_change<Added<T>> {
+    using type = T;
+};
+template<typename T>
+struct unwrap_change<Changed<T>> {
+    using type = T;
+};
+template<typename T>
+struct unwrap_change<Removed<T>> {
+    using type = T;
+};
+
+// Helper to unwrap Not<T> to get T
+template<typename T>
+struct unwrap_not {
+    using type = T;
+};
+
+template<typename T>
+struct unwrap_not<Not<T>> {
+    using type = T;
+};
+
+template<typename...>
+struct filter_components;
+template<>
+struct filter_components<> {
+    using type = type_list<>;
+};
+template<typename T, typename... Rest>
+struct filter_components<T, Rest...> {
+    using prev = typename filter_components<Rest...>::type;
+    using type = std::conditional_t<
+        is_component<T>::value && !is_not_component<T>::value,
+        typename list_prepend<prev, typename for_each_arg<T>::type>::type,
+        prev>;
+};
+
+// Tag mask named by a tags::All/Any/None term; empty for anything else.
+template<template<auto...> typename Kind, typename T>
+struct tag_mask {
+    static TagBitset value() { return {}; }
+};
+template<template<auto...> typename Kind, auto... Es>
+struct tag_mask<Kind, Kind<Es...>> {
+    static TagBitset value() {
+        TagBitset m;
+        (m.set(static_cast<TagId>(Es)), ...);
+        return m;
+    }
+};
+
+// What an entity must look like to match a list of terms: components (plain,
+// Read<T> or Write<T>) it must have, Not<T> it must lack, and
+// tags::All/Any/None. Shared by System<...> and query<...>(). Masks are built
+// once per term list.
+template<typename... Terms>
+struct Signature {
+    static constexpr bool has_not_requirements =
+        (is_not_component<Terms>::value || ...);
+    static constexpr bool has_tag_requirements =
+        (is_tag_type<Terms>::value || ...);
+    static constexpr bool has_change_filters =
+        (is_change_filter<Terms>::value || ...);
+
+    static const ComponentBitSet &required_components() {
+        static const ComponentBitSet m = [] {
+            ComponentBitSet required;
+            (add_required<Terms>(required), ...);
+            return required;
+        }();
+        return m;
+    }
+
+    static const ComponentBitSet &forbidden_components() {
+        static const ComponentBitSet m = [] {
+            ComponentBitSet forbidden;
+            (add_forbidden<Terms>(forbidden), ...);
+            return forbidden;
+        }();
+        return m;
+    }
+
+    static const TagBitset &required_all_mask() {
+        static const TagBitset m =
+            (TagBitset{} | ... | tag_mask<tags::All, Terms>::value());
+        return m;
+    }
+
+    static const TagBitset &required_any_mask() {
+        static const TagBitset m =
+            (TagBitset{} | ... | tag_mask<tags::Any, Terms>::value());
+        return m;
+    }
+
+    static const TagBitset &forbidden_mask() {
+        static const TagBitset m =
+            (TagBitset{} | ... | tag_mask<tags::None, Terms>::value());
+        return m;
+    }
+
+    static bool components_ok(const Entity &entity) {
+        const ComponentBitSet &required = required_components();
+        if ((entity.componentSet & required) != required) return false;
+        if constexpr (has_not_requirements) {
+            return (entity.componentSet & forbidden_components()).none();
+        }
+        return true;
+    }
+
+    static bool tags_ok(const Entity &entity) {
+        if constexpr (!has_tag_requirements) {
+            (void) entity;
+            return true;
+        } else {
+            const TagBitset &all = required_all_mask();
+            const TagBitset &any = required_any_mask();
+            const TagBitset &none = forbidden_mask();
+            if (all.any() && !entity.hasAllTags(all)) return false;
+            if (any.any() && !entity.hasAnyTag(any)) return false;
+            if (none.any() && !entity.hasNoTags(none)) return false;
+            return true;
+        }
+    }
+
+    // Added/Changed/Removed terms, against changes stamped after `since`.
+    static bool changes_ok(const Entity &entity, const std::uint32_t since) {
+        if constexpr (!has_change_filters) {
+            (void) entity;
+            (void) since;
+            return true;
+        } else {
+            return (change_ok<Terms>(entity, since) && ...);
+        }
+    }
+
+    static bool matches(const Entity &entity) {
+        return components_ok(entity) && tags_ok(entity);
+    }
+
+    static bool matches(const Entity &entity, const std::uint32_t since) {
+        return matches(entity) && changes_ok(entity, since);
+    }
+
+   private:
+    template<typename C>
+    static void add_required(ComponentBitSet &required) {
+        if constexpr (is_component<C>::value && !is_not_component<C>::value) {
+            required.set(
+                components::get_type_id<typename unwrap_access<C>::type>());
+        } else if constexpr (is_added_filter<C>::value ||
+                             is_changed_filter<C>::value) {
+            required.set(
+                components::get_type_id<typename unwrap_change<C>::type>());
+        }
+    }
+
+    template<typename C>
+    static bool change_ok(const Entity &entity, const std::uint32_t since) {
+        if constexpr (!is_change_filter<C>::value) {
+            return true;
+        } else {
+            const ComponentID id =
+                components::get_type_id<typename unwrap_change<C>::type>();
+            if constexpr (is_added_filter<C>::value) {
+                return entity.added_tick(id) > since;
+            } else if constexpr (is_changed_filter<C>::value) {
+                return entity.changed_tick(id) > since;
+            } else {
+                return entity.removed_tick(id) > since;
+            }
+        }
+    }
+
+    template<typename C>
+    static void add_forbidden(ComponentBitSet &forbidden) {
+        if constexpr (is_not_component<C>::value) {
+            forbidden.set(
+                components::get_type_id<typename unwrap_not<C>::type>());
+        }
+    }
+};
+
+}  // namespace afterhours
@@ -8,6 +8,8 @@
 #include "entity.h"
 #include "entity_helper.h"
 #include "pointer_policy.h"
+#include "snapshot_binary.h"
+#include "snapshot_delta.h"
 
 namespace afterhours::snapshot {
 
@@ -0,0 +1,830 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../logging.h"
+#include "../type_name.h"
+#include "base_component.h"
+#include "entity.h"
+#include "entity_collection.h"
+#include "entity_handle.h"
+#include "pointer_policy.h"
+
+namespace afterhours::snapshot {
+
+// Binary snapshots of a whole collection, for save games and rollback:
+//
+//   template <> struct is_plain_component<Transform> : std::true_type {};
+//   snapshot::register_component<Transform>();   // once, at startup
+//   snapshot::register_component<Inventory>(save_inventory, load_inventory);
+//
+//   std::vector<std::byte> frame;
+//   snapshot::save(collection, frame);           // reuses frame's capacity
+//   ...
+//   snapshot::restore(collection, frame);
+//
+// A snapshot holds the merged entities (id, type, tags, cleanup), every
+// registered component type as one column, and the handle store: restoring
+// puts every entity back in the slot it had, with the same generation, so
+// EntityHandles taken before the save resolve again afterwards and handles
+// to entities created after it go stale.
+//
+// Restoring reuses entities still sitting in their saved slot and overwrites
+// their components in place, so rolling back a few frames costs little more
+// than a copy. Components of types nobody registered are not saved and are
+// left alone on reused entities. Temp entities are not saved; merge first.
+//
+// The format follows this build's layout (the default codec copies bytes),
+// so a snapshot only loads into the same program on the same platform.
+// Columns are keyed by name, though, so adding or removing component types
+// between versions is fine.
+
+// Appends to a byte buffer. Codecs write their component with value() for
+// trivially copyable fields and string() for text.
+class Writer {
+public:
+  explicit Writer(std::vector<std::byte> &out) : out_(out) {}
+
+  void bytes(const void *data, const std::size_t size) {
+    const std::size_t at = out_.size();
+    out_.resize(at + size);
+    if (size > 0)
+      std::memcpy(out_.data() + at, data, size);
+  }
+
+  template <typename T> void value(const T &v) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "value() copies bytes; write the fields one by one");
+    bytes(&v, sizeof(T));
+  }
+
+  void string(const std::string_view s) {
+    value(static_cast<std::uint32_t>(s.size()));
+    bytes(s.data(), s.size());
+  }
+
+  // Room for `size` more bytes, to fill in place. Cheaper than many small
+  // writes for whole columns.
+  [[nodiscard]] std::byte *extend(const std::size_t size) {
+    const std::size_t at = out_.size();
+    out_.resize(at + size);
+    return out_.data() + at;
+  }
+
+  [[nodiscard]] std::size_t size() const { return out_.size(); }
+
+  // Overwrite a value written earlier at byte offset `at`.
+  template <typename T> void patch(const std::size_t at, const T &v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::memcpy(out_.data() + at, &v, sizeof(T));
+  }
+
+private:
+  std::vector<std::byte> &out_;
+};
+
+// Reads what a Writer wrote. Reading past the end sets failed() and yields
+// zeroes instead, so a codec can read everything and check once.
+class Reader {
+public:
+  explicit Reader(const std::span<const std::byte> data) : data_(data) {}
+
+  bool bytes(void *out, const std::size_t size) {
+    if (failed_ || size > data_.size() - pos_) {
+      failed_ = true;
+      if (size > 0)
+        std::memset(out, 0, size);
+      return false;
+    }
+    if (size > 0)
+      std::memcpy(out, data_.data() + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  template <typename T> bool value(T &v) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "value() copies bytes; read the fields one by one");
+    return bytes(&v, sizeof(T));
+  }
+
+  template <typename T> [[nodiscard]] T value() {
+    T v{};
+    value(v);
+    return v;
+  }
+
+  bool string(std::string &s) {
+    const auto size = value<std::uint32_t>();
+    if (failed_ || size > data_.size() - pos_) {
+      failed_ = true;
+      s.clear();
+      return false;
+    }
+    s.assign(reinterpret_cast<const char *>(data_.data() + pos_), size);
+    pos_ += size;
+    return true;
+  }
+
+  // A u32 element count, checked against what's left: each element takes at
+  // least `min_bytes_each`. Fails instead of sizing a vector off bad data.
+  [[nodiscard]] std::uint32_t count(const std::size_t min_bytes_each) {
+    const auto n = value<std::uint32_t>();
+    if (failed_ || std::size_t{n} * min_bytes_each > data_.size() - pos_) {
+      failed_ = true;
+      return 0;
+    }
+    return n;
+  }
+
+  // The next `size` bytes, skipped over.
+  [[nodiscard]] std::span<const std::byte> take(const std::size_t size) {
+    if (failed_ || size > data_.size() - pos_) {
+      failed_ = true;
+      return {};
+    }
+    const std::span<const std::byte> out = data_.subspan(pos_, size);
+    pos_ += size;
+    return out;
+  }
+
+  [[nodiscard]] bool failed() const { return failed_; }
+  [[nodiscard]] bool at_end() const { return pos_ == data_.size(); }
+
+private:
+  std::span<const std::byte> data_;
+  std::size_t pos_ = 0;
+  bool failed_ = false;
+};
+
+namespace detail {
+
+// Positions (in the entity list) of one column's rows.
+using Rows = std::vector<std::uint32_t>;
+
+struct ComponentCodec {
+  std::string name;
+  ComponentID id;
+  // Bytes per row for byte-copied (is_plain_component) components, 0 for
+  // codecs. Codec rows are each prefixed with their size, so a row can be
+  // found without loading.
+  std::uint32_t stride;
+  std::function<void(std::span<const Entity *const>, Writer &)> save;
+  // Adds the component to (or overwrites it on) each entity. False if the
+  // data doesn't fit.
+  std::function<bool(std::span<Entity *const>, Reader &)> load;
+};
+
+inline std::vector<ComponentCodec> &codecs() {
+  static std::vector<ComponentCodec> registered;
+  return registered;
+}
+
+inline ComponentCodec *find_codec(const std::string_view name) {
+  for (ComponentCodec &codec : codecs()) {
+    if (codec.name == name)
+      return &codec;
+  }
+  return nullptr;
+}
+
+inline const ComponentCodec *find_codec(const ComponentID id) {
+  for (const ComponentCodec &codec : codecs()) {
+    if (codec.id == id)
+      return &codec;
+  }
+  return nullptr;
+}
+
+inline void add_codec(ComponentCodec codec) {
+  if (ComponentCodec *existing = find_codec(codec.name)) {
+    log_warn("snapshot: component {} registered twice; keeping the last",
+             codec.name);
+    *existing = std::move(codec);
+    return;
+  }
+  codecs().push_back(std::move(codec));
+}
+
+// The component's own fields: everything after the BaseComponent header
+// (vtable pointer and change ticks, which belong to this process).
+template <typename T>
+inline constexpr std::size_t payload_size = sizeof(T) - sizeof(BaseComponent);
+
+inline std::byte *payload(BaseComponent &c) {
+  return reinterpret_cast<std::byte *>(&c) + sizeof(BaseComponent);
+}
+inline const std::byte *payload(const BaseComponent &c) {
+  return reinterpret_cast<const std::byte *>(&c) + sizeof(BaseComponent);
+}
+
+// The entity's T, which it has.
+template <typename T>
+const T &component_of(const Entity &e, const ComponentID id) {
+  return static_cast<const T &>(*e.componentArray[id]);
+}
+
+// The existing component, overwritten in place, or a fresh one. Either way
+// it counts as changed now.
+template <typename T> T &component_for_load(Entity &e, const ComponentID id) {
+  if (!e.componentSet.test(id))
+    return e.addComponent<T>();
+  BaseComponent &c = *e.componentArray[id];
+  c.ah_changed_tick = e.change_tick();
+  return static_cast<T &>(c);
+}
+
+template <typename V> void put(std::byte *&to, const V v) {
+  std::memcpy(to, &v, sizeof(V));
+  to += sizeof(V);
+}
+
+// Element `i` of a column of Vs read straight from the buffer.
+template <typename V>
+V get(const std::span<const std::byte> column, const std::size_t i) {
+  V v;
+  std::memcpy(&v, column.data() + i * sizeof(V), sizeof(V));
+  return v;
+}
+
+// Saved per entity: id, slot, entity_type, cleanup, tags.
+constexpr std::size_t entity_bytes = sizeof(EntityID) +
+                                     sizeof(EntityHandle::Slot) + sizeof(int) +
+                                     sizeof(std::uint8_t) + sizeof(TagBitset);
+
+constexpr std::uint32_t magic = 0x4e534841; // "AHSN"
+constexpr std::uint32_t version = 1;
+
+// Entity id state and the free lists, saved whole by snapshots and deltas.
+struct Ids {
+  bool own = false;
+  EntityID next = 0;
+  std::vector<EntityHandle::Slot> free_slots;
+  std::vector<EntityID> free_ids;
+  std::vector<EntityID> permanent;
+};
+
+inline void write_ids(const EntityCollection &collection, Writer &w) {
+  w.value(static_cast<std::uint8_t>(collection.own_entity_ids_));
+  w.value(collection.next_entity_id_);
+  w.value(static_cast<std::uint32_t>(collection.free_slots.size()));
+  w.bytes(collection.free_slots.data(),
+          collection.free_slots.size() * sizeof(EntityHandle::Slot));
+  w.value(static_cast<std::uint32_t>(collection.free_ids_.size()));
+  w.bytes(collection.free_ids_.data(),
+          collection.free_ids_.size() * sizeof(EntityID));
+  w.value(static_cast<std::uint32_t>(collection.permanant_ids.size()));
+  for (const int id : collection.permanant_ids)
+    w.value(static_cast<EntityID>(id));
+}
+
+inline void read_ids(Reader &in, Ids &ids) {
+  ids.own = in.value<std::uint8_t>() != 0;
+  ids.next = in.value<EntityID>();
+  ids.free_slots.resize(in.count(sizeof(EntityHandle::Slot)));
+  in.bytes(ids.free_slots.data(),
+           ids.free_slots.size() * sizeof(EntityHandle::Slot));
+  ids.free_ids.resize(in.count(sizeof(EntityID)));
+  in.bytes(ids.free_ids.data(), ids.free_ids.size() * sizeof(EntityID));
+  ids.permanent.resize(in.count(sizeof(EntityID)));
+  in.bytes(ids.permanent.data(), ids.permanent.size() * sizeof(EntityID));
+}
+
+inline bool free_slots_fit(const Ids &ids, const std::size_t slot_count) {
+  for (const EntityHandle::Slot slot : ids.free_slots) {
+    if (slot >= slot_count) {
+      log_error("snapshot: free slot {} out of range", slot);
+      return false;
+    }
+  }
+  return true;
+}
+
+// `highest` is the largest id now in the collection.
+inline void apply_ids(EntityCollection &collection, Ids &ids,
+                      const EntityID highest) {
+  collection.free_slots = std::move(ids.free_slots);
+  collection.permanant_ids =
+      std::set<int>(ids.permanent.begin(), ids.permanent.end());
+  collection.free_ids_ = std::move(ids.free_ids);
+  if (ids.own) {
+    collection.own_entity_ids_ = true;
+    collection.next_entity_id_ = ids.next;
+    return;
+  }
+  // Process-wide ids only move forward; just make sure none restored here
+  // is handed out again.
+  int current = ENTITY_ID_GEN.load();
+  while (current <= highest &&
+         !ENTITY_ID_GEN.compare_exchange_weak(current, highest + 1)) {
+  }
+}
+
+// Singletons of registered types, by slot.
+using Singletons = std::vector<std::pair<std::string, EntityHandle::Slot>>;
+
+inline void write_singletons(const EntityCollection &collection, Writer &w) {
+  const std::size_t count_at = w.size();
+  w.value(std::uint32_t{0});
+  std::uint32_t count = 0;
+  for (const auto &[id, entity] : collection.singletonMap) {
+    const ComponentCodec *codec = find_codec(id);
+    if (!codec || !entity)
+      continue;
+    w.string(codec->name);
+    w.value(entity->ah_slot_index);
+    ++count;
+  }
+  w.patch(count_at, count);
+}
+
+inline void read_singletons(Reader &in, Singletons &singletons) {
+  singletons.resize(
+      in.count(sizeof(std::uint32_t) + sizeof(EntityHandle::Slot)));
+  for (auto &[name, slot] : singletons) {
+    in.string(name);
+    in.value(slot);
+    if (in.failed())
+      return;
+  }
+}
+
+// Saved singletons by slot; others only if their entity is still there.
+inline void apply_singletons(EntityCollection &collection,
+                             const Singletons &singletons) {
+  auto &singleton_map = collection.singletonMap;
+  for (auto it = singleton_map.begin(); it != singleton_map.end();) {
+    Entity *ent = it->second;
+    const bool kept = ent && ent->ah_slot_index < collection.slots.size() &&
+                      collection.slots[ent->ah_slot_index].ent == ent;
+    it = kept ? std::next(it) : singleton_map.erase(it);
+  }
+  for (const auto &[name, slot] : singletons) {
+    const ComponentCodec *codec = find_codec(name);
+    if (codec && slot < collection.slots.size() && collection.slots[slot].ent)
+      singleton_map[codec->id] = collection.slots[slot].ent;
+  }
+}
+
+// An entity for `id`: one from the pool, or a new one.
+inline EntityType take_entity(EntityCollection &collection,
+                              const EntityID id) {
+  if (collection.entity_pool_.empty())
+    return collection.allocate_entity(id);
+  EntityType e = std::move(collection.entity_pool_.back());
+  collection.entity_pool_.pop_back();
+  e->recycle(id);
+  return e;
+}
+
+// Back to the pool if there's room, as cleanup() does.
+inline void drop_entity(EntityCollection &collection, EntityType &sp) {
+  if (!sp)
+    return;
+  sp->ah_slot_index = EntityHandle::INVALID_SLOT;
+  if (collection.entity_pool_.size() < collection.max_pool_size_)
+    collection.entity_pool_.push_back(std::move(sp));
+  sp.reset();
+}
+
+struct Column {
+  std::string name;
+  std::uint32_t stride;
+  Rows rows;
+  std::span<const std::byte> payload;
+};
+
+// Column `name`'s rows as written: a row count, the rows, then the payload
+// with its size in front.
+inline void read_column(Reader &in, Column &column) {
+  in.string(column.name);
+  in.value(column.stride);
+  column.rows.resize(in.count(sizeof(std::uint32_t)));
+  in.bytes(column.rows.data(), column.rows.size() * sizeof(std::uint32_t));
+  column.payload = in.take(in.value<std::uint64_t>());
+}
+
+// The payload split into one span per row. Empty if the rows and payload
+// don't agree.
+inline std::vector<std::span<const std::byte>> cells(const Column &column) {
+  std::vector<std::span<const std::byte>> out;
+  out.reserve(column.rows.size());
+  if (column.stride != 0) {
+    if (column.payload.size() !=
+        std::size_t{column.stride} * column.rows.size())
+      return {};
+    for (std::size_t k = 0; k < column.rows.size(); ++k)
+      out.push_back(column.payload.subspan(k * column.stride, column.stride));
+    return out;
+  }
+  Reader in(column.payload);
+  for (std::size_t k = 0; k < column.rows.size(); ++k) {
+    out.push_back(in.take(in.value<std::uint32_t>()));
+    if (in.failed())
+      return {};
+  }
+  return in.at_end() ? out : std::vector<std::span<const std::byte>>{};
+}
+
+// Does the column's payload hold exactly one value per row, at this build's
+// stride?
+inline bool column_fits(const Column &column) {
+  const ComponentCodec *codec = find_codec(column.name);
+  if (codec && codec->stride != column.stride)
+    return false;
+  return column.rows.empty() ? column.payload.empty()
+                             : !cells(column).empty();
+}
+
+// A whole snapshot, read and checked but not applied.
+struct Frame {
+  Ids ids;
+  std::vector<EntityHandle::Slot> gens;
+  std::uint32_t count = 0;
+  std::span<const std::byte> entity_ids;
+  std::span<const std::byte> slot_of;
+  std::span<const std::byte> types;
+  std::span<const std::byte> cleanup;
+  std::span<const std::byte> tags;
+  std::vector<Column> columns;
+  Singletons singletons;
+};
+
+inline bool parse(const std::span<const std::byte> data, Frame &frame) {
+  Reader in(data);
+  if (in.value<std::uint32_t>() != magic ||
+      in.value<std::uint32_t>() != version) {
+    log_error("snapshot: not a snapshot, or from another version");
+    return false;
+  }
+  if (in.value<std::uint32_t>() != sizeof(TagBitset)) {
+    log_error("snapshot: saved with a different AFTER_HOURS_MAX_ENTITY_TAGS");
+    return false;
+  }
+
+  read_ids(in, frame.ids);
+  frame.gens.resize(in.count(sizeof(EntityHandle::Slot)));
+  in.bytes(frame.gens.data(), frame.gens.size() * sizeof(EntityHandle::Slot));
+
+  frame.count = in.count(entity_bytes);
+  const std::uint32_t count = frame.count;
+  frame.entity_ids = in.take(count * sizeof(EntityID));
+  frame.slot_of = in.take(count * sizeof(EntityHandle::Slot));
+  frame.types = in.take(count * sizeof(int));
+  frame.cleanup = in.take(count * sizeof(std::uint8_t));
+  frame.tags = in.take(count * sizeof(TagBitset));
+
+  // Name length, stride, row count and payload size: 20 bytes at least.
+  frame.columns.resize(in.count(20));
+  for (Column &column : frame.columns) {
+    read_column(in, column);
+    if (in.failed())
+      break;
+  }
+  read_singletons(in, frame.singletons);
+  if (in.failed()) {
+    log_error("snapshot: truncated");
+    return false;
+  }
+
+  // Check everything that indexes something.
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const auto slot = get<EntityHandle::Slot>(frame.slot_of, i);
+    if (slot != EntityHandle::INVALID_SLOT && slot >= frame.gens.size()) {
+      log_error("snapshot: entity slot {} out of range", slot);
+      return false;
+    }
+  }
+  if (!free_slots_fit(frame.ids, frame.gens.size()))
+    return false;
+  for (const Column &column : frame.columns) {
+    const bool rows_ok = std::all_of(
+        column.rows.begin(), column.rows.end(),
+        [count](const std::uint32_t row) { return row < count; });
+    if (!rows_ok || !column_fits(column)) {
+      log_error("snapshot: column {} doesn't match this build", column.name);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Load `members`' values for `codec` from `payload`, logging if it doesn't
+// come out even.
+inline bool load_column(const ComponentCodec &codec,
+                        const std::span<Entity *const> members,
+                        const std::span<const std::byte> payload) {
+  Reader in(payload);
+  if (codec.load(members, in) && in.at_end())
+    return true;
+  log_error("snapshot: {} didn't load; its codec reads other than it saves",
+            codec.name);
+  return false;
+}
+
+} // namespace detail
+
+// Save T by copying its fields byte for byte. Only for components opted in
+// with is_plain_component; a component holding std::string, containers or
+// pointers needs a codec (below). `name` keys the column in the file; the
+// default is the type's spelled-out name.
+template <typename T>
+  requires is_plain_component<T>::value
+void register_component(std::string name = std::string(type_name<T>())) {
+  static_assert(std::is_base_of_v<BaseComponent, T>,
+                "Component must inherit from BaseComponent");
+  static_assert(std::is_default_constructible_v<T>,
+                "restore default-constructs missing components");
+  static_assert_pointer_free_types<T>();
+
+  constexpr std::size_t stride = detail::payload_size<T>;
+  detail::add_codec(detail::ComponentCodec{
+      .name = std::move(name),
+      .id = components::get_type_id<T>(),
+      .stride = static_cast<std::uint32_t>(stride),
+      .save =
+          [](const std::span<const Entity *const> members, Writer &out) {
+            const ComponentID id = components::get_type_id<T>();
+            std::byte *to = out.extend(members.size() * stride);
+            for (const Entity *e : members) {
+              const T &c = detail::component_of<T>(*e, id);
+              std::memcpy(to, detail::payload(c), stride);
+              to += stride;
+            }
+          },
+      .load =
+          [](const std::span<Entity *const> members, Reader &in) {
+            const ComponentID id = components::get_type_id<T>();
+            const std::span<const std::byte> from =
+                in.take(members.size() * stride);
+            if (in.failed())
+              return false;
+            const std::byte *at = from.data();
+            for (Entity *e : members) {
+              T &c = detail::component_for_load<T>(*e, id);
+              std::memcpy(detail::payload(c), at, stride);
+              at += stride;
+            }
+            return true;
+          },
+  });
+}
+
+// Save T with your own functions: save(const T &, Writer &) and
+// load(T &, Reader &). load() gets the entity's existing component, or a
+// default-constructed one, and should overwrite every field save() wrote.
+template <typename T, typename Save, typename Load>
+void register_component(Save save, Load load,
+                        std::string name = std::string(type_name<T>())) {
+  static_assert(std::is_base_of_v<BaseComponent, T>,
+                "Component must inherit from BaseComponent");
+  static_assert(std::is_default_constructible_v<T>,
+                "restore default-constructs missing components");
+
+  detail::add_codec(detail::ComponentCodec{
+      .name = std::move(name),
+      .id = components::get_type_id<T>(),
+      .stride = 0,
+      .save =
+          [save](const std::span<const Entity *const> members, Writer &out) {
+            const ComponentID id = components::get_type_id<T>();
+            for (const Entity *e : members) {
+              const std::size_t size_at = out.size();
+              out.value(std::uint32_t{0});
+              save(detail::component_of<T>(*e, id), out);
+              out.patch(size_at,
+                        static_cast<std::uint32_t>(out.size() - size_at -
+                                                   sizeof(std::uint32_t)));
+            }
+          },
+      .load =
+          [load](const std::span<Entity *const> members, Reader &in) {
+            const ComponentID id = components::get_type_id<T>();
+            for (Entity *e : members) {
+              Reader row(in.take(in.value<std::uint32_t>()));
+              if (in.failed())
+                return false;
+              load(detail::component_for_load<T>(*e, id), row);
+              if (row.failed() || !row.at_end())
+                return false;
+            }
+            return true;
+          },
+  });
+}
+
+// Replace `out` with a snapshot of `collection`'s merged entities. Keeps
+// out's capacity, so saving every frame into the same buffer doesn't
+// allocate once it has grown.
+inline void save(const EntityCollection &collection,
+                 std::vector<std::byte> &out) {
+  out.clear();
+  Writer w(out);
+  const Entities &entities = collection.get_entities();
+  const auto count = static_cast<std::uint32_t>(entities.size());
+
+  w.value(detail::magic);
+  w.value(detail::version);
+  w.value(static_cast<std::uint32_t>(sizeof(TagBitset)));
+
+  // Ids and the handle store.
+  detail::write_ids(collection, w);
+  w.value(static_cast<std::uint32_t>(collection.slots.size()));
+  std::byte *gens =
+      w.extend(collection.slots.size() * sizeof(EntityHandle::Slot));
+  for (const EntityCollection::Slot &slot : collection.slots)
+    detail::put(gens, slot.gen);
+
+  // Entities, a column per field, filled in one pass that also sorts them
+  // into component columns. Null entries are saved as cleanup.
+  const std::vector<detail::ComponentCodec> &codecs = detail::codecs();
+  thread_local std::vector<detail::Rows> rows;
+  rows.resize(codecs.size());
+  for (detail::Rows &r : rows)
+    r.clear();
+
+  w.value(count);
+  std::byte *id_to = w.extend(count * detail::entity_bytes);
+  std::byte *slot_to = id_to + count * sizeof(EntityID);
+  std::byte *type_to = slot_to + count * sizeof(EntityHandle::Slot);
+  std::byte *cleanup_to = type_to + count * sizeof(int);
+  std::byte *tags_to = cleanup_to + count * sizeof(std::uint8_t);
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const Entity *e = entities[i].get();
+    detail::put(id_to, e ? e->id : EntityID{-1});
+    detail::put(slot_to, e ? e->ah_slot_index : EntityHandle::INVALID_SLOT);
+    detail::put(type_to, e ? e->entity_type : 0);
+    detail::put(cleanup_to, static_cast<std::uint8_t>(!e || e->cleanup));
+    detail::put(tags_to, e ? e->tags : TagBitset{});
+    if (!e)
+      continue;
+    for (std::size_t k = 0; k < codecs.size(); ++k) {
+      if (e->componentSet.test(codecs[k].id))
+        rows[k].push_back(i);
+    }
+  }
+
+  // Components, a column per registered type that any entity has.
+  thread_local std::vector<const Entity *> members;
+  const std::size_t column_count_at = w.size();
+  w.value(std::uint32_t{0});
+  std::uint32_t column_count = 0;
+  for (std::size_t k = 0; k < codecs.size(); ++k) {
+    if (rows[k].empty())
+      continue;
+    members.clear();
+    for (const std::uint32_t row : rows[k])
+      members.push_back(entities[row].get());
+    w.string(codecs[k].name);
+    w.value(codecs[k].stride);
+    w.value(static_cast<std::uint32_t>(rows[k].size()));
+    w.bytes(rows[k].data(), rows[k].size() * sizeof(std::uint32_t));
+    const std::size_t size_at = w.size();
+    w.value(std::uint64_t{0});
+    codecs[k].save(members, w);
+    w.patch(size_at, static_cast<std::uint64_t>(w.size() - size_at -
+                                                sizeof(std::uint64_t)));
+    ++column_count;
+  }
+  w.patch(column_count_at, column_count);
+
+  detail::write_singletons(collection, w);
+}
+
+[[nodiscard]] inline std::vector<std::byte>
+save(const EntityCollection &collection) {
+  std::vector<std::byte> out;
+  save(collection, out);
+  return out;
+}
+
+// Put `collection` back the way it was when `data` was saved. Returns false,
+// leaving the collection untouched, if `data` isn't a snapshot from this
+// build; a codec that runs out of data also returns false, after the
+// entities have already been restored.
+inline bool restore(EntityCollection &collection,
+                    const std::span<const std::byte> data) {
+  detail::Frame frame;
+  if (!detail::parse(data, frame))
+    return false;
+  const std::uint32_t count = frame.count;
+
+  // Entities: reuse whoever is still in the saved slot, else recycle or
+  // allocate one. Everyone else is dropped, as cleanup() would.
+  if (!collection.entities_DO_NOT_USE.empty())
+    (void)collection.position_of_slot(0); // builds slot_positions_
+  const std::vector<std::uint32_t> &old_position = collection.slot_positions_;
+  Entities old = std::move(collection.entities_DO_NOT_USE);
+  Entities &entities = collection.entities_DO_NOT_USE;
+  entities.clear();
+  entities.reserve(count);
+
+  collection.slots.assign(frame.gens.size(), EntityCollection::Slot{});
+  for (std::size_t s = 0; s < frame.gens.size(); ++s)
+    collection.slots[s].gen = frame.gens[s];
+  EntityID highest = -1;
+  for (std::uint32_t i = 0; i < count; ++i)
+    highest = std::max(highest, detail::get<EntityID>(frame.entity_ids, i));
+  collection.id_to_slot.assign(static_cast<std::size_t>(highest + 1),
+                               EntityHandle::INVALID_SLOT);
+
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const auto id = detail::get<EntityID>(frame.entity_ids, i);
+    const auto slot = detail::get<EntityHandle::Slot>(frame.slot_of, i);
+    const std::uint32_t at = slot < old_position.size()
+                                 ? old_position[slot]
+                                 : EntityCollection::npos;
+    EntityType e;
+    if (at < old.size() && old[at] && old[at]->id == id)
+      e = std::move(old[at]);
+    else
+      e = detail::take_entity(collection, id);
+    e->entity_type = detail::get<int>(frame.types, i);
+    e->cleanup = detail::get<std::uint8_t>(frame.cleanup, i) != 0;
+    e->tags = detail::get<TagBitset>(frame.tags, i);
+    e->ah_slot_index = slot;
+    if (slot != EntityHandle::INVALID_SLOT) {
+      collection.slots[slot].ent = e.get();
+      if (id >= 0)
+        collection.id_to_slot[static_cast<std::size_t>(id)] = slot;
+    }
+    entities.push_back(std::move(e));
+  }
+
+  detail::apply_singletons(collection, frame.singletons);
+
+  // What's left in `old` wasn't reused.
+  for (EntityType &sp : old)
+    detail::drop_entity(collection, sp);
+  for (EntityType &sp : collection.temp_entities)
+    detail::drop_entity(collection, sp);
+  old.clear();
+  collection.temp_entities.clear();
+
+  // Components, column by column. Then, in one pass, registered components
+  // that no column gave an entity are removed from it.
+  ComponentBitSet registered;
+  std::vector<ComponentBitSet> loaded(count);
+  std::vector<Entity *> members;
+  bool ok = true;
+  for (const detail::ComponentCodec &codec : detail::codecs()) {
+    registered.set(codec.id);
+    const auto column = std::find_if(
+        frame.columns.begin(), frame.columns.end(),
+        [&](const detail::Column &c) { return c.name == codec.name; });
+    if (column == frame.columns.end())
+      continue;
+    members.clear();
+    for (const std::uint32_t row : column->rows)
+      members.push_back(entities[row].get());
+    ok = detail::load_column(codec, members, column->payload) && ok;
+    for (const std::uint32_t row : column->rows)
+      loaded[row].set(codec.id);
+  }
+  for (std::uint32_t i = 0; i < count; ++i) {
+    Entity &e = *entities[i];
+    const ComponentBitSet stale = e.componentSet & registered & ~loaded[i];
+    if (stale.none())
+      continue;
+    for (ComponentID id = 0; id < max_num_components; ++id) {
+      if (stale.test(id)) {
+        e.componentSet.reset(id);
+        e.release_component(id);
+      }
+    }
+  }
+  for (const detail::Column &column : frame.columns) {
+    if (!detail::find_codec(column.name))
+      log_warn("snapshot: skipping component {}; it isn't registered",
+               column.name);
+  }
+
+  detail::apply_ids(collection, frame.ids, highest);
+
+  // Indexes, match caches and change tracking start over.
+  EntityIndexes &indexes = collection.component_storage().indexes;
+  indexes.clear();
+  if (indexes.indexed_components.any() || indexes.indexed_tags.any()) {
+    for (const EntityType &e : entities) {
+      if (e->ah_slot_index != EntityHandle::INVALID_SLOT)
+        indexes.on_merge(e->ah_slot_index, e->componentSet, e->tags);
+    }
+  }
+  collection.component_storage().ticks.forget_all();
+  collection.note_entity_order_changed();
+  return ok;
+}
+
+} // namespace afterhours::snapshot
@@ -0,0 +1,664 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../logging.h"
+#include "entity.h"
+#include "entity_collection.h"
+#include "entity_handle.h"
+#include "snapshot_binary.h"
+
+namespace afterhours::snapshot {
+
+// Deltas: what changed between a snapshot and a collection, for replays and
+// spectator feeds where a full snapshot per tick is too big.
+//
+//   snapshot::save(world, base);            // once, in full
+//   ...
+//   snapshot::diff(base, world, delta);     // every tick after
+//   send(delta);
+//   snapshot::save(world, base);            // the next tick diffs from here
+//
+//   snapshot::apply_delta(mirror, delta);   // on a collection at `base`
+//
+// A delta holds the entities destroyed and created since the snapshot, the
+// entity fields (type, tags, cleanup) that changed, and per registered
+// component the rows whose saved bytes differ, plus the rows that lost it:
+// a plain component's own fields, or what a codec writes for the rest.
+// Entities are named by slot, so the handle store comes through as in a
+// full snapshot. Its size and the cost of applying it follow the amount of
+// change; diff() still reads every entity once to compare.
+//
+// A delta only applies to a collection in the state its base snapshot
+// describes: the one that was saved, one restored from it, or a mirror kept
+// in step by applying every delta in order. apply_delta checks what it can
+// (entity count, the ids of destroyed entities) and refuses the rest.
+
+namespace detail {
+
+constexpr std::uint32_t delta_magic = 0x44534841; // "AHSD"
+constexpr std::uint32_t delta_version = 1;
+
+// An entity's fields, for created (all of them) and changed (no id) rows.
+struct Fields {
+  EntityHandle::Slot slot = EntityHandle::INVALID_SLOT;
+  EntityID id = -1;
+  int entity_type = 0;
+  bool cleanup = false;
+  TagBitset tags{};
+};
+
+constexpr std::size_t changed_bytes = sizeof(EntityHandle::Slot) +
+                                      sizeof(int) + sizeof(std::uint8_t) +
+                                      sizeof(TagBitset);
+constexpr std::size_t created_bytes = changed_bytes + sizeof(EntityID);
+
+inline void write_fields(const Entity &e, const bool with_id, Writer &w) {
+  w.value(e.ah_slot_index);
+  if (with_id)
+    w.value(e.id);
+  w.value(e.entity_type);
+  w.value(static_cast<std::uint8_t>(e.cleanup));
+  w.value(e.tags);
+}
+
+inline void read_fields(Reader &in, const bool with_id, Fields &f) {
+  in.value(f.slot);
+  if (with_id)
+    in.value(f.id);
+  in.value(f.entity_type);
+  f.cleanup = in.value<std::uint8_t>() != 0;
+  in.value(f.tags);
+}
+
+// A component column of a delta: rows are slots, not positions.
+struct DeltaColumn {
+  Column set;
+  std::vector<EntityHandle::Slot> removed;
+};
+
+struct Delta {
+  std::uint32_t base_count = 0;
+  std::uint32_t count = 0;
+  Ids ids;
+  std::uint32_t slot_count = 0;
+  std::vector<std::pair<EntityHandle::Slot, EntityHandle::Slot>> gens;
+  std::vector<std::pair<EntityHandle::Slot, EntityID>> destroyed;
+  std::vector<Fields> created;
+  std::vector<Fields> changed;
+  // (position, slot): the entity list differs from the base's here.
+  std::vector<std::pair<std::uint32_t, EntityHandle::Slot>> placed;
+  std::vector<DeltaColumn> columns;
+  Singletons singletons;
+};
+
+inline bool parse_delta(const std::span<const std::byte> data, Delta &d) {
+  Reader in(data);
+  if (in.value<std::uint32_t>() != delta_magic ||
+      in.value<std::uint32_t>() != delta_version) {
+    log_error("snapshot: not a delta, or from another version");
+    return false;
+  }
+  if (in.value<std::uint32_t>() != sizeof(TagBitset)) {
+    log_error("snapshot: saved with a different AFTER_HOURS_MAX_ENTITY_TAGS");
+    return false;
+  }
+  in.value(d.base_count);
+  in.value(d.count);
+  read_ids(in, d.ids);
+  in.value(d.slot_count);
+
+  d.gens.resize(in.count(2 * sizeof(EntityHandle::Slot)));
+  for (auto &[slot, gen] : d.gens) {
+    in.value(slot);
+    in.value(gen);
+  }
+  d.destroyed.resize(in.count(sizeof(EntityHandle::Slot) + sizeof(EntityID)));
+  for (auto &[slot, id] : d.destroyed) {
+    in.value(slot);
+    in.value(id);
+  }
+  d.created.resize(in.count(created_bytes));
+  for (Fields &f : d.created)
+    read_fields(in, true, f);
+  d.changed.resize(in.count(changed_bytes));
+  for (Fields &f : d.changed)
+    read_fields(in, false, f);
+  d.placed.resize(in.count(sizeof(std::uint32_t) + sizeof(EntityHandle::Slot)));
+  for (auto &[position, slot] : d.placed) {
+    in.value(position);
+    in.value(slot);
+  }
+  // A column as in a snapshot (20 bytes at least), then its removed count.
+  d.columns.resize(in.count(24));
+  for (DeltaColumn &column : d.columns) {
+    read_column(in, column.set);
+    column.removed.resize(in.count(sizeof(EntityHandle::Slot)));
+    in.bytes(column.removed.data(),
+             column.removed.size() * sizeof(EntityHandle::Slot));
+    if (in.failed())
+      break;
+  }
+  read_singletons(in, d.singletons);
+  if (in.failed() || !in.at_end()) {
+    log_error("snapshot: delta truncated");
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+bool sorted_contains(const std::vector<T> &sorted, const T &value) {
+  return std::binary_search(sorted.begin(), sorted.end(), value);
+}
+
+// Who ends up where: every entity that moves, arrives or leaves, worked out
+// and checked against the collection before anything changes.
+struct DeltaPlan {
+  std::vector<EntityHandle::Slot> destroyed_slots; // sorted
+  std::vector<EntityHandle::Slot> created_slots;   // sorted
+  // Old positions emptied: moved elsewhere, destroyed or past the new end.
+  std::vector<std::uint32_t> vacated;
+  // An entity that lands at a placed position, by its slot afterwards:
+  // from an old position, or created[created] when from is npos.
+  struct Mover {
+    EntityHandle::Slot slot;
+    std::uint32_t from;
+    std::uint32_t created;
+  };
+  std::vector<Mover> movers; // sorted by slot
+};
+
+inline bool plan_delta(const EntityCollection &collection, const Delta &d,
+                       DeltaPlan &plan) {
+  const Entities &entities = collection.get_entities();
+  const auto &slots = collection.slots;
+  if (entities.size() != d.base_count) {
+    log_error("snapshot: delta is from a base with {} entities, not {}",
+              d.base_count, entities.size());
+    return false;
+  }
+
+  for (const auto &[slot, id] : d.destroyed) {
+    if (slot >= slots.size() || !slots[slot].ent || slots[slot].ent->id != id) {
+      log_error("snapshot: delta destroys entity {} in slot {}, which isn't "
+                "there",
+                id, slot);
+      return false;
+    }
+    plan.destroyed_slots.push_back(slot);
+  }
+  std::sort(plan.destroyed_slots.begin(), plan.destroyed_slots.end());
+  if (std::adjacent_find(plan.destroyed_slots.begin(),
+                         plan.destroyed_slots.end()) !=
+      plan.destroyed_slots.end()) {
+    log_error("snapshot: delta destroys an entity twice");
+    return false;
+  }
+  const auto kept = [&](const EntityHandle::Slot slot) {
+    return slot < slots.size() && slots[slot].ent &&
+           !sorted_contains(plan.destroyed_slots, slot);
+  };
+
+  for (const Fields &f : d.created) {
+    if (f.slot >= d.slot_count || kept(f.slot) || f.id < 0) {
+      log_error("snapshot: delta creates entity {} in slot {}, which is taken",
+                f.id, f.slot);
+      return false;
+    }
+    plan.created_slots.push_back(f.slot);
+  }
+  std::sort(plan.created_slots.begin(), plan.created_slots.end());
+  if (std::adjacent_find(plan.created_slots.begin(),
+                         plan.created_slots.end()) !=
+      plan.created_slots.end()) {
+    log_error("snapshot: delta creates two entities in one slot");
+    return false;
+  }
+  const auto exists = [&](const EntityHandle::Slot slot) {
+    return slot < d.slot_count &&
+           (kept(slot) || sorted_contains(plan.created_slots, slot));
+  };
+
+  for (EntityHandle::Slot s = d.slot_count; s < slots.size(); ++s) {
+    if (kept(s)) {
+      log_error("snapshot: delta drops slot {}, which is in use", s);
+      return false;
+    }
+  }
+  for (const auto &[slot, gen] : d.gens) {
+    if (slot >= d.slot_count) {
+      log_error("snapshot: delta slot {} out of range", slot);
+      return false;
+    }
+  }
+  if (!free_slots_fit(d.ids, d.slot_count))
+    return false;
+  for (const Fields &f : d.changed) {
+    if (!exists(f.slot)) {
+      log_error("snapshot: delta changes slot {}, which is empty", f.slot);
+      return false;
+    }
+  }
+  for (const DeltaColumn &column : d.columns) {
+    const bool slots_ok =
+        std::all_of(column.set.rows.begin(), column.set.rows.end(), exists) &&
+        std::all_of(column.removed.begin(), column.removed.end(), exists);
+    if (!slots_ok || !column_fits(column.set)) {
+      log_error("snapshot: delta column {} doesn't match", column.set.name);
+      return false;
+    }
+  }
+
+  // Placement. Positions that get a new entity are emptied first, along
+  // with everything past the new end; what's emptied and created must then
+  // fill them exactly, leaving only the destroyed behind.
+  std::vector<std::uint32_t> positions;
+  positions.reserve(d.placed.size());
+  for (const auto &[position, slot] : d.placed) {
+    if (position >= d.count || !exists(slot)) {
+      log_error("snapshot: delta places slot {} at {}", slot, position);
+      return false;
+    }
+    positions.push_back(position);
+  }
+  std::sort(positions.begin(), positions.end());
+  if (std::adjacent_find(positions.begin(), positions.end()) !=
+      positions.end()) {
+    log_error("snapshot: delta places two entities at one position");
+    return false;
+  }
+  const auto appended = static_cast<std::size_t>(
+      positions.end() -
+      std::lower_bound(positions.begin(), positions.end(), d.base_count));
+  if (d.count > d.base_count && appended != d.count - d.base_count) {
+    log_error("snapshot: delta leaves a gap in the entity list");
+    return false;
+  }
+  for (const std::uint32_t position : positions) {
+    if (position < d.base_count)
+      plan.vacated.push_back(position);
+  }
+  for (std::uint32_t p = d.count; p < d.base_count; ++p)
+    plan.vacated.push_back(p);
+
+  std::size_t destroyed_found = 0;
+  for (const std::uint32_t p : plan.vacated) {
+    const Entity *e = entities[p].get();
+    if (!e || e->ah_slot_index == EntityHandle::INVALID_SLOT) {
+      log_error("snapshot: can't apply a delta over entities without slots");
+      return false;
+    }
+    if (sorted_contains(plan.destroyed_slots, e->ah_slot_index)) {
+      ++destroyed_found;
+      continue;
+    }
+    plan.movers.push_back({e->ah_slot_index, p, 0});
+  }
+  for (std::uint32_t k = 0; k < d.created.size(); ++k)
+    plan.movers.push_back({d.created[k].slot, EntityCollection::npos, k});
+  std::sort(plan.movers.begin(), plan.movers.end(),
+            [](const DeltaPlan::Mover &a, const DeltaPlan::Mover &b) {
+              return a.slot < b.slot;
+            });
+
+  std::vector<bool> used(plan.movers.size());
+  for (const auto &[position, slot] : d.placed) {
+    const auto it = std::lower_bound(
+        plan.movers.begin(), plan.movers.end(), slot,
+        [](const DeltaPlan::Mover &m, const EntityHandle::Slot s) {
+          return m.slot < s;
+        });
+    const auto k = static_cast<std::size_t>(it - plan.movers.begin());
+    if (it == plan.movers.end() || it->slot != slot || used[k]) {
+      log_error("snapshot: delta places slot {}, which doesn't move", slot);
+      return false;
+    }
+    used[k] = true;
+  }
+  if (destroyed_found != d.destroyed.size() ||
+      std::find(used.begin(), used.end(), false) != used.end()) {
+    log_error("snapshot: delta's entity list doesn't add up");
+    return false;
+  }
+  return true;
+}
+
+} // namespace detail
+
+// Replace `out` with the changes from snapshot `base` to `collection` now.
+// Returns false, writing nothing, if `base` isn't a snapshot from this build
+// or an entity on either side has no slot (merge first).
+inline bool diff(const std::span<const std::byte> base,
+                 const EntityCollection &collection,
+                 std::vector<std::byte> &out) {
+  detail::Frame frame;
+  if (!detail::parse(base, frame))
+    return false;
+  const Entities &entities = collection.get_entities();
+  const std::uint32_t base_count = frame.count;
+  const auto count = static_cast<std::uint32_t>(entities.size());
+
+  // Then and now are matched by slot and id.
+  std::vector<std::uint32_t> row_of(frame.gens.size(), EntityCollection::npos);
+  for (std::uint32_t r = 0; r < base_count; ++r) {
+    const auto slot = detail::get<EntityHandle::Slot>(frame.slot_of, r);
+    if (slot == EntityHandle::INVALID_SLOT) {
+      log_error("snapshot: can't diff against entities without slots");
+      return false;
+    }
+    row_of[slot] = r;
+  }
+  for (const EntityType &sp : entities) {
+    if (!sp || sp->ah_slot_index == EntityHandle::INVALID_SLOT) {
+      log_error("snapshot: can't diff entities without slots; merge first");
+      return false;
+    }
+  }
+
+  // Per registered component: the base's value for each row, if it had one.
+  // Byte-copied values are found by stride, codec values by their spans.
+  // Only plain components are compared in place, byte for byte; the rest
+  // are compared on what their codec saves, as their own bytes may hold
+  // pointers that differ while the values don't.
+  const std::vector<detail::ComponentCodec> &codecs = detail::codecs();
+  struct Then {
+    const std::byte *values = nullptr;
+    std::vector<std::span<const std::byte>> cells;
+    std::vector<std::uint32_t> cell_of_row;
+  };
+  std::vector<Then> then(codecs.size());
+  for (std::size_t k = 0; k < codecs.size(); ++k) {
+    const auto column = std::find_if(
+        frame.columns.begin(), frame.columns.end(),
+        [&](const detail::Column &c) { return c.name == codecs[k].name; });
+    if (column == frame.columns.end() || column->stride != codecs[k].stride)
+      continue;
+    if (column->stride != 0)
+      then[k].values = column->payload.data();
+    else
+      then[k].cells = detail::cells(*column);
+    then[k].cell_of_row.assign(base_count, EntityCollection::npos);
+    for (std::uint32_t cell = 0; cell < column->rows.size(); ++cell)
+      then[k].cell_of_row[column->rows[cell]] = cell;
+  }
+
+  std::vector<bool> survived(base_count);
+  std::vector<const Entity *> created;
+  std::vector<const Entity *> changed;
+  std::vector<std::pair<std::uint32_t, EntityHandle::Slot>> placed;
+  std::vector<std::vector<const Entity *>> updated(codecs.size());
+  std::vector<std::vector<EntityHandle::Slot>> removed(codecs.size());
+  std::vector<std::byte> scratch;
+
+  for (std::uint32_t p = 0; p < count; ++p) {
+    const Entity &e = *entities[p];
+    const EntityHandle::Slot slot = e.ah_slot_index;
+    const std::uint32_t r =
+        slot < row_of.size() ? row_of[slot] : EntityCollection::npos;
+    const bool kept =
+        r != EntityCollection::npos &&
+        detail::get<EntityID>(frame.entity_ids, r) == e.id;
+    if (kept) {
+      survived[r] = true;
+      if (e.entity_type != detail::get<int>(frame.types, r) ||
+          e.cleanup != (detail::get<std::uint8_t>(frame.cleanup, r) != 0) ||
+          e.tags != detail::get<TagBitset>(frame.tags, r))
+        changed.push_back(&e);
+    } else {
+      created.push_back(&e);
+    }
+    if (p >= base_count ||
+        detail::get<EntityHandle::Slot>(frame.slot_of, p) != slot ||
+        detail::get<EntityID>(frame.entity_ids, p) != e.id)
+      placed.emplace_back(p, slot);
+
+    for (std::size_t k = 0; k < codecs.size(); ++k) {
+      const detail::ComponentCodec &codec = codecs[k];
+      const std::uint32_t cell = kept && !then[k].cell_of_row.empty()
+                                     ? then[k].cell_of_row[r]
+                                     : EntityCollection::npos;
+      if (!e.componentSet.test(codec.id)) {
+        if (cell != EntityCollection::npos)
+          removed[k].push_back(slot);
+        continue;
+      }
+      if (cell == EntityCollection::npos) {
+        updated[k].push_back(&e);
+        continue;
+      }
+      bool same = false;
+      if (codec.stride != 0) {
+        same = std::memcmp(detail::payload(*e.componentArray[codec.id]),
+                           then[k].values + std::size_t{cell} * codec.stride,
+                           codec.stride) == 0;
+      } else {
+        const std::span<const std::byte> was = then[k].cells[cell];
+        scratch.clear();
+        Writer w(scratch);
+        const Entity *one = &e;
+        codec.save({&one, 1}, w);
+        same = scratch.size() == sizeof(std::uint32_t) + was.size() &&
+               std::memcmp(scratch.data() + sizeof(std::uint32_t),
+                           was.data(), was.size()) == 0;
+      }
+      if (!same)
+        updated[k].push_back(&e);
+    }
+  }
+
+  out.clear();
+  Writer w(out);
+  w.value(detail::delta_magic);
+  w.value(detail::delta_version);
+  w.value(static_cast<std::uint32_t>(sizeof(TagBitset)));
+  w.value(base_count);
+  w.value(count);
+  detail::write_ids(collection, w);
+
+  // Generations that moved, by slot.
+  const auto slot_count = static_cast<std::uint32_t>(collection.slots.size());
+  w.value(slot_count);
+  const std::size_t gen_count_at = w.size();
+  w.value(std::uint32_t{0});
+  std::uint32_t gen_count = 0;
+  for (EntityHandle::Slot s = 0; s < slot_count; ++s) {
+    const EntityHandle::Slot gen = collection.slots[s].gen;
+    if (s < frame.gens.size() && frame.gens[s] == gen)
+      continue;
+    w.value(s);
+    w.value(gen);
+    ++gen_count;
+  }
+  w.patch(gen_count_at, gen_count);
+
+  const std::size_t destroyed_count_at = w.size();
+  w.value(std::uint32_t{0});
+  std::uint32_t destroyed_count = 0;
+  for (std::uint32_t r = 0; r < base_count; ++r) {
+    if (survived[r])
+      continue;
+    w.value(detail::get<EntityHandle::Slot>(frame.slot_of, r));
+    w.value(detail::get<EntityID>(frame.entity_ids, r));
+    ++destroyed_count;
+  }
+  w.patch(destroyed_count_at, destroyed_count);
+
+  w.value(static_cast<std::uint32_t>(created.size()));
+  for (const Entity *e : created)
+    detail::write_fields(*e, true, w);
+  w.value(static_cast<std::uint32_t>(changed.size()));
+  for (const Entity *e : changed)
+    detail::write_fields(*e, false, w);
+  w.value(static_cast<std::uint32_t>(placed.size()));
+  for (const auto &[position, slot] : placed) {
+    w.value(position);
+    w.value(slot);
+  }
+
+  const std::size_t column_count_at = w.size();
+  w.value(std::uint32_t{0});
+  std::uint32_t column_count = 0;
+  for (std::size_t k = 0; k < codecs.size(); ++k) {
+    if (updated[k].empty() && removed[k].empty())
+      continue;
+    w.string(codecs[k].name);
+    w.value(codecs[k].stride);
+    w.value(static_cast<std::uint32_t>(updated[k].size()));
+    for (const Entity *e : updated[k])
+      w.value(e->ah_slot_index);
+    const std::size_t size_at = w.size();
+    w.value(std::uint64_t{0});
+    codecs[k].save(updated[k], w);
+    w.patch(size_at, static_cast<std::uint64_t>(w.size() - size_at -
+                                                sizeof(std::uint64_t)));
+    w.value(static_cast<std::uint32_t>(removed[k].size()));
+    w.bytes(removed[k].data(),
+            removed[k].size() * sizeof(EntityHandle::Slot));
+    ++column_count;
+  }
+  w.patch(column_count_at, column_count);
+
+  detail::write_singletons(collection, w);
+  return true;
+}
+
+// Move `collection` from a delta's base state to the state it was diffed
+// from. Returns false, leaving the collection untouched, if `data` isn't a
+// delta from this build or doesn't start from the collection's state; a
+// codec that runs out of data also returns false, after the entities have
+// been updated. Unmerged temp entities are dropped, as by restore().
+inline bool apply_delta(EntityCollection &collection,
+                        const std::span<const std::byte> data) {
+  detail::Delta d;
+  detail::DeltaPlan plan;
+  if (!detail::parse_delta(data, d) || !detail::plan_delta(collection, d, plan))
+    return false;
+
+  auto &slots = collection.slots;
+  Entities &entities = collection.entities_DO_NOT_USE;
+  ComponentStorage &storage = collection.component_storage();
+  const bool reordered = !d.placed.empty() || d.count != d.base_count;
+
+  for (EntityType &sp : collection.temp_entities)
+    detail::drop_entity(collection, sp);
+  collection.temp_entities.clear();
+
+  // Empty the vacated positions; the destroyed leave their slots.
+  std::vector<EntityType> moving(plan.movers.size());
+  std::vector<EntityType> leaving;
+  for (const std::uint32_t p : plan.vacated) {
+    EntityType &sp = entities[p];
+    const EntityHandle::Slot slot = sp->ah_slot_index;
+    if (!detail::sorted_contains(plan.destroyed_slots, slot)) {
+      const auto it = std::lower_bound(
+          plan.movers.begin(), plan.movers.end(), slot,
+          [](const detail::DeltaPlan::Mover &m, const EntityHandle::Slot s) {
+            return m.slot < s;
+          });
+      moving[static_cast<std::size_t>(it - plan.movers.begin())] =
+          std::move(sp);
+      continue;
+    }
+    slots[slot].ent = nullptr;
+    const auto id = static_cast<std::size_t>(sp->id);
+    if (sp->id >= 0 && id < collection.id_to_slot.size() &&
+        collection.id_to_slot[id] == slot)
+      collection.id_to_slot[id] = EntityHandle::INVALID_SLOT;
+    storage.indexes.on_remove(slot);
+    storage.ticks.forget(slot);
+    leaving.push_back(std::move(sp));
+  }
+
+  // The handle store.
+  slots.resize(d.slot_count);
+  for (const auto &[slot, gen] : d.gens)
+    slots[slot].gen = gen;
+
+  // Created entities take their slots.
+  EntityID highest = -1;
+  for (std::size_t k = 0; k < plan.movers.size(); ++k) {
+    const detail::DeltaPlan::Mover &mover = plan.movers[k];
+    if (mover.from != EntityCollection::npos)
+      continue;
+    const detail::Fields &f = d.created[mover.created];
+    EntityType e = detail::take_entity(collection, f.id);
+    e->entity_type = f.entity_type;
+    e->cleanup = f.cleanup;
+    e->tags = f.tags;
+    e->ah_slot_index = f.slot;
+    slots[f.slot].ent = e.get();
+    collection.ensure_id_mapping_size(f.id);
+    collection.id_to_slot[static_cast<std::size_t>(f.id)] = f.slot;
+    storage.indexes.on_merge(f.slot, e->componentSet, e->tags);
+    highest = std::max(highest, f.id);
+    moving[k] = std::move(e);
+  }
+
+  // The entity list.
+  entities.resize(d.count);
+  for (const auto &[position, slot] : d.placed) {
+    const auto it = std::lower_bound(
+        plan.movers.begin(), plan.movers.end(), slot,
+        [](const detail::DeltaPlan::Mover &m, const EntityHandle::Slot s) {
+          return m.slot < s;
+        });
+    entities[position] =
+        std::move(moving[static_cast<std::size_t>(it - plan.movers.begin())]);
+  }
+  for (EntityType &sp : leaving)
+    detail::drop_entity(collection, sp);
+
+  // Entity fields. Tag changes go through the entity so indexes and match
+  // caches hear about them.
+  for (const detail::Fields &f : d.changed) {
+    Entity &e = *slots[f.slot].ent;
+    e.entity_type = f.entity_type;
+    e.cleanup = f.cleanup;
+    const TagBitset flipped = e.tags ^ f.tags;
+    e.tags = f.tags;
+    for (TagId tag = 0; tag < flipped.size(); ++tag) {
+      if (flipped.test(tag))
+        e.note_tag_change(tag, f.tags.test(tag));
+    }
+  }
+
+  // Components.
+  bool ok = true;
+  std::vector<Entity *> members;
+  for (const detail::DeltaColumn &column : d.columns) {
+    const detail::ComponentCodec *codec = detail::find_codec(column.set.name);
+    if (!codec) {
+      log_warn("snapshot: skipping component {}; it isn't registered",
+               column.set.name);
+      continue;
+    }
+    members.clear();
+    for (const EntityHandle::Slot slot : column.set.rows)
+      members.push_back(slots[slot].ent);
+    ok = detail::load_column(*codec, members, column.set.payload) && ok;
+    for (const EntityHandle::Slot slot : column.removed) {
+      Entity &e = *slots[slot].ent;
+      if (!e.componentSet.test(codec->id))
+        continue;
+      e.componentSet.reset(codec->id);
+      e.release_component(codec->id);
+      e.note_component_change(codec->id, false);
+    }
+  }
+
+  detail::apply_singletons(collection, d.singletons);
+  detail::apply_ids(collection, d.ids, highest);
+  if (reordered)
+    collection.note_entity_order_changed();
+  return ok;
+}
+
+} // namespace afterhours::snapshot
@@ -1,93 +1,32 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <concepts>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string_view>
 #include <type_traits>
+#include <utility>
 
 #include "base_component.h"
+#include "command_buffer.h"
 #include "entity.h"
 #include "entity_helper.h"
+#include "interpolation.h"
+#include "match_cache.h"
+#include "signature.h"
+#include "system_profiler.h"
+#include "system_schedule.h"
+#include "worker_pool.h"
+#include "../memory/alloc_tracking.h"
+#include "../memory/frame_arena.h"
+#include "../type_name.h"
 
 namespace afterhours {
 
-// Negation wrapper for component queries
-template<typename T>
-struct Not {};
-
-namespace tags {
-template<auto... TagEnums>
-struct All {};
-template<auto... TagEnums>
-struct Any {};
-template<auto... TagEnums>
-struct None {};
-}  // namespace tags
-
-template<typename... Ts>
-struct type_list {};
-
-template<typename List, typename T>
-struct list_prepend;
-template<typename... Ts, typename T>
-struct list_prepend<type_list<Ts...>, T> {
-    using type = type_list<T, Ts...>;
-};
-
-template<typename T, typename Enable = void>
-struct is_component : std::false_type {};
-template<typename T>
-struct is_component<T, std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
-    : std::true_type {};
-
-// Support for Not<T> negation
-template<typename T>
-struct is_component<Not<T>,
-                    std::enable_if_t<std::is_base_of_v<BaseComponent, T>>>
-    : std::true_type {};
-
-// Helper to detect Not<T> types
-template<typename T>
-struct is_not_component : std::false_type {};
-
-template<typename T>
-struct is_not_component<Not<T>> : std::true_type {};
-
-template<typename T>
-struct is_tag_type : std::false_type {};
-template<auto... Es>
-struct is_tag_type<tags::All<Es...>> : std::true_type {};
-template<auto... Es>
-struct is_tag_type<tags::Any<Es...>> : std::true_type {};
-template<auto... Es>
-struct is_tag_type<tags::None<Es...>> : std::true_type {};
-
-// Helper to unwrap Not<T> to get T
-template<typename T>
-struct unwrap_not {
-    using type = T;
-};
-
-template<typename T>
-struct unwrap_not<Not<T>> {
-    using type = T;
-};
-
-template<typename...>
-struct filter_components;
-template<>
-struct filter_components<> {
-    using type = type_list<>;
-};
-template<typename T, typename... Rest>
-struct filter_components<T, Rest...> {
-    using prev = typename filter_components<Rest...>::type;
-    using type = std::conditional_t<is_component<T>::value &&
-                                        !is_not_component<T>::value,
-                                    typename list_prepend<prev, T>::type, prev>;
-};
 class SystemBase {
    public:
     SystemBase() {}
@@ -111,6 +50,82 @@ class SystemBase {
     bool include_derived_children = false;
     bool ignore_temp_entities = false;
 
+    // The system's type, filled in when it's registered through a
+    // unique_ptr of that type; empty for ones registered as SystemBase.
+    std::string_view name;
+
+    // The set this system was registered into (see SystemManager::in_set);
+    // empty for none. Ordering constraints and set_enabled() can name it.
+    std::string_view set;
+
+    // Heap allocations made while this system ran during the current (or,
+    // between frames, the last) run(), on any thread. Only counted when the
+    // allocation hook is linked in (see memory/alloc_hook.h).
+    alloc_tracking::Tag allocations;
+
+    // Where this system's SystemProfile lives in its manager's profiler,
+    // and whether for_each counts matches for it; both set by the manager
+    // while profiling is on.
+    std::size_t profile_slot = SystemProfiler::no_slot;
+    bool counting_matches = false;
+
+    // Change tick this system last ran at (see ChangeTicks); its
+    // Added/Changed/Removed filters match changes stamped after it.
+    // SystemManager advances it.
+    std::uint32_t last_run_tick = 0;
+
+    // Set by System<...>, whose component filter is a pair of bitsets.
+    // SystemManager then walks only match_cache.positions instead of every
+    // entity. Systems without a signature (or with derived children) get
+    // the full scan.
+    bool has_component_signature = false;
+    EntityMatchCache match_cache;
+
+    // match_cache, synced to `collection`: the positions in its entity list
+    // this system can match. Null when the system has to scan every entity.
+    const std::vector<std::uint32_t> *synced_matches(
+        EntityCollection &collection) {
+        if (!has_component_signature || include_derived_children)
+            return nullptr;
+        match_cache.sync(collection);
+        return &match_cache.positions;
+    }
+
+    // Run conditions (SystemManager::run_if) that apply to this system, by
+    // index; filled in when the manager works out its run order.
+    std::vector<std::uint32_t> run_conditions;
+
+    // Components this system reads and writes, from Read<>/Write<>. Plain
+    // components count as writes. declares_access is true only when every
+    // listed component is a Read<> or Write<>; only those systems are ever
+    // run on worker threads.
+    ComponentBitSet component_reads;
+    ComponentBitSet component_writes;
+    bool declares_access = false;
+
+    // Deferred structural changes (see EntityCommandBuffer). Set when the
+    // system is registered; the SystemManager flushes it at the end of every
+    // phase.
+    EntityCommandBuffer *command_buffer = nullptr;
+
+    EntityCommandBuffer &commands() {
+        if (!command_buffer) {
+            log_error(
+                "commands() on a system that was never registered with a "
+                "SystemManager; nothing will flush these");
+            static EntityCommandBuffer unregistered;
+            return unregistered;
+        }
+        return *command_buffer;
+    }
+
+    [[nodiscard]] bool conflicts_with(const SystemBase &other) const {
+        return (component_writes &
+                (other.component_reads | other.component_writes))
+                   .any() ||
+               (other.component_writes & component_reads).any();
+    }
+
     virtual void for_each_derived(Entity &, const float) = 0;
     virtual void for_each_derived(const Entity &, const float) const = 0;
 };
@@ -145,31 +160,67 @@ struct System
     using ComponentsOnly = typename filter_components<Components...>::type;
     using ForEachBase = SystemForEachBase<ComponentsOnly>;
 
+    System() {
+        has_component_signature = true;
+        match_cache.required = required_components();
+        match_cache.forbidden = forbidden_components();
+        (add_access_bit<Components>(component_reads, component_writes), ...);
+        declares_access = has_declared_access;
+    }
+
+    static constexpr bool has_declared_access =
+        ((is_read_component<Components>::value ||
+          is_write_component<Components>::value) ||
+         ...) &&
+        ((!is_component<Components>::value ||
+          is_read_component<Components>::value ||
+          is_write_component<Components>::value ||
+          is_not_component<Components>::value) &&
+         ...);
+
+    template<typename C>
+    static void add_access_bit(ComponentBitSet &reads,
+                               ComponentBitSet &writes) {
+        if constexpr (is_not_component<C>::value) {
+            reads.set(components::get_type_id<typename unwrap_not<C>::type>());
+        } else if constexpr (is_change_filter<C>::value) {
+            reads.set(
+                components::get_type_id<typename unwrap_change<C>::type>());
+        } else if constexpr (is_read_component<C>::value) {
+            reads.set(
+                components::get_type_id<typename unwrap_access<C>::type>());
+        } else if constexpr (is_component<C>::value) {
+            writes.set(
+                components::get_type_id<typename unwrap_access<C>::type>());
+        }
+    }
+
+    using Filter = Signature<Components...>;
+
+    // Component filter as bitsets, built once per System<...> type.
+    // Not<T> lands in forbidden_components().
+    static const ComponentBitSet &required_components() {
+        return Filter::required_components();
+    }
+    static const ComponentBitSet &forbidden_components() {
+        return Filter::forbidden_components();
+    }
+
+    static constexpr bool has_not_requirements = Filter::has_not_requirements;
+
+    static bool components_ok(const Entity &entity) {
+        return Filter::components_ok(entity);
+    }
+
     template<typename>
     struct HasAllComponents;
     template<typename... Cs>
     struct HasAllComponents<type_list<Cs...>> {
-        static bool value(const Entity &entity) {
-            return (check_component<Cs>(entity) && ...);
-        }
         static bool value_child(const Entity &entity) {
             return (check_component_child<Cs>(entity) && ...);
         }
 
        private:
-        template<typename C>
-        static bool check_component(const Entity &entity) {
-            if constexpr (is_not_component<C>::value) {
-                // Handle Not<T> - check that entity does NOT have the component
-                using ComponentType = typename unwrap_not<C>::type;
-                return !entity.template has<ComponentType>();
-            } else {
-                // Handle regular component - check that entity HAS the
-                // component
-                return entity.template has<C>();
-            }
-        }
-
         template<typename C>
         static bool check_component_child(const Entity &entity) {
             if constexpr (is_not_component<C>::value) {
@@ -179,20 +230,14 @@ struct System
             } else {
                 // Handle regular component - check that entity HAS the
                 // component
-                return entity.template has_child_of<C>();
+                return entity
+                    .template has_child_of<std::remove_const_t<C>>();
             }
         }
     };
 #ifdef _WIN32
     template<typename List>
     struct HasAllComponents {
-        static bool value(const Entity &entity) {
-            if constexpr (std::is_same_v<List, type_list<>>) {
-                return true;
-            } else {
-                return HasAllComponents<List>::value(entity);
-            }
-        }
         static bool value_child(const Entity &entity) {
             if constexpr (std::is_same_v<List, type_list<>>) {
                 return true;
@@ -204,7 +249,6 @@ struct System
 #else
     template<>
     struct HasAllComponents<type_list<>> {
-        static bool value(const Entity &) { return true; }
         static bool value_child(const Entity &) { return true; }
     };
 #endif
@@ -216,13 +260,15 @@ struct System
         template<typename Self>
         static void call(Self *self, Entity &entity, const float dt) {
             static_cast<ForEachBase *>(self)->for_each_with(
-                entity, entity.template get<Cs>()..., dt);
+                entity, entity.template get<std::remove_const_t<Cs>>()...,
+                dt);
         }
         template<typename Self>
         static void call_const(const Self *self, const Entity &entity,
                                const float dt) {
             static_cast<const ForEachBase *>(self)->for_each_with(
-                entity, entity.template get<Cs>()..., dt);
+                entity, entity.template get<std::remove_const_t<Cs>>()...,
+                dt);
         }
     };
 #ifdef _WIN32
@@ -268,13 +314,17 @@ struct System
         template<typename Self>
         static void call(Self *self, Entity &entity, const float dt) {
             static_cast<ForEachBase *>(self)->for_each_with_derived(
-                entity, entity.template get_with_child<Cs>()..., dt);
+                entity,
+                entity.template get_with_child<std::remove_const_t<Cs>>()...,
+                dt);
         }
         template<typename Self>
         static void call_const(const Self *self, const Entity &entity,
                                const float dt) {
             static_cast<const ForEachBase *>(self)->for_each_with_derived(
-                entity, entity.template get_with_child<Cs>()..., dt);
+                entity,
+                entity.template get_with_child<std::remove_const_t<Cs>>()...,
+                dt);
         }
     };
 #ifdef _WIN32
@@ -313,95 +363,36 @@ struct System
     };
 #endif
 
-    template<typename...>
-    struct AllMask {
-        static TagBitset value() { return {}; }
-    };
-    template<auto... Es>
-    struct AllMask<tags::All<Es...>> {
-        static TagBitset value() {
-            TagBitset m;
-            (m.set(static_cast<TagId>(Es)), ...);
-            return m;
-        }
-    };
-    template<typename...>
-    struct AnyMask {
-        static TagBitset value() { return {}; }
-    };
-    template<auto... Es>
-    struct AnyMask<tags::Any<Es...>> {
-        static TagBitset value() {
-            TagBitset m;
-            (m.set(static_cast<TagId>(Es)), ...);
-            return m;
-        }
-    };
-    template<typename...>
-    struct NoneMask {
-        static TagBitset value() { return {}; }
-    };
-    template<auto... Es>
-    struct NoneMask<tags::None<Es...>> {
-        static TagBitset value() {
-            TagBitset m;
-            (m.set(static_cast<TagId>(Es)), ...);
-            return m;
-        }
-    };
+    static constexpr bool has_tag_requirements = Filter::has_tag_requirements;
 
-    static constexpr bool has_tag_requirements =
-        (is_tag_type<Components>::value || ...);
-
-    static TagBitset required_all_mask() {
-        static TagBitset m = (TagBitset{} | ... | AllMask<Components>::value());
-        return m;
-    }
-
-    static TagBitset required_any_mask() {
-        static TagBitset m = (TagBitset{} | ... | AnyMask<Components>::value());
-        return m;
-    }
-
-    static TagBitset forbidden_mask() {
-        static TagBitset m =
-            (TagBitset{} | ... | NoneMask<Components>::value());
-        return m;
+    static bool tags_ok(const Entity &entity) {
+        return Filter::tags_ok(entity);
     }
 
-    static bool tags_ok(const Entity &entity) {
-        if constexpr (!has_tag_requirements) {
-            (void) entity;
-            return true;
-        } else {
-            const TagBitset &all = required_all_mask();
-            const TagBitset &any = required_any_mask();
-            const TagBitset &none = forbidden_mask();
-            if (all.any() && !entity.hasAllTags(all)) return false;
-            if (any.any() && !entity.hasAnyTag(any)) return false;
-            if (none.any() && !entity.hasNoTags(none)) return false;
-            return true;
-        }
+    bool changes_ok(const Entity &entity) const {
+        return Filter::changes_ok(entity, last_run_tick);
     }
 
     void for_each(Entity &entity, const float dt) {
-        if (!tags_ok(entity)) return;
-        bool has_all = HasAllComponents<ComponentsOnly>::value(entity);
-        if (has_all) {
+        if (!tags_ok(entity) || !changes_ok(entity)) return;
+        if (components_ok(entity)) {
+            if (counting_matches) ++detail::profiled_matches();
             CallWithComponents<ComponentsOnly>::call(this, entity, dt);
         }
     }
 
     void for_each_derived(Entity &entity, const float dt) {
-        if (!tags_ok(entity)) return;
+        if (!tags_ok(entity) || !changes_ok(entity)) return;
         if (HasAllComponents<ComponentsOnly>::value_child(entity)) {
+            if (counting_matches) ++detail::profiled_matches();
             CallWithChildComponents<ComponentsOnly>::call(this, entity, dt);
         }
     }
 
     void for_each_derived(const Entity &entity, const float dt) const {
-        if (!tags_ok(entity)) return;
+        if (!tags_ok(entity) || !changes_ok(entity)) return;
         if (HasAllComponents<ComponentsOnly>::value_child(entity)) {
+            if (counting_matches) ++detail::profiled_matches();
             CallWithChildComponents<ComponentsOnly>::call_const(this, entity,
                                                                 dt);
         }
@@ -412,8 +403,9 @@ struct System
                                        const float) const {}
 
     void for_each(const Entity &entity, const float dt) const {
-        if (!tags_ok(entity)) return;
-        if (HasAllComponents<ComponentsOnly>::value(entity)) {
+        if (!tags_ok(entity) || !changes_ok(entity)) return;
+        if (components_ok(entity)) {
+            if (counting_matches) ++detail::profiled_matches();
             CallWithComponents<ComponentsOnly>::call_const(this, entity, dt);
         }
     }
@@ -429,26 +421,154 @@ struct CallbackSystem : System<> {
     void once(const float dt) override { cb_(dt); }
 };
 
+// When new entities created during the update phase join the entity list.
+// - EverySystem: after each update system, so the next one already sees
+//   them (the original behaviour).
+// - EndOfPhase: once, when the phase ends and the command buffer is flushed.
+//   Systems see a stable list for the whole phase.
+enum struct MergePolicy {
+    EverySystem,
+    EndOfPhase,
+};
+
 struct SystemManager {
     constexpr static float FIXED_TICK_RATE = 1.f / 120.f;
     float accumulator = 0.f;
+    // Most fixed steps one run() takes. A frame that falls further behind
+    // drops the rest of its backlog (see dropped_fixed_steps) instead of
+    // making the next frame longer still. 0 = no limit.
+    int max_fixed_steps = 8;
+    MergePolicy merge_policy = MergePolicy::EverySystem;
 
     std::vector<std::unique_ptr<SystemBase>> update_systems_;
     std::vector<std::unique_ptr<SystemBase>> fixed_update_systems_;
     std::vector<std::unique_ptr<SystemBase>> render_systems_;
 
     void register_update_system(std::unique_ptr<SystemBase> system) {
+        system->command_buffer = commands_.get();
+        if (system->set.empty()) system->set = current_set_;
         update_systems_.emplace_back(std::move(system));
     }
 
     void register_fixed_update_system(std::unique_ptr<SystemBase> system) {
+        system->command_buffer = commands_.get();
+        if (system->set.empty()) system->set = current_set_;
         fixed_update_systems_.emplace_back(std::move(system));
     }
 
     void register_render_system(std::unique_ptr<SystemBase> system) {
+        system->command_buffer = commands_.get();
+        if (system->set.empty()) system->set = current_set_;
         render_systems_.emplace_back(std::move(system));
     }
 
+    // The same, naming the system after S (see SystemBase::name).
+    template<IsSystem S>
+    void register_update_system(std::unique_ptr<S> system) {
+        register_update_system(named(std::move(system)));
+    }
+
+    template<IsSystem S>
+    void register_fixed_update_system(std::unique_ptr<S> system) {
+        register_fixed_update_system(named(std::move(system)));
+    }
+
+    template<IsSystem S>
+    void register_render_system(std::unique_ptr<S> system) {
+        register_render_system(named(std::move(system)));
+    }
+
+    // Systems registered while the returned scope lives join the set `name`:
+    //
+    //   {
+    //       const auto scope = sm.in_set("ui.validation");
+    //       sm.register_update_system(std::make_unique<ValidateZeroSize>());
+    //   }
+    //   sm.set_enabled("ui.validation", false);
+    class SetScope {
+       public:
+        SetScope(SystemManager &sm, const std::string_view name)
+            : sm_(sm), previous_(sm.current_set_) {
+            sm_.current_set_ = sm_.schedule_.intern(name);
+        }
+        ~SetScope() { sm_.current_set_ = previous_; }
+        SetScope(const SetScope &) = delete;
+        SetScope &operator=(const SetScope &) = delete;
+
+       private:
+        SystemManager &sm_;
+        std::string_view previous_;
+    };
+
+    [[nodiscard]] SetScope in_set(const std::string_view name) {
+        return SetScope(*this, name);
+    }
+
+    // Within each phase, everything labelled `first` runs before everything
+    // labelled `then`. A label is a set name or a system's name (its type,
+    // for systems registered through a typed unique_ptr). Systems no
+    // constraint mentions keep their registration order; the order is
+    // worked out once, on the next run after a change.
+    void order(const std::string_view first, const std::string_view then) {
+        schedule_.order(first, then);
+    }
+
+    template<IsSystem First, IsSystem Then>
+    void order() {
+        order(type_name<First>(), type_name<Then>());
+    }
+
+    // Turn a set (or one system, by name) off or back on. Disabled systems
+    // are left out of the run order, so they cost nothing per frame; their
+    // match caches catch up when they come back.
+    void set_enabled(const std::string_view label, const bool on) {
+        schedule_.set_enabled(label, on);
+    }
+
+    [[nodiscard]] bool is_enabled(const std::string_view label) const {
+        return schedule_.enabled(label);
+    }
+
+    // Run the systems labelled `label` (see order) only on frames where
+    // condition() returns true. It is called at most once per frame, when
+    // the first of those systems comes up, however many systems share it:
+    //
+    //   sm.run_if("ui.drag", [] {
+    //       auto *drag = EntityHelper::get_singleton_cmp<DragGroupState>();
+    //       return drag && drag->dragging;
+    //   });
+    //
+    // A system whose condition fails is skipped outright: no should_run,
+    // once, entity loop or after.
+    void run_if(const std::string_view label,
+                std::function<bool()> condition) {
+        schedule_.run_if(label, std::move(condition));
+    }
+
+    // Shared by every registered system. Flushed (applied, then merged) at
+    // the end of each fixed step, the update phase and the render phase.
+    [[nodiscard]] EntityCommandBuffer &commands() { return *commands_; }
+
+    // A sync point on demand: apply pending commands and merge.
+    void flush_commands() {
+        commands_->bind(collection());
+        commands_->flush();
+    }
+
+    // The collection systems run against. Unbound (the default), it is
+    // EntityHelper's default collection for the calling thread. Once bound,
+    // each phase makes it the default for the calling thread and the worker
+    // threads while it runs, so EntityHelper and EntityQuery calls inside
+    // systems reach it too. See World.
+    void bind_collection(EntityCollection &collection) {
+        collection_ = &collection;
+    }
+
+    [[nodiscard]] EntityCollection &collection() const {
+        return collection_ ? *collection_
+                           : EntityHelper::get_default_collection();
+    }
+
     void register_update_system(const std::function<void(float)> &cb) {
         register_update_system(std::make_unique<CallbackSystem>(cb));
     }
@@ -461,95 +581,335 @@ struct SystemManager {
         register_render_system(std::make_unique<CallbackSystem>(cb));
     }
 
-    void tick(Entities &entities, const float dt) {
-        for (auto &system : update_systems_) {
-            if (!system->should_run(dt)) continue;
-            system->once(dt);
-            if (system->should_iterate()) {
-                system->on_iteration_begin(dt);
-                // Index-based so a push_back to entities (e.g. a for_each that
-                // triggers a merge) doesn't invalidate our iterator.
-                const std::size_t entity_count = entities.size();
-                for (std::size_t idx = 0; idx < entity_count; ++idx) {
-                    const auto &entity = entities[idx];
-                    if (!entity) continue;
-                    if (system->include_derived_children)
-                        system->for_each_derived(*entity, dt);
-                    else
-                        system->for_each(*entity, dt);
-                }
-                system->on_iteration_end(dt);
+    // Worker threads for systems that declare Read<>/Write<> access. With
+    // none (the default) every system runs on the calling thread.
+    //
+    // With workers, update and fixed-update systems are grouped: a run of
+    // consecutive declared systems that don't conflict with each other forms
+    // a batch. A batch calls should_run/once for each member in order, then
+    // runs all their for_each calls together in chunks of
+    // parallel_chunk_size entities, then after() for each member in order.
+    // Render systems always run on the calling thread.
+    void set_worker_count(const std::size_t threads) {
+        workers_ = threads > 0 ? std::make_unique<WorkerPool>(threads)
+                               : nullptr;
+        while (frame_arenas_.size() < threads + 1)
+            frame_arenas_.push_back(make_frame_arena());
+    }
+
+    [[nodiscard]] std::size_t worker_count() const {
+        return workers_ ? workers_->concurrency() - 1 : 0;
+    }
+
+    // The pool behind set_worker_count, for systems that split their own
+    // work; null without workers. Replaced by the next set_worker_count.
+    [[nodiscard]] WorkerPool *worker_pool() const { return workers_.get(); }
+
+    std::size_t parallel_chunk_size = 256;
+
+    // Bytes each thread's frame arena starts with. They grow to the largest
+    // frame seen, so this only saves the first few frames' heap calls.
+    static constexpr std::size_t frame_arena_bytes = 64 * 1024;
+
+    // The frame arena (see frame_arena()) of the thread that calls run():
+    // what systems allocate from when they run there.
+    [[nodiscard]] Arena &main_frame_arena() { return *frame_arenas_[0]; }
+
+    // fn(const Arena &) for the calling thread's arena and each worker's.
+    template<typename Fn>
+    void for_each_frame_arena(Fn &&fn) const {
+        for (const auto &arena : frame_arenas_) fn(*arena);
+    }
+
+    // Per-system timing and traces; off until profiler().enable().
+    [[nodiscard]] SystemProfiler &profiler() { return profiler_; }
+    [[nodiscard]] const SystemProfiler &profiler() const { return profiler_; }
+
+    // Heap traffic of the last run() and the most bytes live at once during
+    // it. Zero unless the allocation hook is linked in (see
+    // memory/alloc_hook.h); a steady-state frame should show no
+    // allocations. Per system, see SystemBase::allocations.
+    [[nodiscard]] const alloc_tracking::Window &frame_allocations() const {
+        return frame_allocations_;
+    }
+
+    // Free everything systems took from their frame arenas. run() does
+    // this at the end of every frame; loops that call tick/render directly
+    // call it themselves once nothing from the frame is in use.
+    void reset_frame_arenas() {
+        for (auto &arena : frame_arenas_) arena->reset();
+    }
+
+    // The synced match cache to walk for `system` over `entities`, or null
+    // if the whole list has to be scanned. The cache only applies to the
+    // collection's own list and systems with a component signature.
+    const std::vector<std::uint32_t> *matched_positions(SystemBase &system,
+                                                        Entities &entities) {
+        EntityCollection &coll = collection();
+        if (&entities != &coll.get_entities_for_mod()) return nullptr;
+        return system.synced_matches(coll);
+    }
+
+    // Visit items [begin, end) of `positions`, or of `entities` itself when
+    // positions is null. for_each still checks each entity, because an
+    // earlier for_each may have changed it; an entity that starts matching
+    // midway through is picked up next time. Returns how many entities it
+    // handed to for_each.
+    template<bool AsConst>
+    static std::size_t visit_range(SystemBase &system, Entities &entities,
+                            const std::vector<std::uint32_t> *positions,
+                            const std::size_t begin, const std::size_t end,
+                            const float dt) {
+        std::size_t visited = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            const std::size_t idx = positions ? (*positions)[i] : i;
+            if (idx >= entities.size()) continue;
+            const auto &entity = entities[idx];
+            if (!entity) continue;
+            ++visited;
+            if constexpr (AsConst) {
+                const SystemBase &sys = system;
+                const Entity &e = *entity;
+                if (sys.include_derived_children)
+                    sys.for_each_derived(e, dt);
+                else
+                    sys.for_each(e, dt);
+            } else {
+                if (system.include_derived_children)
+                    system.for_each_derived(*entity, dt);
+                else
+                    system.for_each(*entity, dt);
             }
-            system->after(dt);
-            EntityHelper::merge_entity_arrays();
         }
+        return visited;
     }
 
-    void fixed_tick(Entities &entities, const float dt) {
-        for (auto &system : fixed_update_systems_) {
-            if (!system->should_run(dt)) continue;
-            system->once(dt);
-            if (system->should_iterate()) {
-                system->on_iteration_begin(dt);
-                // Index-based so a push_back to entities (e.g. a for_each that
-                // triggers a merge) doesn't invalidate our iterator.
-                const std::size_t entity_count = entities.size();
-                for (std::size_t idx = 0; idx < entity_count; ++idx) {
-                    const auto &entity = entities[idx];
-                    if (!entity) continue;
-                    if (system->include_derived_children)
-                        system->for_each_derived(*entity, dt);
-                    else
-                        system->for_each(*entity, dt);
-                }
-                system->on_iteration_end(dt);
+    template<bool AsConst>
+    std::size_t for_each_entity(SystemBase &system, Entities &entities,
+                         const float dt) {
+        const std::vector<std::uint32_t> *positions =
+            matched_positions(system, entities);
+        // Bounds are fixed up front and the loop is index-based, so a
+        // push_back to entities (e.g. a for_each that triggers a merge)
+        // doesn't invalidate it.
+        const std::size_t count =
+            positions ? positions->size() : entities.size();
+        return visit_range<AsConst>(system, entities, positions, 0, count,
+                                    dt);
+    }
+
+    ChangeTicks &change_ticks() const {
+        return collection().component_storage().ticks;
+    }
+
+    // Changes stamped while a system runs carry that run's tick, so the
+    // system doesn't see its own writes next time; everything after it
+    // (later systems, code between frames) gets a newer one.
+    void finish_run(SystemBase &system, const std::uint32_t this_run) const {
+        system.last_run_tick = this_run;
+        ChangeTicks &ticks = change_ticks();
+        ticks.now = std::max(ticks.now, this_run + 1);
+    }
+
+    bool run_system(SystemBase &system, Entities &entities, const float dt) {
+        if (!schedule_.conditions_hold(system)) return false;
+        const alloc_tracking::ScopedTag tag(system.allocations);
+        if (!system.should_run(dt)) return false;
+        const std::uint32_t this_run = change_ticks().now;
+        PhaseClock clock = phase_clock(system);
+        if (clock.profile) ++clock.profile->current.runs;
+        system.once(dt);
+        clock.lap(&SystemTiming::once_ms, "once");
+        if (system.should_iterate()) {
+            const std::uint64_t matched = detail::profiled_matches();
+            system.on_iteration_begin(dt);
+            const std::size_t visited =
+                for_each_entity<false>(system, entities, dt);
+            system.on_iteration_end(dt);
+            clock.count(visited, detail::profiled_matches() - matched);
+            clock.lap(&SystemTiming::for_each_ms, "for_each");
+        }
+        system.after(dt);
+        clock.lap(&SystemTiming::after_ms, "after");
+        finish_run(system, this_run);
+        return true;
+    }
+
+    void run_systems(const std::vector<SystemBase *> &systems,
+                     Entities &entities, const float dt,
+                     const bool merge_after_each) {
+        std::size_t i = 0;
+        while (i < systems.size()) {
+            SystemBase &system = *systems[i];
+            if (!workers_ || !system.declares_access) {
+                if (run_system(system, entities, dt) && merge_after_each)
+                    collection().merge_entity_arrays();
+                ++i;
+                continue;
+            }
+
+            batch_.clear();
+            batch_.push_back(&system);
+            std::size_t j = i + 1;
+            for (; j < systems.size(); ++j) {
+                SystemBase &next = *systems[j];
+                if (!next.declares_access) break;
+                const bool conflicts = std::any_of(
+                    batch_.begin(), batch_.end(), [&](const SystemBase *s) {
+                        return s->conflicts_with(next);
+                    });
+                if (conflicts) break;
+                batch_.push_back(&next);
             }
-            system->after(dt);
+            if (run_batch(entities, dt) && merge_after_each)
+                collection().merge_entity_arrays();
+            i = j;
         }
     }
 
-    void render(Entities &entities, const float dt) {
-        for (auto &system : render_systems_) {
-            if (!system->should_run(dt)) continue;
-            system->once(dt);
-            if (system->should_iterate()) {
-                system->on_iteration_begin(dt);
-                // Index-based so a push_back to entities (e.g. a for_each that
-                // triggers a merge) doesn't invalidate our iterator.
-                const std::size_t entity_count = entities.size();
-                for (std::size_t idx = 0; idx < entity_count; ++idx) {
-                    const auto &entity = entities[idx];
-                    if (!entity) continue;
-                    if (system->include_derived_children)
-                        system->for_each_derived(*entity, dt);
-                    else
-                        system->for_each(*entity, dt);
-                }
-                system->on_iteration_end(dt);
+    bool run_batch(Entities &entities, const float dt) {
+        std::erase_if(batch_, [this, dt](SystemBase *s) {
+            return !schedule_.conditions_hold(*s) || !s->should_run(dt);
+        });
+        if (batch_.empty()) return false;
+
+        const std::uint32_t this_run = change_ticks().now;
+        for (SystemBase *s : batch_) {
+            const alloc_tracking::ScopedTag tag(s->allocations);
+            PhaseClock clock = phase_clock(*s);
+            if (clock.profile) ++clock.profile->current.runs;
+            s->once(dt);
+            clock.lap(&SystemTiming::once_ms, "once");
+        }
+
+        jobs_.clear();
+        const std::size_t chunk = std::max<std::size_t>(1, parallel_chunk_size);
+        for (SystemBase *s : batch_) {
+            if (!s->should_iterate()) continue;
+            const alloc_tracking::ScopedTag tag(s->allocations);
+            PhaseClock clock = phase_clock(*s);
+            s->on_iteration_begin(dt);
+            clock.lap(&SystemTiming::for_each_ms, "on_iteration_begin");
+            const std::vector<std::uint32_t> *positions =
+                matched_positions(*s, entities);
+            const std::size_t count =
+                positions ? positions->size() : entities.size();
+            for (std::size_t b = 0; b < count; b += chunk)
+                jobs_.push_back({s, positions, b, std::min(count, b + chunk)});
+        }
+        // Two pointers of captures fit std::function's inline buffer, so
+        // handing the job over doesn't allocate.
+        const BatchFrame frame{&entities, dt, profiler_.enabled()};
+        workers_->run(jobs_.size(), [this, &frame](const std::size_t k) {
+            const EntityHelper::ScopedDefaultCollection scope(collection());
+            const std::size_t thread = workers_->thread_index();
+            const ScopedFrameArena arena(*frame_arenas_[thread]);
+            ParallelJob &job = jobs_[k];
+            const alloc_tracking::ScopedTag tag(job.system->allocations);
+            if (!frame.profiling) {
+                visit_range<false>(*job.system, *frame.entities, job.positions,
+                                   job.begin, job.end, frame.dt);
+                return;
+            }
+            const std::uint64_t matched = detail::profiled_matches();
+            job.start = SystemProfiler::Clock::now();
+            job.visited = visit_range<false>(*job.system, *frame.entities,
+                                             job.positions, job.begin, job.end,
+                                             frame.dt);
+            job.end_time = SystemProfiler::Clock::now();
+            job.matched = detail::profiled_matches() - matched;
+            job.thread = thread;
+        });
+        if (frame.profiling) record_jobs();
+        for (SystemBase *s : batch_) {
+            if (!s->should_iterate()) continue;
+            const alloc_tracking::ScopedTag tag(s->allocations);
+            PhaseClock clock = phase_clock(*s);
+            s->on_iteration_end(dt);
+            clock.lap(&SystemTiming::for_each_ms, "on_iteration_end");
+        }
+        for (SystemBase *s : batch_) {
+            const alloc_tracking::ScopedTag tag(s->allocations);
+            PhaseClock clock = phase_clock(*s);
+            s->after(dt);
+            clock.lap(&SystemTiming::after_ms, "after");
+        }
+        for (SystemBase *s : batch_) finish_run(*s, this_run);
+        return true;
+    }
+
+    // Drop signature journal entries every match cache has already seen.
+    void trim_signature_journal(EntityCollection &collection) {
+        SignatureJournal &journal = collection.component_storage().journal;
+        std::size_t oldest = journal.end();
+        // Disabled systems don't hold it back; they rebuild when enabled.
+        for (const auto *phase : {&update_order_, &fixed_update_order_,
+                                  &render_order_}) {
+            for (const SystemBase *system : phase->systems) {
+                const EntityMatchCache &cache = system->match_cache;
+                if (cache.collection == &collection &&
+                    cache.epoch == journal.epoch)
+                    oldest = std::min(oldest, cache.journal_cursor);
             }
-            system->after(dt);
+        }
+        journal.trim_to(oldest);
+    }
+
+    void tick(Entities &entities, const float dt) {
+        if (!in_run_) schedule_.new_frame();
+        const EntityHelper::ScopedDefaultCollection scope(collection());
+        const ScopedFrameArena arena(main_frame_arena());
+        commands_->bind(collection());
+        run_systems(scheduled(update_systems_, update_order_), entities, dt,
+                    merge_policy == MergePolicy::EverySystem);
+        flush_commands();
+    }
+
+    void fixed_tick(Entities &entities, const float dt) {
+        if (!in_run_) schedule_.new_frame();
+        const EntityHelper::ScopedDefaultCollection scope(collection());
+        const ScopedFrameArena arena(main_frame_arena());
+        commands_->bind(collection());
+        run_systems(scheduled(fixed_update_systems_, fixed_update_order_),
+                    entities, dt, false);
+        flush_commands();
+    }
+
+    void render(Entities &entities, const float dt) {
+        if (!in_run_) schedule_.new_frame();
+        const EntityHelper::ScopedDefaultCollection scope(collection());
+        const ScopedFrameArena arena(main_frame_arena());
+        const detail::ScopedInterpolationAlpha alpha(fixed_alpha());
+        commands_->bind(collection());
+        for (SystemBase *system : scheduled(render_systems_, render_order_)) {
+#ifndef AFTERHOURS_SINGLE_RENDER_PASS
+            const std::uint32_t since = system->last_run_tick;
+#endif
+            if (!run_system(*system, entities, dt)) continue;
 #ifndef AFTERHOURS_SINGLE_RENDER_PASS
+            const alloc_tracking::ScopedTag tag(system->allocations);
+            PhaseClock clock = phase_clock(*system);
+            // The const pass belongs to the same run: same change window.
+            const std::uint32_t ran =
+                std::exchange(system->last_run_tick, since);
             const SystemBase &sys = *system;
             sys.once(dt);
+            clock.lap(&SystemTiming::once_ms, "once");
             if (sys.should_iterate()) {
+                const std::uint64_t matched = detail::profiled_matches();
                 sys.on_iteration_begin(dt);
-                // Index-based so a push_back to entities doesn't invalidate our
-                // iterator (see note in tick).
-                const std::size_t entity_count = entities.size();
-                for (std::size_t idx = 0; idx < entity_count; ++idx) {
-                    const auto &entity = entities[idx];
-                    if (!entity) continue;
-                    const Entity &e = *entity;
-                    if (sys.include_derived_children)
-                        sys.for_each_derived(e, dt);
-                    else
-                        sys.for_each(e, dt);
-                }
+                const std::size_t visited =
+                    for_each_entity<true>(*system, entities, dt);
                 sys.on_iteration_end(dt);
+                clock.count(visited, detail::profiled_matches() - matched);
+                clock.lap(&SystemTiming::for_each_ms, "for_each");
             }
             sys.after(dt);
+            clock.lap(&SystemTiming::after_ms, "after");
+            system->last_run_tick = ran;
 #endif
         }
+        flush_commands();
     }
 
     void tick_all(Entities &entities, const float dt) { tick(entities, dt); }
@@ -558,26 +918,244 @@ struct SystemManager {
         accumulator += dt;
         int num_ticks = (int) std::floor(accumulator / FIXED_TICK_RATE);
         accumulator -= (float) num_ticks * FIXED_TICK_RATE;
+        if (max_fixed_steps > 0 && num_ticks > max_fixed_steps) {
+            dropped_fixed_steps_ +=
+                static_cast<std::uint64_t>(num_ticks - max_fixed_steps);
+            num_ticks = max_fixed_steps;
+        }
 
         while (num_ticks > 0) {
+            save_previous(entities);
             fixed_tick(entities, FIXED_TICK_RATE);
             num_ticks--;
         }
     }
 
+    // How far, in [0, 1), the leftover time reaches towards the next fixed
+    // step. Render systems read it as interpolation_alpha().
+    [[nodiscard]] float fixed_alpha() const {
+        return std::clamp(accumulator / FIXED_TICK_RATE, 0.f, 1.f);
+    }
+
+    // Fixed steps skipped so far because a frame needed more than
+    // max_fixed_steps.
+    [[nodiscard]] std::uint64_t dropped_fixed_steps() const {
+        return dropped_fixed_steps_;
+    }
+
+    // Keep each entity's T from before the latest fixed step in its
+    // Previous<T> (see interpolation.h). A copy-assignable T is assigned;
+    // otherwise T must opt in to a byte copy with is_plain_component, or
+    // pass copy(const T &from, T &to).
+    template<typename T>
+    void keep_previous() {
+        if constexpr (std::is_copy_assignable_v<T>) {
+            keep_previous<T>([](const T &from, T &to) { to = from; });
+        } else {
+            static_assert(is_plain_component<T>::value,
+                          "keep_previous<T>() can't copy T: make it "
+                          "copy-assignable, specialize is_plain_component "
+                          "for it, or pass a copy function");
+            keep_previous<T>(detail::copy_payload<T>);
+        }
+    }
+
+    template<typename T, typename Copy>
+    void keep_previous(Copy copy) {
+        static_assert(std::is_base_of_v<BaseComponent, T>,
+                      "Component must inherit from BaseComponent");
+        static_assert(std::is_default_constructible_v<T>,
+                      "Previous<T> default-constructs its T");
+        const ComponentID id = components::get_type_id<T>();
+        std::erase_if(previous_copies_,
+                      [id](const PreviousCopy &c) { return c.id == id; });
+        previous_copies_.push_back(
+            {id, [copy](Entities &entities) {
+                 for (const auto &entity : entities) {
+                     if (!entity || !entity->has<T>()) continue;
+                     Entity &e = *entity;
+                     Previous<T> &prev = e.has<Previous<T>>()
+                                             ? e.get<Previous<T>>()
+                                             : e.addComponent<Previous<T>>();
+                     copy(e.get<T>(), prev.value);
+                 }
+             }});
+    }
+
     void render_all(const float dt) {
-        auto &entities = EntityHelper::get_entities_for_mod();
+        auto &entities = collection().get_entities_for_mod();
         render(entities, dt);
     }
 
     void run(const float dt) {
-        auto &entities = EntityHelper::get_entities_for_mod();
+        const bool track_allocations = alloc_tracking::installed();
+        if (track_allocations) start_allocation_frame();
+        const bool profiling = profiler_.enabled();
+        if (profiling) profiler_.begin_frame();
+        // Run conditions are worked out once for the whole frame, fixed
+        // steps included; tick/render called on their own do it per call.
+        schedule_.new_frame();
+        in_run_ = true;
+        EntityCollection &coll = collection();
+        const EntityHelper::ScopedDefaultCollection scope(coll);
+        auto &entities = coll.get_entities_for_mod();
         fixed_tick_all(entities, dt);
         tick_all(entities, dt);
 
-        EntityHelper::cleanup();
+        coll.cleanup();
 
         render_all(dt);
+        in_run_ = false;
+        trim_signature_journal(coll);
+        reset_frame_arenas();
+        if (track_allocations) frame_allocations_.end();
+        if (profiling) profiler_.end_frame();
+    }
+
+   private:
+    struct ParallelJob {
+        SystemBase *system;
+        const std::vector<std::uint32_t> *positions;
+        std::size_t begin;
+        std::size_t end;
+        // Filled in by the job while profiling.
+        SystemProfiler::Clock::time_point start{};
+        SystemProfiler::Clock::time_point end_time{};
+        std::size_t visited = 0;
+        std::uint64_t matched = 0;
+        std::size_t thread = 0;
+    };
+    struct BatchFrame {
+        Entities *entities;
+        float dt;
+        bool profiling;
+    };
+    // One phase's run order, and what it was built from.
+    struct PhaseOrder {
+        std::vector<SystemBase *> systems;
+        std::uint64_t version = 0;
+        std::size_t registered = 0;
+    };
+
+    const std::vector<SystemBase *> &scheduled(
+        const std::vector<std::unique_ptr<SystemBase>> &systems,
+        PhaseOrder &order) {
+        if (order.version != schedule_.version() ||
+            order.registered != systems.size()) {
+            schedule_.build(systems, order.systems);
+            order.version = schedule_.version();
+            order.registered = systems.size();
+        }
+        return order.systems;
     }
+
+    struct PreviousCopy {
+        ComponentID id;
+        std::function<void(Entities &)> copy;
+    };
+
+    void save_previous(Entities &entities) {
+        if (previous_copies_.empty()) return;
+        const EntityHelper::ScopedDefaultCollection scope(collection());
+        for (const PreviousCopy &c : previous_copies_) c.copy(entities);
+    }
+
+    // Times consecutive phases of one system run; does nothing unless
+    // profiling is on.
+    struct PhaseClock {
+        SystemProfiler *profiler = nullptr;
+        SystemProfile *profile = nullptr;
+        SystemProfiler::Clock::time_point start{};
+
+        void lap(float SystemTiming::*field, const std::string_view phase) {
+            if (!profile) return;
+            const SystemProfiler::Clock::time_point now =
+                SystemProfiler::Clock::now();
+            profile->current.*field += SystemProfiler::ms(now - start);
+            profiler->trace(profile->name, phase, 0, start, now);
+            start = now;
+        }
+
+        void count(const std::size_t visited, const std::uint64_t matched) {
+            if (!profile) return;
+            profile->current.visited += visited;
+            profile->current.matched += matched;
+        }
+    };
+
+    SystemProfile *profile_of(SystemBase &system) {
+        SystemProfile *profile = profiler_.profile(
+            system.profile_slot,
+            system.name.empty() ? "(unnamed system)" : system.name);
+        system.counting_matches = profile != nullptr;
+        return profile;
+    }
+
+    PhaseClock phase_clock(SystemBase &system) {
+        SystemProfile *profile = profile_of(system);
+        if (!profile) return {};
+        return {&profiler_, profile, SystemProfiler::Clock::now()};
+    }
+
+    // Charge each finished job to its system's for_each.
+    void record_jobs() {
+        for (const ParallelJob &job : jobs_) {
+            SystemProfile *profile = profile_of(*job.system);
+            if (!profile) continue;
+            profile->current.for_each_ms +=
+                SystemProfiler::ms(job.end_time - job.start);
+            profile->current.visited += job.visited;
+            profile->current.matched += job.matched;
+            profiler_.trace(profile->name, "for_each", job.thread, job.start,
+                            job.end_time);
+        }
+    }
+
+    template<IsSystem S>
+    static std::unique_ptr<SystemBase> named(std::unique_ptr<S> system) {
+        if (system->name.empty()) system->name = type_name<S>();
+        return system;
+    }
+
+    void start_allocation_frame() {
+        frame_allocations_.begin();
+        for (const auto *systems :
+             {&update_systems_, &fixed_update_systems_, &render_systems_}) {
+            for (const auto &system : *systems) system->allocations.reset();
+        }
+    }
+
+    static std::unique_ptr<Arena> make_frame_arena() {
+        return std::make_unique<Arena>(frame_arena_bytes,
+                                       Arena::DEFAULT_ALIGNMENT,
+                                       ArenaGrowth::Grow);
+    }
+
+    EntityCollection *collection_ = nullptr;
+    // Heap-allocated so the pointer systems hold survives moving the manager.
+    std::unique_ptr<EntityCommandBuffer> commands_ =
+        std::make_unique<EntityCommandBuffer>();
+    std::unique_ptr<WorkerPool> workers_;
+    // Reused every batch so a steady-state frame doesn't allocate.
+    std::vector<SystemBase *> batch_;
+    std::vector<ParallelJob> jobs_;
+    alloc_tracking::Window frame_allocations_;
+    SystemProfiler profiler_;
+    std::vector<PreviousCopy> previous_copies_;
+    SystemSchedule schedule_;
+    std::string_view current_set_;
+    bool in_run_ = false;
+    PhaseOrder update_order_;
+    PhaseOrder fixed_update_order_;
+    PhaseOrder render_order_;
+    std::uint64_t dropped_fixed_steps_ = 0;
+    // One per thread that runs systems, indexed by WorkerPool::thread_index
+    // (0 is the calling thread). Heap-allocated so arenas in use survive
+    // set_worker_count adding more.
+    std::vector<std::unique_ptr<Arena>> frame_arenas_ = [] {
+        std::vector<std::unique_ptr<Arena>> arenas;
+        arenas.push_back(make_frame_arena());
+        return arenas;
+    }();
 };
 }  // namespace afterhours
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../logging.h"
+
+namespace afterhours {
+
+// The last `capacity` values of something measured once a frame.
+class RollingSamples {
+public:
+  static constexpr std::size_t capacity = 120;
+
+  void push(const float value) {
+    samples_[next_] = value;
+    next_ = (next_ + 1) % capacity;
+    size_ = std::min(size_ + 1, capacity);
+  }
+
+  [[nodiscard]] std::size_t size() const { return size_; }
+
+  [[nodiscard]] float latest() const {
+    return size_ == 0 ? 0.f : samples_[(next_ + capacity - 1) % capacity];
+  }
+
+  [[nodiscard]] float average() const {
+    if (size_ == 0)
+      return 0.f;
+    float sum = 0.f;
+    for (std::size_t i = 0; i < size_; ++i)
+      sum += samples_[i];
+    return sum / static_cast<float>(size_);
+  }
+
+  // Nearest-rank percentile, p in [0, 1].
+  [[nodiscard]] float percentile(const float p) const {
+    if (size_ == 0)
+      return 0.f;
+    std::array<float, capacity> sorted = samples_;
+    const auto rank = static_cast<std::size_t>(
+        std::clamp(p, 0.f, 1.f) * static_cast<float>(size_ - 1) + 0.5f);
+    std::nth_element(sorted.begin(), sorted.begin() + rank,
+                     sorted.begin() + size_);
+    return sorted[rank];
+  }
+
+  [[nodiscard]] float p99() const { return percentile(0.99f); }
+
+private:
+  std::array<float, capacity> samples_{};
+  std::size_t next_ = 0;
+  std::size_t size_ = 0;
+};
+
+// One system's share of one frame. Times are in milliseconds; the parts of
+// a parallel for_each that ran on worker threads are summed, so for_each_ms
+// can exceed the frame's wall time.
+struct SystemTiming {
+  // once()
+  float once_ms = 0.f;
+  // on_iteration_begin(), the entity loop and on_iteration_end()
+  float for_each_ms = 0.f;
+  // after()
+  float after_ms = 0.f;
+  // Entities the loop handed to for_each, and how many of them passed the
+  // system's filter.
+  std::uint64_t visited = 0;
+  std::uint64_t matched = 0;
+  // Runs this frame: fixed-update systems may run several times or not at
+  // all.
+  std::uint32_t runs = 0;
+
+  [[nodiscard]] float total_ms() const {
+    return once_ms + for_each_ms + after_ms;
+  }
+};
+
+struct SystemProfile {
+  std::string_view name;
+  // The last finished frame, and the one in progress.
+  SystemTiming last;
+  SystemTiming current;
+  // last.total_ms() of recent frames.
+  RollingSamples total_ms;
+};
+
+namespace detail {
+// Entities that passed a system's filter on this thread, counted only for
+// systems being profiled (SystemBase::counting_matches).
+inline std::uint64_t &profiled_matches() {
+  thread_local std::uint64_t count = 0;
+  return count;
+}
+} // namespace detail
+
+// Per-system timing for a SystemManager (see SystemManager::profiler()).
+// Off by default; while off, the manager doesn't read the clock at all.
+// Frame numbers come from run(), which brackets each frame with
+// begin_frame() and end_frame().
+//
+// A trace records every system phase, worker jobs included, as Chrome trace
+// events; open the file in chrome://tracing or ui.perfetto.dev:
+//
+//   systems.profiler().enable();
+//   systems.profiler().start_trace();
+//   for (int i = 0; i < 100; ++i) systems.run(dt);
+//   systems.profiler().write_trace("frames.json");
+class SystemProfiler {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::size_t no_slot =
+      std::numeric_limits<std::size_t>::max();
+
+  void enable(const bool on = true) { enabled_ = on; }
+  [[nodiscard]] bool enabled() const { return enabled_; }
+
+  // The profile stored at `slot` (a SystemBase::profile_slot), made on first
+  // use. Null while profiling is off.
+  SystemProfile *profile(std::size_t &slot, const std::string_view name) {
+    if (!enabled_)
+      return nullptr;
+    if (slot == no_slot) {
+      slot = profiles_.size();
+      profiles_.emplace_back().name = name;
+    }
+    return &profiles_[slot];
+  }
+
+  // In the order systems first ran while profiling was on. Entries stay put
+  // as more are added.
+  [[nodiscard]] const std::deque<SystemProfile> &profiles() const {
+    return profiles_;
+  }
+
+  // Wall time of recent run() calls.
+  [[nodiscard]] const RollingSamples &frame_ms() const { return frame_ms_; }
+
+  void begin_frame() {
+    frame_start_ = Clock::now();
+    for (SystemProfile &p : profiles_)
+      p.current = {};
+  }
+
+  void end_frame() {
+    const Clock::time_point end = Clock::now();
+    frame_ms_.push(ms(end - frame_start_));
+    for (SystemProfile &p : profiles_) {
+      p.last = p.current;
+      p.total_ms.push(p.last.total_ms());
+    }
+    trace("frame", "frame", 0, frame_start_, end);
+  }
+
+  // Record events until stop_trace() or `max_events`, whichever is first.
+  void start_trace(const std::size_t max_events = 1 << 20) {
+    events_.clear();
+    trace_start_ = Clock::now();
+    max_events_ = max_events;
+    tracing_ = true;
+  }
+
+  void stop_trace() { tracing_ = false; }
+  [[nodiscard]] bool tracing() const { return tracing_; }
+  [[nodiscard]] std::size_t trace_size() const { return events_.size(); }
+
+  // `thread` is the WorkerPool::thread_index the work ran on.
+  void trace(const std::string_view name, const std::string_view phase,
+             const std::size_t thread, const Clock::time_point start,
+             const Clock::time_point end) {
+    if (!tracing_)
+      return;
+    if (events_.size() >= max_events_) {
+      log_warn("SystemProfiler: trace hit {} events; stopped recording",
+               max_events_);
+      tracing_ = false;
+      return;
+    }
+    events_.push_back({name, phase, thread, us(start - trace_start_),
+                       us(end - start)});
+  }
+
+  // Write what was recorded as Chrome trace-event JSON. False (and a
+  // warning) if the file can't be written.
+  bool write_trace(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      log_warn("SystemProfiler: cannot open {}", path);
+      return false;
+    }
+    out << std::fixed << std::setprecision(3)
+        << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (std::size_t i = 0; i < events_.size(); ++i) {
+      const TraceEvent &e = events_[i];
+      out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"";
+      write_escaped(out, e.name);
+      out << "\",\"cat\":\"";
+      write_escaped(out, e.phase);
+      out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+          << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us << "}";
+    }
+    out << "\n]}\n";
+    out.flush();
+    if (!out) {
+      log_warn("SystemProfiler: write failed for {}", path);
+      return false;
+    }
+    return true;
+  }
+
+  [[nodiscard]] static float ms(const Clock::duration d) {
+    return std::chrono::duration<float, std::milli>(d).count();
+  }
+
+private:
+  struct TraceEvent {
+    std::string_view name;
+    std::string_view phase;
+    std::size_t thread;
+    double start_us;
+    double duration_us;
+  };
+
+  bool enabled_ = false;
+  std::deque<SystemProfile> profiles_;
+  RollingSamples frame_ms_;
+  Clock::time_point frame_start_;
+
+  bool tracing_ = false;
+  std::size_t max_events_ = 0;
+  Clock::time_point trace_start_;
+  std::vector<TraceEvent> events_;
+
+  [[nodiscard]] static double us(const Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  static void write_escaped(std::ofstream &out, const std::string_view s) {
+    for (const char c : s) {
+      if (c == '"' || c == '\\')
+        out << '\\';
+      if (static_cast<unsigned char>(c) >= 0x20)
+        out << c;
+    }
+  }
+};
+
+} // namespace afterhours
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../logging.h"
+
+namespace afterhours {
+
+// Ordering constraints and on/off switches for a SystemManager's systems.
+// Both refer to systems by label: a label is either one system's name
+// (SystemBase::name) or the name of a set of systems (SystemBase::set).
+//
+// build() turns a phase's systems, in registration order, into the order
+// they run in: registration order, except where a constraint says
+// otherwise, and without the disabled ones. Nothing here runs per frame;
+// the manager rebuilds only after a change.
+//
+// Run conditions (run_if) gate labelled systems frame by frame. Each one is
+// evaluated the first time a system it gates comes up in a frame, and the
+// answer is reused for the rest of that frame.
+class SystemSchedule {
+public:
+  // A view of `label` that stays valid as long as the schedule does.
+  std::string_view intern(const std::string_view label) {
+    for (const std::string &l : labels_)
+      if (l == label)
+        return l;
+    return labels_.emplace_back(label);
+  }
+
+  // Everything labelled `first` runs before everything labelled `then` in
+  // the same phase.
+  void order(const std::string_view first, const std::string_view then) {
+    edges_.emplace_back(intern(first), intern(then));
+    ++version_;
+  }
+
+  void set_enabled(const std::string_view label, const bool on) {
+    const std::string_view l = intern(label);
+    std::erase(disabled_, l);
+    if (!on)
+      disabled_.push_back(l);
+    ++version_;
+  }
+
+  [[nodiscard]] bool enabled(const std::string_view label) const {
+    for (const std::string_view l : disabled_)
+      if (l == label)
+        return false;
+    return true;
+  }
+
+  // Run systems labelled `label` only on frames where condition() is true.
+  void run_if(const std::string_view label, std::function<bool()> condition) {
+    conditions_.push_back({intern(label), std::move(condition)});
+    ++version_;
+  }
+
+  // Forget this frame's condition results.
+  void new_frame() { ++frame_; }
+
+  // Whether every run condition on `s` holds this frame.
+  template <typename S> [[nodiscard]] bool conditions_hold(const S &s) {
+    for (const std::uint32_t i : s.run_conditions) {
+      Condition &c = conditions_[i];
+      if (c.frame != frame_) {
+        c.frame = frame_;
+        c.holds = c.fn();
+      }
+      if (!c.holds)
+        return false;
+    }
+    return true;
+  }
+
+  // Bumped by every change; a phase whose order was built at an older
+  // version rebuilds.
+  [[nodiscard]] std::uint64_t version() const { return version_; }
+
+  // The run order of `systems` (see above). If the constraints form a
+  // cycle, the whole phase keeps its registration order.
+  template <typename S>
+  void build(const std::vector<std::unique_ptr<S>> &systems,
+             std::vector<S *> &out) const {
+    out.clear();
+    std::vector<S *> on;
+    for (const auto &s : systems)
+      if (enabled(s->name) && (s->set.empty() || enabled(s->set)))
+        on.push_back(s.get());
+
+    for (S *s : on) {
+      s->run_conditions.clear();
+      for (std::size_t i = 0; i < conditions_.size(); ++i)
+        if (labelled(*s, conditions_[i].label))
+          s->run_conditions.push_back(static_cast<std::uint32_t>(i));
+    }
+
+    const std::size_t n = on.size();
+    std::vector<std::vector<std::size_t>> before(n);
+    for (const auto &[first, then] : edges_) {
+      for (std::size_t j = 0; j < n; ++j) {
+        if (!labelled(*on[j], then))
+          continue;
+        for (std::size_t i = 0; i < n; ++i)
+          if (i != j && labelled(*on[i], first))
+            before[j].push_back(i);
+      }
+    }
+
+    // Walk systems in registration order; each one first places whatever
+    // must run before it. So a system only moves when a constraint pulls
+    // it earlier.
+    enum struct Mark : std::uint8_t { None, Visiting, Placed };
+    std::vector<Mark> marks(n, Mark::None);
+    bool cycle = false;
+    const auto place = [&](const auto &self, const std::size_t i) -> void {
+      if (marks[i] == Mark::Placed)
+        return;
+      if (marks[i] == Mark::Visiting) {
+        cycle = true;
+        return;
+      }
+      marks[i] = Mark::Visiting;
+      for (const std::size_t p : before[i])
+        self(self, p);
+      marks[i] = Mark::Placed;
+      out.push_back(on[i]);
+    };
+    for (std::size_t i = 0; i < n; ++i)
+      place(place, i);
+
+    if (cycle) {
+      log_error("SystemSchedule: ordering constraints form a cycle; running "
+                "these {} systems in registration order",
+                n);
+      out = std::move(on);
+    }
+  }
+
+private:
+  struct Condition {
+    std::string_view label;
+    std::function<bool()> fn;
+    // The frame `holds` was worked out for.
+    std::uint64_t frame = 0;
+    bool holds = true;
+  };
+
+  std::deque<std::string> labels_;
+  std::vector<std::pair<std::string_view, std::string_view>> edges_;
+  std::vector<std::string_view> disabled_;
+  std::uint64_t version_ = 1;
+  std::vector<Condition> conditions_;
+  std::uint64_t frame_ = 1;
+
+  template <typename S>
+  [[nodiscard]] static bool labelled(const S &s, const std::string_view l) {
+    return s.name == l || (!s.set.empty() && s.set == l);
+  }
+};
+
+} // namespace afterhours
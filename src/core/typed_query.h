@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+
+#include "entity.h"
+#include "entity_collection.h"
+#include "entity_helper.h"
+#include "match_cache.h"
+#include "signature.h"
+
+namespace afterhours {
+
+namespace detail {
+// The row a typed query yields for a term list: the entity, then a reference
+// to each listed component (`const` for Read<T>).
+template <typename List> struct QueryRow;
+template <typename... Cs> struct QueryRow<type_list<Cs...>> {
+  using type = std::tuple<Entity &, Cs &...>;
+  static type make(Entity &e) {
+    return type(e, e.template get<std::remove_const_t<Cs>>()...);
+  }
+};
+template <typename... Terms>
+using QueryRowOf = QueryRow<typename filter_components<Terms...>::type>;
+} // namespace detail
+
+// Statically typed counterpart to EntityQuery. The terms are a System<...>
+// signature:
+//
+//   for (auto [e, transform, velocity] :
+//        query<Transform, Read<Velocity>, Not<Dead>, tags::All<Tag::Active>>())
+//     transform.pos += velocity.v;
+//
+// Each match yields the entity followed by a reference to each listed
+// component, in order (`const` for Read<T>); Not<T> and tag terms only
+// filter. Matching is a couple of bitset tests inlined into the loop: no
+// std::function filters and no RefEntities vector.
+//
+// Walks the collection's merged entities in list order, in place. Don't
+// create, destroy or merge entities while iterating; record those on an
+// EntityCommandBuffer instead.
+template <typename... Terms> class TypedQuery {
+  using Rows = detail::QueryRowOf<Terms...>;
+
+public:
+  using Filter = Signature<Terms...>;
+  // std::tuple<Entity &, Components &...>
+  using Row = typename Rows::type;
+
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const Entities::const_iterator it,
+             const Entities::const_iterator end, const std::uint32_t since)
+        : it_(it), end_(end), since_(since) {
+      skip_misses();
+    }
+
+    [[nodiscard]] Row operator*() const { return Rows::make(**it_); }
+
+    iterator &operator++() {
+      ++it_;
+      skip_misses();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    [[nodiscard]] bool operator==(const iterator &other) const {
+      return it_ == other.it_;
+    }
+
+  private:
+    Entities::const_iterator it_;
+    Entities::const_iterator end_;
+    std::uint32_t since_ = 0;
+
+    void skip_misses() {
+      while (it_ != end_ && !(*it_ && Filter::matches(**it_, since_)))
+        ++it_;
+    }
+  };
+
+  explicit TypedQuery(const Entities &entities) : entities_(entities) {}
+
+  // Added<T>/Changed<T>/Removed<T> terms match changes stamped after `tick`
+  // (an earlier EntityCollection::change_tick()). Defaults to 0: everything.
+  // Returns a copy, so it is safe on a temporary in a range-for.
+  [[nodiscard]] TypedQuery since(const std::uint32_t tick) const {
+    TypedQuery q = *this;
+    q.since_ = tick;
+    return q;
+  }
+
+  [[nodiscard]] iterator begin() const {
+    return iterator(entities_.begin(), entities_.end(), since_);
+  }
+  [[nodiscard]] iterator end() const {
+    return iterator(entities_.end(), entities_.end(), since_);
+  }
+
+  // fn(Entity &, Components &...) for every match.
+  template <typename Fn> void each(Fn &&fn) const {
+    for (const auto &sp : entities_) {
+      if (sp && Filter::matches(*sp, since_))
+        std::apply(fn, Rows::make(*sp));
+    }
+  }
+
+  [[nodiscard]] std::size_t count() const {
+    std::size_t n = 0;
+    for (const auto &sp : entities_)
+      n += (sp && Filter::matches(*sp, since_)) ? 1 : 0;
+    return n;
+  }
+
+  [[nodiscard]] bool empty() const { return begin() == end(); }
+
+  [[nodiscard]] OptEntity first() const {
+    const iterator it = begin();
+    if (it == end())
+      return {};
+    return std::get<0>(*it);
+  }
+
+private:
+  const Entities &entities_;
+  std::uint32_t since_ = 0;
+};
+
+// A query<Terms...>() that keeps its result set between uses, for lookups
+// that run every frame over a world that mostly doesn't change shape:
+//
+//   CachedQuery<Transform, Not<Dead>> movers;  // a member, built once
+//   for (auto [e, transform] : movers) ...
+//
+// Every use first catches up with the collection's signature journal, so it
+// re-tests only entities whose components or tags changed and scans only
+// entities merged since last time; when nothing changed that is O(1).
+// Removing entities (cleanup) reorders the list and costs one rebuild.
+//
+// Without a collection it follows EntityHelper's default collection for the
+// calling thread. Like query(), don't change the world while iterating.
+template <typename... Terms> class CachedQuery {
+  using Rows = detail::QueryRowOf<Terms...>;
+  static_assert(!Signature<Terms...>::has_change_filters,
+                "Added/Changed/Removed depend on when you ask; use query()");
+
+public:
+  using Filter = Signature<Terms...>;
+  using Row = typename Rows::type;
+
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const std::uint32_t *pos, const Entities *entities)
+        : pos_(pos), entities_(entities) {}
+
+    [[nodiscard]] Row operator*() const {
+      return Rows::make(*(*entities_)[*pos_]);
+    }
+
+    iterator &operator++() {
+      ++pos_;
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    [[nodiscard]] bool operator==(const iterator &other) const {
+      return pos_ == other.pos_;
+    }
+
+  private:
+    const std::uint32_t *pos_ = nullptr;
+    const Entities *entities_ = nullptr;
+  };
+
+  CachedQuery() { init(); }
+  explicit CachedQuery(EntityCollection &collection)
+      : collection_(&collection) {
+    init();
+  }
+
+  // Bring the result set up to date. Every accessor below does this first.
+  void refresh() { cache_.sync(source()); }
+
+  [[nodiscard]] iterator begin() {
+    refresh();
+    return iterator(cache_.positions.data(), &source().get_entities());
+  }
+  [[nodiscard]] iterator end() {
+    return iterator(cache_.positions.data() + cache_.positions.size(),
+                    &source().get_entities());
+  }
+
+  // fn(Entity &, Components &...) for every match.
+  template <typename Fn> void each(Fn &&fn) {
+    for (Row row : *this)
+      std::apply(fn, row);
+  }
+
+  [[nodiscard]] std::size_t count() {
+    refresh();
+    return cache_.positions.size();
+  }
+
+  [[nodiscard]] bool empty() { return count() == 0; }
+
+  [[nodiscard]] OptEntity first() {
+    if (empty())
+      return {};
+    return *source().get_entities()[cache_.positions.front()];
+  }
+
+  // The matches as a RefEntities, for code that wants EntityQuery's shape.
+  [[nodiscard]] RefEntities gen() {
+    RefEntities out;
+    out.reserve(count());
+    for (Row row : *this)
+      out.push_back(std::get<0>(row));
+    return out;
+  }
+
+  // Changes whenever the result set does; callers can skip derived work
+  // (lookup tables, sorted copies) while it stays put.
+  [[nodiscard]] std::uint64_t generation() {
+    refresh();
+    return cache_.generation;
+  }
+
+  [[nodiscard]] const EntityMatchCache &match_cache() const { return cache_; }
+
+private:
+  EntityCollection *collection_ = nullptr;
+  EntityMatchCache cache_;
+
+  [[nodiscard]] EntityCollection &source() const {
+    return collection_ ? *collection_ : EntityHelper::get_default_collection();
+  }
+
+  void init() {
+    cache_.required = Filter::required_components();
+    cache_.forbidden = Filter::forbidden_components();
+    cache_.all_tags = Filter::required_all_mask();
+    cache_.any_tags = Filter::required_any_mask();
+    cache_.no_tags = Filter::forbidden_mask();
+  }
+};
+
+template <typename... Terms>
+[[nodiscard]] TypedQuery<Terms...> query(EntityCollection &collection) {
+  return TypedQuery<Terms...>(collection.get_entities());
+}
+
+template <typename... Terms> [[nodiscard]] TypedQuery<Terms...> query() {
+  return query<Terms...>(EntityHelper::get_default_collection());
+}
+
+} // namespace afterhours
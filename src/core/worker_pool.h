@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace afterhours {
+
+// Fixed set of worker threads for fork/join work (see
+// SystemManager::set_worker_count). run() hands out job indices to the
+// workers and to the calling thread, and returns once every job finished, so
+// jobs may freely reference the caller's stack.
+class WorkerPool {
+public:
+  explicit WorkerPool(const std::size_t threads) {
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i)
+      workers_.emplace_back([this, i] {
+        current_worker() = {this, i + 1};
+        work();
+      });
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : workers_)
+      t.join();
+  }
+
+  // True on any thread, the caller's included, while it runs a job. Lazily
+  // built shared state (e.g. EntityCollection's indexes) is left alone then.
+  [[nodiscard]] static bool in_job() { return in_job_flag(); }
+
+  // i + 1 on this pool's i-th worker, 0 on any other thread (the caller's
+  // included), so per-thread state can live in a concurrency()-sized array.
+  [[nodiscard]] std::size_t thread_index() const {
+    const WorkerSlot &slot = current_worker();
+    return slot.pool == this ? slot.index : 0;
+  }
+
+  // Worker threads plus the calling thread.
+  [[nodiscard]] std::size_t concurrency() const { return workers_.size() + 1; }
+
+  // Call job(i) for every i in [0, count). The first exception a job throws
+  // is rethrown here after all jobs have stopped.
+  void run(const std::size_t count,
+           const std::function<void(std::size_t)> &job) {
+    if (count == 0)
+      return;
+    if (workers_.empty() || count == 1) {
+      const JobScope scope;
+      for (std::size_t i = 0; i < count; ++i)
+        job(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      job_count_ = count;
+      next_.store(0, std::memory_order_relaxed);
+      busy_ = workers_.size();
+      error_ = nullptr;
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    job_ = nullptr;
+    if (error_)
+      std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+private:
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+
+  const std::function<void(std::size_t)> *job_ = nullptr;
+  std::size_t job_count_ = 0;
+  std::atomic<std::size_t> next_{0};
+  std::size_t busy_ = 0;
+  std::uint64_t generation_ = 0;
+  bool stopping_ = false;
+  std::exception_ptr error_;
+
+  struct WorkerSlot {
+    const WorkerPool *pool = nullptr;
+    std::size_t index = 0;
+  };
+  static WorkerSlot &current_worker() {
+    thread_local WorkerSlot slot;
+    return slot;
+  }
+
+  static bool &in_job_flag() {
+    thread_local bool flag = false;
+    return flag;
+  }
+
+  struct JobScope {
+    bool was = in_job_flag();
+    JobScope() { in_job_flag() = true; }
+    ~JobScope() { in_job_flag() = was; }
+    JobScope(const JobScope &) = delete;
+    JobScope &operator=(const JobScope &) = delete;
+  };
+
+  void drain() {
+    const JobScope scope;
+    for (;;) {
+      const std::size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+      if (i >= job_count_)
+        return;
+      try {
+        (*job_)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+          error_ = std::current_exception();
+        // Skip whatever is left.
+        next_.store(job_count_, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void work() {
+    std::uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_)
+          return;
+        seen = generation_;
+      }
+      drain();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --busy_;
+      }
+      done_.notify_one();
+    }
+  }
+};
+
+} // namespace afterhours
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <utility>
+
+#include "entity_collection.h"
+#include "entity_helper.h"
+#include "system.h"
+
+namespace afterhours {
+
+// An independent ECS: its own entities, systems and entity ids. Stepping a
+// world touches nothing another world uses, so several can run at once, one
+// thread each, e.g. many server-side matches in one process:
+//
+//   std::vector<std::unique_ptr<World>> matches = ...;
+//   std::vector<std::thread> threads;
+//   for (auto &match : matches)
+//     threads.emplace_back([&m = *match] {
+//       for (int frame = 0; frame < frames; ++frame)
+//         m.run(dt);
+//     });
+//
+// While run() or enter() is on the stack, the world is the calling thread's
+// default collection (and its worker threads'), so systems written against
+// EntityHelper, EntityQuery or query<...>() work unchanged.
+//
+// A world is used by one thread at a time. Its isolation ends where the code
+// it runs reaches for process-wide state: singletons such as RandomEngine or
+// plugin globals, and statics inside systems.
+class World {
+public:
+  World() {
+    collection_.use_own_entity_ids();
+    systems_.bind_collection(collection_);
+  }
+
+  // The system manager points at the collection.
+  World(const World &) = delete;
+  World &operator=(const World &) = delete;
+
+  [[nodiscard]] EntityCollection &collection() { return collection_; }
+  [[nodiscard]] const EntityCollection &collection() const {
+    return collection_;
+  }
+
+  [[nodiscard]] SystemManager &systems() { return systems_; }
+
+  // One frame: fixed steps, update, cleanup and render (SystemManager::run).
+  void run(const float dt) { systems_.run(dt); }
+
+  // fn(World &) with this world as the calling thread's default collection,
+  // for setup or inspection code that goes through EntityHelper.
+  template <typename Fn> decltype(auto) enter(Fn &&fn) {
+    const EntityHelper::ScopedDefaultCollection scope(collection_);
+    return std::forward<Fn>(fn)(*this);
+  }
+
+private:
+  // Declared first so it outlives the systems.
+  EntityCollection collection_;
+  SystemManager systems_;
+};
+
+} // namespace afterhours
@@ -4,4 +4,7 @@
 #include "core/entity.h"
 #include "core/entity_helper.h"
 #include "core/entity_query.h"
+#include "core/typed_query.h"
 #include "core/system.h"
+#include "core/hierarchy.h"
+#include "core/world.h"
@@ -0,0 +1,96 @@
+#pragma once
+
+// Replaces the global operator new/delete with versions that count every
+// allocation for alloc_tracking. Include it from exactly one .cpp of the
+// program (a second copy is a duplicate-symbol link error):
+//
+//   #include <afterhours/src/memory/alloc_hook.h>
+//
+// Each block carries its size in a small header so frees count their bytes.
+// Over-aligned allocations (the std::align_val_t overloads) keep the
+// standard library's versions and are not counted.
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "alloc_tracking.h"
+
+namespace afterhours {
+namespace alloc_tracking {
+namespace detail {
+
+inline constexpr std::size_t hook_header = alignof(std::max_align_t);
+
+inline void *hooked_new(const std::size_t size) noexcept {
+  auto *block = static_cast<unsigned char *>(std::malloc(size + hook_header));
+  if (!block)
+    return nullptr;
+  std::memcpy(block, &size, sizeof(size));
+  record_allocation(size);
+  return block + hook_header;
+}
+
+inline void hooked_delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  unsigned char *block = static_cast<unsigned char *>(ptr) - hook_header;
+  std::size_t size = 0;
+  std::memcpy(&size, block, sizeof(size));
+  record_free(size);
+  std::free(block);
+}
+
+static const bool hook_installed = [] {
+  totals.installed.store(true, std::memory_order_relaxed);
+  return true;
+}();
+
+} // namespace detail
+} // namespace alloc_tracking
+} // namespace afterhours
+
+void *operator new(const std::size_t size) {
+  if (void *ptr = afterhours::alloc_tracking::detail::hooked_new(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new[](const std::size_t size) {
+  if (void *ptr = afterhours::alloc_tracking::detail::hooked_new(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new(const std::size_t size, const std::nothrow_t &) noexcept {
+  return afterhours::alloc_tracking::detail::hooked_new(size);
+}
+
+void *operator new[](const std::size_t size, const std::nothrow_t &) noexcept {
+  return afterhours::alloc_tracking::detail::hooked_new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  afterhours::alloc_tracking::detail::hooked_delete(ptr);
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace afterhours {
+namespace alloc_tracking {
+
+// Counters for heap traffic through operator new/delete. Nothing is counted
+// until the hook in alloc_hook.h is linked in (installed() says whether it
+// is); then every allocation lands in the process totals and in the calling
+// thread's current Tag, if it has one.
+//
+// SystemManager tags each system while it runs (SystemBase::allocations) and
+// keeps the totals of the last frame (SystemManager::frame_allocations).
+
+struct Counts {
+  std::uint64_t allocations = 0;
+  std::uint64_t frees = 0;
+  std::uint64_t bytes = 0;
+
+  [[nodiscard]] Counts operator-(const Counts &since) const {
+    return {allocations - since.allocations, frees - since.frees,
+            bytes - since.bytes};
+  }
+};
+
+// A bucket the hook charges allocations to while it is some thread's
+// current tag (see ScopedTag). Several threads may share one.
+struct Tag {
+  std::string_view name;
+  std::atomic<std::uint64_t> allocations{0};
+  std::atomic<std::uint64_t> frees{0};
+  std::atomic<std::uint64_t> bytes{0};
+
+  Tag() = default;
+  explicit Tag(const std::string_view n) : name(n) {}
+  Tag(const Tag &other) : name(other.name) { add(other.counts()); }
+  Tag &operator=(const Tag &other) {
+    name = other.name;
+    reset();
+    add(other.counts());
+    return *this;
+  }
+
+  [[nodiscard]] Counts counts() const {
+    return {allocations.load(std::memory_order_relaxed),
+            frees.load(std::memory_order_relaxed),
+            bytes.load(std::memory_order_relaxed)};
+  }
+
+  void reset() {
+    allocations.store(0, std::memory_order_relaxed);
+    frees.store(0, std::memory_order_relaxed);
+    bytes.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  void add(const Counts &c) {
+    allocations.fetch_add(c.allocations, std::memory_order_relaxed);
+    frees.fetch_add(c.frees, std::memory_order_relaxed);
+    bytes.fetch_add(c.bytes, std::memory_order_relaxed);
+  }
+};
+
+namespace detail {
+struct Totals {
+  std::atomic<bool> installed{false};
+  std::atomic<std::uint64_t> allocations{0};
+  std::atomic<std::uint64_t> frees{0};
+  std::atomic<std::uint64_t> bytes{0};
+  std::atomic<std::uint64_t> live_bytes{0};
+  std::atomic<std::uint64_t> peak_bytes{0};
+};
+// Constant-initialized, so usable from operator new before main().
+inline Totals totals;
+
+inline Tag *&current_tag() {
+  thread_local Tag *tag = nullptr;
+  return tag;
+}
+} // namespace detail
+
+// Called by the hook; custom allocators can report through them too.
+inline void record_allocation(const std::size_t bytes) noexcept {
+  detail::Totals &t = detail::totals;
+  t.allocations.fetch_add(1, std::memory_order_relaxed);
+  t.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  const std::uint64_t live =
+      t.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  std::uint64_t peak = t.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !t.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+  if (Tag *tag = detail::current_tag()) {
+    tag->allocations.fetch_add(1, std::memory_order_relaxed);
+    tag->bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+inline void record_free(const std::size_t bytes) noexcept {
+  detail::Totals &t = detail::totals;
+  t.frees.fetch_add(1, std::memory_order_relaxed);
+  t.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  if (Tag *tag = detail::current_tag())
+    tag->frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+[[nodiscard]] inline bool installed() {
+  return detail::totals.installed.load(std::memory_order_relaxed);
+}
+
+// Everything since the program started.
+[[nodiscard]] inline Counts totals() {
+  const detail::Totals &t = detail::totals;
+  return {t.allocations.load(std::memory_order_relaxed),
+          t.frees.load(std::memory_order_relaxed),
+          t.bytes.load(std::memory_order_relaxed)};
+}
+
+[[nodiscard]] inline std::uint64_t live_bytes() {
+  return detail::totals.live_bytes.load(std::memory_order_relaxed);
+}
+
+// Most bytes live at once since the last reset_peak().
+[[nodiscard]] inline std::uint64_t peak_bytes() {
+  return detail::totals.peak_bytes.load(std::memory_order_relaxed);
+}
+
+inline void reset_peak() {
+  detail::totals.peak_bytes.store(live_bytes(), std::memory_order_relaxed);
+}
+
+// Heap traffic between begin() and end(), e.g. one frame. counts and
+// peak_bytes keep the last finished window's values until end() is called.
+struct Window {
+  Counts counts;
+  // Most bytes live at once, process-wide, during the window.
+  std::uint64_t peak_bytes = 0;
+
+  void begin() {
+    start_ = totals();
+    reset_peak();
+  }
+  void end() {
+    counts = totals() - start_;
+    peak_bytes = alloc_tracking::peak_bytes();
+  }
+
+private:
+  Counts start_;
+};
+
+// Charges the calling thread's allocations to `tag` until the scope ends.
+struct ScopedTag {
+  Tag *previous = detail::current_tag();
+  explicit ScopedTag(Tag &tag) { detail::current_tag() = &tag; }
+  ~ScopedTag() { detail::current_tag() = previous; }
+  ScopedTag(const ScopedTag &) = delete;
+  ScopedTag &operator=(const ScopedTag &) = delete;
+};
+
+} // namespace alloc_tracking
+} // namespace afterhours
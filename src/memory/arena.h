@@ -8,6 +8,7 @@
 #include <new>
 #include <type_traits>
 #include <utility>
+#include <vector>
 #if defined(_WIN32)
 #include <malloc.h>
 #endif
@@ -47,6 +48,13 @@ inline void aligned_free_compat(void *ptr) {
 
 } // namespace detail
 
+// What an Arena does with a request that doesn't fit.
+// - Fixed: allocate() returns nullptr.
+// - Grow: the request is served from an extra heap block, and the next
+//   reset() folds everything into one block big enough for the whole pass,
+//   so a workload that repeats stops touching the heap after its first pass.
+enum struct ArenaGrowth : std::uint8_t { Fixed, Grow };
+
 class Arena {
 public:
   static constexpr size_t DEFAULT_CAPACITY = 4 * 1024 * 1024; // 4MB
@@ -58,15 +66,27 @@ private:
   size_t offset_ = 0;
   size_t alignment_ = DEFAULT_ALIGNMENT;
   bool owns_memory_ = false;
+  ArenaGrowth growth_ = ArenaGrowth::Fixed;
+
+  // Grow only: blocks taken since the last reset(), the newest last.
+  std::vector<uint8_t *> overflow_;
+  size_t overflow_capacity_ = 0;
+  size_t overflow_offset_ = 0;
+  size_t overflow_used_ = 0;
+  // Grow only: sizes handed out since the last reset(), each rounded up to
+  // the alignment; what one block needs to serve the same pass.
+  size_t pass_bytes_ = 0;
 
   size_t peak_usage_ = 0;
   size_t allocation_count_ = 0;
+  size_t heap_allocations_ = 0;
 
 public:
   Arena() = default;
 
-  explicit Arena(size_t capacity, size_t alignment = DEFAULT_ALIGNMENT)
-      : alignment_(alignment), owns_memory_(true) {
+  explicit Arena(size_t capacity, size_t alignment = DEFAULT_ALIGNMENT,
+                 ArenaGrowth growth = ArenaGrowth::Fixed)
+      : alignment_(alignment), owns_memory_(true), growth_(growth) {
     init_owned(capacity, alignment);
   }
 
@@ -74,11 +94,7 @@ public:
       : memory_(static_cast<uint8_t *>(memory)), capacity_(capacity),
         alignment_(alignment), owns_memory_(false) {}
 
-  ~Arena() {
-    if (owns_memory_ && memory_) {
-      detail::aligned_free_compat(memory_);
-    }
-  }
+  ~Arena() { release(); }
 
   Arena(const Arena &) = delete;
   Arena &operator=(const Arena &) = delete;
@@ -86,9 +102,7 @@ public:
   Arena(Arena &&other) noexcept { swap(other); }
   Arena &operator=(Arena &&other) noexcept {
     if (this != &other) {
-      if (owns_memory_ && memory_) {
-        detail::aligned_free_compat(memory_);
-      }
+      release();
       memory_ = nullptr;
       swap(other);
     }
@@ -98,14 +112,15 @@ public:
   [[nodiscard]] void *allocate(size_t size) {
     size_t aligned_offset = detail::align_up_value(offset_, alignment_);
     if (aligned_offset + size > capacity_) {
-      return nullptr;
+      return allocate_overflow(size);
     }
 
     void *ptr = memory_ + aligned_offset;
     offset_ = aligned_offset + size;
+    pass_bytes_ += detail::align_up_value(size, alignment_);
     allocation_count_++;
-    if (offset_ > peak_usage_) {
-      peak_usage_ = offset_;
+    if (used() > peak_usage_) {
+      peak_usage_ = used();
     }
     return ptr;
   }
@@ -141,7 +156,10 @@ public:
   }
 
   void reset() {
+    if (!overflow_.empty())
+      consolidate();
     offset_ = 0;
+    pass_bytes_ = 0;
     allocation_count_ = 0;
   }
 
@@ -150,11 +168,16 @@ public:
     peak_usage_ = 0;
   }
 
-  [[nodiscard]] size_t used() const { return offset_; }
+  // Includes what went to overflow blocks.
+  [[nodiscard]] size_t used() const { return offset_ + overflow_used_; }
   [[nodiscard]] size_t capacity() const { return capacity_; }
   [[nodiscard]] size_t remaining() const { return capacity_ - offset_; }
   [[nodiscard]] size_t peak_usage() const { return peak_usage_; }
   [[nodiscard]] size_t allocation_count() const { return allocation_count_; }
+  [[nodiscard]] ArenaGrowth growth() const { return growth_; }
+  // Blocks this arena has ever asked the heap for. Flat across passes once
+  // a growable arena has seen its largest one.
+  [[nodiscard]] size_t heap_allocations() const { return heap_allocations_; }
 
   [[nodiscard]] float usage_percent() const {
     return capacity_ > 0 ? static_cast<float>(offset_) / capacity_ * 100.0f
@@ -178,6 +201,54 @@ private:
         detail::aligned_alloc_compat(alignment_, aligned_capacity));
     assert(memory_ && "Arena allocation failed");
     capacity_ = aligned_capacity;
+    ++heap_allocations_;
+  }
+
+  void release() {
+    for (uint8_t *block : overflow_)
+      detail::aligned_free_compat(block);
+    overflow_.clear();
+    if (owns_memory_ && memory_) {
+      detail::aligned_free_compat(memory_);
+    }
+  }
+
+  void *allocate_overflow(size_t size) {
+    if (growth_ != ArenaGrowth::Grow || !owns_memory_)
+      return nullptr;
+    size_t at = detail::align_up_value(overflow_offset_, alignment_);
+    if (overflow_.empty() || at + size > overflow_capacity_) {
+      // Doubling keeps the number of blocks per pass logarithmic.
+      const size_t bytes = detail::align_up_value(
+          std::max({size, capacity_, overflow_capacity_ * 2}), alignment_);
+      auto *block = static_cast<uint8_t *>(
+          detail::aligned_alloc_compat(alignment_, bytes));
+      if (!block)
+        return nullptr;
+      overflow_.push_back(block);
+      overflow_capacity_ = bytes;
+      ++heap_allocations_;
+      overflow_offset_ = 0;
+      at = 0;
+    }
+    overflow_used_ += at - overflow_offset_ + size;
+    overflow_offset_ = at + size;
+    pass_bytes_ += detail::align_up_value(size, alignment_);
+    allocation_count_++;
+    peak_usage_ = std::max(peak_usage_, used());
+    return overflow_.back() + at;
+  }
+
+  // One block as big as everything handed out this pass, and at least twice
+  // the old one so passes that vary in size settle after a few resets.
+  void consolidate() {
+    const size_t needed = std::max(capacity_ * 2, pass_bytes_);
+    release();
+    overflow_capacity_ = 0;
+    overflow_offset_ = 0;
+    overflow_used_ = 0;
+    memory_ = nullptr;
+    init_owned(needed, alignment_);
   }
 
   void swap(Arena &other) noexcept {
@@ -186,8 +257,15 @@ private:
     std::swap(offset_, other.offset_);
     std::swap(alignment_, other.alignment_);
     std::swap(owns_memory_, other.owns_memory_);
+    std::swap(growth_, other.growth_);
+    std::swap(overflow_, other.overflow_);
+    std::swap(overflow_capacity_, other.overflow_capacity_);
+    std::swap(overflow_offset_, other.overflow_offset_);
+    std::swap(overflow_used_, other.overflow_used_);
+    std::swap(pass_bytes_, other.pass_bytes_);
     std::swap(peak_usage_, other.peak_usage_);
     std::swap(allocation_count_, other.allocation_count_);
+    std::swap(heap_allocations_, other.heap_allocations_);
   }
 };
 
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "arena.h"
+
+namespace afterhours {
+
+// Scratch memory that lives until the end of the frame. SystemManager owns
+// one growable arena per thread that runs systems, makes it the thread's
+// frame_arena() while a system runs and resets them all at the end of
+// run(), so per-frame lists cost a pointer bump instead of a heap call:
+//
+//   void once(float) override {
+//     FrameVector<RefEntity> targets = EntityQuery().whereHasComponent<
+//         Target>().gen_frame();
+//     ...
+//   }
+//
+// Nothing allocated from it may be kept past the frame.
+
+namespace detail {
+inline Arena *&current_frame_arena() {
+  thread_local Arena *arena = nullptr;
+  return arena;
+}
+} // namespace detail
+
+// The calling thread's frame arena. Outside a SystemManager frame this is a
+// per-thread fallback that nobody resets; code running there resets it
+// itself (frame_arena().reset()) or installs its own with ScopedFrameArena.
+[[nodiscard]] inline Arena &frame_arena() {
+  if (Arena *arena = detail::current_frame_arena())
+    return *arena;
+  thread_local Arena fallback(64 * 1024, Arena::DEFAULT_ALIGNMENT,
+                              ArenaGrowth::Grow);
+  return fallback;
+}
+
+// Makes `arena` the calling thread's frame arena until the scope ends.
+struct ScopedFrameArena {
+  Arena *previous = detail::current_frame_arena();
+  explicit ScopedFrameArena(Arena &arena) {
+    detail::current_frame_arena() = &arena;
+  }
+  ~ScopedFrameArena() { detail::current_frame_arena() = previous; }
+  ScopedFrameArena(const ScopedFrameArena &) = delete;
+  ScopedFrameArena &operator=(const ScopedFrameArena &) = delete;
+};
+
+// std allocator over an Arena; deallocate() is a no-op and the memory goes
+// back with the arena's reset(). Default-constructed, it binds to the frame
+// arena of the thread that creates it.
+template <typename T> struct FrameAllocator {
+  static_assert(alignof(T) <= alignof(std::max_align_t),
+                "FrameAllocator doesn't over-align");
+  using value_type = T;
+
+  Arena *arena;
+
+  FrameAllocator() : arena(&frame_arena()) {}
+  explicit FrameAllocator(Arena &a) : arena(&a) {}
+  template <typename U>
+  FrameAllocator(const FrameAllocator<U> &other) : arena(other.arena) {}
+
+  [[nodiscard]] T *allocate(const std::size_t n) {
+    void *p = arena->allocate(n * sizeof(T));
+    if (!p)
+      throw std::bad_alloc();
+    return static_cast<T *>(p);
+  }
+  void deallocate(T *, std::size_t) {}
+
+  template <typename U>
+  bool operator==(const FrameAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+};
+
+template <typename T> using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+} // namespace afterhours
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace afterhours {
+
+// Broadphases: given a list of axis-aligned boxes, find the pairs that
+// overlap without testing every pair. collision::UpdateCollidingEntities
+// takes one (its `broadphase` member) and runs its narrowphase only on the
+// pairs found here.
+
+struct Aabb {
+  float min_x = 0.f;
+  float min_y = 0.f;
+  float max_x = 0.f;
+  float max_y = 0.f;
+
+  // Touching counts: a broadphase may report more pairs than really
+  // collide, never fewer.
+  [[nodiscard]] bool overlaps(const Aabb &o) const {
+    return min_x <= o.max_x && o.min_x <= max_x && min_y <= o.max_y &&
+           o.min_y <= max_y;
+  }
+};
+
+// Indices into the boxes handed to find_pairs().
+struct BroadphasePair {
+  std::uint32_t a = 0;
+  std::uint32_t b = 0;
+};
+
+class Broadphase {
+public:
+  virtual ~Broadphase() = default;
+
+  // Replace `out` with every pair of overlapping `boxes`, each once, in no
+  // particular order. Called once per tick; implementations may keep state
+  // between calls, and reuse their buffers so a steady tick doesn't
+  // allocate.
+  virtual void find_pairs(const std::vector<Aabb> &boxes,
+                          std::vector<BroadphasePair> &out) = 0;
+};
+
+// Every box goes into each cell of a uniform grid it touches; boxes are
+// compared only with others sharing a cell. Cells are hashed, not stored, so
+// the world needs no bounds. Best when bodies are of similar size: make
+// `cell_size` about the size of a typical body. A body spanning many cells
+// costs one entry per cell; one spanning more than `max_cells_per_box` is
+// kept out of the grid and tested against every box instead.
+class SpatialHashBroadphase : public Broadphase {
+public:
+  explicit SpatialHashBroadphase(const float cell_size = 64.f)
+      : cell_size_(cell_size > 0.f ? cell_size : 64.f) {}
+
+  static constexpr std::int64_t max_cells_per_box = 1024;
+
+  [[nodiscard]] float cell_size() const { return cell_size_; }
+
+  void find_pairs(const std::vector<Aabb> &boxes,
+                  std::vector<BroadphasePair> &out) override {
+    out.clear();
+    entries_.clear();
+    oversized_.clear();
+    is_oversized_.assign(boxes.size(), 0);
+    for (std::size_t i = 0; i < boxes.size(); ++i) {
+      const Aabb &box = boxes[i];
+      const std::int32_t x0 = cell(box.min_x), x1 = cell(box.max_x);
+      const std::int32_t y0 = cell(box.min_y), y1 = cell(box.max_y);
+      if ((std::int64_t{x1} - x0 + 1) * (std::int64_t{y1} - y0 + 1) >
+          max_cells_per_box) {
+        oversized_.push_back(static_cast<std::uint32_t>(i));
+        is_oversized_[i] = 1;
+        continue;
+      }
+      for (std::int32_t x = x0; x <= x1; ++x)
+        for (std::int32_t y = y0; y <= y1; ++y)
+          entries_.push_back({key(x, y), static_cast<std::uint32_t>(i)});
+    }
+    std::sort(entries_.begin(), entries_.end(),
+              [](const Entry &l, const Entry &r) {
+                return l.key != r.key ? l.key < r.key : l.index < r.index;
+              });
+
+    for (std::size_t begin = 0; begin < entries_.size();) {
+      std::size_t end = begin + 1;
+      while (end < entries_.size() && entries_[end].key == entries_[begin].key)
+        ++end;
+      for (std::size_t i = begin; i < end; ++i) {
+        const Aabb &a = boxes[entries_[i].index];
+        for (std::size_t j = i + 1; j < end; ++j) {
+          const Aabb &b = boxes[entries_[j].index];
+          if (!a.overlaps(b))
+            continue;
+          // A pair sharing several cells is reported only from the cell
+          // holding the corner of their overlap, so no dedup pass.
+          if (key(cell(std::max(a.min_x, b.min_x)),
+                  cell(std::max(a.min_y, b.min_y))) != entries_[i].key)
+            continue;
+          out.push_back({entries_[i].index, entries_[j].index});
+        }
+      }
+      begin = end;
+    }
+
+    for (const std::uint32_t big : oversized_) {
+      for (std::size_t j = 0; j < boxes.size(); ++j) {
+        // Another oversized box pairs up from whichever comes first.
+        if (j == big || (is_oversized_[j] && j < big))
+          continue;
+        if (boxes[big].overlaps(boxes[j]))
+          out.push_back({big, static_cast<std::uint32_t>(j)});
+      }
+    }
+  }
+
+private:
+  struct Entry {
+    std::uint64_t key;
+    std::uint32_t index;
+  };
+
+  float cell_size_;
+  std::vector<Entry> entries_;
+  std::vector<std::uint32_t> oversized_;
+  // By box: 1 if it's in oversized_.
+  std::vector<std::uint8_t> is_oversized_;
+
+  [[nodiscard]] std::int32_t cell(const float v) const {
+    // Clamped so far-off (or non-finite) coordinates land in an edge cell
+    // instead of overflowing the conversion.
+    constexpr float limit = 1 << 30;
+    const float c = std::floor(v / cell_size_);
+    return static_cast<std::int32_t>(c >= -limit && c <= limit
+                                         ? c
+                                         : (c > 0.f ? limit : -limit));
+  }
+
+  [[nodiscard]] static std::uint64_t key(const std::int32_t x,
+                                         const std::int32_t y) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) |
+           static_cast<std::uint32_t>(y);
+  }
+};
+
+// Sort boxes along x and sweep, comparing each only with boxes whose x
+// range it reaches. The sorted order is kept between ticks; bodies move a
+// little each tick, so re-sorting is an insertion sort over an almost sorted
+// list, close to linear. Needs no tuning, and copes with mixed body sizes,
+// but degrades when many bodies line up on the same x.
+class SweepAndPruneBroadphase : public Broadphase {
+public:
+  void find_pairs(const std::vector<Aabb> &boxes,
+                  std::vector<BroadphasePair> &out) override {
+    out.clear();
+    const std::size_t n = boxes.size();
+    const auto before = [&](const std::uint32_t l, const std::uint32_t r) {
+      return boxes[l].min_x < boxes[r].min_x;
+    };
+    if (order_.size() != n) {
+      // A different set of bodies; start over.
+      order_.resize(n);
+      for (std::size_t i = 0; i < n; ++i)
+        order_[i] = static_cast<std::uint32_t>(i);
+      std::sort(order_.begin(), order_.end(), before);
+    } else {
+      for (std::size_t i = 1; i < n; ++i) {
+        const std::uint32_t moving = order_[i];
+        std::size_t j = i;
+        for (; j > 0 && before(moving, order_[j - 1]); --j)
+          order_[j] = order_[j - 1];
+        order_[j] = moving;
+      }
+    }
+
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::uint32_t a = order_[i];
+      const Aabb &box = boxes[a];
+      for (std::size_t j = i + 1; j < n; ++j) {
+        const std::uint32_t b = order_[j];
+        if (boxes[b].min_x > box.max_x)
+          break;
+        if (box.min_y <= boxes[b].max_y && boxes[b].min_y <= box.max_y)
+          out.push_back({a, b});
+      }
+    }
+  }
+
+private:
+  std::vector<std::uint32_t> order_;
+};
+
+} // namespace afterhours
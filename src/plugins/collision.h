@@ -1,13 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <limits>
+#include <memory>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "../core/base_component.h"
 #include "../core/system.h"
 #include "../developer.h"
 #include "../ecs.h"
+#include "broadphase.h"
+#include "contact_solver.h"
+#include "narrowphase.h"
 
 #ifdef AFTER_HOURS_USE_RAYLIB
 namespace raylib {
@@ -27,6 +36,16 @@ struct collision : developer::Plugin {
     float mass{1.f};
     float friction{0.f};
     float restitution{.5f};
+
+    // Sleep state, kept by UpdateCollidingEntities when allow_sleep is on.
+    bool asleep{false};
+    // Seconds spent at or below sleep_speed.
+    float still_for{0.f};
+    // Bodies that fell asleep together share one: an entity id among them.
+    EntityID island{-1};
+    // Where the body fell asleep; it is held there while asleep.
+    float rest_x{0.f};
+    float rest_y{0.f};
   };
 
   template <typename TransformType>
@@ -35,12 +54,91 @@ struct collision : developer::Plugin {
 
     std::unordered_set<int> ids;
 
-    // cache the query ents instead of just the ids
-    RefEntities collidables;
+    // Every entity with a Transform. Kept between frames and only updated
+    // for entities that changed, instead of re-querying the world each frame.
+    CachedQuery<Transform> collidables;
+
+    // Optional. Without one, every entity is tested against every other
+    // (O(N^2)); with one, only the pairs it finds are, and the whole pass
+    // runs in once(). Bounds are taken at the start of the tick from
+    // callbacks.get_bounds, or position and size.
+    //
+    //   system->broadphase = std::make_unique<SpatialHashBroadphase>(32.f);
+    std::unique_ptr<Broadphase> broadphase;
+    // Added around every body's bounds. Resolving a pair pushes both bodies
+    // apart, which can push one into a body it wasn't touching when the
+    // bounds were taken; the margin catches those this tick instead of the
+    // next. Each push is at most 1 / mass, so only bodies pushed several
+    // times in one tick (deep piles) can still miss a contact for a tick.
+    float broadphase_margin = 1.f;
+
+    enum struct Narrowphase {
+      // check_overlap and the vector callbacks, pair by pair.
+      Callbacks,
+      // Built in: a strict overlap test of position to position + size,
+      // run several candidates at a time, and inline vector math on a
+      // packed copy of the bodies, written back once per tick.
+      // check_overlap, normalize_vec, dot_product, vector_length and
+      // get_speed aren't called; the built-in versions match the usual
+      // ones (normalizing a vector shorter than 1e-4 gives zero), so the
+      // results do too. Runs in once(), with or without a broadphase.
+      Aabb,
+    };
+    Narrowphase narrowphase = Narrowphase::Callbacks;
+
+    enum struct Solver {
+      // Each contact resolved as soon as it is found, so earlier contacts
+      // change what later ones see, and an entity hit by one that came
+      // before it starts no contacts of its own that tick.
+      Sequential,
+      // Every contact overlapping at the start of the tick goes to
+      // contact_solver, which resolves them together over several passes,
+      // in parallel on `workers` when set. The result doesn't depend on
+      // iteration order or thread count. Uses the built-in AABB math, as
+      // Narrowphase::Aabb does.
+      Colored,
+    };
+    Solver solver = Solver::Sequential;
+    ContactSolver contact_solver;
+    // For Solver::Colored, e.g. SystemManager::worker_pool().
+    WorkerPool *workers = nullptr;
+
+    // Resting bodies sleep. Once a body, and every body touching it, has
+    // moved no faster than sleep_speed for sleep_time seconds, they fall
+    // asleep together as an island (see CollisionConfig). Pairs of sleeping
+    // or immovable bodies are never tested, so a level of props at rest
+    // costs little more than its moving bodies. A sleeping body is held
+    // where it fell asleep, velocity zeroed, until its island wakes: when an
+    // awake body touches it, or when one of its bodies is given a speed
+    // above sleep_speed, moved further than that speed allows, or passed to
+    // wake(). Runs in once().
+    bool allow_sleep = false;
+    float sleep_speed = 1.f;
+    float sleep_time = .5f;
+
+    // Wakes `t`, and its island on the next tick.
+    static void wake(Transform &t) {
+      t.collision_config.asleep = false;
+      t.collision_config.still_for = 0.f;
+    }
+
+    // Bodies asleep after the last tick.
+    [[nodiscard]] std::size_t sleeping() const { return sleeping_; }
 
-    virtual void once(float) override {
+    virtual void once(float dt) override {
       ids.clear();
-      collidables = EntityQuery().whereHasComponent<Transform>().gen();
+      collidables.refresh();
+      if (!should_iterate()) {
+        resolve_pairs(dt);
+      } else if (callbacks.is_fast) {
+        gather(dt);
+        sweep_fast_bodies(dt);
+      }
+    }
+
+    bool should_iterate() const override {
+      return !broadphase && narrowphase == Narrowphase::Callbacks &&
+             solver == Solver::Sequential && !allow_sleep;
     }
 
     struct Config {
@@ -58,6 +156,12 @@ struct collision : developer::Plugin {
       std::function<float(const vec2 &)> vector_length;
       std::function<float(const Transform &)> get_speed;
       std::function<bool(const Transform &, const Transform &)> check_overlap;
+      // Broadphase bounds; position to position + size when unset.
+      std::function<Aabb(const Transform &)> get_bounds;
+      // Entities that move far enough in a tick to pass through others
+      // (bullets). Each is swept from where it was to where it is, and on
+      // a hit put back where it first touched; see sweep_fast_bodies().
+      std::function<bool(const Entity &)> is_fast;
     } callbacks;
 
     void positional_correction(Transform &a, Transform &b,
@@ -202,53 +306,666 @@ struct collision : developer::Plugin {
       return impulse;
     }
 
+    // Whether `entity` starts no collisions of its own this tick.
+    bool skipped_as_first(const Entity &entity) const {
+      if (callbacks.should_skip_entity && callbacks.should_skip_entity(entity))
+        return true;
+      if (callbacks.is_floor_overlay && callbacks.is_floor_overlay(entity))
+        return true;
+      return callbacks.gets_absorbed && callbacks.gets_absorbed(entity);
+    }
+
+    enum struct PairResult { Ignored, Resolved, Excluded };
+
+    // Test one pair and resolve it if it overlaps. Resolved and Excluded
+    // both take `other` out of the rest of the tick.
+    PairResult collide_pair(Transform &transform, const Entity &other,
+                            Transform &b, const float dt) {
+      if (callbacks.is_floor_overlay && callbacks.is_floor_overlay(other))
+        return PairResult::Ignored;
+      if (callbacks.gets_absorbed && callbacks.gets_absorbed(other))
+        return PairResult::Excluded;
+      if (!callbacks.check_overlap(transform, b))
+        return PairResult::Ignored;
+      resolve_collision(transform, b, dt);
+      return PairResult::Resolved;
+    }
+
     virtual void for_each_with(Entity &entity, Transform &transform,
                                float dt) override {
       if (ids.contains(entity.id)) {
         return;
       }
 
-      if (callbacks.should_skip_entity &&
-          callbacks.should_skip_entity(entity)) {
+      if (skipped_as_first(entity)) {
         return;
       }
 
-      if (callbacks.is_floor_overlay && callbacks.is_floor_overlay(entity)) {
-        return;
+      for (auto [other, b] : collidables) {
+        if (other.id == entity.id) {
+          continue;
+        }
+        if (collide_pair(transform, other, b, dt) != PairResult::Ignored) {
+          ids.insert(other.id);
+        }
       }
+    }
 
-      if (callbacks.gets_absorbed && callbacks.gets_absorbed(entity)) {
-        return;
+  private:
+    // Scratch for the once() pass, kept between ticks.
+    std::vector<Entity *> bodies_;
+    std::vector<Transform *> transforms_;
+    std::vector<Aabb> bounds_;
+    std::vector<BroadphasePair> pairs_;
+    std::vector<std::uint32_t> neighbor_start_;
+    std::vector<std::uint32_t> neighbors_;
+    std::vector<std::uint8_t> done_;
+    std::vector<std::uint8_t> fast_;
+    std::vector<vec2> swept_from_;
+    // Sleeping or immovable, and the indices of the rest.
+    std::vector<std::uint8_t> resting_;
+    std::vector<std::uint32_t> awake_;
+    // Islands, as a union-find over body indices.
+    std::vector<std::uint32_t> island_of_;
+    std::vector<std::pair<EntityID, std::uint32_t>> by_island_;
+    std::vector<std::uint8_t> island_awake_;
+    std::vector<float> island_still_;
+    std::size_t sleeping_ = 0;
+
+    // The bodies, by field, for the built-in paths.
+    struct Packed : ContactBodies {
+      std::vector<std::uint8_t> flags;
+    } packed_;
+    AabbRow row_;
+    std::vector<Contact> contacts_;
+
+    // Starts no collisions of its own.
+    static constexpr std::uint8_t skip_first = 1;
+    // Never collides at all (floor overlays, absorbed entities).
+    static constexpr std::uint8_t never_hit = 2;
+
+    [[nodiscard]] Aabb bounds_of(const Transform &t) const {
+      const Aabb box = callbacks.get_bounds
+                           ? callbacks.get_bounds(t)
+                           : Aabb{.min_x = t.position.x,
+                                  .min_y = t.position.y,
+                                  .max_x = t.position.x + t.size.x,
+                                  .max_y = t.position.y + t.size.y};
+      return {.min_x = box.min_x - broadphase_margin,
+              .min_y = box.min_y - broadphase_margin,
+              .max_x = box.max_x + broadphase_margin,
+              .max_y = box.max_y + broadphase_margin};
+    }
+
+    void resolve_pairs(const float dt) {
+      gather(dt);
+      if (broadphase)
+        find_candidates();
+      if (callbacks.is_fast)
+        sweep_fast_bodies(dt);
+
+      done_.assign(bodies_.size(), 0);
+      if (solver == Solver::Colored)
+        solve_contacts(dt);
+      else if (narrowphase == Narrowphase::Aabb)
+        resolve_packed(dt);
+      else
+        resolve_callbacks(dt);
+      if (allow_sleep)
+        update_sleep(dt);
+    }
+
+    // The same pass as for_each_with over every collidable, in collidables
+    // order. With a broadphase each entity only meets the candidates it
+    // found, still in that order.
+    void resolve_callbacks(const float dt) {
+      const std::size_t n = bodies_.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (done_[i] || skipped_as_first(*bodies_[i]))
+          continue;
+        const auto meet = [&](const std::uint32_t j) {
+          if (j == i || both_resting(i, j))
+            return;
+          if (collide_pair(*transforms_[i], *bodies_[j], *transforms_[j],
+                           dt) != PairResult::Ignored)
+            done_[j] = 1;
+        };
+        if (broadphase) {
+          for (std::uint32_t k = neighbor_start_[i];
+               k < neighbor_start_[i + 1]; ++k)
+            meet(neighbors_[k]);
+        } else if (allow_sleep && resting_[i]) {
+          // A resting body only meets awake ones.
+          for (const std::uint32_t j : awake_)
+            meet(j);
+        } else {
+          for (std::size_t j = 0; j < n; ++j)
+            meet(static_cast<std::uint32_t>(j));
+        }
+      }
+    }
+
+    // Candidates per body, both ways round, as ranges of neighbors_ in
+    // collidables order. A fast body's bounds cover its whole sweep.
+    void find_candidates() {
+      const std::size_t n = bodies_.size();
+      bounds_.clear();
+      for (std::size_t i = 0; i < n; ++i) {
+        const Transform &t = *transforms_[i];
+        Aabb box = bounds_of(t);
+        if (fast_[i]) {
+          const float dx = swept_from_[i].x - t.position.x;
+          const float dy = swept_from_[i].y - t.position.y;
+          box = {.min_x = std::min(box.min_x, box.min_x + dx),
+                 .min_y = std::min(box.min_y, box.min_y + dy),
+                 .max_x = std::max(box.max_x, box.max_x + dx),
+                 .max_y = std::max(box.max_y, box.max_y + dy)};
+        }
+        bounds_.push_back(box);
       }
+      broadphase->find_pairs(bounds_, pairs_);
 
-      for (Entity &other : collidables) {
-        if (other.id == entity.id) {
+      neighbor_start_.assign(n + 1, 0);
+      for (const BroadphasePair &p : pairs_) {
+        ++neighbor_start_[p.a + 1];
+        ++neighbor_start_[p.b + 1];
+      }
+      for (std::size_t i = 0; i < n; ++i)
+        neighbor_start_[i + 1] += neighbor_start_[i];
+      neighbors_.resize(pairs_.size() * 2);
+      for (const BroadphasePair &p : pairs_) {
+        neighbors_[neighbor_start_[p.a]++] = p.b;
+        neighbors_[neighbor_start_[p.b]++] = p.a;
+      }
+      // The fill advanced each start to the next body's; shift back.
+      for (std::size_t i = n; i > 0; --i)
+        neighbor_start_[i] = neighbor_start_[i - 1];
+      neighbor_start_[0] = 0;
+      for (std::size_t i = 0; i < n; ++i)
+        std::sort(neighbors_.begin() + neighbor_start_[i],
+                  neighbors_.begin() + neighbor_start_[i + 1]);
+    }
+
+    void gather(const float dt) {
+      bodies_.clear();
+      transforms_.clear();
+      fast_.clear();
+      swept_from_.clear();
+      resting_.clear();
+      awake_.clear();
+      for (auto [entity, transform] : collidables) {
+        bodies_.push_back(&entity);
+        transforms_.push_back(&transform);
+        const bool fast = callbacks.is_fast && callbacks.is_fast(entity);
+        fast_.push_back(fast);
+        swept_from_.push_back(fast ? swept_from(entity, transform, dt)
+                                   : transform.position);
+        if (!allow_sleep)
           continue;
+        const bool resting = !movable(transform) || hold_asleep(transform, dt);
+        resting_.push_back(resting);
+        if (!resting)
+          awake_.push_back(static_cast<std::uint32_t>(resting_.size() - 1));
+      }
+    }
+
+    [[nodiscard]] static bool movable(const Transform &t) {
+      return t.collision_config.mass > 0.0f &&
+             t.collision_config.mass != std::numeric_limits<float>::max();
+    }
+
+    [[nodiscard]] bool still(const Transform &t) const {
+      return t.velocity.x * t.velocity.x + t.velocity.y * t.velocity.y <=
+             sleep_speed * sleep_speed;
+    }
+
+    // Keep a sleeping body where it fell asleep, or wake it if it was given
+    // a speed, or moved further, than a still body could have managed.
+    bool hold_asleep(Transform &t, const float dt) const {
+      CollisionConfig &c = t.collision_config;
+      if (!c.asleep)
+        return false;
+      const float dx = t.position.x - c.rest_x;
+      const float dy = t.position.y - c.rest_y;
+      const float reach = sleep_speed * dt;
+      if (!still(t) || dx * dx + dy * dy > reach * reach) {
+        wake(t);
+        return false;
+      }
+      t.position = {c.rest_x, c.rest_y};
+      t.velocity = {0.f, 0.f};
+      return true;
+    }
+
+    [[nodiscard]] bool both_resting(const std::size_t i,
+                                    const std::size_t j) const {
+      return allow_sleep && resting_[i] && resting_[j];
+    }
+
+    [[nodiscard]] std::uint32_t island_root(std::uint32_t i) {
+      while (island_of_[i] != i)
+        i = island_of_[i] = island_of_[island_of_[i]];
+      return i;
+    }
+
+    void join(const std::uint32_t a, const std::uint32_t b) {
+      const std::uint32_t ra = island_root(a), rb = island_root(b);
+      if (ra != rb)
+        island_of_[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    // An island is the movable bodies touching an awake one at the end of
+    // the tick (their bounds overlap, margin included), joined with those
+    // that fell asleep together. An island with no awake body stays
+    // asleep. One whose awake bodies have all been still for sleep_time
+    // falls asleep; any other is (or stays) awake, its sleepers woken.
+    void update_sleep(const float dt) {
+      const std::size_t n = bodies_.size();
+      island_of_.resize(n);
+      bounds_.clear();
+      for (std::size_t i = 0; i < n; ++i) {
+        island_of_[i] = static_cast<std::uint32_t>(i);
+        bounds_.push_back(bounds_of(*transforms_[i]));
+      }
+      for (const std::uint32_t i : awake_) {
+        const auto meet = [&](const std::uint32_t j) {
+          if (j != i && movable(*transforms_[j]) &&
+              bounds_[i].overlaps(bounds_[j]))
+            join(i, j);
+        };
+        if (broadphase) {
+          for (std::uint32_t k = neighbor_start_[i];
+               k < neighbor_start_[i + 1]; ++k)
+            meet(neighbors_[k]);
+        } else {
+          for (std::size_t j = 0; j < n; ++j)
+            meet(static_cast<std::uint32_t>(j));
         }
-        if (callbacks.is_floor_overlay && callbacks.is_floor_overlay(other)) {
+      }
+      by_island_.clear();
+      for (std::size_t i = 0; i < n; ++i)
+        if (const EntityID island = transforms_[i]->collision_config.island;
+            island != -1 && movable(*transforms_[i]))
+          by_island_.push_back({island, static_cast<std::uint32_t>(i)});
+      std::sort(by_island_.begin(), by_island_.end());
+      for (std::size_t k = 1; k < by_island_.size(); ++k)
+        if (by_island_[k].first == by_island_[k - 1].first)
+          join(by_island_[k - 1].second, by_island_[k].second);
+
+      island_awake_.assign(n, 0);
+      island_still_.assign(n, std::numeric_limits<float>::max());
+      for (std::size_t i = 0; i < n; ++i) {
+        Transform &t = *transforms_[i];
+        CollisionConfig &c = t.collision_config;
+        if (!movable(t) || c.asleep)
+          continue;
+        c.still_for = still(t) ? c.still_for + dt : 0.f;
+        const std::uint32_t root = island_root(static_cast<std::uint32_t>(i));
+        island_awake_[root] = 1;
+        island_still_[root] = std::min(island_still_[root], c.still_for);
+      }
+
+      sleeping_ = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        Transform &t = *transforms_[i];
+        CollisionConfig &c = t.collision_config;
+        if (!movable(t))
           continue;
+        const std::uint32_t root = island_root(static_cast<std::uint32_t>(i));
+        if (!island_awake_[root]) {
+          ++sleeping_;
+        } else if (island_still_[root] >= sleep_time) {
+          c.asleep = true;
+          c.island = bodies_[root]->id;
+          c.rest_x = t.position.x;
+          c.rest_y = t.position.y;
+          t.velocity = {0.f, 0.f};
+          ++sleeping_;
+        } else {
+          if (c.asleep)
+            wake(t);
+          c.island = -1;
         }
+      }
+    }
 
-        Transform &b = other.get<Transform>();
+    // Where a fast entity was at the start of the tick: its Previous<T>
+    // (SystemManager::keep_previous) when it has one, else a tick's worth of
+    // velocity back from where it is.
+    [[nodiscard]] static vec2 swept_from(const Entity &entity,
+                                         const Transform &t, const float dt) {
+      if (entity.has<Previous<Transform>>())
+        return entity.get<Previous<Transform>>().value.position;
+      return {t.position.x - t.velocity.x * dt,
+              t.position.y - t.velocity.y * dt};
+    }
 
-        if (callbacks.gets_absorbed && callbacks.gets_absorbed(other)) {
-          if (callbacks.get_absorber_parent_id) {
-            auto parent_id = callbacks.get_absorber_parent_id(other);
-            if (parent_id.has_value() && parent_id.value() == entity.id) {
-              ids.insert(other.id);
-              continue;
-            }
+    // Sweep each fast entity's box from swept_from() to where it is now,
+    // against every other body where it is now. On a hit, put the entity
+    // back at the first contact (the rest of its move is lost) and apply
+    // the normal impulse resolve_collision would along the face it hit.
+    // Later passes then see the two touching, not overlapping.
+    void sweep_fast_bodies(const float dt) {
+      const std::size_t n = bodies_.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (!fast_[i] || skipped_as_first(*bodies_[i]))
+          continue;
+        Transform &t = *transforms_[i];
+        const vec2 from = swept_from_[i];
+        const float dx = t.position.x - from.x;
+        const float dy = t.position.y - from.y;
+        if (dx == 0.f && dy == 0.f)
+          continue;
+
+        SweptHit best;
+        std::size_t hit = n;
+        const auto test = [&](const std::size_t j) {
+          if (j == i || never_collides(*bodies_[j]))
+            return;
+          const Transform &o = *transforms_[j];
+          const SweptHit h = sweep_box(
+              from.x, from.y, from.x + t.size.x, from.y + t.size.y, dx, dy,
+              o.position.x, o.position.y, o.position.x + o.size.x,
+              o.position.y + o.size.y);
+          if (h.hit && h.toi < best.toi) {
+            best = h;
+            hit = j;
           }
-          ids.insert(other.id);
+        };
+        if (broadphase) {
+          for (std::uint32_t k = neighbor_start_[i];
+               k < neighbor_start_[i + 1]; ++k)
+            test(neighbors_[k]);
+        } else {
+          for (std::size_t j = 0; j < n; ++j)
+            test(j);
+        }
+        if (hit == n)
           continue;
+        t.position = {from.x + dx * best.toi, from.y + dy * best.toi};
+        impact(t, *transforms_[hit], best.nx, best.ny, dt);
+      }
+    }
+
+    [[nodiscard]] bool never_collides(const Entity &e) const {
+      return (callbacks.is_floor_overlay && callbacks.is_floor_overlay(e)) ||
+             (callbacks.gets_absorbed && callbacks.gets_absorbed(e));
+    }
+
+    // calculate_impulse along (nx, ny), applied as resolve_collision does.
+    void impact(Transform &a, Transform &b, const float nx, const float ny,
+                const float dt) {
+      const auto inv_mass = [](const Transform &t) {
+        const float m = t.collision_config.mass;
+        return m > 0.0f && m != std::numeric_limits<float>::max() ? 1.0f / m
+                                                                  : 0.0f;
+      };
+      const float inv_a = inv_mass(a), inv_b = inv_mass(b);
+      if (!(inv_a + inv_b > 0.0f))
+        return;
+      const float rvx = b.velocity.x - a.velocity.x;
+      const float rvy = b.velocity.y - a.velocity.y;
+      const float along = rvx * nx + rvy * ny;
+      if (!(along < 0.0f))
+        return;
+      float restitution = std::min(a.collision_config.restitution,
+                                   b.collision_config.restitution);
+      if (std::sqrt(rvx * rvx + rvy * rvy) >
+          config.get_max_speed() * .75f)
+        restitution *= 0.5f;
+      const float impulse = -(1.0f + restitution) * along /
+                            (inv_a + inv_b) * config.get_collision_scalar() *
+                            dt;
+      a.velocity = {a.velocity.x - nx * impulse * inv_a,
+                    a.velocity.y - ny * impulse * inv_a};
+      b.velocity = {b.velocity.x + nx * impulse * inv_b,
+                    b.velocity.y + ny * impulse * inv_b};
+    }
+
+    void pack() {
+      Packed &p = packed_;
+      const std::size_t n = bodies_.size();
+      p.boxes.clear();
+      for (auto *v : {&p.w, &p.h, &p.vx, &p.vy, &p.mass, &p.inv_mass,
+                      &p.friction, &p.restitution})
+        v->resize(n);
+      p.flags.resize(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        const Transform &t = *transforms_[i];
+        const Entity &e = *bodies_[i];
+        p.boxes.push(t.position.x, t.position.y, t.position.x + t.size.x,
+                     t.position.y + t.size.y, static_cast<std::uint32_t>(i));
+        p.w[i] = t.size.x;
+        p.h[i] = t.size.y;
+        p.vx[i] = t.velocity.x;
+        p.vy[i] = t.velocity.y;
+        p.mass[i] = t.collision_config.mass;
+        p.inv_mass[i] = 1.0f / t.collision_config.mass;
+        p.friction[i] = t.collision_config.friction;
+        p.restitution[i] = t.collision_config.restitution;
+        p.flags[i] = 0;
+        if (callbacks.should_skip_entity && callbacks.should_skip_entity(e))
+          p.flags[i] |= skip_first;
+        // An absorbed entity also leaves the tick when first met, but as
+        // it starts nothing itself that changes nothing here.
+        if (never_collides(e))
+          p.flags[i] |= never_hit | skip_first;
+      }
+    }
+
+    void resolve_packed(const float dt) {
+      pack();
+      Packed &p = packed_;
+      const std::size_t n = bodies_.size();
+      const float scalar = config.get_collision_scalar();
+      const float max_speed = config.get_max_speed();
+
+      AabbRow &boxes = p.boxes;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (done_[i] || (p.flags[i] & skip_first))
+          continue;
+        // Without a broadphase, test against every box in place; with one,
+        // gather this body's candidates into a row of their own. Resolving
+        // moves only this body and the one it hit, so the rest of the row
+        // stays current.
+        // A resting body only meets awake ones.
+        const AabbRow *row = &boxes;
+        const bool resting = allow_sleep && resting_[i];
+        if (broadphase || resting) {
+          row_.clear();
+          const auto add = [&](const std::uint32_t j) {
+            if (!(p.flags[j] & never_hit) && !both_resting(i, j))
+              row_.push(boxes.min_x[j], boxes.min_y[j], boxes.max_x[j],
+                        boxes.max_y[j], j);
+          };
+          if (broadphase) {
+            for (std::uint32_t k = neighbor_start_[i];
+                 k < neighbor_start_[i + 1]; ++k)
+              add(neighbors_[k]);
+          } else {
+            for (const std::uint32_t j : awake_)
+              add(j);
+          }
+          row = &row_;
+        }
+        for (std::size_t k = 0;; ++k) {
+          k = first_overlap(*row, k, boxes.min_x[i], boxes.min_y[i],
+                            boxes.max_x[i], boxes.max_y[i]);
+          if (k == row->size())
+            break;
+          const std::uint32_t j = row->index[k];
+          if (j == i || (p.flags[j] & never_hit) || both_resting(i, j))
+            continue;
+          resolve_packed_pair(i, j, dt, scalar, max_speed);
+          done_[j] = 1;
         }
+      }
+
+      unpack();
+    }
 
-        if (!callbacks.check_overlap(transform, b)) {
+    void unpack() {
+      const Packed &p = packed_;
+      for (std::size_t i = 0; i < transforms_.size(); ++i) {
+        Transform &t = *transforms_[i];
+        t.position = {p.boxes.min_x[i], p.boxes.min_y[i]};
+        t.velocity = {p.vx[i], p.vy[i]};
+      }
+    }
+
+    // A contact for every pair overlapping at the start of the tick, in
+    // collidables order, then solve them all together. Pairs the
+    // sequential pass never resolves (floor overlays, absorbed entities,
+    // two that both start nothing, two immovable bodies) are left out.
+    void solve_contacts(const float dt) {
+      pack();
+      const Packed &p = packed_;
+      const AabbRow &boxes = p.boxes;
+      const std::size_t n = bodies_.size();
+      contacts_.clear();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (p.flags[i] & never_hit)
           continue;
+        const AabbRow *row = &boxes;
+        std::size_t from = i + 1;
+        const bool resting = allow_sleep && resting_[i];
+        if (broadphase || resting) {
+          row_.clear();
+          const auto add = [&](const std::uint32_t j) {
+            if (j > i && !both_resting(i, j))
+              row_.push(boxes.min_x[j], boxes.min_y[j], boxes.max_x[j],
+                        boxes.max_y[j], j);
+          };
+          if (broadphase) {
+            for (std::uint32_t k = neighbor_start_[i];
+                 k < neighbor_start_[i + 1]; ++k)
+              add(neighbors_[k]);
+          } else {
+            for (const std::uint32_t j : awake_)
+              add(j);
+          }
+          row = &row_;
+          from = 0;
+        }
+        for (std::size_t k = from;; ++k) {
+          k = first_overlap(*row, k, boxes.min_x[i], boxes.min_y[i],
+                            boxes.max_x[i], boxes.max_y[i]);
+          if (k == row->size())
+            break;
+          const std::uint32_t j = row->index[k];
+          if ((p.flags[j] & never_hit) ||
+              ((p.flags[i] & skip_first) && (p.flags[j] & skip_first)) ||
+              (!p.movable(i) && !p.movable(j)) || both_resting(i, j))
+            continue;
+          float nx = boxes.min_x[j] - boxes.min_x[i];
+          float ny = boxes.min_y[j] - boxes.min_y[i];
+          const float len = std::sqrt(nx * nx + ny * ny);
+          nx = len < 0.0001f ? 0.f : nx / len;
+          ny = len < 0.0001f ? 0.f : ny / len;
+          contacts_.push_back({static_cast<std::uint32_t>(i), j, nx, ny});
+        }
+      }
+      contact_solver.solve(packed_, contacts_, config.get_collision_scalar(),
+                           dt, config.get_max_speed(), workers);
+      unpack();
+    }
+
+    // resolve_collision on packed bodies, step for step.
+    void resolve_packed_pair(const std::size_t a, const std::size_t b,
+                             const float dt, const float scalar,
+                             const float max_speed) {
+      Packed &p = packed_;
+      std::vector<float> &x = p.boxes.min_x;
+      std::vector<float> &y = p.boxes.min_y;
+      const auto length = [](const float u, const float v) {
+        return std::sqrt(u * u + v * v);
+      };
+      const auto normalize = [&](float &u, float &v) {
+        const float len = length(u, v);
+        if (len < 0.0001f) {
+          u = v = 0.f;
+          return;
+        }
+        u = u / len;
+        v = v / len;
+      };
+      const auto movable = [&](const std::size_t i) {
+        return p.mass[i] > 0.0f &&
+               p.mass[i] != std::numeric_limits<float>::max();
+      };
+      const float inv_sum = p.inv_mass[a] + p.inv_mass[b];
+
+      float nx = x[b] - x[a];
+      float ny = y[b] - y[a];
+      normalize(nx, ny);
+
+      float rvx = p.vx[b] - p.vx[a];
+      float rvy = p.vy[b] - p.vy[a];
+      float impulse = 0.f;
+      if (const float along = rvx * nx + rvy * ny; !(along > 0.0f)) {
+        float restitution = std::min(p.restitution[a], p.restitution[b]);
+        if (length(rvx, rvy) > (max_speed * .75f))
+          restitution *= 0.5f;
+        impulse = -(1.0f + restitution) * along;
+        impulse /= inv_sum;
+      }
+      const float impulse_magnitude = impulse * scalar * dt;
+      if (movable(a)) {
+        p.vx[a] = p.vx[a] - nx * impulse_magnitude * p.inv_mass[a];
+        p.vy[a] = p.vy[a] - ny * impulse_magnitude * p.inv_mass[a];
+      }
+      if (movable(b)) {
+        p.vx[b] = p.vx[b] + nx * impulse_magnitude * p.inv_mass[b];
+        p.vy[b] = p.vy[b] + ny * impulse_magnitude * p.inv_mass[b];
+      }
+
+      rvx = p.vx[b] - p.vx[a];
+      rvy = p.vy[b] - p.vy[a];
+      const float dot = rvx * nx + rvy * ny;
+      float tx = rvx - nx * dot;
+      float ty = rvy - ny * dot;
+      normalize(tx, ty);
+      const float coefficient = std::sqrt(p.friction[a] * p.friction[b]);
+      const float friction =
+          std::clamp((rvx * tx + rvy * ty) / inv_sum, -impulse * coefficient,
+                     impulse * coefficient);
+      const float friction_magnitude = friction * scalar * dt;
+      if (movable(a)) {
+        p.vx[a] = p.vx[a] - tx * friction_magnitude * p.inv_mass[a];
+        p.vy[a] = p.vy[a] - ty * friction_magnitude * p.inv_mass[a];
+      }
+      if (movable(b)) {
+        p.vx[b] = p.vx[b] + tx * friction_magnitude * p.inv_mass[b];
+        p.vy[b] = p.vy[b] + ty * friction_magnitude * p.inv_mass[b];
+      }
+
+      for (const std::size_t i : {a, b}) {
+        if (length(p.vx[i], p.vy[i]) > max_speed) {
+          float vx = p.vx[i], vy = p.vy[i];
+          normalize(vx, vy);
+          p.vx[i] = vx * max_speed;
+          p.vy[i] = vy * max_speed;
         }
+      }
 
-        resolve_collision(transform, b, dt);
-        ids.insert(other.id);
+      const float overlap_x = std::min(x[a] + p.w[a], x[b] + p.w[b]) -
+                              std::max(x[a], x[b]);
+      const float overlap_y = std::min(y[a] + p.h[a], y[b] + p.h[b]) -
+                              std::max(y[a], y[b]);
+      const float depth = overlap_x <= 0.0f || overlap_y <= 0.0f
+                              ? 0.0f
+                              : std::min(overlap_x, overlap_y);
+      const float correction = std::max(depth, 0.0f) / inv_sum;
+      float cx = nx * correction;
+      float cy = ny * correction;
+      normalize(cx, cy);
+      x[a] = x[a] - cx * p.inv_mass[a];
+      y[a] = y[a] - cy * p.inv_mass[a];
+      x[b] = x[b] + cx * p.inv_mass[b];
+      y[b] = y[b] + cy * p.inv_mass[b];
+      for (const std::size_t i : {a, b}) {
+        p.boxes.max_x[i] = x[i] + p.w[i];
+        p.boxes.max_y[i] = y[i] + p.h[i];
       }
     }
   };
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "../core/worker_pool.h"
+#include "narrowphase.h"
+
+namespace afterhours {
+
+// Bodies by field, as the built-in collision paths work on them. `boxes`
+// holds position to position + size and is kept current as bodies move.
+struct ContactBodies {
+  AabbRow boxes;
+  std::vector<float> w, h, vx, vy;
+  std::vector<float> mass, inv_mass, friction, restitution;
+
+  [[nodiscard]] std::size_t size() const { return boxes.size(); }
+
+  // Infinite (or non-positive) mass: never moved by a contact.
+  [[nodiscard]] bool movable(const std::size_t i) const {
+    return mass[i] > 0.0f && mass[i] != std::numeric_limits<float>::max();
+  }
+};
+
+// Two overlapping bodies, and the direction from a to b.
+struct Contact {
+  std::uint32_t a = 0;
+  std::uint32_t b = 0;
+  float nx = 0.f;
+  float ny = 0.f;
+};
+
+// Resolves a tick's contacts all together instead of one at a time: a few
+// velocity passes over every contact, then a few position passes. Contacts
+// are colored so no two of one color move the same body; a color's contacts
+// then run side by side on a WorkerPool, colors one after another. Contacts
+// involving an immovable body don't move it, so they don't conflict over it.
+//
+// A color's contacts touch separate bodies and colors run in a fixed
+// order, so the result depends only on the contact list: not on the number
+// of threads, nor on how the work is split between them.
+class ContactSolver {
+public:
+  int velocity_iterations = 4;
+  int position_iterations = 2;
+  // Contacts per job handed to a worker; smaller colors stay on the
+  // calling thread.
+  std::size_t chunk_size = 128;
+
+  // 64 colors fit a mask; contacts that need more go into one extra color,
+  // solved on the calling thread.
+  static constexpr std::size_t max_colors = 64;
+
+  // Impulses are scaled by scalar * dt, as in resolve_collision, and the
+  // speeds of movable bodies in a contact capped at max_speed after the
+  // velocity passes; bodies in no contact keep their speed. Without workers
+  // (or when called from a worker job) everything runs on the calling
+  // thread.
+  void solve(ContactBodies &bodies, const std::vector<Contact> &contacts,
+             const float scalar, const float dt, const float max_speed,
+             WorkerPool *workers) {
+    bodies_ = &bodies;
+    contacts_ = &contacts;
+    scale_ = scalar * dt;
+    max_speed_ = max_speed;
+    color(bodies, contacts);
+
+    for (int pass = 0; pass < velocity_iterations; ++pass)
+      run_colors(workers, &ContactSolver::solve_velocity);
+    for (std::size_t i = 0; i < bodies.size(); ++i)
+      if (touched_[i])
+        clamp_speed(i);
+    for (int pass = 0; pass < position_iterations; ++pass)
+      run_colors(workers, &ContactSolver::solve_position);
+  }
+
+  // Colors the last solve() used, the overflow color included.
+  [[nodiscard]] std::size_t colors() const {
+    std::size_t n = 0;
+    for (std::size_t c = 0; c + 1 < color_start_.size(); ++c)
+      n += color_start_[c + 1] > color_start_[c];
+    return n;
+  }
+
+  // Contacts of the last solve(), grouped by color: indices into its
+  // contact list.
+  [[nodiscard]] const std::vector<std::uint32_t> &by_color() const {
+    return order_;
+  }
+  [[nodiscard]] const std::vector<std::uint32_t> &color_start() const {
+    return color_start_;
+  }
+
+private:
+  using Step = void (ContactSolver::*)(const Contact &);
+
+  ContactBodies *bodies_ = nullptr;
+  const std::vector<Contact> *contacts_ = nullptr;
+  float scale_ = 0.f;
+  float max_speed_ = 0.f;
+
+  std::vector<std::uint64_t> used_;
+  // Movable bodies in at least one contact: the ones clamp_speed applies to.
+  std::vector<std::uint8_t> touched_;
+  std::vector<std::uint8_t> color_of_;
+  // order_[color_start_[c] .. color_start_[c + 1]) is color c.
+  std::vector<std::uint32_t> color_start_;
+  std::vector<std::uint32_t> order_;
+  std::vector<std::uint32_t> next_;
+
+  // What the current worker job runs.
+  Step step_ = nullptr;
+  std::size_t job_begin_ = 0;
+  std::size_t job_end_ = 0;
+
+  // Greedy: each contact takes the lowest color neither movable body has
+  // yet. Then a stable counting sort by color.
+  void color(const ContactBodies &bodies,
+             const std::vector<Contact> &contacts) {
+    used_.assign(bodies.size(), 0);
+    touched_.assign(bodies.size(), 0);
+    color_of_.resize(contacts.size());
+    color_start_.assign(max_colors + 2, 0);
+    for (std::size_t k = 0; k < contacts.size(); ++k) {
+      const Contact &c = contacts[k];
+      const bool move_a = bodies.movable(c.a);
+      const bool move_b = bodies.movable(c.b);
+      touched_[c.a] |= move_a;
+      touched_[c.b] |= move_b;
+      const std::uint64_t taken =
+          (move_a ? used_[c.a] : 0) | (move_b ? used_[c.b] : 0);
+      const auto color = static_cast<std::size_t>(std::countr_one(taken));
+      color_of_[k] = static_cast<std::uint8_t>(color);
+      ++color_start_[color + 1];
+      if (color == max_colors)
+        continue;
+      const std::uint64_t bit = std::uint64_t{1} << color;
+      if (move_a)
+        used_[c.a] |= bit;
+      if (move_b)
+        used_[c.b] |= bit;
+    }
+    for (std::size_t c = 1; c < color_start_.size(); ++c)
+      color_start_[c] += color_start_[c - 1];
+    order_.resize(contacts.size());
+    next_.assign(color_start_.begin(), color_start_.end() - 1);
+    for (std::size_t k = 0; k < contacts.size(); ++k)
+      order_[next_[color_of_[k]]++] = static_cast<std::uint32_t>(k);
+  }
+
+  void run_colors(WorkerPool *workers, const Step step) {
+    step_ = step;
+    const std::function<void(std::size_t)> job = [this](std::size_t chunk) {
+      const std::size_t begin = job_begin_ + chunk * chunk_size;
+      const std::size_t end = std::min(job_end_, begin + chunk_size);
+      for (std::size_t k = begin; k < end; ++k)
+        (this->*step_)((*contacts_)[order_[k]]);
+    };
+    for (std::size_t c = 0; c + 1 < color_start_.size(); ++c) {
+      job_begin_ = color_start_[c];
+      job_end_ = color_start_[c + 1];
+      const std::size_t count = job_end_ - job_begin_;
+      if (count == 0)
+        continue;
+      // The overflow color's contacts may share bodies.
+      const bool serial = c == max_colors || !workers ||
+                          WorkerPool::in_job() || count <= chunk_size;
+      if (serial) {
+        for (std::size_t k = job_begin_; k < job_end_; ++k)
+          (this->*step)((*contacts_)[order_[k]]);
+        continue;
+      }
+      workers->run((count + chunk_size - 1) / chunk_size, job);
+    }
+  }
+
+  [[nodiscard]] static float length(const float x, const float y) {
+    return std::sqrt(x * x + y * y);
+  }
+
+  // The normal impulse and friction of resolve_collision.
+  void solve_velocity(const Contact &c) {
+    ContactBodies &p = *bodies_;
+    const std::uint32_t a = c.a, b = c.b;
+    const float inv_a = p.movable(a) ? p.inv_mass[a] : 0.f;
+    const float inv_b = p.movable(b) ? p.inv_mass[b] : 0.f;
+    const float inv_sum = inv_a + inv_b;
+    if (!(inv_sum > 0.f))
+      return;
+
+    float rvx = p.vx[b] - p.vx[a];
+    float rvy = p.vy[b] - p.vy[a];
+    const float along = rvx * c.nx + rvy * c.ny;
+    if (!(along < 0.f))
+      return;
+    float restitution = std::min(p.restitution[a], p.restitution[b]);
+    if (length(rvx, rvy) > max_speed_ * .75f)
+      restitution *= 0.5f;
+    const float impulse = -(1.0f + restitution) * along / inv_sum;
+    const float j = impulse * scale_;
+    add_velocity(a, -c.nx * j * inv_a, -c.ny * j * inv_a);
+    add_velocity(b, c.nx * j * inv_b, c.ny * j * inv_b);
+
+    rvx = p.vx[b] - p.vx[a];
+    rvy = p.vy[b] - p.vy[a];
+    const float dot = rvx * c.nx + rvy * c.ny;
+    float tx = rvx - c.nx * dot;
+    float ty = rvy - c.ny * dot;
+    const float t_len = length(tx, ty);
+    if (t_len < 0.0001f)
+      return;
+    tx /= t_len;
+    ty /= t_len;
+    const float mu = std::sqrt(p.friction[a] * p.friction[b]);
+    const float friction = std::clamp((rvx * tx + rvy * ty) / inv_sum,
+                                      -impulse * mu, impulse * mu) *
+                           scale_;
+    add_velocity(a, -tx * friction * inv_a, -ty * friction * inv_a);
+    add_velocity(b, tx * friction * inv_b, ty * friction * inv_b);
+  }
+
+  // Immovable bodies are shared between a color's contacts, so they are
+  // only ever read (here and in move()).
+  void add_velocity(const std::uint32_t i, const float dvx, const float dvy) {
+    if (!bodies_->movable(i))
+      return;
+    bodies_->vx[i] += dvx;
+    bodies_->vy[i] += dvy;
+  }
+
+  // Push an overlapping pair apart along the contact normal by their
+  // current penetration depth, split by inverse mass.
+  void solve_position(const Contact &c) {
+    ContactBodies &p = *bodies_;
+    AabbRow &box = p.boxes;
+    const std::uint32_t a = c.a, b = c.b;
+    const float inv_a = p.movable(a) ? p.inv_mass[a] : 0.f;
+    const float inv_b = p.movable(b) ? p.inv_mass[b] : 0.f;
+    const float inv_sum = inv_a + inv_b;
+    if (!(inv_sum > 0.f))
+      return;
+
+    const float overlap_x = std::min(box.max_x[a], box.max_x[b]) -
+                            std::max(box.min_x[a], box.min_x[b]);
+    const float overlap_y = std::min(box.max_y[a], box.max_y[b]) -
+                            std::max(box.min_y[a], box.min_y[b]);
+    if (overlap_x <= 0.f || overlap_y <= 0.f)
+      return;
+    const float apart = std::min(overlap_x, overlap_y) / inv_sum;
+    move(a, -c.nx * apart * inv_a, -c.ny * apart * inv_a);
+    move(b, c.nx * apart * inv_b, c.ny * apart * inv_b);
+  }
+
+  void move(const std::uint32_t i, const float dx, const float dy) {
+    if (!bodies_->movable(i))
+      return;
+    AabbRow &box = bodies_->boxes;
+    box.min_x[i] += dx;
+    box.min_y[i] += dy;
+    box.max_x[i] = box.min_x[i] + bodies_->w[i];
+    box.max_y[i] = box.min_y[i] + bodies_->h[i];
+  }
+
+  void clamp_speed(const std::size_t i) {
+    ContactBodies &p = *bodies_;
+    const float speed = length(p.vx[i], p.vy[i]);
+    if (speed > max_speed_) {
+      p.vx[i] = p.vx[i] / speed * max_speed_;
+      p.vy[i] = p.vy[i] / speed * max_speed_;
+    }
+  }
+};
+
+} // namespace afterhours
@@ -2,12 +2,14 @@
 // This module is intentionally opt-in: projects must explicitly register it.
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "../../logging.h"
+#include "../../memory/alloc_tracking.h"
 #include "pending_command.h"
 
 namespace afterhours {
@@ -18,6 +20,8 @@ struct PerfEntry {
     std::string name;
     float ms = 0.f;
     std::optional<int> entity_count;
+    // Heap allocations in the last frame, when tracked.
+    std::optional<std::uint64_t> allocations;
 };
 
 struct PerfProvider {
@@ -27,6 +31,10 @@ struct PerfProvider {
     std::function<std::optional<float>()> get_p99_ms;
     // Return top profile entries (already sorted or unsorted; handler sorts).
     std::function<std::vector<PerfEntry>(int)> top_entries;
+    // Return heap allocations in the last frame if tracked.
+    std::function<std::optional<std::uint64_t>()> get_frame_allocations;
+    // Return the systems that allocated most in the last frame.
+    std::function<std::vector<PerfEntry>(int)> top_allocators;
 };
 
 inline PerfProvider &provider() {
@@ -36,6 +44,55 @@ inline PerfProvider &provider() {
 
 inline void set_provider(PerfProvider p) { provider() = std::move(p); }
 
+// Fill get_frame_allocations and top_allocators from `sm`'s allocation
+// tracking. Both report nothing unless the hook in memory/alloc_hook.h is
+// linked in.
+inline void add_allocation_stats(PerfProvider &p, const SystemManager &sm) {
+    p.get_frame_allocations = [&sm]() -> std::optional<std::uint64_t> {
+        if (!alloc_tracking::installed()) return std::nullopt;
+        return sm.frame_allocations().counts.allocations;
+    };
+    p.top_allocators = [&sm](int) {
+        std::vector<PerfEntry> entries;
+        if (!alloc_tracking::installed()) return entries;
+        for (const auto *systems :
+             {&sm.update_systems_, &sm.fixed_update_systems_,
+              &sm.render_systems_}) {
+            for (const auto &system : *systems) {
+                const std::uint64_t n =
+                    system->allocations.counts().allocations;
+                if (n == 0) continue;
+                entries.push_back({.name = std::string(system->name),
+                                   .allocations = n});
+            }
+        }
+        return entries;
+    };
+}
+
+// Fill get_p99_ms and top_entries from `sm`'s SystemProfiler: frame p99,
+// and each system's average ms and matched entities. Both report nothing
+// until sm.profiler().enable() is called.
+inline void add_system_profile(PerfProvider &p, const SystemManager &sm) {
+    p.get_p99_ms = [&sm]() -> std::optional<float> {
+        const SystemProfiler &profiler = sm.profiler();
+        if (!profiler.enabled() || profiler.frame_ms().size() == 0)
+            return std::nullopt;
+        return profiler.frame_ms().p99();
+    };
+    p.top_entries = [&sm](int) {
+        std::vector<PerfEntry> entries;
+        if (!sm.profiler().enabled()) return entries;
+        for (const SystemProfile &profile : sm.profiler().profiles()) {
+            entries.push_back(
+                {.name = std::string(profile.name),
+                 .ms = profile.total_ms.average(),
+                 .entity_count = static_cast<int>(profile.last.matched)});
+        }
+        return entries;
+    };
+}
+
 struct HandleDumpProfileCommand : System<PendingE2ECommand> {
     void for_each_with(Entity &, PendingE2ECommand &cmd, float) override {
         if (cmd.is_consumed() || !cmd.is("dump_profile")) return;
@@ -72,6 +129,27 @@ struct HandleDumpProfileCommand : System<PendingE2ECommand> {
                 log_info("  {:.2f}ms  {}", e.ms, e.name);
             }
         }
+        if (p.get_frame_allocations) {
+            std::optional<std::uint64_t> allocs = p.get_frame_allocations();
+            if (allocs) log_info("Heap allocations last frame: {}", *allocs);
+        }
+        if (p.top_allocators) {
+            std::vector<PerfEntry> allocators = p.top_allocators(count);
+            std::sort(allocators.begin(), allocators.end(),
+                      [](const PerfEntry &a, const PerfEntry &b) {
+                          return a.allocations.value_or(0) >
+                                 b.allocations.value_or(0);
+                      });
+            if (static_cast<int>(allocators.size()) > count)
+                allocators.resize(count);
+            if (!allocators.empty())
+                log_info("--- Top {} systems by allocations ---",
+                         allocators.size());
+            for (const PerfEntry &e : allocators) {
+                log_info("  {} allocs  {}", e.allocations.value_or(0),
+                         e.name);
+            }
+        }
         log_info("=== END PROFILE ===");
         cmd.consume();
     }
@@ -140,10 +218,49 @@ struct HandleExpectP99BelowCommand : System<PendingE2ECommand> {
     }
 };
 
+// Fails when the last frame allocated more than `count` times; a steady-state
+// frame is expected to pass `expect_frame_allocations_at_most 0`.
+struct HandleExpectFrameAllocationsAtMostCommand
+    : System<PendingE2ECommand> {
+    void for_each_with(Entity &, PendingE2ECommand &cmd, float) override {
+        if (cmd.is_consumed() ||
+            !cmd.is("expect_frame_allocations_at_most"))
+            return;
+        if (!cmd.has_args(1)) {
+            cmd.fail("expect_frame_allocations_at_most requires: count");
+            return;
+        }
+
+        PerfProvider &p = provider();
+        std::optional<std::uint64_t> allocs =
+            p.get_frame_allocations ? p.get_frame_allocations()
+                                    : std::nullopt;
+        if (!allocs) {
+            cmd.fail(
+                "expect_frame_allocations_at_most unavailable: allocations "
+                "not tracked");
+            return;
+        }
+
+        int max_allocs = cmd.arg_as<int>(0);
+        if (*allocs > static_cast<std::uint64_t>(std::max(max_allocs, 0))) {
+            cmd.fail(std::format("{} allocations last frame, expected at "
+                                 "most {}",
+                                 *allocs, max_allocs));
+            return;
+        }
+        log_info("expect_frame_allocations_at_most: {} <= {} (PASS)", *allocs,
+                 max_allocs);
+        cmd.consume();
+    }
+};
+
 inline void register_perf_commands(SystemManager &sm) {
     sm.register_update_system(std::make_unique<HandleDumpProfileCommand>());
     sm.register_update_system(std::make_unique<HandleExpectFpsAboveCommand>());
     sm.register_update_system(std::make_unique<HandleExpectP99BelowCommand>());
+    sm.register_update_system(
+        std::make_unique<HandleExpectFrameAllocationsAtMostCommand>());
 }
 
 }  // namespace perf_commands
@@ -172,7 +172,7 @@ static inline RectangleType hit_rect(const Entity &entity,
 } // namespace detail
 
 /// Singleton component that caches entity mappings for fast lookups during
-/// UI tree traversal. Populated once per frame by BuildUIEntityMapping system.
+/// UI tree traversal. Kept current by the BuildUIEntityMapping system.
 struct UIEntityMappingCache : BaseComponent {
   std::vector<Entity *> components;
 
@@ -197,29 +197,37 @@ struct UIEntityMappingCache : BaseComponent {
   }
 };
 
-/// System that builds the entity mapping cache once per frame.
+/// System that keeps the entity mapping cache current. It checks once per frame
+/// and only rebuilds when the set of UI entities changed.
 /// Must run before RunAutoLayout and TrackIfComponentWillBeRendered.
 struct BuildUIEntityMapping : System<> {
+  CachedQuery<UIComponent> ui_entities{UICollectionHolder::get().collection};
+  // What the mapping was last built from; unchanged means nothing to do.
+  UIEntityMappingCache *mapped_cache = nullptr;
+  std::uint64_t mapped_generation = 0;
+
   virtual void once(float) override {
     auto *cache = EntityHelper::get_singleton_cmp<UIEntityMappingCache>();
     if (!cache) {
       return;
     }
 
-    auto &ui_coll = UICollectionHolder::get().collection;
-    auto ui_entities = EntityQuery(ui_coll, {.ignore_temp_warning = true})
-                           .whereHasComponent<UIComponent>()
-                           .gen();
+    const std::uint64_t generation = ui_entities.generation();
+    if (cache == mapped_cache && generation == mapped_generation) {
+      return;
+    }
 
     EntityID max_id = 0;
-    for (Entity &entity : ui_entities) {
+    for (auto [entity, ui] : ui_entities) {
       max_id = std::max(max_id, entity.id);
     }
 
     cache->components.assign(static_cast<size_t>(max_id) + 1, nullptr);
-    for (Entity &entity : ui_entities) {
+    for (auto [entity, ui] : ui_entities) {
       cache->components[entity.id] = &entity;
     }
+    mapped_cache = cache;
+    mapped_generation = generation;
   }
 };
 
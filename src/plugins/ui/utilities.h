@@ -184,27 +184,43 @@ static Entity &init_ui_plugin() {
     return ui_root;
 }
 
-// Helper: run a list of systems on UI collection entities
+// Helper: run a list of systems on UI collection entities. Systems with a
+// component signature visit only the entities their match cache holds, so
+// one with nothing to match skips the entity loop entirely.
 inline void run_systems_on_ui_entities(
     std::vector<std::unique_ptr<SystemBase>> &systems, float dt,
     bool is_render = false) {
     auto &ui_coll = UICollectionHolder::get().collection;
     ui_coll.merge_entity_arrays();
 
+    // fn(entity) for each entity `system` may match, in list order.
+    const auto visit = [&ui_coll](SystemBase &system, auto &&fn) {
+        if (!system.should_iterate()) return;
+        auto &entities = ui_coll.get_entities_for_mod();
+        const std::vector<std::uint32_t> *positions =
+            system.synced_matches(ui_coll);
+        if (!positions) {
+            for (auto &entity : entities)
+                if (entity) fn(*entity);
+            return;
+        }
+        for (std::size_t i = 0; i < positions->size(); ++i) {
+            const std::size_t idx = (*positions)[i];
+            if (idx < entities.size() && entities[idx]) fn(*entities[idx]);
+        }
+    };
+
     for (auto &system : systems) {
         if (!system->should_run(dt)) continue;
 
-        auto &entities = ui_coll.get_entities_for_mod();
-
         system->once(dt);
         system->on_iteration_begin(dt);
-        for (auto &entity : entities) {
-            if (!entity) continue;
+        visit(*system, [&](Entity &entity) {
             if (system->include_derived_children)
-                system->for_each_derived(*entity, dt);
+                system->for_each_derived(entity, dt);
             else
-                system->for_each(*entity, dt);
-        }
+                system->for_each(entity, dt);
+        });
         system->on_iteration_end(dt);
         system->after(dt);
 
@@ -212,14 +228,12 @@ inline void run_systems_on_ui_entities(
             const SystemBase &csys = *system;
             csys.once(dt);
             csys.on_iteration_begin(dt);
-            for (auto &entity : entities) {
-                if (!entity) continue;
-                const Entity &e = *entity;
+            visit(*system, [&](const Entity &e) {
                 if (csys.include_derived_children)
                     csys.for_each_derived(e, dt);
                 else
                     csys.for_each(e, dt);
-            }
+            });
             csys.on_iteration_end(dt);
             csys.after(dt);
         }
@@ -19,9 +19,14 @@
 //   // Or register render overlay for visual debugging
 //   ui::validation::register_render_systems<InputAction>(system_manager);
 //
+//   // Every system here joins the set ui::validation::system_set, so a
+//   // release build can switch them all off at no per-frame cost:
+//   system_manager.set_enabled(ui::validation::system_set, false);
+//
 
 #include <map>
 #include <set>
+#include <string_view>
 #include <vector>
 
 #include "../../ecs.h"
@@ -792,9 +797,13 @@ struct RenderOverlay : System<UIContext<InputAction>> {
 // System Registration Helpers
 // ============================================================
 
+// The set all validation systems are registered into.
+inline constexpr std::string_view system_set = "ui.validation";
+
 // Register validation update systems
 // Call this after register_after_ui_updates()
 static void register_update_systems(SystemManager &sm) {
+  const auto set = sm.in_set(system_set);
   // Clear previous frame's violations first
   sm.register_update_system(std::make_unique<ClearViolations>());
 
@@ -815,11 +824,13 @@ static void register_update_systems(SystemManager &sm) {
 // Call this after registering main render systems
 template <typename InputAction>
 static void register_render_overlay(SystemManager &sm) {
+  const auto set = sm.in_set(system_set);
   sm.register_render_system(std::make_unique<RenderOverlay<InputAction>>());
 }
 
 template <typename InputAction>
 static void register_systems(SystemManager &sm) {
+  const auto set = sm.in_set(system_set);
   // Register update systems (validation checks)
   sm.register_update_system(std::make_unique<ClearViolations>());
   sm.register_update_system(std::make_unique<ValidateScreenBounds>());
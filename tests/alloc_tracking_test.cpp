@@ -0,0 +1,188 @@
+// alloc_tracking_test.cpp
+// With the allocation hook linked in, SystemManager reports the heap
+// traffic of each frame and charges it to the system that made it. A
+// steady-state frame of ordinary systems allocates nothing.
+//
+// Build (from tests/, via the Makefile):  make alloc_tracking_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/memory/alloc_hook.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  int x = 0;
+};
+struct Velocity : BaseComponent {
+  int dx = 0;
+};
+struct Score : BaseComponent {
+  int value = 0;
+};
+
+// Runs on the workers.
+struct Move : System<Write<Position>, Read<Velocity>> {
+  void for_each_with(Entity &, Position &p, const Velocity &v,
+                     float) override {
+    p.x += v.dx;
+  }
+};
+
+// Scratch from the frame arena, not the heap.
+struct Tally : System<Position> {
+  void once(float) override {
+    FrameVector<int> xs;
+    for (const auto &sp : EntityHelper::get_entities())
+      if (sp->has<Position>())
+        xs.push_back(sp->get<Position>().x);
+    EntityHelper::get_singleton_cmp<Score>()->value =
+        static_cast<int>(xs.size());
+  }
+};
+
+// Every frame: a fresh vector of 100 ints.
+struct Leaky : System<> {
+  std::vector<int> kept;
+  void once(float) override { kept = std::vector<int>(100, 1); }
+};
+
+struct Render : System<Position> {
+  void for_each_with(const Entity &, const Position &, float) const override {}
+};
+
+static std::unique_ptr<World> make_world() {
+  auto world = std::make_unique<World>();
+  SystemManager &systems = world->systems();
+  systems.set_worker_count(2);
+  systems.parallel_chunk_size = 64;
+  systems.register_update_system(std::make_unique<Move>());
+  systems.register_update_system(std::make_unique<Tally>());
+  systems.register_render_system(std::make_unique<Render>());
+  world->enter([](World &w) {
+    for (int i = 0; i < 1000; ++i) {
+      Entity &e = w.collection().createEntity();
+      e.addComponent<Position>();
+      e.addComponent<Velocity>().dx = 1;
+    }
+    Entity &score = w.collection().createEntity();
+    score.addComponent<Score>();
+    w.collection().registerSingleton<Score>(score);
+    w.collection().merge_entity_arrays();
+  });
+  return world;
+}
+
+TEST(hook_counts_allocations) {
+  CHECK(alloc_tracking::installed());
+  const alloc_tracking::Counts before = alloc_tracking::totals();
+  const std::uint64_t live = alloc_tracking::live_bytes();
+  // Called as functions: a new-expression and its delete may be elided.
+  void *block = ::operator new[](sizeof(std::uint64_t) * 32);
+  CHECK(alloc_tracking::live_bytes() == live + sizeof(std::uint64_t) * 32);
+  ::operator delete[](block);
+  const alloc_tracking::Counts diff = alloc_tracking::totals() - before;
+  CHECK(diff.allocations == 1);
+  CHECK(diff.frees == 1);
+  CHECK(diff.bytes == sizeof(std::uint64_t) * 32);
+  CHECK(alloc_tracking::live_bytes() == live);
+
+  alloc_tracking::Tag tag("scratch");
+  {
+    const alloc_tracking::ScopedTag scope(tag);
+    ::operator delete(::operator new(sizeof(int) * 10));
+  }
+  CHECK(tag.counts().allocations == 1);
+  CHECK(tag.counts().frees == 1);
+  CHECK(tag.counts().bytes == sizeof(int) * 10);
+}
+
+TEST(steady_frames_do_not_allocate) {
+  std::unique_ptr<World> world = make_world();
+  for (int frame = 0; frame < 5; ++frame)
+    world->run(1.f / 60.f);
+
+  std::uint64_t allocations = 0;
+  for (int frame = 0; frame < 50; ++frame) {
+    world->run(1.f / 60.f);
+    allocations += world->systems().frame_allocations().counts.allocations;
+  }
+  CHECK(allocations == 0);
+  CHECK(world->collection().get_singleton_cmp<Score>()->value == 1000);
+}
+
+TEST(allocations_are_charged_to_their_system) {
+  std::unique_ptr<World> world = make_world();
+  auto leaky = std::make_unique<Leaky>();
+  Leaky *leaky_ptr = leaky.get();
+  world->systems().register_update_system(std::move(leaky));
+  for (int frame = 0; frame < 5; ++frame)
+    world->run(1.f / 60.f);
+
+  const alloc_tracking::Window &frame = world->systems().frame_allocations();
+  CHECK(frame.counts.allocations == 1);
+  CHECK(frame.counts.frees == 1);
+  CHECK(frame.counts.bytes == sizeof(int) * 100);
+  CHECK(frame.peak_bytes >= sizeof(int) * 200);
+  CHECK(leaky_ptr->allocations.counts().allocations == 1);
+  CHECK(leaky_ptr->name.find("Leaky") != std::string_view::npos);
+  for (const auto &system : world->systems().update_systems_) {
+    if (system.get() != leaky_ptr)
+      CHECK(system->allocations.counts().allocations == 0);
+  }
+}
+
+int main() {
+  printf("Running allocation tracking tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
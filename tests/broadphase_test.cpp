@@ -0,0 +1,265 @@
+// broadphase_test.cpp
+// SpatialHashBroadphase and SweepAndPruneBroadphase find exactly the
+// overlapping pairs, and UpdateCollidingEntities gives the same result with
+// a broadphase as without one.
+//
+// Build (from tests/, via the Makefile):  make broadphase_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/plugins/collision.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+using PairList = std::vector<std::pair<std::uint32_t, std::uint32_t>>;
+
+static PairList normalized(const std::vector<BroadphasePair> &pairs) {
+  PairList out;
+  for (const BroadphasePair &p : pairs)
+    out.emplace_back(std::min(p.a, p.b), std::max(p.a, p.b));
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+static PairList brute_force(const std::vector<Aabb> &boxes) {
+  PairList out;
+  for (std::uint32_t i = 0; i < boxes.size(); ++i)
+    for (std::uint32_t j = i + 1; j < boxes.size(); ++j)
+      if (boxes[i].overlaps(boxes[j]))
+        out.emplace_back(i, j);
+  return out;
+}
+
+static std::vector<Aabb> random_boxes(std::mt19937 &rng, const int n) {
+  std::uniform_real_distribution<float> pos(-500.f, 500.f);
+  std::uniform_real_distribution<float> size(1.f, 40.f);
+  std::vector<Aabb> boxes;
+  for (int i = 0; i < n; ++i) {
+    const float x = pos(rng), y = pos(rng);
+    boxes.push_back({x, y, x + size(rng), y + size(rng)});
+  }
+  return boxes;
+}
+
+static bool finds_exactly(Broadphase &bp, const std::vector<Aabb> &boxes) {
+  std::vector<BroadphasePair> pairs;
+  bp.find_pairs(boxes, pairs);
+  const PairList found = normalized(pairs);
+  return found == brute_force(boxes) &&
+         std::adjacent_find(found.begin(), found.end()) == found.end();
+}
+
+TEST(pairs_match_brute_force) {
+  std::mt19937 rng(7);
+  SpatialHashBroadphase grid(16.f);
+  SweepAndPruneBroadphase sap;
+  std::vector<Aabb> boxes = random_boxes(rng, 600);
+  // Larger than a cell, and larger than the whole grid limit.
+  boxes.push_back({-30.f, -30.f, 30.f, 30.f});
+  boxes.push_back({-1e6f, -10.f, 1e6f, 10.f});
+  boxes.push_back({-1e6f, -1e6f, 1e6f, 1e6f});
+  CHECK(!brute_force(boxes).empty());
+  CHECK(finds_exactly(grid, boxes));
+  CHECK(finds_exactly(sap, boxes));
+
+  // Everything drifts, as between ticks; sweep and prune re-sorts from
+  // last tick's order.
+  std::uniform_real_distribution<float> step(-3.f, 3.f);
+  for (int tick = 0; tick < 5; ++tick) {
+    for (Aabb &b : boxes) {
+      const float dx = step(rng), dy = step(rng);
+      b = {b.min_x + dx, b.min_y + dy, b.max_x + dx, b.max_y + dy};
+    }
+    CHECK(finds_exactly(grid, boxes));
+    CHECK(finds_exactly(sap, boxes));
+  }
+
+  boxes.resize(100);
+  CHECK(finds_exactly(grid, boxes));
+  CHECK(finds_exactly(sap, boxes));
+  boxes.clear();
+  CHECK(finds_exactly(grid, boxes));
+  CHECK(finds_exactly(sap, boxes));
+}
+
+TEST(many_oversized_boxes) {
+  std::mt19937 rng(11);
+  std::vector<Aabb> boxes = random_boxes(rng, 300);
+  // Spread among the rest, each past the grid's per-box cell limit.
+  std::uniform_real_distribution<float> pos(-500.f, 500.f);
+  for (int i = 0; i < 60; ++i) {
+    const float x = pos(rng), y = pos(rng);
+    boxes.insert(boxes.begin() + i * 5, {x, y, x + 800.f, y + 400.f});
+  }
+  SpatialHashBroadphase grid(16.f);
+  CHECK(finds_exactly(grid, boxes));
+}
+
+TEST(touching_boxes_are_candidates) {
+  const std::vector<Aabb> boxes = {{0.f, 0.f, 10.f, 10.f},
+                                   {10.f, 0.f, 20.f, 10.f},
+                                   {0.f, 10.f, 10.f, 20.f},
+                                   {21.f, 0.f, 30.f, 10.f}};
+  SpatialHashBroadphase grid(10.f);
+  SweepAndPruneBroadphase sap;
+  CHECK(brute_force(boxes).size() == 3);
+  CHECK(finds_exactly(grid, boxes));
+  CHECK(finds_exactly(sap, boxes));
+}
+
+struct Body : BaseComponent {
+  vec2 position{0.f, 0.f};
+  vec2 size{1.f, 1.f};
+  vec2 velocity{0.f, 0.f};
+  collision::CollisionConfig collision_config;
+};
+
+using Colliding = collision::UpdateCollidingEntities<Body>;
+
+static void configure(Colliding &system) {
+  const auto length = [](const vec2 &v) {
+    return std::sqrt(v.x * v.x + v.y * v.y);
+  };
+  system.config.get_collision_scalar = [] { return 100.f; };
+  system.config.get_max_speed = [] { return 50.f; };
+  system.callbacks.vector_length = length;
+  system.callbacks.normalize_vec = [length](const vec2 &v) {
+    const float len = length(v);
+    return len < 1e-4f ? vec2{0.f, 0.f} : vec2{v.x / len, v.y / len};
+  };
+  system.callbacks.dot_product = [](const vec2 &a, const vec2 &b) {
+    return a.x * b.x + a.y * b.y;
+  };
+  system.callbacks.get_speed = [length](const Body &b) {
+    return length(b.velocity);
+  };
+  system.callbacks.check_overlap = [](const Body &a, const Body &b) {
+    return a.position.x < b.position.x + b.size.x &&
+           a.position.x + a.size.x > b.position.x &&
+           a.position.y < b.position.y + b.size.y &&
+           a.position.y + a.size.y > b.position.y;
+  };
+}
+
+// Bodies after a few ticks, from the same start.
+static std::vector<Body> simulate(std::unique_ptr<Broadphase> broadphase) {
+  World world;
+  auto system = std::make_unique<Colliding>();
+  configure(*system);
+  system->broadphase = std::move(broadphase);
+  world.systems().register_update_system(std::move(system));
+
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> pos(0.f, 200.f);
+  std::uniform_real_distribution<float> vel(-20.f, 20.f);
+  std::vector<Entity *> entities;
+  for (int i = 0; i < 300; ++i) {
+    Entity &e = world.collection().createEntity();
+    Body &b = e.addComponent<Body>();
+    b.position = {pos(rng), pos(rng)};
+    b.size = {8.f, 8.f};
+    b.velocity = {vel(rng), vel(rng)};
+    entities.push_back(&e);
+  }
+  world.collection().merge_entity_arrays();
+
+  for (int tick = 0; tick < 4; ++tick) {
+    world.run(1.f / 60.f);
+    for (Entity *e : entities) {
+      Body &b = e->get<Body>();
+      b.position = {b.position.x + b.velocity.x / 60.f,
+                    b.position.y + b.velocity.y / 60.f};
+    }
+  }
+  std::vector<Body> out;
+  for (Entity *e : entities) {
+    const Body &b = e->get<Body>();
+    Body copy;
+    copy.position = b.position;
+    copy.velocity = b.velocity;
+    out.push_back(std::move(copy));
+  }
+  return out;
+}
+
+static bool same_bodies(const std::vector<Body> &a,
+                        const std::vector<Body> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    if (a[i].position.x != b[i].position.x ||
+        a[i].position.y != b[i].position.y ||
+        a[i].velocity.x != b[i].velocity.x ||
+        a[i].velocity.y != b[i].velocity.y)
+      return false;
+  return true;
+}
+
+TEST(collision_results_match_without_broadphase) {
+  const std::vector<Body> reference = simulate(nullptr);
+  const std::vector<Body> grid =
+      simulate(std::make_unique<SpatialHashBroadphase>(8.f));
+  const std::vector<Body> sap =
+      simulate(std::make_unique<SweepAndPruneBroadphase>());
+  CHECK(same_bodies(reference, grid));
+  CHECK(same_bodies(reference, sap));
+}
+
+int main() {
+  printf("Running broadphase tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
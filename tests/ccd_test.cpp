@@ -0,0 +1,235 @@
+// ccd_test.cpp
+// sweep_box finds where a moving box first touches a still one, and
+// UpdateCollidingEntities with an is_fast callback stops a fast body at a
+// thin wall it would otherwise pass through in one tick.
+//
+// Build (from tests/, via the Makefile):  make ccd_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/plugins/collision.h>
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+TEST(sweep_box) {
+  // 2x2 box at the origin moving 10 right, toward a box at x 5..6.
+  SweptHit h = sweep_box(0.f, 0.f, 2.f, 2.f, 10.f, 0.f, 5.f, 0.f, 6.f, 2.f);
+  CHECK(h.hit);
+  CHECK(std::fabs(h.toi - 0.3f) < 1e-6f);
+  CHECK(h.nx == 1.f && h.ny == 0.f);
+
+  // Moving up into a box above.
+  h = sweep_box(0.f, 0.f, 2.f, 2.f, 0.f, -10.f, 0.f, -6.f, 2.f, -4.f);
+  CHECK(h.hit);
+  CHECK(std::fabs(h.toi - 0.4f) < 1e-6f);
+  CHECK(h.nx == 0.f && h.ny == -1.f);
+
+  // Passes beside it.
+  CHECK(!sweep_box(0.f, 0.f, 2.f, 2.f, 10.f, 0.f, 5.f, 3.f, 6.f, 4.f).hit);
+  // Stops short of it, or only touches it at the end.
+  CHECK(!sweep_box(0.f, 0.f, 2.f, 2.f, 2.f, 0.f, 5.f, 0.f, 6.f, 2.f).hit);
+  CHECK(!sweep_box(0.f, 0.f, 2.f, 2.f, 3.f, 0.f, 5.f, 0.f, 6.f, 2.f).hit);
+  // Moving away, or already overlapping.
+  CHECK(!sweep_box(0.f, 0.f, 2.f, 2.f, -10.f, 0.f, 5.f, 0.f, 6.f, 2.f).hit);
+  CHECK(!sweep_box(0.f, 0.f, 2.f, 2.f, 10.f, 0.f, 1.f, 0.f, 3.f, 2.f).hit);
+  // Diagonal, entering on y last: the normal is y.
+  h = sweep_box(0.f, 0.f, 1.f, 1.f, 10.f, 10.f, 3.f, 5.f, 8.f, 8.f);
+  CHECK(h.hit);
+  CHECK(std::fabs(h.toi - 0.4f) < 1e-6f);
+  CHECK(h.nx == 0.f && h.ny == 1.f);
+}
+
+struct Body : BaseComponent {
+  vec2 position{0.f, 0.f};
+  vec2 size{1.f, 1.f};
+  vec2 velocity{0.f, 0.f};
+  collision::CollisionConfig collision_config;
+};
+
+struct Bullet : BaseComponent {};
+
+using Colliding = collision::UpdateCollidingEntities<Body>;
+
+struct Move : System<Body> {
+  void for_each_with(Entity &, Body &b, float dt) override {
+    b.position = {b.position.x + b.velocity.x * dt,
+                  b.position.y + b.velocity.y * dt};
+  }
+};
+
+static float length(const vec2 &v) { return std::sqrt(v.x * v.x + v.y * v.y); }
+
+static vec2 normalize(const vec2 &v) {
+  const float l = length(v);
+  return l > 0.f ? vec2{v.x / l, v.y / l} : v;
+}
+
+static void configure(Colliding &system) {
+  system.config.get_collision_scalar = [] { return 100.f; };
+  system.config.get_max_speed = [] { return 10000.f; };
+  system.callbacks.vector_length = length;
+  system.callbacks.normalize_vec = normalize;
+  system.callbacks.dot_product = [](const vec2 &a, const vec2 &b) {
+    return a.x * b.x + a.y * b.y;
+  };
+  system.callbacks.get_speed = [](const Body &b) {
+    return length(b.velocity);
+  };
+  system.callbacks.check_overlap = [](const Body &a, const Body &b) {
+    return a.position.x < b.position.x + b.size.x &&
+           b.position.x < a.position.x + a.size.x &&
+           a.position.y < b.position.y + b.size.y &&
+           b.position.y < a.position.y + a.size.y;
+  };
+}
+
+constexpr float tick = 1.f / 120.f;
+
+// A bullet moving 50 units a tick toward a wall 2 units thick.
+struct Range {
+  World world;
+  Colliding *system = nullptr;
+  Entity *bullet = nullptr;
+
+  explicit Range(const bool sweep) {
+    world.systems().register_update_system(std::make_unique<Move>());
+    auto s = std::make_unique<Colliding>();
+    configure(*s);
+    if (sweep)
+      s->callbacks.is_fast = [](const Entity &e) { return e.has<Bullet>(); };
+    system = s.get();
+    world.systems().register_update_system(std::move(s));
+
+    Entity &b = world.collection().createEntity();
+    b.addComponent<Bullet>();
+    Body &body = b.addComponent<Body>();
+    body.position = {0.f, 0.f};
+    body.size = {8.f, 2.f};
+    body.velocity = {6000.f, 0.f};
+    body.collision_config.mass = 0.1f;
+    bullet = &b;
+
+    Entity &wall = world.collection().createEntity();
+    Body &w = wall.addComponent<Body>();
+    w.position = {40.f, -50.f};
+    w.size = {2.f, 100.f};
+    w.collision_config.mass = std::numeric_limits<float>::max();
+    world.collection().merge_entity_arrays();
+  }
+
+  const Body &shot() const { return bullet->get<Body>(); }
+
+  void run(const int ticks) {
+    for (int t = 0; t < ticks; ++t)
+      world.run(tick);
+  }
+};
+
+TEST(tunnels_without_sweep) {
+  Range range(false);
+  range.run(1);
+  CHECK(range.shot().position.x > 42.f);
+}
+
+TEST(fast_body_stops_at_wall) {
+  Range range(true);
+  range.run(1);
+  CHECK(std::fabs(range.shot().position.x - 32.f) < 1e-3f);
+  CHECK(range.shot().velocity.x < 6000.f);
+  range.run(10);
+  CHECK(range.shot().position.x + 8.f <= 40.f + 1e-3f);
+}
+
+TEST(sweeps_from_previous) {
+  // Slow, but moved past the wall (say, teleported): only Previous<Body>
+  // knows where it came from.
+  Range range(true);
+  Body &body = range.bullet->get<Body>();
+  body.velocity = {12.f, 0.f};
+  body.position = {50.f, 0.f};
+  range.bullet->addComponent<Previous<Body>>().value.position = {0.f, 0.f};
+  range.run(1);
+  CHECK(std::fabs(range.shot().position.x - 32.f) < 1e-3f);
+
+  // Without it, the sweep starts a tick's velocity back, past the wall.
+  Range plain(true);
+  Body &other = plain.bullet->get<Body>();
+  other.velocity = {12.f, 0.f};
+  other.position = {50.f, 0.f};
+  plain.run(1);
+  CHECK(plain.shot().position.x > 50.f);
+}
+
+TEST(with_broadphase_and_colored_solver) {
+  Range sap(true);
+  sap.system->broadphase = std::make_unique<SweepAndPruneBroadphase>();
+  sap.run(5);
+  CHECK(sap.shot().position.x + 8.f <= 40.f + 1e-3f);
+
+  Range colored(true);
+  colored.system->solver = Colliding::Solver::Colored;
+  colored.system->broadphase = std::make_unique<SpatialHashBroadphase>(16.f);
+  colored.run(5);
+  CHECK(colored.shot().position.x + 8.f <= 40.f + 1e-3f);
+
+  Range packed(true);
+  packed.system->narrowphase = Colliding::Narrowphase::Aabb;
+  packed.run(5);
+  CHECK(packed.shot().position.x + 8.f <= 40.f + 1e-3f);
+}
+
+int main() {
+  printf("Running CCD tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,214 @@
+// change_tracking_test.cpp
+// Components carry added/changed ticks and collections remember removals, so
+// Added<T>, Changed<T> and Removed<T> filters let a system visit only what
+// changed since it last ran.
+//
+// Build (from tests/, via the Makefile):  make change_tracking_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  float x = 0;
+};
+struct Velocity : BaseComponent {};
+
+static void reset_world() {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+}
+
+static std::vector<EntityHandle> make_entities(int n) {
+  std::vector<Entity *> made;
+  for (int i = 0; i < n; ++i) {
+    Entity &e = EntityHelper::createEntity();
+    e.addComponent<Position>();
+    e.addComponent<Velocity>();
+    made.push_back(&e);
+  }
+  EntityHelper::merge_entity_arrays();
+  std::vector<EntityHandle> handles;
+  for (Entity *e : made)
+    handles.push_back(EntityHelper::handle_for(*e));
+  return handles;
+}
+
+static Entity &at(const EntityHandle h) { return EntityHelper::resolve(h).asE(); }
+
+template <typename Filter> struct Count : System<Filter> {
+  int seen = 0;
+  void for_each_with(Entity &, float) override { ++seen; }
+};
+
+template <typename S> static S *add(SystemManager &sm) {
+  auto sys = std::make_unique<S>();
+  S *raw = sys.get();
+  sm.register_update_system(std::move(sys));
+  return raw;
+}
+
+TEST(added_changed_removed_since_last_run) {
+  reset_world();
+  const auto handles = make_entities(10);
+
+  SystemManager sm;
+  auto *added = add<Count<Added<Position>>>(sm);
+  auto *changed = add<Count<Changed<Position>>>(sm);
+  auto *removed = add<Count<Removed<Velocity>>>(sm);
+
+  sm.run(1.f / 60.f);
+  CHECK(added->seen == 10);
+  CHECK(changed->seen == 10); // being added counts as a change
+  CHECK(removed->seen == 0);
+
+  added->seen = changed->seen = 0;
+  sm.run(1.f / 60.f);
+  CHECK(added->seen == 0);
+  CHECK(changed->seen == 0);
+
+  at(handles[1]).mark_changed<Position>();
+  at(handles[2]).get_mut<Position>().x = 4.f;
+  at(handles[3]).get<Position>().x = 9.f; // untracked write
+  at(handles[4]).removeComponent<Velocity>();
+  at(handles[5]).removeComponent<Velocity>();
+  Entity &late = EntityHelper::createEntity();
+  late.addComponent<Position>();
+  EntityHelper::merge_entity_arrays();
+
+  sm.run(1.f / 60.f);
+  CHECK(added->seen == 1);
+  CHECK(changed->seen == 3);
+  CHECK(removed->seen == 2);
+
+  added->seen = changed->seen = removed->seen = 0;
+  sm.run(1.f / 60.f);
+  CHECK(added->seen == 0);
+  CHECK(changed->seen == 0);
+  CHECK(removed->seen == 0);
+}
+
+struct Mover : System<Position, Changed<Position>> {
+  int seen = 0;
+  void for_each_with(Entity &e, Position &p, float) override {
+    ++seen;
+    p.x += 1.f;
+    e.mark_changed<Position>();
+  }
+};
+
+TEST(systems_see_later_writes_but_not_their_own) {
+  reset_world();
+  const auto handles = make_entities(4);
+
+  SystemManager sm;
+  auto *mover = add<Mover>(sm);
+  auto *watcher = add<Count<Changed<Position>>>(sm);
+
+  sm.run(1.f / 60.f);
+  CHECK(mover->seen == 4);
+  CHECK(watcher->seen == 4);
+
+  mover->seen = watcher->seen = 0;
+  sm.run(1.f / 60.f);
+  // The mover's own marks from last frame don't wake it up again.
+  CHECK(mover->seen == 0);
+  CHECK(watcher->seen == 0);
+
+  // The watcher, which runs after the mover, sees what the mover marked this
+  // frame.
+  at(handles[0]).mark_changed<Position>();
+  sm.run(1.f / 60.f);
+  CHECK(mover->seen == 1);
+  CHECK(watcher->seen == 1);
+}
+
+TEST(queries_since_a_tick) {
+  EntityCollection ec;
+  for (int i = 0; i < 6; ++i)
+    ec.createEntity().addComponent<Position>();
+  ec.merge_entity_arrays();
+
+  CHECK((query<Added<Position>>(ec).count() == 6));
+  const std::uint32_t mark = ec.advance_change_tick();
+  CHECK((query<Changed<Position>>(ec).since(mark).count() == 0));
+
+  ec.get_entities()[2]->mark_changed<Position>();
+  ec.get_entities()[4]->removeComponent<Position>();
+  int changed = 0;
+  for (auto [e, p] : query<Position, Changed<Position>>(ec).since(mark)) {
+    (void)p;
+    ++changed;
+  }
+  CHECK(changed == 1);
+  CHECK((query<Removed<Position>>(ec).since(mark).count() == 1));
+  CHECK((query<Removed<Position>>(ec).since(ec.change_tick()).count() == 0));
+}
+
+TEST(reused_slots_start_clean) {
+  EntityCollection ec;
+  Entity &a = ec.createEntity();
+  a.addComponent<Position>();
+  ec.merge_entity_arrays();
+  a.removeComponent<Position>();
+  CHECK((query<Removed<Position>>(ec).count() == 1));
+
+  a.cleanup = true;
+  ec.cleanup();
+  ec.createEntity();
+  ec.merge_entity_arrays();
+  CHECK((query<Removed<Position>>(ec).count() == 0));
+}
+
+int main() {
+  printf("Running change tracking tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
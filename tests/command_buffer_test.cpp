@@ -0,0 +1,223 @@
+// command_buffer_test.cpp
+// EntityCommandBuffer records structural changes and applies them at a sync
+// point; SystemManager flushes its buffer at the end of every phase.
+//
+// Build (from tests/, via the Makefile):  make command_buffer_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Health : BaseComponent {
+  int hp = 0;
+  Health() = default;
+  explicit Health(int h) : hp(h) {}
+};
+struct Spawner : BaseComponent {};
+struct Spawned : BaseComponent {};
+
+enum struct Tag : TagId { Burning = 3 };
+
+static void reset_world() {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+}
+
+TEST(changes_wait_for_flush) {
+  EntityCollection ec;
+  Entity &e = ec.createEntity();
+  ec.merge_entity_arrays();
+
+  EntityCommandBuffer cmds(ec);
+  cmds.add_component<Health>(e, 5);
+  cmds.enable_tag(e, Tag::Burning);
+  cmds.create([](Entity &n) { n.addComponent<Spawned>(); });
+  CHECK(cmds.size() == 3);
+  CHECK(!e.has<Health>());
+  CHECK(!e.hasTag(Tag::Burning));
+  CHECK(ec.get_entities().size() == 1);
+
+  cmds.flush();
+  CHECK(cmds.empty());
+  CHECK(e.get<Health>().hp == 5);
+  CHECK(e.hasTag(Tag::Burning));
+  // Created and merged in the same flush.
+  CHECK(ec.get_entities().size() == 2);
+  CHECK(ec.get_entities().back()->has<Spawned>());
+
+  cmds.remove_component<Health>(e);
+  cmds.disable_tag(e, Tag::Burning);
+  cmds.destroy(e);
+  cmds.flush();
+  CHECK(!e.has<Health>());
+  CHECK(!e.hasTag(Tag::Burning));
+  CHECK(e.cleanup);
+}
+
+TEST(dead_targets_are_skipped) {
+  EntityCollection ec;
+  Entity &a = ec.createEntity();
+  ec.merge_entity_arrays();
+
+  EntityCommandBuffer cmds(ec);
+  cmds.add_component<Health>(a, 1);
+  a.cleanup = true;
+  ec.cleanup();
+  // Likely reuses a's slot, block and id.
+  Entity &b = ec.createEntity();
+  ec.merge_entity_arrays();
+
+  cmds.flush();
+  CHECK(!b.has<Health>());
+}
+
+TEST(temp_entities_are_targeted_by_address) {
+  EntityCollection ec;
+  EntityCommandBuffer cmds(ec);
+
+  Entity &kept = ec.createEntity();
+  Entity &dropped = ec.createEntity();
+  cmds.add_component<Health>(kept, 2);
+  cmds.add_component<Health>(dropped, 3);
+  dropped.cleanup = true;
+  ec.merge_entity_arrays(); // kept moves over, dropped is destroyed
+
+  cmds.flush();
+  CHECK(kept.get<Health>().hp == 2);
+  CHECK(ec.get_entities().size() == 1);
+}
+
+struct SpawnOne : System<Spawner> {
+  void for_each_with(Entity &, Spawner &, float) override {
+    commands().create([](Entity &e) { e.addComponent<Spawned>(); });
+  }
+};
+
+struct CountSpawned : System<Spawned> {
+  int seen = 0;
+  void for_each_with(Entity &, Spawned &, float) override { ++seen; }
+};
+
+TEST(system_manager_flushes_at_end_of_phase) {
+  reset_world();
+  EntityHelper::createEntity().addComponent<Spawner>();
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  sm.merge_policy = MergePolicy::EndOfPhase;
+  sm.register_update_system(std::make_unique<SpawnOne>());
+  auto count = std::make_unique<CountSpawned>();
+  CountSpawned *c = count.get();
+  sm.register_update_system(std::move(count));
+
+  sm.tick(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+  CHECK(c->seen == 0);
+  CHECK(sm.commands().empty());
+  CHECK(EntityHelper::get_entities().size() == 2);
+
+  sm.tick(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+  CHECK(c->seen == 1);
+}
+
+struct SpawnDirectly : System<Spawner> {
+  void for_each_with(Entity &, Spawner &, float) override {
+    EntityHelper::createEntity().addComponent<Spawned>();
+  }
+};
+
+TEST(merge_policy_controls_visibility) {
+  for (const MergePolicy policy :
+       {MergePolicy::EverySystem, MergePolicy::EndOfPhase}) {
+    reset_world();
+    EntityHelper::createEntity().addComponent<Spawner>();
+    EntityHelper::merge_entity_arrays();
+
+    SystemManager sm;
+    sm.merge_policy = policy;
+    sm.register_update_system(std::make_unique<SpawnDirectly>());
+    auto count = std::make_unique<CountSpawned>();
+    CountSpawned *c = count.get();
+    sm.register_update_system(std::move(count));
+    sm.tick(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+
+    CHECK(c->seen == (policy == MergePolicy::EverySystem ? 1 : 0));
+    CHECK(EntityHelper::get_temp().empty());
+  }
+}
+
+struct ParallelDamage : System<Write<Health>> {
+  void for_each_with(Entity &e, Health &, float) override {
+    commands().add_component<Spawned>(e);
+  }
+};
+
+TEST(recording_from_worker_threads) {
+  reset_world();
+  for (int i = 0; i < 1000; ++i)
+    EntityHelper::createEntity().addComponent<Health>();
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  sm.set_worker_count(3);
+  sm.parallel_chunk_size = 16;
+  sm.register_update_system(std::make_unique<ParallelDamage>());
+  sm.tick(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+
+  int tagged = 0;
+  for (const auto &sp : EntityHelper::get_entities())
+    tagged += sp->has<Spawned>() ? 1 : 0;
+  CHECK(tagged == 1000);
+}
+
+int main() {
+  printf("Running command buffer tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,326 @@
+// component_storage_test.cpp
+// Column component storage (ComponentStorageMode::Columns): components live
+// in per-type chunked columns owned by the collection, while Entity's
+// get/has/addComponent/removeComponent API stays the same. Single types can
+// be pooled in either mode with reserve_components<T>().
+//
+// Build (from tests/, via the Makefile):  make component_storage_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  float x = 0, y = 0;
+  Position() = default;
+  Position(float x_, float y_) : x(x_), y(y_) {}
+};
+
+struct Velocity : BaseComponent {
+  float dx = 0, dy = 0;
+  Velocity() = default;
+  Velocity(float dx_, float dy_) : dx(dx_), dy(dy_) {}
+};
+
+struct Name : BaseComponent {
+  std::string name;
+  Name() = default;
+  explicit Name(std::string n) : name(std::move(n)) {}
+};
+
+// Counts live instances so we can tell the column actually destroys them.
+struct Tracked : BaseComponent {
+  static inline int alive = 0;
+  Tracked() { ++alive; }
+  Tracked(Tracked &&other) noexcept : BaseComponent(std::move(other)) {
+    ++alive;
+  }
+  ~Tracked() override { --alive; }
+};
+
+struct Pinned : BaseComponent {
+  int v = 0;
+  explicit Pinned(int v_) : v(v_) {}
+  Pinned(Pinned &&) = delete;
+};
+
+struct Huge : BaseComponent {
+  char bytes[40 * 1024] = {};
+};
+
+static ComponentID id_of_position() {
+  return components::get_type_id<Position>();
+}
+
+TEST(columns_keep_entity_api) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+
+  Entity &e = ec.createEntity();
+  e.addComponent<Position>(1.f, 2.f);
+  e.addComponent<Name>("hero");
+  CHECK(e.has<Position>());
+  CHECK(e.has<Name>());
+  CHECK(e.get<Position>().x == 1.f);
+  CHECK(e.get<Name>().name == "hero");
+  CHECK(e.ah_pooled.test(id_of_position()));
+  CHECK(ec.component_storage().column_size(id_of_position()) == 1);
+
+  e.removeComponent<Position>();
+  CHECK(!e.has<Position>());
+  CHECK(ec.component_storage().column_size(id_of_position()) == 0);
+}
+
+TEST(components_are_contiguous_within_a_column) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+
+  std::vector<Position *> ptrs;
+  for (int i = 0; i < 8; ++i)
+    ptrs.push_back(&ec.createEntity().addComponent<Position>(float(i), 0.f));
+
+  for (size_t i = 1; i < ptrs.size(); ++i) {
+    CHECK(reinterpret_cast<char *>(ptrs[i]) -
+              reinterpret_cast<char *>(ptrs[i - 1]) ==
+          static_cast<std::ptrdiff_t>(sizeof(Position)));
+  }
+}
+
+TEST(destroyed_components_run_destructors) {
+  Tracked::alive = 0;
+  {
+    EntityCollection ec;
+    ec.set_component_storage_mode(ComponentStorageMode::Columns);
+    Entity &a = ec.createEntity();
+    a.addComponent<Tracked>();
+    Entity &b = ec.createEntity();
+    b.addComponent<Tracked>();
+    CHECK(Tracked::alive == 2);
+
+    a.removeComponent<Tracked>();
+    CHECK(Tracked::alive == 1);
+    ec.cleanup();
+  }
+  CHECK(Tracked::alive == 0);
+}
+
+TEST(cell_reuse_after_remove) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+  Entity &e = ec.createEntity();
+  Position *first = &e.addComponent<Position>();
+  e.removeComponent<Position>();
+  Position *second = &e.addComponent<Position>();
+  CHECK(first == second);
+}
+
+TEST(switching_modes_mixes_safely) {
+  Tracked::alive = 0;
+  {
+    EntityCollection ec;
+    Entity &e = ec.createEntity();
+    e.addComponent<Tracked>(); // heap
+    ec.set_component_storage_mode(ComponentStorageMode::Columns);
+    e.addComponent<Position>(3.f, 4.f); // pooled
+    CHECK(!e.ah_pooled.test(components::get_type_id<Tracked>()));
+    CHECK(e.ah_pooled.test(id_of_position()));
+
+    ec.set_component_storage_mode(ComponentStorageMode::Heap);
+    e.removeComponent<Position>(); // released to its column, not deleted
+    CHECK(ec.component_storage().column_size(id_of_position()) == 0);
+    CHECK(Tracked::alive == 1);
+  }
+  CHECK(Tracked::alive == 0);
+}
+
+TEST(pooled_entities_recycle_pooled_components) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+  ec.reserve_entities(2);
+
+  Entity &e = ec.createEntity();
+  e.addComponent<Position>(5.f, 5.f);
+  ec.merge_entity_arrays();
+  e.cleanup = true;
+  ec.cleanup();
+
+  Entity &again = ec.createEntity();
+  CHECK(!again.has<Position>());
+  CHECK(ec.component_storage().column_size(id_of_position()) == 0);
+}
+
+TEST(compact_groups_by_signature_and_keeps_values) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+
+  // Interleave two signatures: {Position} and {Position, Velocity}.
+  std::vector<EntityHandle> handles;
+  for (int i = 0; i < 20; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Position>(float(i), float(-i));
+    if (i % 2)
+      e.addComponent<Velocity>(float(i), 1.f);
+  }
+  ec.merge_entity_arrays();
+  for (const auto &sp : ec.get_entities())
+    handles.push_back(ec.handle_for(*sp));
+
+  ec.compact_component_storage();
+
+  // Same-signature entities are now adjacent.
+  const Entities &ents = ec.get_entities();
+  int signature_changes = 0;
+  for (size_t i = 1; i < ents.size(); ++i) {
+    if (ents[i]->componentSet != ents[i - 1]->componentSet)
+      ++signature_changes;
+  }
+  CHECK(signature_changes == 1);
+
+  // Handles survive and values moved with their entities.
+  for (const EntityHandle h : handles) {
+    OptEntity opt = ec.resolve(h);
+    CHECK(opt.valid());
+    const Entity &e = opt.asE();
+    CHECK(e.get<Position>().y == -e.get<Position>().x);
+    if (e.has<Velocity>())
+      CHECK(e.get<Velocity>().dx == e.get<Position>().x);
+  }
+
+  // Column order now follows entity order.
+  std::vector<float> column_order;
+  ec.for_each_component<Position>(
+      [&](Position &p) { column_order.push_back(p.x); });
+  CHECK(column_order.size() == ents.size());
+  bool matches = true;
+  for (size_t i = 0; i < ents.size(); ++i)
+    matches = matches && ents[i]->get<Position>().x == column_order[i];
+  CHECK(matches);
+}
+
+TEST(compact_leaves_non_movable_columns_in_place) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+  Entity &e = ec.createEntity();
+  Pinned *before = &e.addComponent<Pinned>(7);
+  ec.compact_component_storage();
+  CHECK(&e.get<Pinned>() == before);
+  CHECK(e.get<Pinned>().v == 7);
+}
+
+TEST(oversized_components_get_their_own_chunks) {
+  EntityCollection ec;
+  ec.set_component_storage_mode(ComponentStorageMode::Columns);
+  for (int i = 0; i < 3; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Huge>().bytes[0] = static_cast<char>(i);
+  }
+  ec.merge_entity_arrays();
+  int i = 0;
+  for (const auto &sp : ec.get_entities())
+    CHECK(sp->get<Huge>().bytes[0] == static_cast<char>(i++));
+}
+
+TEST(reserved_types_are_pooled_in_heap_mode) {
+  EntityCollection ec;
+  ec.reserve_components<Velocity>(100);
+  ComponentPoolStats stats = ec.component_pool_stats<Velocity>();
+  CHECK(stats.capacity >= 100);
+  CHECK(stats.chunk_allocations == 1);
+
+  // Churn: a hundred add/remove rounds reuse the reserved cells.
+  Entity &e = ec.createEntity();
+  for (int i = 0; i < 100; ++i) {
+    e.addComponent<Velocity>(float(i), 0.f);
+    e.addComponent<Position>();
+    e.removeComponent<Velocity>();
+    e.removeComponent<Position>();
+  }
+  CHECK(e.ah_pooled.none());
+  stats = ec.component_pool_stats<Velocity>();
+  CHECK(stats.allocations == 100);
+  CHECK(stats.chunk_allocations == 1);
+  CHECK(stats.live == 0);
+  CHECK(stats.peak == 1);
+  CHECK(stats.name.find("Velocity") != std::string_view::npos);
+
+  // Types nobody reserved still come from the heap.
+  CHECK(ec.component_pool_stats<Position>().capacity == 0);
+  std::size_t pools = 0;
+  ec.for_each_component_pool([&](const ComponentPoolStats &) { ++pools; });
+  CHECK(pools == 1);
+}
+
+TEST(pooled_entity_outlives_its_collection) {
+  Tracked::alive = 0;
+  std::shared_ptr<Entity> kept;
+  {
+    EntityCollection ec;
+    ec.reserve_components<Tracked>(1);
+    Entity &e = ec.createEntity();
+    e.addComponent<Tracked>();
+    ec.merge_entity_arrays();
+    kept = ec.getEntityAsSharedPtr(e);
+  }
+  // The storage lives on with the entity: components still come and go.
+  kept->removeComponent<Tracked>();
+  kept->addComponent<Tracked>();
+  CHECK(Tracked::alive == 1);
+  kept.reset();
+  CHECK(Tracked::alive == 0);
+}
+
+int main() {
+  printf("Running component storage tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
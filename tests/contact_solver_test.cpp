@@ -0,0 +1,319 @@
+// contact_solver_test.cpp
+// ContactSolver's coloring keeps a color's contacts off each other's
+// bodies, and UpdateCollidingEntities with Solver::Colored separates
+// bodies and gives the same result on any number of threads.
+//
+// Build (from tests/, via the Makefile):  make contact_solver_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/plugins/collision.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+static ContactBodies make_bodies(const std::size_t n) {
+  ContactBodies bodies;
+  for (std::size_t i = 0; i < n; ++i) {
+    bodies.boxes.push(0.f, 0.f, 1.f, 1.f, static_cast<std::uint32_t>(i));
+    for (auto *v : {&bodies.w, &bodies.h, &bodies.mass, &bodies.inv_mass})
+      v->push_back(1.f);
+    for (auto *v : {&bodies.vx, &bodies.vy, &bodies.friction,
+                    &bodies.restitution})
+      v->push_back(0.f);
+  }
+  return bodies;
+}
+
+// No two contacts of one color (the overflow color aside) move one body.
+static bool colors_are_independent(const ContactSolver &solver,
+                                   const ContactBodies &bodies,
+                                   const std::vector<Contact> &contacts) {
+  const std::vector<std::uint32_t> &start = solver.color_start();
+  for (std::size_t c = 0; c < ContactSolver::max_colors; ++c) {
+    std::set<std::uint32_t> moved;
+    for (std::uint32_t k = start[c]; k < start[c + 1]; ++k) {
+      const Contact &contact = contacts[solver.by_color()[k]];
+      for (const std::uint32_t body : {contact.a, contact.b})
+        if (bodies.movable(body) && !moved.insert(body).second)
+          return false;
+    }
+  }
+  return true;
+}
+
+TEST(coloring) {
+  ContactBodies bodies = make_bodies(200);
+  // Body 0 is immovable: everything can touch it in one color.
+  bodies.mass[0] = std::numeric_limits<float>::max();
+  std::vector<Contact> contacts;
+  for (std::uint32_t i = 1; i < 200; ++i)
+    contacts.push_back({0, i, 0.f, 1.f});
+  ContactSolver solver;
+  solver.solve(bodies, contacts, 1.f, 0.f, 100.f, nullptr);
+  CHECK(solver.colors() == 1);
+  CHECK(colors_are_independent(solver, bodies, contacts));
+
+  // Random pairs among movable bodies.
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<std::uint32_t> pick(1, 199);
+  contacts.clear();
+  for (int k = 0; k < 600; ++k) {
+    const std::uint32_t a = pick(rng), b = pick(rng);
+    if (a != b)
+      contacts.push_back({a, b, 1.f, 0.f});
+  }
+  solver.solve(bodies, contacts, 1.f, 0.f, 100.f, nullptr);
+  CHECK(solver.colors() > 1);
+  CHECK(solver.colors() < ContactSolver::max_colors);
+  CHECK(solver.by_color().size() == contacts.size());
+  CHECK(colors_are_independent(solver, bodies, contacts));
+
+  // One movable body in more contacts than there are colors.
+  contacts.clear();
+  for (std::uint32_t i = 2; i < 100; ++i)
+    contacts.push_back({1, i, 1.f, 0.f});
+  solver.solve(bodies, contacts, 1.f, 0.f, 100.f, nullptr);
+  CHECK(solver.colors() == ContactSolver::max_colors + 1);
+  CHECK(colors_are_independent(solver, bodies, contacts));
+}
+
+struct Body : BaseComponent {
+  vec2 position{0.f, 0.f};
+  vec2 size{1.f, 1.f};
+  vec2 velocity{0.f, 0.f};
+  collision::CollisionConfig collision_config;
+};
+
+using Colliding = collision::UpdateCollidingEntities<Body>;
+
+static float length(const vec2 &v) { return std::sqrt(v.x * v.x + v.y * v.y); }
+
+static void configure(Colliding &system) {
+  system.solver = Colliding::Solver::Colored;
+  system.config.get_collision_scalar = [] { return 100.f; };
+  system.config.get_max_speed = [] { return 50.f; };
+  // The colored solver does its own math; these stay unused.
+  system.callbacks.vector_length = length;
+  system.callbacks.normalize_vec = [](const vec2 &v) { return v; };
+  system.callbacks.dot_product = [](const vec2 &, const vec2 &) {
+    return 0.f;
+  };
+  system.callbacks.get_speed = [](const Body &b) {
+    return length(b.velocity);
+  };
+  system.callbacks.check_overlap = [](const Body &, const Body &) {
+    return false;
+  };
+}
+
+static float overlap(const Body &a, const Body &b) {
+  const float x = std::min(a.position.x + a.size.x, b.position.x + b.size.x) -
+                  std::max(a.position.x, b.position.x);
+  const float y = std::min(a.position.y + a.size.y, b.position.y + b.size.y) -
+                  std::max(a.position.y, b.position.y);
+  return x > 0.f && y > 0.f ? std::min(x, y) : 0.f;
+}
+
+TEST(head_on_pair_separates) {
+  World world;
+  auto system = std::make_unique<Colliding>();
+  configure(*system);
+  world.systems().register_update_system(std::move(system));
+  Entity &left = world.collection().createEntity();
+  Body &a = left.addComponent<Body>();
+  a.position = {0.f, 0.f};
+  a.size = {10.f, 10.f};
+  a.velocity = {5.f, 0.f};
+  Entity &right = world.collection().createEntity();
+  Body &b = right.addComponent<Body>();
+  b.position = {8.f, 0.f};
+  b.size = {10.f, 10.f};
+  b.velocity = {-5.f, 0.f};
+  Entity &wall = world.collection().createEntity();
+  Body &w = wall.addComponent<Body>();
+  w.position = {-9.f, 0.f};
+  w.size = {10.f, 10.f};
+  w.collision_config.mass = std::numeric_limits<float>::max();
+  world.collection().merge_entity_arrays();
+
+  world.run(1.f / 60.f);
+  CHECK(b.velocity.x - a.velocity.x >= 0.f);
+  CHECK(overlap(a, b) < 2.f);
+  CHECK(overlap(a, w) < 1.f);
+  CHECK(w.position.x == -9.f);
+  CHECK(w.velocity.x == 0.f);
+}
+
+TEST(only_contacting_bodies_are_capped) {
+  ContactBodies bodies = make_bodies(4);
+  bodies.boxes.min_x[2] = bodies.boxes.max_x[2] = 50.f;
+  bodies.mass[3] = std::numeric_limits<float>::max();
+  bodies.vx = {20.f, -20.f, 1000.f, 1000.f};
+  ContactSolver solver;
+  solver.solve(bodies, {{0, 1, 1.f, 0.f}, {1, 3, 1.f, 0.f}}, 1.f, 0.f, 10.f,
+               nullptr);
+  CHECK(std::fabs(bodies.vx[0]) <= 10.f);
+  CHECK(std::fabs(bodies.vx[1]) <= 10.f);
+  // In no contact, and immovable: both keep their speed.
+  CHECK(bodies.vx[2] == 1000.f);
+  CHECK(bodies.vx[3] == 1000.f);
+
+  World world;
+  auto system = std::make_unique<Colliding>();
+  configure(*system);
+  world.systems().register_update_system(std::move(system));
+  for (const float x : {0.f, 8.f}) {
+    Body &body = world.collection().createEntity().addComponent<Body>();
+    body.position = {x, 0.f};
+    body.size = {10.f, 10.f};
+  }
+  Body &bullet = world.collection().createEntity().addComponent<Body>();
+  bullet.position = {500.f, 500.f};
+  bullet.velocity = {1000.f, 0.f};
+  world.collection().merge_entity_arrays();
+
+  world.run(1.f / 60.f);
+  CHECK(bullet.velocity.x == 1000.f);
+}
+
+struct Pile {
+  World world;
+  Colliding *system = nullptr;
+  std::vector<Entity *> entities;
+
+  Pile(std::unique_ptr<Broadphase> broadphase, const std::size_t workers) {
+    world.systems().set_worker_count(workers);
+    auto s = std::make_unique<Colliding>();
+    configure(*s);
+    s->broadphase = std::move(broadphase);
+    s->workers = world.systems().worker_pool();
+    // Small jobs, so even this pile is split between threads.
+    s->contact_solver.chunk_size = 4;
+    system = s.get();
+    world.systems().register_update_system(std::move(s));
+
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> pos(0.f, 150.f);
+    std::uniform_real_distribution<float> vel(-20.f, 20.f);
+    for (int i = 0; i < 500; ++i) {
+      Entity &e = world.collection().createEntity();
+      Body &b = e.addComponent<Body>();
+      b.position = {pos(rng), pos(rng)};
+      b.size = {8.f, 8.f};
+      b.velocity = {vel(rng), vel(rng)};
+      b.collision_config.friction = 0.2f;
+      if (i % 25 == 0)
+        b.collision_config.mass = std::numeric_limits<float>::max();
+      entities.push_back(&e);
+    }
+    world.collection().merge_entity_arrays();
+  }
+
+  float total_overlap() const {
+    float sum = 0.f;
+    for (std::size_t i = 0; i < entities.size(); ++i)
+      for (std::size_t j = i + 1; j < entities.size(); ++j)
+        sum += overlap(entities[i]->get<Body>(), entities[j]->get<Body>());
+    return sum;
+  }
+
+  void run(const int ticks) {
+    for (int t = 0; t < ticks; ++t)
+      world.run(1.f / 60.f);
+  }
+
+  bool same_as(const Pile &other) const {
+    for (std::size_t i = 0; i < entities.size(); ++i) {
+      const Body &a = entities[i]->get<Body>();
+      const Body &b = other.entities[i]->get<Body>();
+      if (std::memcmp(&a.position, &b.position, sizeof(vec2)) != 0 ||
+          std::memcmp(&a.velocity, &b.velocity, sizeof(vec2)) != 0)
+        return false;
+    }
+    return true;
+  }
+};
+
+TEST(same_result_on_any_thread_count) {
+  Pile serial(nullptr, 0);
+  Pile threaded(nullptr, 3);
+  Pile grid(std::make_unique<SpatialHashBroadphase>(8.f), 3);
+  CHECK(serial.system->workers == nullptr);
+  CHECK(threaded.system->workers != nullptr);
+  serial.run(10);
+  threaded.run(10);
+  grid.run(10);
+  CHECK(serial.system->contact_solver.colors() > 1);
+  CHECK(serial.same_as(threaded));
+  CHECK(serial.same_as(grid));
+}
+
+TEST(pile_spreads_out) {
+  Pile pile(std::make_unique<SweepAndPruneBroadphase>(), 2);
+  const float before = pile.total_overlap();
+  pile.run(30);
+  CHECK(before > 0.f);
+  CHECK(pile.total_overlap() < before * 0.25f);
+}
+
+int main() {
+  printf("Running contact solver tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,167 @@
+// entity_index_test.cpp
+// EntityCollection keeps per-component and per-tag slot indexes current, and
+// EntityQuery's whereHasComponent/whereHasTag walk them instead of the whole
+// entity list while returning the same entities in the same order.
+//
+// Build (from tests/, via the Makefile):  make entity_index_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Common : BaseComponent {};
+struct Rare : BaseComponent {
+  int value = 0;
+};
+
+enum struct Tag : TagId { Boss = 5 };
+
+// 1000 entities; every 50th is Rare, every 100th is a Boss.
+static void populate(EntityCollection &ec) {
+  for (int i = 0; i < 1000; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Common>();
+    if (i % 50 == 0)
+      e.addComponent<Rare>().value = i;
+    if (i % 100 == 0)
+      e.enableTag(Tag::Boss);
+  }
+  ec.merge_entity_arrays();
+}
+
+// The same query without a collection never uses an index.
+static std::vector<int> scanned_rare_ids(const EntityCollection &ec) {
+  return EntityQuery(ec.get_entities()).whereHasComponent<Rare>().gen_ids();
+}
+
+TEST(indexes_follow_components_and_tags) {
+  EntityCollection ec;
+  populate(ec);
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 20);
+  CHECK(ec.tag_index(static_cast<TagId>(Tag::Boss)).size() == 10);
+
+  Entity &plain = *ec.get_entities()[1];
+  plain.addComponent<Rare>();
+  plain.enableTag(Tag::Boss);
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 21);
+  CHECK(ec.tag_index(static_cast<TagId>(Tag::Boss)).size() == 11);
+
+  plain.removeComponent<Rare>();
+  plain.disableTag(Tag::Boss);
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 20);
+  CHECK(ec.tag_index(static_cast<TagId>(Tag::Boss)).size() == 10);
+
+  // Temp entities join when merged, dead ones leave on cleanup.
+  ec.createEntity().addComponent<Rare>();
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 20);
+  ec.merge_entity_arrays();
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 21);
+
+  ec.get_entities()[0]->cleanup = true;
+  ec.cleanup();
+  CHECK(ec.component_index(components::get_type_id<Rare>()).size() == 20);
+  CHECK(ec.tag_index(static_cast<TagId>(Tag::Boss)).size() == 9);
+
+  ec.delete_all_entities_NO_REALLY_I_MEAN_ALL();
+  CHECK(ec.component_index(components::get_type_id<Rare>()).empty());
+}
+
+TEST(indexed_queries_match_a_scan) {
+  EntityCollection ec;
+  populate(ec);
+
+  const std::vector<int> expected = scanned_rare_ids(ec);
+  CHECK(expected.size() == 20);
+  CHECK(EntityQuery(ec).whereHasComponent<Rare>().gen_ids() == expected);
+
+  // Removing entities reorders the list; results still follow it.
+  for (int i = 0; i < 1000; i += 3)
+    ec.get_entities()[static_cast<std::size_t>(i)]->cleanup = true;
+  ec.cleanup();
+  CHECK(EntityQuery(ec).whereHasComponent<Rare>().gen_ids() ==
+        scanned_rare_ids(ec));
+
+  // Other filters still apply, in order.
+  const auto bosses =
+      EntityQuery(ec).whereHasTag(Tag::Boss).whereHasComponent<Rare>().gen();
+  const auto scanned = EntityQuery(ec.get_entities())
+                           .whereHasTag(Tag::Boss)
+                           .whereHasComponent<Rare>()
+                           .gen();
+  CHECK(bosses.size() == scanned.size());
+  bool same = bosses.size() == scanned.size();
+  for (std::size_t i = 0; same && i < bosses.size(); ++i)
+    same = bosses[i].get().id == scanned[i].get().id;
+  CHECK(same);
+
+  const auto first = EntityQuery(ec).whereHasComponent<Rare>().gen_first();
+  CHECK(first.has_value());
+  CHECK(first.asE().id == scanned_rare_ids(ec).front());
+  CHECK(EntityQuery(ec).whereHasComponent<Rare>().take(3).gen_count() == 3);
+
+  int streamed = 0;
+  EntityQuery(ec).whereHasComponent<Rare>().for_each_stream(
+      [&](Entity &) { ++streamed; });
+  CHECK(streamed == static_cast<int>(scanned_rare_ids(ec).size()));
+}
+
+TEST(dense_components_fall_back_to_a_scan) {
+  EntityCollection ec;
+  populate(ec);
+  // Every entity has Common, so no index is worth building for it.
+  CHECK(EntityQuery(ec).whereHasComponent<Common>().gen_count() == 1000);
+}
+
+int main() {
+  printf("Running entity index tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
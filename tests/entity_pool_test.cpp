@@ -355,6 +355,66 @@ TEST(id_reuse_bounded) {
   CHECK(ec.free_ids_.size() > 0);
 }
 
+// ============================================================================
+// Test 12: Entity memory comes from the block pool and is reused
+// ============================================================================
+
+TEST(block_pool_reuses_entity_memory) {
+  EntityCollection ec; // no reserve_entities: every entity is really freed
+
+  for (int i = 0; i < 50; ++i)
+    ec.createEntity();
+  ec.cleanup();
+  CHECK(ec.entity_block_pool().blocks_in_use() == 50);
+  const size_t capacity = ec.entity_block_pool().capacity();
+
+  for (int cycle = 0; cycle < 20; ++cycle) {
+    for (auto &sp : ec.get_entities_for_mod())
+      sp->cleanup = true;
+    ec.cleanup();
+    CHECK(ec.entity_block_pool().blocks_in_use() == 0);
+    for (int i = 0; i < 50; ++i)
+      ec.createEntity();
+    ec.cleanup();
+  }
+  CHECK(ec.entity_block_pool().capacity() == capacity);
+}
+
+// ============================================================================
+// Test 13: Slots don't own entities; shared_ptr recovery is O(1)
+// ============================================================================
+
+TEST(slots_point_without_owning) {
+  EntityCollection ec;
+  Entity &e = ec.createEntity();
+  CHECK(ec.getEntityAsSharedPtr(e).get() == &e); // still in temp
+  ec.merge_entity_arrays();
+
+  const EntityHandle h = ec.handle_for(e);
+  CHECK(ec.slots[h.slot].ent == &e);
+  // entities_DO_NOT_USE holds the only reference.
+  CHECK(ec.get_entities().front().use_count() == 1);
+
+  std::shared_ptr<Entity> sp = ec.getEntityAsSharedPtr(e);
+  CHECK(sp.get() == &e);
+  CHECK(sp.use_count() == 2);
+}
+
+TEST(entity_outlives_its_collection) {
+  std::shared_ptr<Entity> kept;
+  {
+    EntityCollection ec;
+    Entity &e = ec.createEntity();
+    e.addComponent<Health>(7);
+    ec.merge_entity_arrays();
+    kept = ec.getEntityAsSharedPtr(e);
+    e.cleanup = true;
+    ec.cleanup();
+  }
+  // The block pool lives on in kept's control block.
+  CHECK(kept->id >= 0);
+}
+
 // ============================================================================
 // Main
 // ============================================================================
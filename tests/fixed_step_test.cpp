@@ -0,0 +1,211 @@
+// fixed_step_test.cpp
+// SystemManager caps the fixed steps one frame may take, exposes how far the
+// frame sits between two steps, and keeps the state before the latest step
+// for components registered with keep_previous<T>().
+//
+// Build (from tests/, via the Makefile):  make fixed_step_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Body : BaseComponent {
+  float x = 0.f;
+  float vx = 1.f;
+};
+template <> struct afterhours::is_plain_component<Body> : std::true_type {};
+struct Label : BaseComponent {
+  std::string text;
+};
+// Copy-assignable, so keep_previous<Name>() needs no copy function.
+struct Name : BaseComponent {
+  std::string text;
+  Name() = default;
+  Name(const Name &other) : BaseComponent(), text(other.text) {}
+  Name &operator=(const Name &other) {
+    text = other.text;
+    return *this;
+  }
+};
+
+struct Step : System<Body> {
+  int *steps = nullptr;
+  explicit Step(int *s) : steps(s) {}
+  void once(float) override { ++*steps; }
+  void for_each_with(Entity &, Body &b, float) override { b.x += b.vx; }
+};
+
+struct Rename : System<Label> {
+  void for_each_with(Entity &, Label &l, float) override { l.text += "!"; }
+};
+
+struct Renumber : System<Name> {
+  void for_each_with(Entity &, Name &n, float) override { n.text += "?"; }
+};
+
+// What render systems saw.
+struct Draw : System<Body> {
+  float *alpha = nullptr;
+  float *drawn_x = nullptr;
+  Draw(float *a, float *x) : alpha(a), drawn_x(x) {}
+  void for_each_with(const Entity &e, const Body &b, float) const override {
+    *alpha = interpolation_alpha();
+    const float from = previous<Body>(e).x;
+    *drawn_x = from + (b.x - from) * *alpha;
+  }
+};
+
+static bool near(const float a, const float b) {
+  return std::fabs(a - b) < 1e-3f;
+}
+
+static constexpr float step = SystemManager::FIXED_TICK_RATE;
+
+TEST(long_frames_take_at_most_max_fixed_steps) {
+  World world;
+  int steps = 0;
+  world.systems().max_fixed_steps = 4;
+  world.systems().register_fixed_update_system(std::make_unique<Step>(&steps));
+
+  world.run(1.f);
+  CHECK(steps == 4);
+  CHECK(world.systems().dropped_fixed_steps() >= 115);
+  CHECK(world.systems().accumulator < step);
+  // The next ordinary frame is back to one step.
+  steps = 0;
+  world.run(step);
+  CHECK(steps == 1);
+
+  // 0 lifts the cap.
+  World uncapped;
+  steps = 0;
+  uncapped.systems().max_fixed_steps = 0;
+  uncapped.systems().register_fixed_update_system(
+      std::make_unique<Step>(&steps));
+  uncapped.run(0.5f);
+  CHECK(steps >= 59);
+  CHECK(uncapped.systems().dropped_fixed_steps() == 0);
+}
+
+TEST(render_interpolates_between_steps) {
+  World world;
+  SystemManager &systems = world.systems();
+  int steps = 0;
+  float alpha = -1.f;
+  float drawn_x = -1.f;
+  systems.keep_previous<Body>();
+  systems.register_fixed_update_system(std::make_unique<Step>(&steps));
+  systems.register_render_system(std::make_unique<Draw>(&alpha, &drawn_x));
+  Entity &e = world.collection().createEntity();
+  e.addComponent<Body>();
+  world.collection().merge_entity_arrays();
+
+  // Not a whole step yet: nothing to interpolate from.
+  world.run(step * 0.5f);
+  CHECK(steps == 0);
+  CHECK(near(alpha, 0.5f));
+  CHECK(!e.has<Previous<Body>>());
+  CHECK(near(drawn_x, 0.f));
+
+  // Two steps and a quarter.
+  world.run(step * 1.75f);
+  CHECK(steps == 2);
+  CHECK(near(systems.fixed_alpha(), 0.25f));
+  CHECK(near(alpha, 0.25f));
+  CHECK(near(e.get<Body>().x, 2.f));
+  CHECK(near(previous<Body>(e).x, 1.f));
+  CHECK(near(previous<Body>(e).vx, 1.f));
+  CHECK(near(drawn_x, 1.25f));
+
+  // Outside render the current state wins.
+  CHECK(interpolation_alpha() == 1.f);
+}
+
+TEST(keep_previous_with_a_copy_function) {
+  World world;
+  SystemManager &systems = world.systems();
+  int copies = 0;
+  systems.keep_previous<Label>([&copies](const Label &from, Label &to) {
+    to.text = from.text;
+    ++copies;
+  });
+  systems.register_fixed_update_system(std::make_unique<Rename>());
+  Entity &e = world.collection().createEntity();
+  e.addComponent<Label>().text = "hi";
+  world.collection().merge_entity_arrays();
+
+  world.run(step * 2.f);
+  CHECK(copies == 2);
+  CHECK(e.get<Label>().text == "hi!!");
+  CHECK(previous<Label>(e).text == "hi!");
+}
+
+TEST(keep_previous_assigns_a_copy_assignable_component) {
+  World world;
+  world.systems().keep_previous<Name>();
+  world.systems().register_fixed_update_system(std::make_unique<Renumber>());
+  Entity &e = world.collection().createEntity();
+  e.addComponent<Name>().text = "hi";
+  world.collection().merge_entity_arrays();
+
+  world.run(step * 3.f);
+  CHECK(e.get<Name>().text == "hi???");
+  CHECK(previous<Name>(e).text == "hi??");
+}
+
+int main() {
+  printf("Running fixed step tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,183 @@
+// frame_arena_test.cpp
+// SystemManager hands each thread that runs systems a growable frame arena
+// and resets them all at the end of run(); once the arenas have grown to the
+// largest frame, a frame takes no more memory from the heap.
+//
+// Build (from tests/, via the Makefile):  make frame_arena_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  int x = 0;
+};
+struct Velocity : BaseComponent {
+  int dx = 0;
+};
+
+TEST(growable_arena_settles_into_one_block) {
+  Arena arena(64, Arena::DEFAULT_ALIGNMENT, ArenaGrowth::Grow);
+  const auto pass = [&arena] {
+    bool got = true;
+    for (int i = 0; i < 100; ++i)
+      got = got && arena.allocate(40) != nullptr;
+    return got;
+  };
+
+  CHECK(pass());
+  CHECK(arena.heap_allocations() > 1);
+  CHECK(arena.used() >= 4000);
+  arena.reset();
+  CHECK(arena.used() == 0);
+  CHECK(arena.capacity() >= 4000);
+
+  const std::size_t settled = arena.heap_allocations();
+  for (int i = 0; i < 10; ++i) {
+    CHECK(pass());
+    arena.reset();
+  }
+  CHECK(arena.heap_allocations() == settled);
+
+  // Fixed arenas still say no.
+  Arena fixed(64);
+  CHECK(fixed.allocate(32) != nullptr);
+  CHECK(fixed.allocate(64) == nullptr);
+}
+
+// Lists everything with a Position, twice over, from the frame arena. The
+// list alone outgrows the arena's first block.
+struct Survey : System<> {
+  Arena *seen = nullptr;
+  std::size_t found = 0;
+  void once(float) override {
+    seen = &frame_arena();
+    FrameRefEntities movers;
+    movers.reserve(10000);
+    EntityQuery().whereHasComponent<Position>().gen_into(movers);
+    EntityQuery().whereHasComponent<Velocity>().gen_into(movers);
+    found = movers.size();
+  }
+};
+
+// Runs on the workers, taking a little scratch per entity. Small enough
+// that a worker's arena never grows, however the chunks fall.
+struct Move : System<Write<Position>, Read<Velocity>> {
+  std::atomic<int> outside{0};
+  void for_each_with(Entity &, Position &p, const Velocity &v,
+                     float) override {
+    const FrameVector<int> steps(4, v.dx);
+    if (frame_arena().used() == 0)
+      ++outside;
+    for (const int step : steps)
+      p.x += step;
+  }
+};
+
+static std::size_t heap_allocations(const SystemManager &systems) {
+  std::size_t total = 0;
+  systems.for_each_frame_arena(
+      [&](const Arena &arena) { total += arena.heap_allocations(); });
+  return total;
+}
+
+TEST(steady_frames_take_nothing_from_the_heap) {
+  World world;
+  SystemManager &systems = world.systems();
+  systems.set_worker_count(2);
+  systems.parallel_chunk_size = 16;
+  auto survey = std::make_unique<Survey>();
+  Survey *survey_ptr = survey.get();
+  systems.register_update_system(std::move(survey));
+  auto move = std::make_unique<Move>();
+  Move *move_ptr = move.get();
+  systems.register_update_system(std::move(move));
+
+  for (int i = 0; i < 2000; ++i) {
+    Entity &e = world.collection().createEntity();
+    e.addComponent<Position>();
+    e.addComponent<Velocity>().dx = 1;
+  }
+  world.collection().merge_entity_arrays();
+
+  world.run(1.f / 60.f);
+  const std::size_t warm = heap_allocations(systems);
+  CHECK(warm > systems.worker_count() + 1);
+  for (int frame = 0; frame < 50; ++frame)
+    world.run(1.f / 60.f);
+
+  CHECK(heap_allocations(systems) == warm);
+  CHECK(survey_ptr->found == 4000);
+  CHECK(survey_ptr->seen == &systems.main_frame_arena());
+  CHECK(move_ptr->outside == 0);
+  CHECK(world.collection().get_entities()[0]->get<Position>().x == 51 * 4);
+
+  // Everything went back at the end of the frame.
+  std::size_t used = 0;
+  systems.for_each_frame_arena([&](const Arena &a) { used += a.used(); });
+  CHECK(used == 0);
+  // And outside a frame the thread has its own.
+  CHECK(&frame_arena() != &systems.main_frame_arena());
+  CHECK(EntityQuery(world.collection())
+            .whereHasComponent<Position>()
+            .gen_frame()
+            .size() == 2000);
+  frame_arena().reset();
+}
+
+int main() {
+  printf("Running frame arena tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,207 @@
+// hierarchy_test.cpp
+// Parent/child links and PropagateTransforms: world transforms follow the
+// tree, and a frame recomputes only the subtrees under something that
+// changed.
+//
+// Build (from tests/, via the Makefile):  make hierarchy_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+static bool near(const float a, const float b) {
+  return std::fabs(a - b) < 1e-4f;
+}
+
+struct Scene {
+  World world;
+  PropagateTransforms *propagate = nullptr;
+
+  Scene() {
+    auto system = std::make_unique<PropagateTransforms>();
+    propagate = system.get();
+    world.systems().register_update_system(std::move(system));
+  }
+
+  Entity &spawn(const float x, const float y) {
+    Entity &e = world.collection().createEntity();
+    e.addComponent<LocalTransform>(Transform2D{.x = x, .y = y});
+    return e;
+  }
+
+  void merge() { world.collection().merge_entity_arrays(); }
+  void run() { world.run(0.f); }
+  bool link(Entity &child, Entity &parent) {
+    return world.enter([&](World &) { return set_parent(child, parent); });
+  }
+};
+
+static const Transform2D &world_of(const Entity &e) {
+  return e.get<WorldTransform>().value;
+}
+
+TEST(transform_composition) {
+  const Transform2D parent{.x = 10.f, .rotation = 3.14159265f / 2.f,
+                           .scale_x = 2.f, .scale_y = 2.f};
+  const Transform2D world = parent.then({.x = 1.f});
+  CHECK(near(world.x, 10.f));
+  CHECK(near(world.y, 2.f));
+  CHECK(near(world.rotation, 3.14159265f / 2.f));
+  CHECK(near(world.scale_x, 2.f));
+}
+
+TEST(only_dirty_subtrees_are_recomputed) {
+  Scene scene;
+  // Created leaf first, so list order isn't tree order.
+  Entity &leaf = scene.spawn(1.f, 0.f);
+  Entity &mid = scene.spawn(0.f, 2.f);
+  Entity &root = scene.spawn(100.f, 0.f);
+  Entity &other = scene.spawn(-5.f, -5.f);
+  scene.merge();
+  CHECK(scene.link(mid, root));
+  CHECK(scene.link(leaf, mid));
+
+  scene.run();
+  CHECK(scene.propagate->size() == 4);
+  CHECK(scene.propagate->recomputed() == 4);
+  CHECK(near(world_of(leaf).x, 101.f));
+  CHECK(near(world_of(leaf).y, 2.f));
+  CHECK(near(world_of(other).x, -5.f));
+
+  scene.run();
+  CHECK(scene.propagate->recomputed() == 0);
+
+  leaf.get_mut<LocalTransform>().value.x = 3.f;
+  scene.run();
+  CHECK(scene.propagate->recomputed() == 1);
+  CHECK(near(world_of(leaf).x, 103.f));
+
+  root.get_mut<LocalTransform>().value.x = 0.f;
+  scene.run();
+  CHECK(scene.propagate->recomputed() == 3);
+  CHECK(near(world_of(mid).x, 0.f));
+  CHECK(near(world_of(leaf).x, 3.f));
+  CHECK(near(world_of(other).x, -5.f));
+}
+
+TEST(reparent_and_detach) {
+  Scene scene;
+  Entity &a = scene.spawn(10.f, 0.f);
+  Entity &b = scene.spawn(20.f, 0.f);
+  Entity &child = scene.spawn(1.f, 0.f);
+  scene.merge();
+  CHECK(scene.link(child, a));
+  scene.run();
+  CHECK(near(world_of(child).x, 11.f));
+  CHECK(a.get<Children>().entities.size() == 1);
+
+  CHECK(scene.link(child, b));
+  CHECK(a.get<Children>().entities.empty());
+  CHECK(b.get<Children>().entities.size() == 1);
+  scene.run();
+  CHECK(near(world_of(child).x, 21.f));
+  CHECK(scene.propagate->recomputed() == 1);
+
+  // No cycles.
+  CHECK(!scene.link(b, child));
+  CHECK(!scene.link(b, b));
+  CHECK(!b.has<Parent>());
+
+  scene.world.enter([&](World &) { detach(child); });
+  CHECK(!child.has<Parent>());
+  CHECK(b.get<Children>().entities.empty());
+  scene.run();
+  CHECK(near(world_of(child).x, 1.f));
+}
+
+TEST(children_of_a_deleted_parent_become_roots) {
+  Scene scene;
+  Entity &parent = scene.spawn(50.f, 0.f);
+  Entity &child = scene.spawn(1.f, 0.f);
+  Entity &grandchild = scene.spawn(1.f, 0.f);
+  scene.merge();
+  CHECK(scene.link(child, parent));
+  CHECK(scene.link(grandchild, child));
+  scene.run();
+  CHECK(near(world_of(grandchild).x, 52.f));
+
+  parent.cleanup = true;
+  scene.run(); // removed at the end of this frame
+  scene.run();
+  CHECK(scene.propagate->size() == 2);
+  CHECK(near(world_of(child).x, 1.f));
+  CHECK(near(world_of(grandchild).x, 2.f));
+}
+
+TEST(deep_chain) {
+  Scene scene;
+  std::vector<Entity *> chain;
+  for (int i = 0; i < 200; ++i)
+    chain.push_back(&scene.spawn(1.f, 0.f));
+  scene.merge();
+  // Linked deepest-first, in reverse list order.
+  for (int i = 199; i > 0; --i)
+    CHECK(scene.link(*chain[i], *chain[i - 1]));
+  scene.run();
+  CHECK(near(world_of(*chain[199]).x, 200.f));
+  chain[100]->get_mut<LocalTransform>().value.x = 2.f;
+  scene.run();
+  CHECK(scene.propagate->recomputed() == 100);
+  CHECK(near(world_of(*chain[199]).x, 201.f));
+}
+
+int main() {
+  printf("Running hierarchy tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,219 @@
+// narrowphase_test.cpp
+// first_overlap agrees with a plain loop, and UpdateCollidingEntities'
+// built-in AABB narrowphase gives the same bodies as the callback one, with
+// and without a broadphase.
+//
+// Build (from tests/, via the Makefile):  make narrowphase_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/plugins/collision.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+TEST(first_overlap_matches_scalar) {
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> pos(0.f, 100.f);
+  std::uniform_real_distribution<float> size(1.f, 10.f);
+  for (int round = 0; round < 50; ++round) {
+    AabbRow row;
+    const int n = round % 23;
+    for (int i = 0; i < n; ++i) {
+      const float x = pos(rng), y = pos(rng);
+      row.push(x, y, x + size(rng), y + size(rng),
+               static_cast<std::uint32_t>(i));
+    }
+    const float x0 = pos(rng), y0 = pos(rng);
+    const float x1 = x0 + 20.f, y1 = y0 + 20.f;
+    bool same = true;
+    for (std::size_t from = 0; from <= row.size(); ++from) {
+      std::size_t expected = from;
+      while (expected < row.size() &&
+             !(x0 < row.max_x[expected] && x1 > row.min_x[expected] &&
+               y0 < row.max_y[expected] && y1 > row.min_y[expected]))
+        ++expected;
+      same &= first_overlap(row, from, x0, y0, x1, y1) == expected;
+    }
+    CHECK(same);
+  }
+
+  // Touching isn't overlapping.
+  AabbRow row;
+  for (int i = 0; i < 9; ++i)
+    row.push(10.f, 0.f, 20.f, 10.f, static_cast<std::uint32_t>(i));
+  row.push(9.f, 0.f, 20.f, 10.f, 9);
+  CHECK(first_overlap(row, 0, 0.f, 0.f, 10.f, 10.f) == 9);
+  CHECK(first_overlap(row, 0, 30.f, 0.f, 40.f, 10.f) == row.size());
+}
+
+struct Body : BaseComponent {
+  vec2 position{0.f, 0.f};
+  vec2 size{1.f, 1.f};
+  vec2 velocity{0.f, 0.f};
+  collision::CollisionConfig collision_config;
+};
+
+using Colliding = collision::UpdateCollidingEntities<Body>;
+
+static void configure(Colliding &system) {
+  const auto length = [](const vec2 &v) {
+    return std::sqrt(v.x * v.x + v.y * v.y);
+  };
+  system.config.get_collision_scalar = [] { return 100.f; };
+  system.config.get_max_speed = [] { return 50.f; };
+  system.callbacks.vector_length = length;
+  system.callbacks.normalize_vec = [length](const vec2 &v) {
+    const float len = length(v);
+    return len < 1e-4f ? vec2{0.f, 0.f} : vec2{v.x / len, v.y / len};
+  };
+  system.callbacks.dot_product = [](const vec2 &a, const vec2 &b) {
+    return a.x * b.x + a.y * b.y;
+  };
+  system.callbacks.get_speed = [length](const Body &b) {
+    return length(b.velocity);
+  };
+  system.callbacks.check_overlap = [](const Body &a, const Body &b) {
+    return a.position.x < b.position.x + b.size.x &&
+           a.position.x + a.size.x > b.position.x &&
+           a.position.y < b.position.y + b.size.y &&
+           a.position.y + a.size.y > b.position.y;
+  };
+}
+
+// Bodies after a few ticks, from the same start.
+static std::vector<Body> simulate(const Colliding::Narrowphase narrowphase,
+                                  std::unique_ptr<Broadphase> broadphase) {
+  World world;
+  auto system = std::make_unique<Colliding>();
+  configure(*system);
+  system->narrowphase = narrowphase;
+  system->broadphase = std::move(broadphase);
+  // A heavy, a static and a floor body among the rest.
+  system->callbacks.is_floor_overlay = [](const Entity &e) {
+    return e.id % 50 == 7;
+  };
+  world.systems().register_update_system(std::move(system));
+
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> pos(0.f, 200.f);
+  std::uniform_real_distribution<float> vel(-20.f, 20.f);
+  std::vector<Entity *> entities;
+  for (int i = 0; i < 300; ++i) {
+    Entity &e = world.collection().createEntity();
+    Body &b = e.addComponent<Body>();
+    b.position = {pos(rng), pos(rng)};
+    b.size = {8.f, 8.f};
+    b.velocity = {vel(rng), vel(rng)};
+    if (i % 30 == 3)
+      b.collision_config.mass = 5.f;
+    if (i % 40 == 5)
+      b.collision_config.mass = std::numeric_limits<float>::max();
+    b.collision_config.friction = i % 2 ? 0.3f : 0.f;
+    entities.push_back(&e);
+  }
+  world.collection().merge_entity_arrays();
+
+  for (int tick = 0; tick < 4; ++tick) {
+    world.run(1.f / 60.f);
+    for (Entity *e : entities) {
+      Body &b = e->get<Body>();
+      b.position = {b.position.x + b.velocity.x / 60.f,
+                    b.position.y + b.velocity.y / 60.f};
+    }
+  }
+  std::vector<Body> out;
+  for (Entity *e : entities) {
+    const Body &b = e->get<Body>();
+    Body copy;
+    copy.position = b.position;
+    copy.velocity = b.velocity;
+    out.push_back(std::move(copy));
+  }
+  return out;
+}
+
+static bool same_bodies(const std::vector<Body> &a,
+                        const std::vector<Body> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    if (a[i].position.x != b[i].position.x ||
+        a[i].position.y != b[i].position.y ||
+        a[i].velocity.x != b[i].velocity.x ||
+        a[i].velocity.y != b[i].velocity.y)
+      return false;
+  return true;
+}
+
+TEST(aabb_narrowphase_matches_callbacks) {
+  using Narrowphase = Colliding::Narrowphase;
+  const std::vector<Body> reference =
+      simulate(Narrowphase::Callbacks, nullptr);
+  CHECK(same_bodies(reference, simulate(Narrowphase::Aabb, nullptr)));
+  CHECK(same_bodies(reference,
+                    simulate(Narrowphase::Aabb,
+                             std::make_unique<SpatialHashBroadphase>(8.f))));
+  CHECK(same_bodies(reference,
+                    simulate(Narrowphase::Aabb,
+                             std::make_unique<SweepAndPruneBroadphase>())));
+}
+
+int main() {
+  printf("Running narrowphase tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,223 @@
+// parallel_systems_test.cpp
+// Systems that declare Read<>/Write<> access are split across
+// SystemManager's worker threads, and non-conflicting ones share a batch.
+//
+// Build (from tests/, via the Makefile):  make parallel_systems_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  float x = 0;
+};
+struct Velocity : BaseComponent {
+  float dx = 1;
+};
+struct Health : BaseComponent {
+  int hp = 0;
+};
+struct Mirror : BaseComponent {
+  float x = -1;
+};
+
+struct Integrate : System<Write<Position>, Read<Velocity>> {
+  void for_each_with(Entity &, Position &p, const Velocity &v,
+                     float) override {
+    p.x += v.dx;
+  }
+};
+
+struct Heal : System<Write<Health>> {
+  void for_each_with(Entity &, Health &h, float) override { ++h.hp; }
+};
+
+struct CopyPosition : System<Read<Position>, Write<Mirror>> {
+  void for_each_with(Entity &, const Position &p, Mirror &m,
+                     float) override {
+    m.x = p.x;
+  }
+};
+
+struct PlainIntegrate : System<Position, Velocity> {
+  void for_each_with(Entity &, Position &p, Velocity &v, float) override {
+    p.x += v.dx;
+  }
+};
+
+static void reset_world() {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+}
+
+static void make_entities(int n) {
+  for (int i = 0; i < n; ++i) {
+    Entity &e = EntityHelper::createEntity();
+    e.addComponent<Position>();
+    e.addComponent<Velocity>().dx = float(i % 7);
+    e.addComponent<Health>();
+    e.addComponent<Mirror>();
+  }
+  EntityHelper::merge_entity_arrays();
+}
+
+TEST(access_declarations) {
+  const Integrate integrate;
+  const Heal heal;
+  const CopyPosition copy;
+  const PlainIntegrate plain;
+  CHECK(integrate.declares_access);
+  CHECK(!plain.declares_access);
+  CHECK(!integrate.conflicts_with(heal));
+  CHECK(integrate.conflicts_with(copy));
+  CHECK(copy.conflicts_with(integrate));
+  CHECK(plain.conflicts_with(heal) == false);
+  CHECK(plain.conflicts_with(integrate));
+}
+
+TEST(parallel_results_match_serial) {
+  reset_world();
+  make_entities(5000);
+
+  SystemManager sm;
+  sm.set_worker_count(3);
+  sm.parallel_chunk_size = 64;
+  CHECK(sm.worker_count() == 3);
+  sm.register_update_system(std::make_unique<Integrate>());
+  sm.register_update_system(std::make_unique<Heal>());
+  sm.register_update_system(std::make_unique<CopyPosition>());
+
+  for (int frame = 0; frame < 3; ++frame)
+    sm.tick_all(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+
+  bool ok = true;
+  int i = 0;
+  for (const auto &sp : EntityHelper::get_entities()) {
+    const float expected = 3.f * float(i % 7);
+    ok = ok && sp->get<Position>().x == expected;
+    ok = ok && sp->get<Health>().hp == 3;
+    // CopyPosition conflicts with Integrate, so it always runs after it.
+    ok = ok && sp->get<Mirror>().x == expected;
+    ++i;
+  }
+  CHECK(ok);
+}
+
+struct Slow : System<Write<Health>> {
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  void for_each_with(Entity &, Health &, float) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.insert(std::this_thread::get_id());
+  }
+};
+
+TEST(chunks_run_on_worker_threads) {
+  reset_world();
+  make_entities(16);
+
+  SystemManager sm;
+  sm.set_worker_count(3);
+  sm.parallel_chunk_size = 1;
+  auto slow = std::make_unique<Slow>();
+  Slow *s = slow.get();
+  sm.register_fixed_update_system(std::move(slow));
+  sm.fixed_tick(EntityHelper::get_entities_for_mod(), 1.f / 120.f);
+  CHECK(s->threads.size() > 1);
+}
+
+TEST(without_workers_everything_stays_on_the_caller) {
+  reset_world();
+  make_entities(16);
+
+  SystemManager sm;
+  sm.parallel_chunk_size = 1;
+  auto slow = std::make_unique<Slow>();
+  Slow *s = slow.get();
+  sm.register_fixed_update_system(std::move(slow));
+  sm.fixed_tick(EntityHelper::get_entities_for_mod(), 1.f / 120.f);
+  CHECK(s->threads.size() == 1);
+  CHECK(s->threads.count(std::this_thread::get_id()) == 1);
+}
+
+struct Throws : System<Write<Health>> {
+  void for_each_with(Entity &, Health &, float) override {
+    throw std::runtime_error("boom");
+  }
+};
+
+TEST(exceptions_reach_the_caller) {
+  reset_world();
+  make_entities(100);
+
+  SystemManager sm;
+  sm.set_worker_count(2);
+  sm.parallel_chunk_size = 8;
+  sm.register_update_system(std::make_unique<Throws>());
+  bool caught = false;
+  try {
+    sm.tick(EntityHelper::get_entities_for_mod(), 1.f / 60.f);
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+  CHECK(caught);
+}
+
+int main() {
+  printf("Running parallel systems tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
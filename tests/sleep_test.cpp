@@ -0,0 +1,294 @@
+// sleep_test.cpp
+// UpdateCollidingEntities with allow_sleep puts resting bodies to sleep,
+// stops testing pairs of them, holds them in place, and wakes a whole
+// island when it is hit or pushed.
+//
+// Build (from tests/, via the Makefile):  make sleep_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/plugins/collision.h>
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Body : BaseComponent {
+  vec2 position{0.f, 0.f};
+  vec2 size{10.f, 10.f};
+  vec2 velocity{0.f, 0.f};
+  collision::CollisionConfig collision_config;
+};
+
+using Colliding = collision::UpdateCollidingEntities<Body>;
+
+constexpr float tick = 1.f / 120.f;
+
+struct Move : System<Body> {
+  float gravity = 0.f;
+  void for_each_with(Entity &, Body &b, float dt) override {
+    if (b.collision_config.mass == std::numeric_limits<float>::max())
+      return;
+    b.velocity.y += gravity * dt;
+    b.position = {b.position.x + b.velocity.x * dt,
+                  b.position.y + b.velocity.y * dt};
+  }
+};
+
+static float length(const vec2 &v) { return std::sqrt(v.x * v.x + v.y * v.y); }
+
+static int overlap_tests = 0;
+
+struct Scene {
+  World world;
+  Move *move = nullptr;
+  Colliding *system = nullptr;
+
+  Scene() {
+    auto m = std::make_unique<Move>();
+    move = m.get();
+    world.systems().register_update_system(std::move(m));
+    auto s = std::make_unique<Colliding>();
+    s->allow_sleep = true;
+    s->sleep_time = 0.1f;
+    // Impulses of scalar * dt cancel a closing speed in one tick.
+    s->config.get_collision_scalar = [] { return 1.f / tick; };
+    s->config.get_max_speed = [] { return 1000.f; };
+    s->callbacks.vector_length = length;
+    s->callbacks.normalize_vec = [](const vec2 &v) {
+      const float l = length(v);
+      return l > 0.0001f ? vec2{v.x / l, v.y / l} : vec2{0.f, 0.f};
+    };
+    s->callbacks.dot_product = [](const vec2 &a, const vec2 &b) {
+      return a.x * b.x + a.y * b.y;
+    };
+    s->callbacks.get_speed = [](const Body &b) { return length(b.velocity); };
+    s->callbacks.check_overlap = [](const Body &a, const Body &b) {
+      ++overlap_tests;
+      return a.position.x < b.position.x + b.size.x &&
+             b.position.x < a.position.x + a.size.x &&
+             a.position.y < b.position.y + b.size.y &&
+             b.position.y < a.position.y + a.size.y;
+    };
+    system = s.get();
+    world.systems().register_update_system(std::move(s));
+  }
+
+  Body &add(const float x, const float y, const float w = 10.f,
+            const float h = 10.f) {
+    Entity &e = world.collection().createEntity();
+    Body &b = e.addComponent<Body>();
+    b.position = {x, y};
+    b.size = {w, h};
+    b.collision_config.restitution = 0.f;
+    return b;
+  }
+
+  Body &add_wall(const float x, const float y, const float w,
+                 const float h) {
+    Body &b = add(x, y, w, h);
+    b.collision_config.mass = std::numeric_limits<float>::max();
+    return b;
+  }
+
+  void run(const int ticks) {
+    world.collection().merge_entity_arrays();
+    for (int t = 0; t < ticks; ++t)
+      world.run(tick);
+  }
+};
+
+// Three still boxes, a wall and one box drifting away from them.
+static void still_boxes_sleep(Scene &scene) {
+  std::vector<Body *> still;
+  for (int i = 0; i < 3; ++i)
+    still.push_back(&scene.add(20.f * static_cast<float>(i), 0.f));
+  scene.add_wall(0.f, 50.f, 100.f, 10.f);
+  Body &drifter = scene.add(0.f, -100.f);
+  drifter.velocity = {0.f, -30.f};
+
+  scene.run(11);
+  CHECK(scene.system->sleeping() == 0);
+  scene.run(2);
+  CHECK(scene.system->sleeping() == 3);
+  for (const Body *b : still)
+    CHECK(b->collision_config.asleep);
+  CHECK(!drifter.collision_config.asleep);
+}
+
+TEST(still_bodies_fall_asleep) {
+  {
+    Scene scene;
+    still_boxes_sleep(scene);
+    // Four resting bodies each meet only the drifter, which meets all
+    // four: 8 tests instead of 20.
+    overlap_tests = 0;
+    scene.run(1);
+    CHECK(overlap_tests == 8);
+  }
+  {
+    Scene scene;
+    scene.system->narrowphase = Colliding::Narrowphase::Aabb;
+    still_boxes_sleep(scene);
+  }
+  {
+    Scene scene;
+    scene.system->broadphase = std::make_unique<SweepAndPruneBroadphase>();
+    still_boxes_sleep(scene);
+  }
+  {
+    Scene scene;
+    scene.system->solver = Colliding::Solver::Colored;
+    still_boxes_sleep(scene);
+  }
+}
+
+TEST(sleeping_body_is_held) {
+  Scene scene;
+  Body &box = scene.add(0.f, 0.f);
+  scene.run(20);
+  CHECK(box.collision_config.asleep);
+
+  // Pulled by less than sleep_speed: put back.
+  scene.move->gravity = 60.f;
+  scene.run(30);
+  CHECK(box.collision_config.asleep);
+  CHECK(box.position.y == 0.f);
+  CHECK(box.velocity.y == 0.f);
+
+  // Moved further than a still body could go: woken.
+  box.position.x = 5.f;
+  scene.run(1);
+  CHECK(!box.collision_config.asleep);
+}
+
+// Two stacks of three on floors, with gravity. The colored solver leaves
+// resting bodies just touching, so stacks settle.
+struct Stacks : Scene {
+  std::vector<Body *> left, right;
+
+  Stacks() {
+    system->solver = Colliding::Solver::Colored;
+    // A few passes don't quite settle a stack; allow for the jitter.
+    system->sleep_speed = 5.f;
+    move->gravity = 100.f;
+    // Normals run between boxes' corners, so each stack gets a floor of
+    // its own width.
+    add_wall(0.f, 100.f, 10.f, 10.f);
+    add_wall(100.f, 100.f, 10.f, 10.f);
+    for (int i = 0; i < 3; ++i) {
+      const float y = 90.f - 10.f * static_cast<float>(i);
+      left.push_back(&add(0.f, y));
+      right.push_back(&add(100.f, y));
+    }
+    run(120);
+  }
+
+  static bool asleep(const std::vector<Body *> &stack) {
+    for (const Body *b : stack)
+      if (!b->collision_config.asleep)
+        return false;
+    return true;
+  }
+
+  static bool awake(const std::vector<Body *> &stack) {
+    for (const Body *b : stack)
+      if (b->collision_config.asleep)
+        return false;
+    return true;
+  }
+};
+
+TEST(stack_sleeps_as_one_island) {
+  Stacks s;
+  CHECK(s.system->sleeping() == 6);
+  CHECK(Stacks::asleep(s.left));
+  const EntityID island = s.left[0]->collision_config.island;
+  CHECK(island != -1);
+  for (const Body *b : s.left)
+    CHECK(b->collision_config.island == island);
+  CHECK(s.right[0]->collision_config.island != island);
+  CHECK(s.left[2]->position.y > 69.f);
+}
+
+TEST(hit_wakes_the_island) {
+  Stacks s;
+  Body &ball = s.add(0.f, 40.f);
+  ball.velocity = {0.f, 80.f};
+  bool woke = false;
+  for (int t = 0; t < 60 && !woke; ++t) {
+    s.run(1);
+    woke = !s.left[0]->collision_config.asleep;
+  }
+  CHECK(woke);
+  CHECK(Stacks::awake(s.left));
+  CHECK(Stacks::asleep(s.right));
+  s.run(120);
+  CHECK(Stacks::asleep(s.left));
+}
+
+TEST(push_or_wake_wakes_the_island) {
+  Stacks s;
+  s.right[0]->velocity = {40.f, 0.f};
+  s.run(1);
+  CHECK(Stacks::awake(s.right));
+  CHECK(Stacks::asleep(s.left));
+
+  Colliding::wake(*s.left[1]);
+  s.run(1);
+  CHECK(Stacks::awake(s.left));
+}
+
+int main() {
+  printf("Running sleep tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,342 @@
+// snapshot_test.cpp
+// Binary snapshots save every registered component column by column and
+// restore into a collection with each entity back in its old slot, so
+// handles taken before the save still resolve. Deltas carry only what
+// changed since a snapshot.
+//
+// Build (from tests/, via the Makefile):  make snapshot_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+#include <afterhours/src/core/snapshot.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  float x = 0.f;
+  float y = 0.f;
+};
+struct Target : BaseComponent {
+  EntityHandle target{};
+};
+template <> struct afterhours::is_plain_component<Position> : std::true_type {};
+template <> struct afterhours::is_plain_component<Target> : std::true_type {};
+// Not byte-copyable: saved through a codec.
+struct Name : BaseComponent {
+  std::string value;
+};
+
+// Only plain components get the byte codec; Name has to bring its own.
+template <typename T>
+concept byte_codec_for = requires { snapshot::register_component<T>(); };
+static_assert(byte_codec_for<Position>);
+static_assert(!byte_codec_for<Name>);
+// Never registered, so never saved.
+struct Scratch : BaseComponent {
+  int value = 0;
+};
+
+enum struct Tag : TagId { Player = 2 };
+
+static void register_components() {
+  static bool done = false;
+  if (std::exchange(done, true))
+    return;
+  snapshot::register_component<Position>();
+  snapshot::register_component<Target>();
+  snapshot::register_component<Name>(
+      [](const Name &n, snapshot::Writer &out) { out.string(n.value); },
+      [](Name &n, snapshot::Reader &in) { in.string(n.value); });
+}
+
+// 100 entities: all have a Position, every 10th a Name and the Player tag,
+// each points at the previous one.
+static void populate(EntityCollection &ec) {
+  EntityHandle previous = EntityHandle::invalid();
+  for (int i = 0; i < 100; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Position>().x = static_cast<float>(i);
+    e.addComponent<Target>().target = previous;
+    e.entity_type = i % 3;
+    if (i % 10 == 0) {
+      e.addComponent<Name>().value = "entity " + std::to_string(i);
+      e.enableTag(Tag::Player);
+    }
+    ec.merge_entity_arrays();
+    previous = ec.handle_for(e);
+  }
+}
+
+TEST(rollback_restores_the_saved_frame) {
+  register_components();
+  EntityCollection ec;
+  populate(ec);
+  Entity &first = *ec.get_entities()[0];
+  first.addComponent<Scratch>().value = 7;
+  const EntityHandle first_handle = ec.handle_for(first);
+  const EntityHandle tenth = ec.handle_for(*ec.get_entities()[10]);
+
+  const std::vector<std::byte> frame = snapshot::save(ec);
+
+  // Play on: move things, change the shape, destroy and create.
+  for (const auto &sp : ec.get_entities())
+    sp->get<Position>().x += 100.f;
+  first.removeComponent<Position>();
+  first.disableTag(Tag::Player);
+  first.get<Scratch>().value = 8;
+  ec.get_entities()[10]->get<Name>().value = "renamed";
+  ec.get_entities()[5]->addComponent<Name>().value = "new";
+  ec.get_entities()[10]->cleanup = true;
+  ec.cleanup();
+  const EntityHandle spawned = ec.handle_for(ec.createEntity());
+  ec.merge_entity_arrays();
+  Entity &unmerged = ec.createEntity();
+  (void)unmerged;
+
+  CHECK(snapshot::restore(ec, frame));
+
+  CHECK(ec.get_entities().size() == 100);
+  CHECK(ec.get_temp().empty());
+  bool positions = true;
+  for (std::size_t i = 0; i < ec.get_entities().size(); ++i)
+    positions = positions && ec.get_entities()[i]->get<Position>().x ==
+                                 static_cast<float>(i);
+  CHECK(positions);
+
+  // Reused in place: same object, saved components back, unregistered
+  // ones left as they were.
+  CHECK(&ec.resolve(first_handle).asE() == &first);
+  CHECK(first.has<Position>());
+  CHECK(first.hasTag(Tag::Player));
+  CHECK(first.get<Scratch>().value == 8);
+  CHECK(!ec.get_entities()[5]->has<Name>());
+
+  // The destroyed entity is back in its slot under its old handle.
+  OptEntity back = ec.resolve(tenth);
+  CHECK(back.has_value());
+  CHECK(back.asE().get<Name>().value == "entity 10");
+  CHECK(back.asE().entity_type == 1);
+  CHECK(ec.resolve(back.asE().get<Target>().target).asE().id ==
+        ec.get_entities()[9]->id);
+
+  // What was created after the save is gone.
+  CHECK(!ec.resolve(spawned).has_value());
+  CHECK(EntityQuery(ec).whereHasComponent<Name>().gen_count() == 10);
+}
+
+TEST(restore_into_another_collection) {
+  register_components();
+  EntityCollection source;
+  source.use_own_entity_ids();
+  populate(source);
+  source.registerSingleton<Target>(*source.get_entities()[3]);
+  const EntityHandle h = source.handle_for(*source.get_entities()[42]);
+  std::vector<std::byte> file;
+  snapshot::save(source, file);
+
+  EntityCollection loaded;
+  CHECK(snapshot::restore(loaded, file));
+  CHECK(loaded.get_entities().size() == 100);
+  CHECK(loaded.has_own_entity_ids());
+  CHECK(loaded.resolve(h).has_value());
+  CHECK(loaded.resolve(h).asE().id == 42);
+  CHECK(loaded.resolve(h).asE().get<Position>().x == 42.f);
+  CHECK(loaded.get_singleton<Target>().get().id == 3);
+  // Ids carry on from where the source left off.
+  CHECK(loaded.createEntity().id == 100);
+}
+
+TEST(bad_data_is_rejected_untouched) {
+  register_components();
+  EntityCollection ec;
+  populate(ec);
+  std::vector<std::byte> frame = snapshot::save(ec);
+  ec.get_entities()[0]->get<Position>().x = -1.f;
+
+  CHECK(!snapshot::restore(ec, std::vector<std::byte>(16, std::byte{7})));
+  frame.resize(frame.size() / 2);
+  CHECK(!snapshot::restore(ec, frame));
+  CHECK(ec.get_entities().size() == 100);
+  CHECK(ec.get_entities()[0]->get<Position>().x == -1.f);
+}
+
+// One tick of play: move everyone, rename, retag, destroy a couple (cleanup
+// swaps from the back) and spawn a few.
+static void play(EntityCollection &ec, const int tick) {
+  for (const auto &sp : ec.get_entities())
+    sp->get<Position>().y += 1.f;
+  Entity &renamed = *ec.get_entities()[static_cast<std::size_t>(tick) * 7 %
+                                       ec.get_entities().size()];
+  if (renamed.has<Name>())
+    renamed.get<Name>().value += "!";
+  else
+    renamed.addComponent<Name>().value = "late";
+  ec.get_entities()[3]->enableTag(Tag::Player);
+  ec.get_entities()[4]->removeComponent<Target>();
+  ec.get_entities()[static_cast<std::size_t>(tick) * 3]->cleanup = true;
+  ec.get_entities()[static_cast<std::size_t>(tick) * 5 + 1]->cleanup = true;
+  ec.cleanup();
+  for (int i = 0; i < 3; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Position>().x = static_cast<float>(-tick);
+    e.addComponent<Target>().target = ec.handle_for(*ec.get_entities()[0]);
+  }
+  ec.merge_entity_arrays();
+}
+
+TEST(deltas_keep_a_mirror_in_step) {
+  register_components();
+  EntityCollection source;
+  source.use_own_entity_ids();
+  populate(source);
+  std::vector<std::byte> base = snapshot::save(source);
+  EntityCollection mirror;
+  CHECK(snapshot::restore(mirror, base));
+
+  std::vector<std::byte> delta;
+  bool applied = true;
+  bool same = true;
+  for (int tick = 1; tick <= 10; ++tick) {
+    play(source, tick);
+    applied = applied && snapshot::diff(base, source, delta) &&
+              snapshot::apply_delta(mirror, delta);
+    snapshot::save(source, base);
+    same = same && snapshot::save(mirror) == base;
+  }
+  CHECK(applied);
+  CHECK(same);
+
+  // Handles into the source resolve the same way in the mirror.
+  const EntityHandle last = source.handle_for(*source.get_entities().back());
+  CHECK(mirror.resolve(last).has_value());
+  CHECK(mirror.resolve(last).asE().id == source.get_entities().back()->id);
+}
+
+TEST(deltas_are_as_big_as_the_change) {
+  register_components();
+  EntityCollection ec;
+  populate(ec);
+  const std::vector<std::byte> base = snapshot::save(ec);
+  std::vector<std::byte> delta;
+
+  CHECK(snapshot::diff(base, ec, delta));
+  const std::size_t empty = delta.size();
+  CHECK(empty < 96);
+
+  ec.get_entities()[50]->get<Position>().x = -1.f;
+  CHECK(snapshot::diff(base, ec, delta));
+  // One Position row: name, stride, slot and 8 bytes of payload.
+  CHECK(delta.size() < empty + 64);
+  CHECK(delta.size() * 20 < base.size());
+
+  // Writes through get<T>() are found by comparing bytes, not ticks.
+  EntityCollection mirror;
+  CHECK(snapshot::restore(mirror, base));
+  CHECK(snapshot::apply_delta(mirror, delta));
+  CHECK(mirror.get_entities()[50]->get<Position>().x == -1.f);
+}
+
+TEST(codec_components_diff_by_value) {
+  register_components();
+  EntityCollection ec;
+  populate(ec);
+  Name &name = ec.get_entities()[0]->get<Name>();
+  name.value = "a name too long to fit in the string's own bytes";
+  const std::vector<std::byte> base = snapshot::save(ec);
+  std::vector<std::byte> delta;
+  CHECK(snapshot::diff(base, ec, delta));
+  const std::size_t empty = delta.size();
+
+  // Same text in another buffer: nothing changed.
+  std::string copy = name.value;
+  name.value.swap(copy);
+  CHECK(name.value.data() != copy.data());
+  CHECK(snapshot::diff(base, ec, delta));
+  CHECK(delta.size() == empty);
+
+  name.value = "renamed";
+  CHECK(snapshot::diff(base, ec, delta));
+  CHECK(delta.size() > empty);
+  EntityCollection mirror;
+  CHECK(snapshot::restore(mirror, base));
+  CHECK(snapshot::apply_delta(mirror, delta));
+  CHECK(mirror.get_entities()[0]->get<Name>().value == "renamed");
+  CHECK(snapshot::save(mirror) == snapshot::save(ec));
+}
+
+TEST(deltas_only_apply_to_their_base) {
+  register_components();
+  EntityCollection ec;
+  populate(ec);
+  const std::vector<std::byte> base = snapshot::save(ec);
+  EntityCollection mirror;
+  CHECK(snapshot::restore(mirror, base));
+
+  ec.get_entities()[0]->cleanup = true;
+  ec.cleanup();
+  std::vector<std::byte> delta;
+  CHECK(snapshot::diff(base, ec, delta));
+
+  CHECK(snapshot::apply_delta(mirror, delta));
+  CHECK(mirror.get_entities().size() == 99);
+  // Applied again, the entity it destroys is already gone.
+  CHECK(!snapshot::apply_delta(mirror, delta));
+  CHECK(mirror.get_entities().size() == 99);
+  CHECK(!snapshot::apply_delta(mirror, base));
+}
+
+int main() {
+  printf("Running snapshot tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
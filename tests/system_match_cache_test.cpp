@@ -0,0 +1,239 @@
+// system_match_cache_test.cpp
+// SystemManager keeps a per-system list of matching entities, kept current
+// from the collection's signature journal instead of rescanning every entity
+// every frame.
+//
+// Build (from tests/, via the Makefile):  make system_match_cache_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  float x = 0;
+};
+struct Velocity : BaseComponent {
+  float dx = 1;
+};
+struct Frozen : BaseComponent {};
+
+struct Move : System<Position, Velocity> {
+  int visited = 0;
+  void for_each_with(Entity &, Position &p, Velocity &v, float) override {
+    p.x += v.dx;
+    ++visited;
+  }
+};
+
+struct MoveUnlessFrozen : System<Position, Not<Frozen>> {
+  int visited = 0;
+  void for_each_with(Entity &, Position &, float) override { ++visited; }
+};
+
+static void reset_world() {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+}
+
+static Entity &make(bool with_velocity) {
+  Entity &e = EntityHelper::createEntity();
+  e.addComponent<Position>();
+  if (with_velocity)
+    e.addComponent<Velocity>();
+  return e;
+}
+
+TEST(visits_only_matching_entities) {
+  reset_world();
+  for (int i = 0; i < 100; ++i)
+    make(i % 10 == 0);
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  auto move = std::make_unique<Move>();
+  Move *m = move.get();
+  sm.register_update_system(std::move(move));
+
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 10);
+  CHECK(m->match_cache.positions.size() == 10);
+}
+
+TEST(signature_changes_update_the_cache_incrementally) {
+  reset_world();
+  std::vector<EntityHandle> handles;
+  for (int i = 0; i < 20; ++i)
+    make(false);
+  EntityHelper::merge_entity_arrays();
+  for (const auto &sp : EntityHelper::get_entities())
+    handles.push_back(EntityHelper::handle_for(*sp));
+
+  SystemManager sm;
+  auto move = std::make_unique<Move>();
+  Move *m = move.get();
+  sm.register_update_system(std::move(move));
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 0);
+
+  const auto epoch = EntityHelper::get_default_collection()
+                         .signature_journal()
+                         .epoch;
+  EntityHelper::resolve(handles[3]).asE().addComponent<Velocity>();
+  EntityHelper::resolve(handles[7]).asE().addComponent<Velocity>();
+  m->visited = 0;
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 2);
+  // Caught up through the journal, not a rebuild.
+  CHECK(m->match_cache.epoch == epoch);
+
+  EntityHelper::resolve(handles[3]).asE().removeComponent<Velocity>();
+  m->visited = 0;
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 1);
+  CHECK(EntityHelper::resolve(handles[7]).asE().get<Position>().x == 2.f);
+}
+
+TEST(new_and_removed_entities_are_tracked) {
+  reset_world();
+  for (int i = 0; i < 5; ++i)
+    make(true);
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  auto move = std::make_unique<Move>();
+  Move *m = move.get();
+  sm.register_update_system(std::move(move));
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 5);
+
+  make(true);
+  make(false);
+  EntityHelper::merge_entity_arrays();
+  m->visited = 0;
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 6);
+
+  EntityHelper::get_entities_for_mod().front()->cleanup = true;
+  EntityHelper::cleanup();
+  m->visited = 0;
+  sm.run(1.f / 60.f);
+  CHECK(m->visited == 5);
+  for (const std::uint32_t pos : m->match_cache.positions)
+    CHECK(EntityHelper::get_entities()[pos]->has<Velocity>());
+}
+
+TEST(not_components_are_excluded) {
+  reset_world();
+  make(false);
+  make(false).addComponent<Frozen>();
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  auto sys = std::make_unique<MoveUnlessFrozen>();
+  MoveUnlessFrozen *s = sys.get();
+  sm.register_update_system(std::move(sys));
+  sm.run(1.f / 60.f);
+  CHECK(s->visited == 1);
+}
+
+TEST(other_entity_lists_are_scanned) {
+  reset_world();
+  Entities detached;
+  for (int i = 0; i < 4; ++i) {
+    auto e = std::make_shared<Entity>();
+    e->addComponent<Position>();
+    e->addComponent<Velocity>();
+    detached.push_back(e);
+  }
+
+  SystemManager sm;
+  auto move = std::make_unique<Move>();
+  Move *m = move.get();
+  sm.register_update_system(std::move(move));
+  sm.tick(detached, 1.f / 60.f);
+  CHECK(m->visited == 4);
+  CHECK(m->match_cache.collection == nullptr);
+}
+
+TEST(consumed_journal_entries_are_trimmed) {
+  reset_world();
+  for (int i = 0; i < 8; ++i)
+    make(false);
+  EntityHelper::merge_entity_arrays();
+
+  SystemManager sm;
+  sm.register_update_system(std::make_unique<Move>());
+  sm.run(1.f / 60.f);
+
+  const SignatureJournal &journal =
+      EntityHelper::get_default_collection().signature_journal();
+  // The newest entries are kept for readers SystemManager doesn't track.
+  for (const auto &sp : EntityHelper::get_entities())
+    sp->addComponent<Velocity>();
+  CHECK(journal.slots.size() == 8);
+  sm.run(1.f / 60.f);
+  CHECK(journal.slots.size() == 8);
+
+  for (int round = 0; round < 600; ++round) {
+    for (const auto &sp : EntityHelper::get_entities()) {
+      sp->removeComponent<Velocity>();
+      sp->addComponent<Velocity>();
+    }
+  }
+  CHECK(journal.slots.size() > SignatureJournal::retained);
+  sm.run(1.f / 60.f);
+  CHECK(journal.slots.size() == SignatureJournal::retained);
+}
+
+int main() {
+  printf("Running system match cache tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,222 @@
+// system_profiler_test.cpp
+// With SystemManager::profiler() enabled, each run() times every system's
+// once/for_each/after, counts the entities it visited and matched, and can
+// record the frame as a Chrome trace, worker threads included.
+//
+// Build (from tests/, via the Makefile):  make system_profiler_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  int x = 0;
+};
+struct Velocity : BaseComponent {
+  int dx = 0;
+};
+struct Frozen : BaseComponent {};
+
+// Runs on the workers.
+struct Move : System<Write<Position>, Read<Velocity>> {
+  void for_each_with(Entity &, Position &p, const Velocity &v,
+                     float) override {
+    p.x += v.dx;
+  }
+};
+
+// Sees every Position but only moves the ones that aren't Frozen.
+struct Thaw : System<Position, Not<Frozen>> {
+  void once(float) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  void for_each_with(Entity &, Position &p, float) override { ++p.x; }
+};
+
+// Turns the Frozen entities around every frame.
+struct Steer : System<> {
+  void once(float) override {
+    for (const auto &sp : EntityHelper::get_entities())
+      if (sp->has<Frozen>())
+        sp->mark_changed<Velocity>();
+  }
+};
+
+// Sees every Velocity but only handles the ones that changed, which the
+// match cache can't tell apart.
+struct Follow : System<Velocity, Changed<Velocity>> {
+  void for_each_with(Entity &, Velocity &, float) override {}
+};
+
+static void populate(World &world) {
+  for (int i = 0; i < 1000; ++i) {
+    Entity &e = world.collection().createEntity();
+    e.addComponent<Position>();
+    e.addComponent<Velocity>().dx = 1;
+    if (i % 4 == 0)
+      e.addComponent<Frozen>();
+  }
+  world.collection().merge_entity_arrays();
+}
+
+static const SystemProfile *find(const SystemProfiler &profiler,
+                                 const std::string &name) {
+  for (const SystemProfile &p : profiler.profiles())
+    if (p.name.find(name) != std::string_view::npos)
+      return &p;
+  return nullptr;
+}
+
+TEST(rolling_samples) {
+  RollingSamples s;
+  CHECK(s.p99() == 0.f);
+  for (int i = 1; i <= 100; ++i)
+    s.push(static_cast<float>(i));
+  CHECK(s.size() == 100);
+  CHECK(s.latest() == 100.f);
+  CHECK(s.average() == 50.5f);
+  CHECK(s.p99() == 99.f);
+  CHECK(s.percentile(0.f) == 1.f);
+  // Old samples roll off.
+  for (int i = 0; i < 200; ++i)
+    s.push(1.f);
+  CHECK(s.size() == RollingSamples::capacity);
+  CHECK(s.p99() == 1.f);
+}
+
+TEST(times_and_counts_each_system) {
+  World world;
+  SystemManager &systems = world.systems();
+  systems.set_worker_count(2);
+  systems.parallel_chunk_size = 64;
+  systems.register_update_system(std::make_unique<Move>());
+  systems.register_update_system(std::make_unique<Thaw>());
+  systems.register_update_system(std::make_unique<Steer>());
+  systems.register_update_system(std::make_unique<Follow>());
+  populate(world);
+  systems.profiler().enable();
+
+  for (int frame = 0; frame < 3; ++frame)
+    world.run(1.f / 60.f);
+
+  const SystemProfiler &profiler = systems.profiler();
+  CHECK(profiler.frame_ms().size() == 3);
+  const SystemProfile *thaw = find(profiler, "Thaw");
+  const SystemProfile *move = find(profiler, "Move");
+  CHECK(thaw != nullptr);
+  CHECK(move != nullptr);
+  const SystemProfile *follow = find(profiler, "Follow");
+  CHECK(follow != nullptr);
+  if (!thaw || !move || !follow)
+    return;
+  CHECK(thaw->last.runs == 1);
+  CHECK(thaw->last.once_ms >= 2.f);
+  // The match cache already left out the Frozen ones.
+  CHECK(thaw->last.visited == 750);
+  CHECK(thaw->last.matched == 750);
+  CHECK(thaw->total_ms.average() >= 2.f);
+  CHECK(profiler.frame_ms().p99() >= thaw->total_ms.latest());
+  CHECK(move->last.matched == 1000);
+  CHECK(move->last.for_each_ms > 0.f);
+  CHECK(follow->last.visited == 1000);
+  CHECK(follow->last.matched == 250);
+}
+
+TEST(trace_has_a_track_per_worker) {
+  World world;
+  SystemManager &systems = world.systems();
+  systems.set_worker_count(2);
+  systems.parallel_chunk_size = 16;
+  systems.register_update_system(std::make_unique<Move>());
+  populate(world);
+  systems.profiler().enable();
+  systems.profiler().start_trace();
+  for (int frame = 0; frame < 20; ++frame)
+    world.run(1.f / 60.f);
+  systems.profiler().stop_trace();
+  CHECK(systems.profiler().trace_size() > 20);
+
+  const std::string path = "system_profiler_test_trace.json";
+  CHECK(systems.profiler().write_trace(path));
+  std::ifstream in(path);
+  const std::string json((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  std::remove(path.c_str());
+  CHECK(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0) == 0);
+  CHECK(json.find("\"name\":\"frame\"") != std::string::npos);
+  CHECK(json.find("\"cat\":\"for_each\"") != std::string::npos);
+  CHECK(json.find("\"tid\":1,") != std::string::npos ||
+        json.find("\"tid\":2,") != std::string::npos);
+  CHECK(json.size() > 2 && json.substr(json.size() - 3) == "]}\n");
+
+  CHECK(!systems.profiler().write_trace("no/such/dir/trace.json"));
+}
+
+TEST(disabled_records_nothing) {
+  World world;
+  world.systems().register_update_system(std::make_unique<Thaw>());
+  populate(world);
+  world.run(1.f / 60.f);
+  CHECK(world.systems().profiler().profiles().empty());
+  CHECK(world.systems().profiler().frame_ms().size() == 0);
+}
+
+int main() {
+  printf("Running system profiler tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
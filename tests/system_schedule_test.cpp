@@ -0,0 +1,257 @@
+// system_schedule_test.cpp
+// SystemManager runs each phase in registration order unless order()
+// constraints between systems or named sets say otherwise, leaves disabled
+// sets out of the frame entirely, and gates systems on run conditions
+// worked out once per frame.
+//
+// Build (from tests/, via the Makefile):  make system_schedule_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  int x = 0;
+};
+
+static std::string ran;
+
+template <char Id> struct Mark : System<> {
+  void once(float) override { ran += Id; }
+};
+
+// Counts the entities it sees.
+struct Count : System<Position> {
+  int seen = 0;
+  void once(float) override {
+    ran += 'c';
+    seen = 0;
+  }
+  void for_each_with(Entity &, Position &, float) override { ++seen; }
+};
+
+static void add_position(World &world) {
+  world.collection().createEntity().addComponent<Position>();
+  world.collection().merge_entity_arrays();
+}
+
+TEST(registration_order_by_default) {
+  World world;
+  SystemManager &sm = world.systems();
+  sm.register_update_system(std::make_unique<Mark<'a'>>());
+  sm.register_update_system(std::make_unique<Mark<'b'>>());
+  sm.register_update_system(std::make_unique<Mark<'c'>>());
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "abc");
+}
+
+TEST(order_between_systems) {
+  World world;
+  SystemManager &sm = world.systems();
+  sm.register_update_system(std::make_unique<Mark<'a'>>());
+  sm.register_update_system(std::make_unique<Mark<'b'>>());
+  sm.register_update_system(std::make_unique<Mark<'c'>>());
+  sm.order<Mark<'c'>, Mark<'a'>>();
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "cab");
+}
+
+TEST(order_between_sets) {
+  World world;
+  SystemManager &sm = world.systems();
+  {
+    const auto set = sm.in_set("physics");
+    sm.register_update_system(std::make_unique<Mark<'p'>>());
+    sm.register_update_system(std::make_unique<Mark<'q'>>());
+  }
+  sm.register_update_system(std::make_unique<Mark<'x'>>());
+  {
+    const auto set = sm.in_set("ai");
+    sm.register_update_system(std::make_unique<Mark<'i'>>());
+  }
+  sm.order("ai", "physics");
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "ipqx");
+  CHECK(sm.update_systems_[0]->set == "physics");
+  CHECK(sm.update_systems_[2]->set.empty());
+
+  // Systems registered later still fall in line.
+  {
+    const auto set = sm.in_set("ai");
+    sm.register_update_system(std::make_unique<Mark<'j'>>());
+  }
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "ijpqx");
+}
+
+TEST(disabled_sets_do_not_run) {
+  World world;
+  SystemManager &sm = world.systems();
+  sm.register_update_system(std::make_unique<Mark<'a'>>());
+  auto count = std::make_unique<Count>();
+  Count *count_ptr = count.get();
+  {
+    const auto set = sm.in_set("debug");
+    sm.register_update_system(std::move(count));
+    sm.register_render_system(std::make_unique<Mark<'r'>>());
+  }
+  add_position(world);
+
+  sm.set_enabled("debug", false);
+  CHECK(!sm.is_enabled("debug"));
+  for (int frame = 0; frame < 10; ++frame) {
+    add_position(world);
+    ran.clear();
+    world.run(0.f);
+    CHECK(ran == "a");
+  }
+  // The journal doesn't wait on a system that isn't running.
+  const SignatureJournal &journal =
+      world.collection().component_storage().journal;
+  CHECK(journal.end() == journal.base);
+
+  sm.set_enabled("debug", true);
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "acr");
+  CHECK(count_ptr->seen == 11);
+
+  // One system, by name.
+  sm.set_enabled(type_name<Mark<'a'>>(), false);
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "cr");
+}
+
+TEST(cycles_fall_back_to_registration_order) {
+  World world;
+  SystemManager &sm = world.systems();
+  sm.register_update_system(std::make_unique<Mark<'a'>>());
+  sm.register_update_system(std::make_unique<Mark<'b'>>());
+  sm.register_update_system(std::make_unique<Mark<'c'>>());
+  sm.order<Mark<'c'>, Mark<'a'>>();
+  sm.order<Mark<'b'>, Mark<'c'>>();
+  sm.order<Mark<'a'>, Mark<'b'>>();
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "abc");
+}
+
+// Counts should_run calls, to show a failed condition skips it too.
+struct Asked : System<> {
+  int asked = 0;
+  bool should_run(float) override {
+    ++asked;
+    return true;
+  }
+  void once(float) override { ran += 'k'; }
+};
+
+TEST(run_conditions_are_evaluated_once_per_frame) {
+  World world;
+  SystemManager &sm = world.systems();
+  auto asked = std::make_unique<Asked>();
+  Asked *asked_ptr = asked.get();
+  {
+    const auto set = sm.in_set("drag");
+    sm.register_update_system(std::make_unique<Mark<'a'>>());
+    sm.register_update_system(std::move(asked));
+    sm.register_fixed_update_system(std::make_unique<Mark<'f'>>());
+    sm.register_render_system(std::make_unique<Mark<'r'>>());
+  }
+  sm.register_update_system(std::make_unique<Mark<'z'>>());
+  int evaluated = 0;
+  bool dragging = false;
+  sm.run_if("drag", [&] {
+    ++evaluated;
+    return dragging;
+  });
+
+  ran.clear();
+  world.run(SystemManager::FIXED_TICK_RATE * 3.f);
+  CHECK(ran == "z");
+  CHECK(evaluated == 1);
+  CHECK(asked_ptr->asked == 0);
+
+  dragging = true;
+  ran.clear();
+  world.run(SystemManager::FIXED_TICK_RATE * 2.f);
+  CHECK(ran == "ffakzr");
+  CHECK(evaluated == 2);
+  CHECK(asked_ptr->asked == 1);
+
+  // A condition on one system, by name, on top of its set's.
+  bool allow_k = false;
+  sm.run_if(type_name<Asked>(), [&] { return allow_k; });
+  ran.clear();
+  world.run(0.f);
+  CHECK(ran == "azr");
+
+  // Outside run(), each tick/render call starts afresh.
+  allow_k = true;
+  ran.clear();
+  sm.tick(world.collection().get_entities_for_mod(), 0.f);
+  dragging = false;
+  sm.tick(world.collection().get_entities_for_mod(), 0.f);
+  CHECK(ran == "akzz");
+}
+
+int main() {
+  printf("Running system schedule tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,217 @@
+// typed_query_test.cpp
+// query<Terms...>() matches with System<...> signatures and hands back
+// component references as structured bindings, without std::function
+// filters or a RefEntities vector. CachedQuery keeps its matches between uses
+// and follows the collection's changes.
+//
+// Build (from tests/, via the Makefile):  make typed_query_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Transform : BaseComponent {
+  float x = 0;
+};
+struct Velocity : BaseComponent {
+  float dx = 0;
+};
+struct Dead : BaseComponent {};
+
+enum struct Tag : TagId { Active = 2, Frozen = 4 };
+
+// 12 entities: all move, every 3rd is dead, every even one is active, every
+// 4th is frozen.
+static void populate(EntityCollection &ec) {
+  for (int i = 0; i < 12; ++i) {
+    Entity &e = ec.createEntity();
+    e.addComponent<Transform>().x = float(i);
+    e.addComponent<Velocity>().dx = 1.f;
+    if (i % 3 == 0)
+      e.addComponent<Dead>();
+    if (i % 2 == 0)
+      e.enableTag(Tag::Active);
+    if (i % 4 == 0)
+      e.enableTag(Tag::Frozen);
+  }
+  ec.merge_entity_arrays();
+}
+
+using Row = TypedQuery<Transform, Read<Velocity>, Not<Dead>>::Row;
+static_assert(std::is_same_v<std::tuple_element_t<1, Row>, Transform &>);
+static_assert(std::is_same_v<std::tuple_element_t<2, Row>, const Velocity &>);
+static_assert(std::tuple_size_v<Row> == 3);
+
+TEST(structured_bindings_write_through) {
+  EntityCollection ec;
+  populate(ec);
+
+  for (auto [e, transform, velocity] :
+       query<Transform, Read<Velocity>, Not<Dead>>(ec))
+    transform.x += velocity.dx * 10.f;
+
+  bool ok = true;
+  for (const auto &sp : ec.get_entities()) {
+    const float start = float(sp->id - ec.get_entities().front()->id);
+    const float expected = sp->has<Dead>() ? start : start + 10.f;
+    ok = ok && sp->get<Transform>().x == expected;
+  }
+  CHECK(ok);
+}
+
+TEST(matches_equal_entity_query) {
+  EntityCollection ec;
+  populate(ec);
+
+  std::vector<int> typed;
+  query<Transform, Not<Dead>, tags::All<Tag::Active>, tags::None<Tag::Frozen>>(
+      ec)
+      .each([&](Entity &e, Transform &) { typed.push_back(e.id); });
+
+  const std::vector<int> erased = EntityQuery(ec)
+                                      .whereHasComponent<Transform>()
+                                      .whereMissingComponent<Dead>()
+                                      .whereHasTag(Tag::Active)
+                                      .whereHasNoTags(Tag::Frozen)
+                                      .gen_ids();
+  CHECK(typed == erased);
+  CHECK(typed.size() == 2); // 2 and 10
+  CHECK((query<Transform, tags::Any<Tag::Frozen>>(ec).count() == 3));
+  CHECK((query<Dead, tags::All<Tag::Active>>(ec).count() == 2));
+}
+
+TEST(first_and_empty) {
+  EntityCollection ec;
+  CHECK(query<Transform>(ec).empty());
+  CHECK(!query<Transform>(ec).first());
+
+  populate(ec);
+  const OptEntity first = query<Transform, Not<Dead>>(ec).first();
+  CHECK(first.has_value());
+  CHECK(first.asE().id == ec.get_entities()[1]->id);
+  CHECK((!query<Dead, Not<Transform>>(ec).first()));
+}
+
+TEST(default_collection) {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+  EntityHelper::createEntity().addComponent<Velocity>();
+  EntityHelper::merge_entity_arrays();
+  CHECK(query<Velocity>().count() == 1);
+  CHECK(query<Transform>().count() == 0);
+}
+
+static std::vector<int> ids_of(CachedQuery<Transform, Not<Dead>,
+                                            tags::All<Tag::Active>> &q) {
+  std::vector<int> ids;
+  for (auto [e, transform] : q)
+    ids.push_back(e.id);
+  return ids;
+}
+
+static std::vector<int> scanned_ids(EntityCollection &ec) {
+  std::vector<int> ids;
+  query<Transform, Not<Dead>, tags::All<Tag::Active>>(ec).each(
+      [&](Entity &e, Transform &) { ids.push_back(e.id); });
+  return ids;
+}
+
+TEST(cached_query_follows_changes) {
+  EntityCollection ec;
+  populate(ec);
+  CachedQuery<Transform, Not<Dead>, tags::All<Tag::Active>> q(ec);
+
+  CHECK(ids_of(q) == scanned_ids(ec));
+  CHECK(q.count() == 4); // 2, 4, 8, 10
+  const auto epoch = q.match_cache().epoch;
+  const auto generation = q.generation();
+  CHECK(q.generation() == generation);
+
+  // Component and tag changes are picked up without a rebuild.
+  Entity &two = *ec.get_entities()[2];
+  two.addComponent<Dead>();
+  ec.get_entities()[4]->disableTag(Tag::Active);
+  ec.get_entities()[5]->enableTag(Tag::Active);
+  CHECK(ids_of(q) == scanned_ids(ec));
+  CHECK(q.count() == 3);
+  CHECK(q.match_cache().epoch == epoch);
+  CHECK(q.generation() != generation);
+
+  Entity &fresh = ec.createEntity();
+  fresh.addComponent<Transform>();
+  fresh.enableTag(Tag::Active);
+  ec.merge_entity_arrays();
+  CHECK(q.count() == 4);
+  CHECK(q.match_cache().epoch == epoch);
+
+  // Cleanup reorders the list, which costs one rebuild.
+  ec.get_entities()[5]->cleanup = true;
+  ec.cleanup();
+  CHECK(ids_of(q) == scanned_ids(ec));
+  CHECK(q.count() == 3);
+  CHECK(q.first().asE().id == scanned_ids(ec).front());
+  CHECK(q.gen().size() == 3);
+}
+
+TEST(cached_query_on_default_collection) {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+  CachedQuery<Velocity> q;
+  CHECK(q.empty());
+  EntityHelper::createEntity().addComponent<Velocity>();
+  EntityHelper::merge_entity_arrays();
+  CHECK(q.count() == 1);
+}
+
+int main() {
+  printf("Running typed query tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
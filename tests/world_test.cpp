@@ -0,0 +1,210 @@
+// world_test.cpp
+// A World is a collection, a system manager and an entity id space of its
+// own; several can be stepped at once on different threads without seeing
+// each other.
+//
+// Build (from tests/, via the Makefile):  make world_test
+
+#define FMT_HEADER_ONLY
+#include <fmt/format.h>
+
+#include <afterhours/ah.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace afterhours;
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  struct Register_##name {                                                     \
+    Register_##name() { register_test(#name, test_##name); }                   \
+  } register_##name##_instance;                                                \
+  static void test_##name()
+
+struct TestEntry {
+  const char *name;
+  void (*fn)();
+};
+static std::vector<TestEntry> &test_registry() {
+  static std::vector<TestEntry> r;
+  return r;
+}
+static void register_test(const char *name, void (*fn)()) {
+  test_registry().push_back({name, fn});
+}
+static void check(bool cond, const char *expr, const char *file, int line) {
+  tests_run++;
+  if (cond)
+    tests_passed++;
+  else
+    fprintf(stderr, "  FAIL: %s  (%s:%d)\n", expr, file, line);
+}
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+struct Position : BaseComponent {
+  int x = 0;
+};
+struct Velocity : BaseComponent {
+  int dx = 0;
+};
+struct Spawner : BaseComponent {};
+
+// Every frame, the spawner adds one mover through EntityHelper, which must
+// land in the world being stepped.
+struct Spawn : System<Spawner> {
+  void for_each_with(Entity &, Spawner &, float) override {
+    Entity &e = EntityHelper::createEntity();
+    e.addComponent<Position>();
+    e.addComponent<Velocity>().dx = e.id;
+  }
+};
+
+// Runs on the manager's worker threads; each job checks it sees its world.
+struct Move : System<Write<Position>, Read<Velocity>> {
+  EntityCollection *expected = nullptr;
+  std::atomic<int> elsewhere{0};
+  void for_each_with(Entity &, Position &p, const Velocity &v,
+                     float) override {
+    if (&EntityHelper::get_default_collection() != expected)
+      ++elsewhere;
+    p.x += v.dx;
+  }
+};
+
+static std::unique_ptr<World> make_world(Move **move_out = nullptr) {
+  auto world = std::make_unique<World>();
+  world->systems().set_worker_count(2);
+  world->systems().parallel_chunk_size = 8;
+  world->systems().register_update_system(std::make_unique<Spawn>());
+  auto move = std::make_unique<Move>();
+  move->expected = &world->collection();
+  if (move_out)
+    *move_out = move.get();
+  world->systems().register_update_system(std::move(move));
+  world->enter([](World &) {
+    EntityHelper::createEntity().addComponent<Spawner>();
+    EntityHelper::merge_entity_arrays();
+  });
+  return world;
+}
+
+static std::uint64_t checksum(const World &world) {
+  std::uint64_t sum = 0;
+  for (const auto &sp : world.collection().get_entities()) {
+    sum = sum * 31 + sp->id;
+    if (sp->has<Position>())
+      sum = sum * 31 + sp->get<Position>().x;
+  }
+  return sum;
+}
+
+TEST(worlds_number_their_own_entities) {
+  World a;
+  World b;
+  const int global_before = ENTITY_ID_GEN.load();
+  CHECK(a.collection().createEntity().id == 0);
+  CHECK(a.collection().createEntity().id == 1);
+  CHECK(b.collection().createEntity().id == 0);
+  CHECK(ENTITY_ID_GEN.load() == global_before);
+
+  // Plain collections still share the process-wide ids.
+  EntityCollection plain;
+  CHECK(!plain.has_own_entity_ids());
+  CHECK(plain.createEntity().id == global_before);
+}
+
+TEST(systems_reach_the_world_through_entity_helper) {
+  EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL();
+  EntityCollection &global = EntityHelper::get_default_collection();
+
+  Move *move = nullptr;
+  std::unique_ptr<World> world = make_world(&move);
+  for (int frame = 0; frame < 5; ++frame)
+    world->run(1.f / 60.f);
+
+  // The spawner plus one mover per frame, all in the world.
+  CHECK(world->collection().get_entities().size() == 6);
+  CHECK(global.get_entities().empty());
+  CHECK(global.get_temp().empty());
+  CHECK(move->elsewhere == 0);
+  // And the thread's default is back where it was.
+  CHECK(&EntityHelper::get_default_collection() == &global);
+}
+
+TEST(worlds_step_concurrently) {
+  constexpr int frames = 200;
+  std::unique_ptr<World> reference = make_world();
+  for (int frame = 0; frame < frames; ++frame)
+    reference->run(1.f / 60.f);
+  const std::uint64_t expected = checksum(*reference);
+
+  std::vector<std::unique_ptr<World>> worlds;
+  std::vector<Move *> moves(4, nullptr);
+  for (Move *&move : moves)
+    worlds.push_back(make_world(&move));
+
+  std::vector<std::thread> threads;
+  for (auto &world : worlds) {
+    threads.emplace_back([&w = *world] {
+      for (int frame = 0; frame < frames; ++frame)
+        w.run(1.f / 60.f);
+    });
+  }
+  for (std::thread &t : threads)
+    t.join();
+
+  for (std::size_t i = 0; i < worlds.size(); ++i) {
+    CHECK(worlds[i]->collection().get_entities().size() == frames + 1);
+    CHECK(checksum(*worlds[i]) == expected);
+    CHECK(moves[i]->elsewhere == 0);
+  }
+}
+
+template <int N> struct Probe : BaseComponent {};
+
+template <int... Ns>
+static std::vector<ComponentID> ids_from_threads(
+    std::integer_sequence<int, Ns...>) {
+  std::vector<ComponentID> ids(sizeof...(Ns));
+  std::vector<std::thread> threads;
+  (threads.emplace_back(
+       [&ids] { ids[Ns] = components::get_type_id<Probe<Ns>>(); }),
+   ...);
+  for (std::thread &t : threads)
+    t.join();
+  return ids;
+}
+
+TEST(component_ids_are_unique_across_threads) {
+  const std::vector<ComponentID> ids =
+      ids_from_threads(std::make_integer_sequence<int, 16>{});
+  CHECK(std::set<ComponentID>(ids.begin(), ids.end()).size() == ids.size());
+}
+
+int main() {
+  printf("Running world tests...\n\n");
+
+  for (const auto &entry : test_registry()) {
+    printf("  %s\n", entry.name);
+    entry.fn();
+  }
+
+  printf("\n%d/%d tests passed.\n", tests_passed, tests_run);
+
+  if (tests_passed != tests_run) {
+    printf("SOME TESTS FAILED!\n");
+    return 1;
+  }
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}